@@ -7,6 +7,9 @@
 #include "./minfer/mat.h"
 #include "./minfer/layer.h"
 #include "./minfer/net.h"
+#include "./minfer/session.h"
+#include "./minfer/generate.h"
+#include "./minfer/speculative.h"
 #include "./minfer/saturate.h"
 #include "./minfer/utils.h"
 #include "./minfer/define.h"
@@ -0,0 +1,92 @@
+//
+// Created by mzh on 2025/3/10.
+//
+
+#ifndef MINFER_GENERATE_H
+#define MINFER_GENERATE_H
+
+#include <functional>
+#include <vector>
+
+namespace minfer
+{
+
+/// 采样的参数，依次执行 repetition penalty -> top-k -> temperature -> min-p -> top-p，然后按概率采样。
+struct SamplingParams
+{
+    int max_new_tokens = 64;        // 最多生成的token数量
+    float temperature = 0.8f;       // <= 0 表示greedy，直接选择logits最大的token
+    int top_k = 40;                 // 只在logits最大的top_k个token中采样，<= 0 表示不限制
+    float top_p = 0.95f;            // 只保留累计概率达到top_p的token，>= 1 表示不限制
+    float min_p = 0.05f;            // 丢弃概率小于 min_p * 最大概率 的token，<= 0 表示不限制
+    float repetition_penalty = 1.0f;// 最近出现过的token的logits，正数除以penalty，负数乘以penalty，1 表示不惩罚
+    int penalty_last_n = 64;        // repetition penalty考虑最近多少个token（包含prompt）
+    unsigned int seed = 42;         // 随机数种子，相同的种子得到相同的结果
+    int eos_id = -1;                // 生成eos之后停止，< 0 表示没有结束符
+};
+
+/// 每生成一个token调用一次，返回false时停止生成。
+typedef std::function<bool(int token)> TokenCallback;
+
+/// prompt lookup 投机解码的参数，在prompt和已经生成的token中查找和结尾n-gram相同的片段，用它后面的token作为draft
+struct PromptLookupParams
+{
+    int n_draft = 8;                // 每次最多起草的token数量
+    int ngram_max = 4;              // 先匹配最长的n-gram，找不到时逐渐缩短
+    int ngram_min = 1;
+};
+
+/// embedding模式的pooling方式
+enum PoolingType
+{
+    POOLING_MEAN = 0,               // 所有位置的平均
+    POOLING_LAST = 1,               // 最后一个位置，适合decoder-only的模型
+    POOLING_CLS = 2,                // 第一个位置
+};
+
+/// embedding模式的参数，输出为output norm之后的hidden state，不计算vocab投影
+struct EmbeddingParams
+{
+    PoolingType pooling = POOLING_MEAN;
+    bool normalize = true;          // 对pooling的结果做L2 normalize
+    int batch_size = 16;            // 长度相同的文本最多多少个作为一个batch推理，<= 0 表示不限制
+};
+
+/// teacher-forced 打分（困惑度评估）的参数
+struct ScoreParams
+{
+    int chunk_size = 512;           // 每次forward的token数量，只保留一个chunk的logits
+    bool keep_token_logprobs = false;   // 是否保存每个token的log概率
+};
+
+/// 打分的结果，第一个token没有预测，不参与统计
+struct ScoreResult
+{
+    int n_tokens = 0;               // 参与统计的token数量
+    double sum_logprob = 0.0;       // 所有token的log概率之和
+    double perplexity = 0.0;        // exp(-sum_logprob / n_tokens)
+    double seconds = 0.0;           // 推理和打分的耗时
+    double tokens_per_second = 0.0;
+    std::vector<float> token_logprobs;  // keep_token_logprobs时保存，第i个为tokens[i + 1]的log概率
+};
+
+/// beam search 的参数
+struct BeamSearchParams
+{
+    int beam_size = 4;              // 同时保留的beam数量，所有beam作为一个batch一起decode
+    int max_new_tokens = 32;        // 最多生成的token数量
+    float length_penalty = 1.0f;    // 得分为 sum(log_prob) / len^length_penalty，> 0 时偏向更长的句子
+    int eos_id = -1;                // 结束符，< 0 表示没有结束符，只在max_new_tokens时停止
+};
+
+/// beam search 的一个候选结果
+struct BeamHypothesis
+{
+    std::vector<int> tokens;        // 生成的token，如果以eos结束，包含eos
+    float score = 0.f;              // 经过length penalty之后的得分
+    float sum_logprob = 0.f;        // 所有token的log概率之和
+};
+
+}
+
+#endif //MINFER_GENERATE_H
@@ -5,6 +5,7 @@
 #ifndef MINFER_LAYER_H
 #define MINFER_LAYER_H
 
+#include <map>
 #include <string>
 #include <vector>
 #include "mat.h"
@@ -29,6 +30,7 @@ enum LayerType {
     Linear,
     Attention,
     LayerNorm,
+    GetRows, // 只保留部分位置，比如prefill时只有最后一个位置需要计算logits
 };
 
 enum ActivateType {
@@ -40,6 +42,15 @@ enum ActivateType {
 
 };
 
+// 按block量化的权重类型，取值和gguf中的GGML_TYPE一致。
+// 量化的权重用DT_8U的Mat按行存放量化block，shape为[行数, 每行的字节数]。
+enum QuantType {
+    QUANT_NONE = 0, // 没有量化，Mat的类型就是权重的类型
+    QUANT_Q4_0 = 2,
+    QUANT_Q4_1 = 3,
+    QUANT_Q8_0 = 8,
+};
+
 // 这里是否应当包含模型参数信息？
 // 模型初始化中，应当保持
 // 每一个层，如果有额外的需要，都应该重写这部分，从而添加额外的参数信息。
@@ -60,11 +71,36 @@ public:
 //    :type(_type), inputIndex(_inputIndex), outputIndex(_outputIndex)
 //    {}
 
+    // 层的所有权重，顺序固定，没有的权重（如bias）是空Mat。用于权重缓存等需要遍历所有权重的地方。
+    virtual std::vector<Mat*> getWeights() { return {}; }
+
+    // layer构造时是否把权重转换为FP32。返回false时layer直接使用源类型的权重，权重缓存也不会保存这些权重。
+    virtual bool convertsWeights() const { return true; }
+
+    // getWeights()中按block量化的权重（DT_8U，见QuantType）的量化类型，其他权重为QUANT_NONE。
+    // 量化的权重在layer构造时才通过Layer::weightToFloat反量化，权重缓存命中时已经替换为FP32，不需要反量化。
+    virtual QuantType getQuantType(const Mat* w) const
+    {
+        auto it = quantTypes.find(w);
+        return it == quantTypes.end() ? QUANT_NONE : it->second;
+    }
+
+    virtual void setQuantType(const Mat* w, QuantType quantType)
+    {
+        if (quantType == QUANT_NONE)
+            quantTypes.erase(w);
+        else
+            quantTypes[w] = quantType;
+    }
+
 //    int layerId = -1;               // It will be set
     LayerType type;
     std::vector<int> inputIndex;
     std::vector<int> outputIndex;
     std::vector<Mat> weights;
+
+private:
+    std::map<const Mat*, QuantType> quantTypes;
 };
 
 class RMSNormLayerParams: public LayerParams
@@ -78,6 +114,8 @@ public:
         outputIndex = _outputIndex;
     }
 
+    std::vector<Mat*> getWeights() override { return {&w}; }
+
     int embd_dim; // output, embedding feature length.
     float rms_eps;// RMS norm layer
     Mat w;        // Embedding layer params
@@ -86,17 +124,32 @@ public:
 class EmbeddingLayerParams: public LayerParams
 {
 public:
-    EmbeddingLayerParams(std::vector<int> _inputIndex, std::vector<int> _outputIndex, int _vocab_dim, int _embd_dim, Mat _w)
-    :vocab_dim(_vocab_dim), embd_dim(_embd_dim), w(_w)
+    EmbeddingLayerParams(std::vector<int> _inputIndex, std::vector<int> _outputIndex, int _vocab_dim, int _embd_dim, Mat _w,
+                         QuantType _quant_type = QUANT_NONE)
+    :vocab_dim(_vocab_dim), embd_dim(_embd_dim), w(_w), quant_type(_quant_type)
     {
         type = LayerType::Embedding;
         inputIndex = _inputIndex;
         outputIndex = _outputIndex;
     }
 
+    std::vector<Mat*> getWeights() override { return {&w}; }
+
+    // 每次只查询几行，forward时再把这几行转换为FP32
+    bool convertsWeights() const override { return false; }
+
+    QuantType getQuantType(const Mat* _w) const override { return _w == &w ? quant_type : QUANT_NONE; }
+
+    void setQuantType(const Mat* _w, QuantType _quant_type) override
+    {
+        M_Assert(_w == &w);
+        quant_type = _quant_type;
+    }
+
     int vocab_dim;  // input, the length of vocabulary
     int embd_dim;   // output, embedding feature length.
     Mat w;          // Embedding layer params
+    QuantType quant_type; // w是量化的block时为量化类型，shape为[vocab_dim, 每行的字节数]
 };
 
 class LinearLayerParams: public LayerParams
@@ -110,6 +163,8 @@ public:
         outputIndex = _outputIndex;
     }
 
+    std::vector<Mat*> getWeights() override { return {&w, &b}; }
+
     int in_features;  // input, the number of input features
     int out_features; // output, the number of output features
     Mat w;           // weight matrix
@@ -138,6 +193,8 @@ public:
         outputIndex = _outputIndex;
     }
 
+    std::vector<Mat*> getWeights() override { return {&norm, &wq, &wk, &wv, &wout, &bq, &bk, &bv, &bout}; }
+
     int max_seq_len;   // sequence max length
     int embd_dim;      // length of embedding feature
     int head_count;    // num_attention_heads
@@ -168,6 +225,8 @@ public:
         outputIndex = _outputIndex;
     }
 
+    std::vector<Mat*> getWeights() override { return {&norm, &gate, &up, &down}; }
+
     std::string layerNamePrefix = "FFN_"; // Layer name prefix
     ActivateType actType;
     int embd_dim; // input embedding feature length
@@ -179,6 +238,22 @@ public:
     Mat down;
 };
 
+class KVCache;
+
+// Session在forward时传给layer的上下文信息。
+// layer本身只持有不可变的权重，和会话相关的状态（kv cache、位置）都保存在Session中。
+struct LayerContext
+{
+    int start_pos = 0;             // 本次输入的第一个token在整个序列中的位置
+    KVCache* kv_cache = nullptr;   // 会话的kv cache，只有attention层会使用
+
+    // batch > 1时，每个batch使用自己的kv cache，起始位置为各自cache的size()，此时忽略start_pos和kv_cache。
+    std::vector<KVCache*> kv_caches;
+
+    // GetRows层需要保留的位置（相对于本次输入，已经排好序），为空时保留所有位置。init和forward时必须一致。
+    std::vector<int> output_rows;
+};
+
 // layer 层抽象
 class Layer {
 public:
@@ -195,15 +270,31 @@ public:
     // start pos 是llm模型的输入启始位置，而seqlen是此次推理seqlen的长度。
     virtual void init(const std::vector<Mat*>& input, std::vector<Mat*>& output);
 
+    // 带会话上下文的init，默认直接调用不带上下文的init。输出shape依赖于上下文的层（如GetRows）需要重写。
+    virtual void init(const std::vector<Mat*>& input, std::vector<Mat*>& output, LayerContext& ctx);
+
     // 初始化完成之后，需要调用finalize函数完成一些初始化任务。
     virtual void finalize(const std::vector<Mat*>& input, std::vector<Mat*>& output);
 
-    // and the forward can be run several times
-    virtual void forward(const std::vector<Mat*>& input, std::vector<Mat*>& output, int start_pos);
+    // 带会话上下文的forward，默认直接调用不带上下文的forward。
+    // 有状态的层（如attention）需要重写这个函数，并且不能修改layer自身的成员，从而保证多个Session可以并发调用。
+    virtual void forward(const std::vector<Mat*>& input, std::vector<Mat*>& output, LayerContext& ctx);
 
     // and the forward can be run several times
     virtual void forward(const std::vector<Mat*>& input, std::vector<Mat*>& output);
 
+    // 输出output[0]可以和第几个输入共享内存（in-place），-1表示不可以。
+    // 返回 >= 0 时，layer必须保证开始写output[0]之后，不再读取这个输入中还没有处理的数据。
+    virtual int getInplaceInput();
+
+    // forward中临时Mat需要的内存（字节），init之后调用，默认为0。
+    // Session按照所有层中的最大值准备scratch内存，临时Mat在forward结束后一起释放。
+    virtual size_t getWorkspaceSize(const std::vector<Mat*>& input, const std::vector<Mat*>& output);
+
+    // layer持有的权重（转换、切分之后实际使用的），可能有空的Mat。Net用来统计权重内存，
+    // 以及判断layer是否还在引用模型文件的映射，必要时把它们替换为拷贝。
+    virtual std::vector<Mat*> getWeights();
+
     void setId(int id);
 
     int getId();
@@ -212,8 +303,15 @@ public:
 
     LayerType getType();
 
+    // 权重转换为FP32。已经是FP32时直接引用原来的内存（例如mmap的模型文件），不做拷贝，所以layer不能修改权重。
+    // quantType不是QUANT_NONE时src是量化的block [ne1, 每行的字节数]，反量化为 [ne0, ne1]，和gguf中的shape一致。
+    static void weightToFloat(const Mat& src, Mat& dst, QuantType quantType = QUANT_NONE);
+
 protected:
     void getBasicInfo(const std::shared_ptr<LayerParams> param);
+
+    // 一个临时Mat在scratch内存中占用的字节数，包含对齐
+    static size_t workspaceBytes(size_t elemNum, int type = DT_32F);
     int layerId; // layer id 是layer在Net中前后顺序的序号，保存在Net的layerList中
     std::string layerNamePrefix = "";          // Layer name prefix
     std::string layerName;                     // layer prefix + layerId
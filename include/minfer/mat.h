@@ -6,6 +6,8 @@
 #define MINFER_MAT_H
 
 #include <iostream>
+#include <climits>
+#include <initializer_list>
 #include <assert.h>
 
 #include "define.h"
@@ -68,17 +70,21 @@ struct MatData
     MatData::MemoryFlag flags;
 };
 
+// shape保存在MatSize内部，创建、拷贝和reshape Mat时都不需要为shape分配内存
 struct MatSize
 {
-    MatSize(int* _p);
+    MatSize();
+    MatSize(const MatSize& sz);
+    MatSize& operator=(const MatSize& sz);
     int dims() const;
     const int& operator[](int i) const;
     int& operator[](int i);
     bool operator == (const MatSize& sz) const;
     bool operator != (const MatSize& sz) const;
 
-    int* p0; // p0[0] is dim
+    int* p0; // p0[0] is dim, 指向buf
     int* p;  // p is p0+1
+    int buf[MAT_MAX_DIM + 1];
 };
 
 // Mat class, 从OpenCV处抄过来
@@ -91,6 +97,9 @@ public:
 
     Mat(const std::vector<int> sizes, int type);
 
+    // 使用initializer_list的重载，Mat({1, n}, type)不需要构造临时的std::vector
+    Mat(std::initializer_list<int> sizes, int type);
+
     // create specific dimension Mat with given default value.
     // Note the value is int type, if you wanna set the default value as other type
     // please reinterpret_cast it to int value first.
@@ -105,6 +114,8 @@ public:
 
     Mat(const std::vector<int> sizes, int type, void* data);
 
+    Mat(std::initializer_list<int> sizes, int type, void* data);
+
     ~Mat();
 
     // No data copy, just add reference counter.
@@ -131,6 +142,8 @@ public:
 
     Mat reshape(const std::vector<int> newSizes) const;
 
+    Mat reshape(std::initializer_list<int> newSizes) const;
+
     void copyTo(Mat& m) const;
 
     // convert mat to other mat with specific data type.
@@ -140,6 +153,8 @@ public:
 
     void create(const std::vector<int> sizes, int type);
 
+    void create(std::initializer_list<int> sizes, int type);
+
     void release();
 
     void deallocate();
@@ -181,6 +196,10 @@ public:
     static MatAllocator* getStdAllocator();
     static MatAllocator* getDefaultAllocator();
 
+    // 设置当前线程新建Mat时使用的默认allocator，nullptr表示使用全局默认的allocator，返回之前的设置。
+    // Session在layer forward时用它把临时Mat放到scratch内存中。
+    static MatAllocator* setThreadAllocator(MatAllocator* allocator);
+
     int dims;
     uchar* data;
 
@@ -289,6 +308,11 @@ size_t total(const MatShape shape, int startDim, int endDim = -1);
 // for fast gemm
 Mat gemm(const Mat& a, const Mat& b, bool transA = false, bool transB = false);
 
+// 不分配内存的FP32 gemm kernel，gemm内部也使用它。a为[M, K]，transB时b为[N, K]，否则为[K, N]，结果写入[M, N]的c。
+// lda、ldb、ldc为每行的元素数量，可以直接读写更大矩阵中的一块；accumulate时结果累加到c上。
+void gemm_kernel(int M, int N, int K, const float* a, size_t lda, const float* b, size_t ldb, bool transB,
+                 float* c, size_t ldc, bool accumulate = false);
+
 // read data from given path and re-construct it to Mat.
 Mat readMatFromNpy(const std::string& path);
 
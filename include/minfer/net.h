@@ -3,36 +3,40 @@
 
 #include "layer.h"
 #include "mat.h"
+#include "session.h"
 #include "map"
+#include <functional>
+#include <memory>
 
 namespace minfer
 {
 
 /// Net 类别
 /* 例子代码：
- * Net nets = readNet("llama.gguf");
- * Mat input = toknizer_input("I have a pen for", 2048);
- * nets.setInput(input);
- * nets.init();
- * Mat out;
- * while(true)
- * {
- *  nets.setInput(input);
- *  out = nets.forward();
+ * 下面的接口使用Net内部默认的Session，多个对话并发时请使用createSession()。
+ * Net nets;
+ * nets.readNet("llama.gguf");
+ * std::vector<int> prompt, out_ids;
+ * nets.encode("I have a pen for", prompt);
  *
- *  bool ifStop = false;
- *  std::string chat_out = tokizer_output(out, ifStop);
- *  std::cout<<"say: "<<chat_out<<std::endl;
- *  if (ifStop)
- *      break;
- *  input = out;
- * }
+ * SamplingParams params;
+ * params.eos_id = eos;
+ * nets.generate(prompt, params, out_ids, [&](int token) {
+ *     std::string text;
+ *     nets.decode({token}, text);
+ *     std::cout<<text<<std::flush;
+ *     return true;
+ * });
  * */
 class Net {
 public:
     Net();
     ~Net();
 
+    // Net持有模型的权重，Session中保存的是Net的指针，所以Net不能拷贝，并且必须在它创建的Session之后释放
+    Net(const Net&) = delete;
+    Net& operator=(const Net&) = delete;
+
     // create new layer, and return layerId
     int createLayer(std::shared_ptr<LayerParams> param);
 
@@ -44,6 +48,21 @@ public:
     /// ⚠️目前只支持gguf一种模型格式
     void readNet(const std::string path, const std::string modelType = "gguf");
 
+    /// 设置权重缓存文件，必须在readNet之前调用。第一次加载时把转换之后的权重写入缓存，
+    /// 之后启动时直接mmap缓存文件，不再做类型转换。模型、库版本或者指令集变化时缓存自动失效并重新生成。
+    /// \param cachePath 缓存文件路径，为空表示不使用缓存（默认）。
+    void setWeightCachePath(const std::string& cachePath);
+
+    /// 设置weight streaming，用于权重超过内存的模型。forward计算第i层时，系统在后台读入后面window-1层的权重，
+    /// 第i层计算完成之后丢弃它的权重内存页，所以同时驻留内存的只有window层的权重，速度取决于磁盘读取速度。
+    /// 只对readNet中mmap加载、并且由layer直接引用的权重（FP32权重，或者使用了权重缓存）有效，
+    /// 权重使用大页（见setHugePageMode）时这些权重被拷贝到堆内存中，不起作用。
+    /// \param window 同时驻留内存的层数，0表示关闭（默认），所有权重常驻内存。
+    void setWeightStreaming(int window);
+
+    /// 创建一个新的会话，会话拥有独立的kv cache和激活值内存，可以和其他会话在不同线程中并发推理。
+    std::shared_ptr<Session> createSession();
+
     /// set input data with given mat index
     /// \param input
     /// \param mIndx defaule is -1, if the nets is single input.
@@ -58,16 +77,70 @@ public:
 
     void forward(Mat& out);
 
-    // 生成模式
-    void generate(Mat& out);
+    /// 设置prefill阶段的chunk大小，长的prompt会被切分成多个chunk依次推理，kv cache逐渐增长，
+    /// 激活值的峰值内存由chunk大小决定，而不是prompt长度。
+    /// \param chunkSize 每个chunk的token数量，<= 0 表示不切分（默认）。
+    void setPrefillChunkSize(int chunkSize);
+
+    /// 设置默认Session需要输出logits的位置，默认只输出最后一个位置，为空时输出所有位置。参考Session::setOutputPositions。
+    void setOutputPositions(const std::vector<int>& positions);
+
+    /// 生成模式，使用默认的Session，参考Session::generate。
+    /// 多次调用时会继续之前的对话（上一次生成的token已经在kv cache中），调用Session::reset开始新的对话。
+    void generate(const std::vector<int>& prompt_ids, const SamplingParams& params, std::vector<int>& out_ids,
+                  const TokenCallback& callback = nullptr);
+
+    /// 使用一个新的Session做beam search，参考Session::beamSearch。
+    void beamSearch(const std::vector<int>& prompt_ids, const BeamSearchParams& params, std::vector<BeamHypothesis>& out);
+
+    /// 使用一个新的Session提取文本的embedding，参考Session::embed。
+    void embed(const std::vector<std::vector<int> >& texts, const EmbeddingParams& params, Mat& out);
+
+    /// 使用一个新的Session对tokens打分，参考Session::score。
+    void score(const std::vector<int>& tokens, const ScoreParams& params, ScoreResult& result);
 
     Mat forward();
 
+    /// 模型权重占用的内存（字节），按照layer实际持有的权重（转换、切分之后的）计算，mmap的权重也计算在内
+    size_t getWeightBytes() const;
+
 private:
+    friend class Session;
     class NetImpl;
     NetImpl* impl; // 里面保存多种Backend，subnet，
 };
 
+/// 多模型注册表，一个进程中按照路径加载多个模型，所有模型的权重总和超过内存预算时，释放最久没有使用的模型。
+/// 被释放的模型如果还有外部持有的shared_ptr，会在外部释放之后才真正释放内存，在这之前它的权重计入evicted_bytes和预算。
+struct ModelRegistryInfo
+{
+    size_t model_count = 0;     // 注册表中的模型数量
+    size_t resident_bytes = 0;  // 注册表中模型的权重总和
+    size_t evicted_bytes = 0;   // 已经从注册表释放、但是外部仍然持有的模型的权重总和
+    size_t budget_bytes = 0;    // 内存预算，0表示不限制
+    size_t hit_count = 0;       // getModel时模型已经加载的次数
+    size_t load_count = 0;      // 加载模型的次数
+    size_t evict_count = 0;     // 因为超过预算被释放的次数
+    size_t over_budget_count = 0; // 加载之后释放了所有能释放的模型，仍然超过预算的次数
+};
+
+typedef std::function<std::shared_ptr<Net>(const std::string& path)> ModelLoader;
+
+/// 获取路径对应的模型，没有加载时先加载，必要时释放最久没有使用的模型。多线程安全，
+/// 多个线程同时获取同一个模型时只加载一次，加载一个模型时不阻塞其他模型的getModel。
+std::shared_ptr<Net> getModel(const std::string& path);
+
+/// 设置所有模型权重总和的预算（字节），0表示不限制（默认）。
+void setModelMemoryBudget(size_t bytes);
+
+/// 设置加载模型的函数，可以在readNet之前设置权重缓存等参数，为空时使用Net::readNet（默认）。
+void setModelLoader(const ModelLoader& loader);
+
+/// 从注册表中释放模型，返回模型是否在注册表中。
+bool evictModel(const std::string& path);
+
+ModelRegistryInfo getModelRegistryInfo();
+
 //// 释放全局资源 TODO
 //void releaseMinfer();
 
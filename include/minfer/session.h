@@ -0,0 +1,122 @@
+//
+// Created by mzh on 2025/3/6.
+//
+
+#ifndef MINFER_SESSION_H
+#define MINFER_SESSION_H
+
+#include "mat.h"
+#include "generate.h"
+#include <memory>
+
+namespace minfer
+{
+
+class Net;
+
+/// Session 是一次对话（请求）的推理上下文。
+/// Session 持有kv cache、当前位置以及所有中间层的激活值内存，Net只持有不可变的权重，
+/// 所以多个线程可以各自使用自己的Session，同时在同一个Net上推理。
+/* 例子代码：
+ * Net net;
+ * net.readNet("llama.gguf");
+ * std::shared_ptr<Session> session = net.createSession();
+ * session->setInput(prompt);
+ * Mat out = session->forward();
+ * session->setInput(next_token);
+ * out = session->forward();
+ * */
+/// ⚠️ Session不能比创建它的Net存活更久，forward返回的Mat引用的是Session内部的内存。
+class Session
+{
+public:
+    ~Session();
+
+    /// set input data with given mat index
+    /// \param input
+    /// \param mIndx defaule is -1, if the nets is single input.
+    void setInput(const Mat input, const int mIndx = -1);
+
+    // 根据输入的shape计算每一层的输出shape并分配内存，forward时如果需要会自动调用。
+    void init();
+
+    void forward(Mat& out);
+
+    Mat forward();
+
+    /// 设置prefill阶段的chunk大小，<= 0 表示不切分（默认）。参考Net::setPrefillChunkSize。
+    void setPrefillChunkSize(int chunkSize);
+
+    /// 设置需要输出logits的位置，包含GetRows层的Net中其他位置不会计算output norm和vocab投影。
+    /// 没有GetRows层的Net只有chunk prefill时有效（只保存这些位置的结果），否则总是输出所有位置。
+    /// \param positions 相对于本次输入的位置，负数表示从后往前数，默认为 {-1}，即只输出最后一个位置；
+    /// 为空时输出所有位置。forward的结果按照位置从小到大排列，shape为 [batch, positions.size(), n_vocab]。
+    void setOutputPositions(const std::vector<int>& positions);
+
+    // 清空kv cache，开始新的对话
+    void reset();
+
+    // kv cache中已经保存的token数量，也是下一个输入token的位置
+    int getPosition() const;
+
+    /// 激活值内存的统计，反映最近一次init的结果
+    struct MemoryInfo
+    {
+        size_t planned_bytes = 0;   // 按照生存区间规划之后的峰值
+        size_t naive_bytes = 0;     // 每个Mat单独分配时的总和
+        size_t arena_bytes = 0;     // 实际分配的arena大小，shape变小时不会缩小
+        size_t scratch_bytes = 0;   // layer临时Mat使用的scratch内存，按照最大的layer workspace分配
+        size_t scratch_overflows = 0;   // scratch放不下，从堆上分配临时Mat的次数
+        size_t plan_count = 0;          // 缓存的执行计划数量，每个shape bucket一个
+        size_t forward_allocations = 0; // 最近一次forward中当前线程堆内存分配的次数，见getAllocationCount()
+    };
+
+    MemoryInfo getMemoryInfo() const;
+
+    // 回退到position，只保留kv cache中前position个token，position不能超过getPosition()
+    void truncate(int position);
+
+    /// 复制当前会话，新会话从当前位置继续推理。
+    /// 两个会话共享已有的kv cache page（copy-on-write），只有在各自写入新token时才分配新的page，
+    /// 所以n>1的采样和beam search只需要prefill一次prompt。
+    std::shared_ptr<Session> fork() const;
+
+    /// 从当前位置开始生成：先prefill prompt，之后每一步输入上一个token做增量decode。
+    /// decode阶段复用输入和激活值的内存，不会重新init。生成的token（包含eos）会追加到out_ids中。
+    /// 返回时prompt和所有生成的token都已经写入kv cache，再次调用时prompt只需要包含新的输入。
+    /// \param callback 每生成一个token调用一次，可以用来流式输出，返回false时停止。
+    void generate(const std::vector<int>& prompt_ids, const SamplingParams& params, std::vector<int>& out_ids,
+                  const TokenCallback& callback = nullptr);
+
+    /// 从当前位置开始，对prompt做beam search。
+    /// prompt只prefill一次，所有beam共享prompt的kv cache page；每一步所有存活的beam作为一个batch推理，
+    /// beam重新排序时只复制page的指针。结果按得分从高到低排列，最多beam_size个。
+    /// 会话自己的kv cache只增加prompt，不包含生成的token。
+    /// \param prompt_ids 输入的token ids，不能为空
+    void beamSearch(const std::vector<int>& prompt_ids, const BeamSearchParams& params, std::vector<BeamHypothesis>& out);
+
+    /// embedding模式：返回output norm之后的hidden state经过pooling的结果，不运行vocab投影的Linear层。
+    /// 每个文本使用临时的kv cache，互不影响，会话自己的kv cache不变。长度相同的文本作为一个batch推理。
+    /// \param texts 每个文本的token ids，不能为空
+    /// \param out shape为 [texts.size(), n_embd]，和texts一一对应
+    void embed(const std::vector<std::vector<int> >& texts, const EmbeddingParams& params, Mat& out);
+
+    /// teacher-forced 打分：从当前位置开始，按照chunk_size依次输入tokens，计算每个token在前面所有token条件下的log概率，
+    /// 并统计困惑度。每个chunk的logits逐行计算log-sum-exp后立即丢弃，不会保存 [seq_len, n_vocab] 的logits。
+    /// 会话的kv cache增加 tokens.size() - 1 个token（最后一个token只作为target）。
+    /// \param tokens 至少包含两个token
+    void score(const std::vector<int>& tokens, const ScoreParams& params, ScoreResult& result);
+
+private:
+    friend class Net;
+    friend class SpeculativeGenerator; // 直接使用target和draft会话的实现，见SpeculativeGenerator::generate
+    class SessionImpl;
+
+    explicit Session(SessionImpl* impl);
+
+    SessionImpl* impl;
+};
+
+}
+
+#endif //MINFER_SESSION_H
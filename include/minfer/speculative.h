@@ -0,0 +1,66 @@
+//
+// Created by mzh on 2025/3/16.
+//
+
+#ifndef MINFER_SPECULATIVE_H
+#define MINFER_SPECULATIVE_H
+
+#include "net.h"
+#include "generate.h"
+
+namespace minfer
+{
+
+/// 投机解码：小的draft模型每次起草nDraft个token，大的target模型一次forward验证所有token，
+/// 按照rejection sampling接受最长的前缀，被拒绝的位置从 max(0, p - q) 中重新采样，然后回退两个模型的kv cache。
+/// 输出的分布和只使用target模型采样完全一致，greedy时结果也完全一致。
+/* 例子代码：
+ * Net target, draft;
+ * target.readNet("llama-7b.gguf");
+ * draft.readNet("llama-1b.gguf");
+ * SpeculativeGenerator gen(target, draft, 4);
+ * gen.generate(prompt, params, out_ids);
+ * */
+/// 没有draft模型时，可以使用prompt lookup起草：输出大量复制prompt的任务（摘要、代码修改）可以获得很高的接受率，
+/// 而且不需要额外的模型内存。
+/// ⚠️ target和draft必须使用同一个tokenizer，SpeculativeGenerator不能比使用的Net存活更久。
+class SpeculativeGenerator
+{
+public:
+    SpeculativeGenerator(Net& target, Net& draft, int nDraft = 4);
+
+    // 不使用draft模型，使用prompt lookup起草
+    SpeculativeGenerator(Net& target, const PromptLookupParams& lookup);
+
+    /// 从当前位置继续生成，参数和Session::generate一致，多次调用会继续之前的对话，
+    /// 返回时所有生成的token都已经写入两个模型的kv cache。
+    void generate(const std::vector<int>& prompt_ids, const SamplingParams& params, std::vector<int>& out_ids,
+                  const TokenCallback& callback = nullptr);
+
+    // 清空两个模型的kv cache，开始新的对话
+    void reset();
+
+    // 起草的token数量和被target接受的数量，接受率越高加速越明显
+    int getDraftedTokens() const;
+
+    int getAcceptedTokens() const;
+
+    /// 两个模型的会话，generate之间可以直接使用（例如forward读取logits），draft模型的会话在prompt lookup时为空。
+    /// generate临时修改的输出位置在返回（包括抛出异常）时恢复为用户的设置。
+    std::shared_ptr<Session> getTargetSession() const;
+
+    std::shared_ptr<Session> getDraftSession() const;
+
+private:
+    std::shared_ptr<Session> target;
+    std::shared_ptr<Session> draft;    // 为空时使用prompt lookup
+    int nDraft;
+    PromptLookupParams lookup;
+
+    int draftedTokens = 0;
+    int acceptedTokens = 0;
+};
+
+}
+
+#endif //MINFER_SPECULATIVE_H
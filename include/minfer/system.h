@@ -157,6 +157,49 @@ void mprintf(const char* fmt, ...);
  */
 std::string format(const char* fmt, ...) M_FORMAT_PRINTF(1, 2);
 
+// 当前线程堆内存分配的次数统计，fastMalloc和MMemoryAllocAlign中会计数。
+// 测试中替换了全局的operator new，同样调用addAllocationCount，用来检查decode阶段不会分配内存。
+void addAllocationCount();
+size_t getAllocationCount();
+
+// 大页内存：按照内存的类别分别选择是否使用大页（2MB），减少decode时大块权重和kv cache的TLB miss。
+// 默认不使用，环境变量MINFER_HUGE_PAGES=madvise/hugetlb会为权重、kv cache和激活值打开。
+// 只对不小于一个大页的内存生效，申请大页失败时退回普通内存。只修改之后的内存分配。
+// 权重使用大页时，readNet把原本直接引用mmap映射（只能是4KB的页）的FP32权重拷贝到权重类别的内存中，
+// 启动时多一次拷贝，并且weight streaming不再起作用。
+enum MemoryClass {
+    MEMORY_CLASS_DEFAULT = 0,
+    MEMORY_CLASS_WEIGHT,     // layer中的权重
+    MEMORY_CLASS_KV_CACHE,
+    MEMORY_CLASS_ACTIVATION, // 激活值arena和scratch内存
+    MEMORY_CLASS_COUNT,
+};
+
+enum HugePageMode {
+    HUGE_PAGE_OFF = 0,
+    HUGE_PAGE_MADVISE = 1, // 透明大页，madvise(MADV_HUGEPAGE)
+    HUGE_PAGE_HUGETLB = 2, // mmap(MAP_HUGETLB)，需要预留大页，失败时使用透明大页
+};
+
+struct HugePageInfo
+{
+    size_t requested_bytes = 0; // 当前存活的、以大页方式申请的内存
+    size_t hugetlb_bytes = 0;   // 其中由hugetlbfs提供的
+    size_t thp_bytes = 0;       // 其中实际由透明大页提供的（读取/proc/self/smaps）
+    size_t fallback_bytes = 0;  // 申请大页失败，退回到普通内存的
+};
+
+void setHugePageMode(MemoryClass memClass, HugePageMode mode);
+HugePageMode getHugePageMode(MemoryClass memClass);
+HugePageInfo getHugePageInfo(MemoryClass memClass);
+
+// NUMA：之后创建的layer把矩阵乘的权重按输出列切分到nodes个node上，每段由绑定到对应node的worker计算，
+// attention按kv head分组，每组的kv cache由对应的worker分配、写入和读取，
+// decode时每个node只读取本地内存中的权重和kv cache。0关闭（默认），-1使用系统中所有的node，
+// 环境变量MINFER_NUMA_NODES设置默认值。不能在forward的同时修改。
+void setNumaNodes(int nodes);
+int getNumaNodes();
+
 
 /* This function is made for report error.
  * */
@@ -13,6 +13,7 @@
 #include "layer/embeding_layer.h"
 #include "layer/linear_layer.h"
 #include "layer/rms_norm_layer.h"
+#include "layer/get_rows_layer.h"
 
 namespace minfer
 {
@@ -20,7 +21,7 @@ namespace minfer
 BackendCPU::BackendCPU()
 {
     layerFactory = std::shared_ptr<LayerFactoryCPU>(new LayerFactoryCPU());
-    memoryAllocatorCPUImpl = Allocator::AllocatorImpl::createDefault();
+    memoryAllocatorCPUImpl = Allocator::AllocatorImpl::createDefault(MEMORY_CLASS_ACTIVATION);
     memoryAllocatorCPU = std::shared_ptr<Allocator>(new Allocator(memoryAllocatorCPUImpl));
 }
 
@@ -58,6 +59,7 @@ void BackendCPU::LayerFactoryCPU::registerAllLayer()
     M_CPU_REGISTER_LAYER(LayerType::Embedding, EmbeddingLayer);
     M_CPU_REGISTER_LAYER(LayerType::Linear, LinearLayer);
     M_CPU_REGISTER_LAYER(LayerType::RMSNorm, RMSNormLayer);
+    M_CPU_REGISTER_LAYER(LayerType::GetRows, GetRowsLayer);
 }
 
 std::shared_ptr<Layer> BackendCPU::createLayer(std::shared_ptr<LayerParams> param)
@@ -21,9 +21,7 @@ AddLayer::~AddLayer()
 void AddLayer::init(const std::vector<Mat*> &input, std::vector<Mat*> &output)
 {
     // pre check
-    inputNum = input.size();
-
-    M_Assert(inputNum == 2);
+    M_Assert(input.size() == 2);
     M_Assert(output.size() == 1);
 
     // 设置同样的shape
@@ -40,6 +38,11 @@ void AddLayer::forward(const std::vector<Mat*> &input, std::vector<Mat*> &output
     // (*output[0]).print();
 }
 
+int AddLayer::getInplaceInput()
+{
+    return 0;
+}
+
 std::shared_ptr<AddLayer> AddLayer::create(const std::shared_ptr<LayerParams> param)
 {
     return std::shared_ptr<AddLayer>(new AddLayer(param));
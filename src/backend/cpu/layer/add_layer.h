@@ -22,9 +22,11 @@ public:
     // and the forward can be run several times
     void forward(const std::vector<Mat*>& input, std::vector<Mat*>& output) override;
 
+    // output[0]可以和input[0]共享内存
+    int getInplaceInput() override;
+
 private:
     AddLayer(const std::shared_ptr<LayerParams> param);
-    int inputNum = -1;
 };
 
 }
@@ -4,24 +4,31 @@
 
 #include "attention_layer.h"
 #include "autobuffer.h"
+#include "kv_cache.h"
 #include <cstring>  // for memcpy
+#include <cfloat>
+#include <algorithm>
 
-#define ATTEN_DEBUG 0
+#define ATTEN_QUERY_BLOCK 64 // attention中每次计算的query行数
 namespace minfer {
 
-#if 1
-void print_mat(const Mat& m, int start, int num)
+// x: [rows, n]，每一行加上长度为n的bias，bias为空时不做任何事
+static void add_bias(Mat& x, const Mat& bias)
 {
-    const float* p = (const float*)m.data;
-    for (int i = start; i < start + num; i++)
+    if (bias.empty())
+        return;
+
+    const int n = x.size[1];
+    const int rows = x.size[0];
+    const float* pb = (const float *)bias.data;
+    for (int i = 0; i < rows; i++)
     {
-        std::cout<<p[i]<<" ";
+        float* px = (float *)x.data + (size_t)i * n;
+        for (int j = 0; j < n; j++)
+            px[j] += pb[j];
     }
-    std::cout<<std::endl;
 }
 
-#endif
-
 AttentionLayer::AttentionLayer(const std::shared_ptr<AttentionLayerParams> param)
 {
     layerNamePrefix = "AttentionLayer_";
@@ -38,25 +45,38 @@ AttentionLayer::AttentionLayer(const std::shared_ptr<AttentionLayerParams> param
     embd_dim_head = embd_dim / head_count;
     embd_dim_kv = embd_dim_head * head_count_kv;
 
-    param->norm.convertTo(norm, DT_32F);
-
-    param->wq.convertTo(wq, DT_32F);
-    param->wk.convertTo(wk, DT_32F);
-    param->wv.convertTo(wv, DT_32F);
-    param->wout.convertTo(wout, DT_32F);
-
-    param->bq.convertTo(bq, DT_32F);
-    param->bk.convertTo(bk, DT_32F);
-    param->bv.convertTo(bv, DT_32F);
-    param->bout.convertTo(bout, DT_32F);
-
-#if ATTEN_DEBUG
-    std::cout<<"print in init q k v out shape and params"<<std::endl;
-    wq.print(2);
-    wk.print(2);
-    wv.print(2);
-    wout.print(2);
-#endif
+    weightToFloat(param->norm, norm);
+
+    // 每个权重使用单独的Mat，convertTo不能写入已经交给NumaWeight的内存
+    Mat w_q, w_k, w_v, w_out;
+    weightToFloat(param->wq, w_q, param->getQuantType(&param->wq));
+    weightToFloat(param->wk, w_k, param->getQuantType(&param->wk));
+    weightToFloat(param->wv, w_v, param->getQuantType(&param->wv));
+    weightToFloat(param->wout, w_out, param->getQuantType(&param->wout));
+    wq.reset(w_q);
+    wk.reset(w_k);
+    wv.reset(w_v);
+    wout.reset(w_out);
+
+    // NUMA模式下kv head按pool的worker分组，每组的kv cache和attention由一个worker负责
+    pool = NumaPool::get();
+    kv_groups = 1;
+    if (pool)
+    {
+        kv_groups = std::min(pool->getWorkerCount(), head_count_kv);
+        while (head_count_kv % kv_groups != 0)
+            kv_groups--;
+    }
+
+    // 可选的bias，和投影的输出维度一致
+    weightToFloat(param->bq, bq);
+    weightToFloat(param->bk, bk);
+    weightToFloat(param->bv, bv);
+    weightToFloat(param->bout, bout);
+    M_Assert(bq.empty() || bq.total() == embd_dim);
+    M_Assert(bk.empty() || bk.total() == embd_dim_kv);
+    M_Assert(bv.empty() || bv.total() == embd_dim_kv);
+    M_Assert(bout.empty() || bout.total() == embd_dim);
 }
 
 void AttentionLayer::finalize(const std::vector<Mat *> &input, std::vector<Mat *> &output)
@@ -64,75 +84,164 @@ void AttentionLayer::finalize(const std::vector<Mat *> &input, std::vector<Mat *
 
 }
 
-Mat softmax(Mat inp)
+/* forward function contains two operator, RMSnorm and attention.
+ * 输入是从start_pos开始的seq_len个token，k v会被追加到kv cache中，所以长的prompt可以按chunk多次调用forward。
+ * */
+void AttentionLayer::forward(const std::vector<Mat *> &input, std::vector<Mat *> &output)
 {
-    Mat out = inp.clone();
-    M_Assert(inp.type() == DT_32F);
-
-    int inp_dim = inp.dims;
-
-    M_Assert(inp_dim > 1);
-
-    size_t last_len = inp.size[inp_dim - 1];
-    size_t out_loop = inp.total(0, inp_dim - 1);
-
-    for (int l = 0; l < out_loop; l++)
+    // 没有会话的情况下，每个batch使用临时的kv cache，从位置0开始推理。
+    M_Assert(input.size() == 1 && input[0] && input[0]->dims == 3);
+    int batch = input[0]->size[0];
+    std::vector<KVCache> kv_caches(batch);
+    LayerContext ctx;
+    for (int b = 0; b < batch; b++)
     {
-        const float* p_i = (const float*)inp.data + last_len * l;
-        float* p_o = (float*)out.data + last_len * l;
-
-        float max_val = *std::max_element(p_i, p_i + last_len);
+        ctx.kv_caches.push_back(&kv_caches[b]);
+    }
+    forward(input, output, ctx);
+}
 
-        float sum = 0.0f;
-        for (int i = 0; i < last_len; i++)
+// 一个batch中一组kv head的attention，NUMA模式下由这一组对应的worker执行，不分配内存
+struct AttentionLayer::AttentionTask
+{
+    const AttentionLayer* layer;
+    KVCache* const* kv_caches;
+    const int* start_pos;
+    int cache_id;
+    int seq_len;
+    const float* q;   // [rows, embd_dim]
+    const float* k;   // [rows, embd_dim_kv]
+    const float* v;
+    float* score;     // [kv_groups, query_block, score_ld]
+    int score_ld;
+    float* out;       // [rows, embd_dim]
+
+    // 先写入第group组的k v，再计算使用这一组kv head的所有head
+    void compute(int b, int group) const
+    {
+        const AttentionLayer& l = *layer;
+        KVCache& kv_cache = *kv_caches[b];
+        const int group_dim = l.embd_dim_kv / l.kv_groups; // cache中这一组每个token的步长
+        for (int i = 0; i < seq_len; i++)
         {
-            p_o[i] = expf(p_i[i] - max_val);
-            sum += p_o[i];
+            size_t offset = (size_t)(b * seq_len + i) * l.embd_dim_kv + group * group_dim;
+            kv_cache.writeGroup(cache_id, start_pos[b] + i, group, k + offset, v + offset);
         }
 
-        // normalize
-        float sum_div = 1.f/sum;
-        for (int i = 0; i < last_len; i++)
+        // q的第i个token只能看到cache中 [0, start_pos + i] 的token。
+        // 对于GQA，第h个head使用第 h / repeat_kv 个kv head，不需要repeat kv的拷贝。
+        // 每个head的query按ATTEN_QUERY_BLOCK行分块，q * k^T 和 score * v 都按kv cache的page调用gemm_kernel，
+        // q、k、v和输出都直接按行步长读写，score只需要 [ATTEN_QUERY_BLOCK, kv_len] 的buffer。
+        const float scale = 1.f / sqrtf(l.embd_dim_head);
+        const int page_size = kv_cache.getPageSize();
+        const int query_block = std::min(seq_len, ATTEN_QUERY_BLOCK);
+        const int heads_per_group = l.head_count / l.kv_groups;
+        float* s = score + (size_t)group * query_block * score_ld;
+        for (int h = group * heads_per_group; h < (group + 1) * heads_per_group; h++)
         {
-            p_o[i] *= sum_div;
+            const int h_kv = h / l.repeat_kv - group * (l.head_count_kv / l.kv_groups); // 组内的kv head
+            for (int i0 = 0; i0 < seq_len; i0 += query_block)
+            {
+                const int m = std::min(query_block, seq_len - i0);
+                const int row0 = b * seq_len + i0;
+                const int kv_len = start_pos[b] + i0 + m; // 块中最后一行能看到的长度
+
+                // score = q * k^T
+                const float* q_block = q + (size_t)row0 * l.embd_dim + h * l.embd_dim_head;
+                for (int p0 = 0; p0 < kv_len; p0 += page_size)
+                {
+                    const int n = std::min(page_size, kv_len - p0);
+                    gemm_kernel(m, n, l.embd_dim_head, q_block, l.embd_dim,
+                                kv_cache.k(cache_id, p0, group) + h_kv * l.embd_dim_head, group_dim, true,
+                                s + p0, score_ld);
+                }
+
+                // causal mask + softmax，看不到的位置置0，下面的gemm可以直接使用整个块
+                for (int r = 0; r < m; r++)
+                {
+                    float* s_r = s + (size_t)r * score_ld;
+                    const int visible_len = start_pos[b] + i0 + r + 1;
+
+                    float max_val = -FLT_MAX;
+                    for (int j = 0; j < visible_len; j++)
+                    {
+                        s_r[j] *= scale;
+                        max_val = std::max(max_val, s_r[j]);
+                    }
+
+                    float sum = 0.f;
+                    for (int j = 0; j < visible_len; j++)
+                    {
+                        s_r[j] = expf(s_r[j] - max_val);
+                        sum += s_r[j];
+                    }
+
+                    float sum_div = 1.f / sum;
+                    for (int j = 0; j < visible_len; j++)
+                        s_r[j] *= sum_div;
+                    for (int j = visible_len; j < kv_len; j++)
+                        s_r[j] = 0.f;
+                }
+
+                // out = score * v
+                float* o_block = out + (size_t)row0 * l.embd_dim + h * l.embd_dim_head;
+                for (int p0 = 0; p0 < kv_len; p0 += page_size)
+                {
+                    const int n = std::min(page_size, kv_len - p0);
+                    gemm_kernel(m, l.embd_dim_head, n, s + p0, score_ld,
+                                kv_cache.v(cache_id, p0, group) + h_kv * l.embd_dim_head, group_dim, false,
+                                o_block, l.embd_dim, p0 > 0);
+                }
+            }
         }
     }
+};
 
-    return out;
-}
-
-/* forward function contains two operator, RMSnorm and attention.
- * forward contain start_pos and sequence len, how to set the sequence len to the forward?
- * */
-// TODO take into account the kv_head is different with head_count.
-// TODO try to use bias params
-void AttentionLayer::forward(const std::vector<Mat *> &input, std::vector<Mat *> &output)
+void AttentionLayer::forward(const std::vector<Mat *> &input, std::vector<Mat *> &output, LayerContext &ctx)
 {
     // shape check
     M_Assert(input.size() == 1 && input[0]);
     M_Assert(output.size() == 1 && output[0]);
 
-    MatShape in_shape = input[0]->shape();
+    M_Assert(input[0]->dims == 3);
+    M_Assert(input[0]->size[2] == embd_dim);
 
-    M_Assert(in_shape.size() == 3);
-    M_Assert(in_shape[2] == embd_dim);
-    M_Assert(in_shape[0] == 1 && "Currently, only support single batch!");
+    // 每个batch使用自己的kv cache和起始位置，batch为1时可以直接使用ctx.kv_cache。
+    // decode每一步都会调用，这里不拷贝ctx.kv_caches，起始位置也放在scratch内存中。
+    const int batch = input[0]->size[0];
+    KVCache* const* kv_caches = ctx.kv_caches.data();
+    Mat start_pos_buf = Mat({batch}, DT_32S);
+    int* start_pos = (int *)start_pos_buf.data;
+    if (ctx.kv_caches.empty())
+    {
+        M_Assert(batch == 1 && ctx.kv_cache && "AttentionLayer need the kv cache of session!");
+        kv_caches = &ctx.kv_cache;
+        start_pos[0] = ctx.start_pos;
+    }
+    else
+    {
+        M_Assert(ctx.kv_caches.size() == batch && "Every batch needs its own kv cache!");
+        for (int b = 0; b < batch; b++)
+        {
+            start_pos[b] = kv_caches[b]->size();
+        }
+    }
 
-    // TODO support multi-type Mat. Current only fp16 is supported.
+    // 目前只支持FP32输入
     M_Assert(input[0]->type() == DT_32F);
 
     // step0: implementation the rms norm
     // xq shape is [bsz, seq, embed]
     Mat x = *input[0];
-    Mat x_norm = Mat(x.dims - 1, x.size.p + 1, DT_32F); // shape [bsz, seq_len, embed]
+    const int seq_len = input[0]->size[1];
+    const int rows = batch * seq_len;   // batch和seq_len合并成行
+    Mat x_norm = Mat({rows, embd_dim}, DT_32F); // shape [bsz * seq_len, embed]
 
     float* p = (float *)x_norm.data;
     float* pi = (float *)x.data;
     float * p_norm = (float *)norm.data;
 
-    int seq_len = in_shape[1];
-
-    for (int i = 0; i < seq_len; i++)
+    for (int i = 0; i < rows; i++)
     {
         float sum_f2 = 0;
         float* pi_s = pi + i * embd_dim;
@@ -153,29 +262,21 @@ void AttentionLayer::forward(const std::vector<Mat *> &input, std::vector<Mat *>
 
     // implementation Q K V linear
 
-    Mat x_q = gemm(x_norm, wq, false, false); // xq shape is [bsz, seq, embed], x_norm shape is [embed, embed], after shape, is the same.
-    Mat x_k = gemm(x_norm, wk, false, false); // k and v may has different shape with q, use Group-query attention.
-    Mat x_v = gemm(x_norm, wv, false, false); // wk and wv shape is [embed, embd_dim_kv], x_k = [bsz, seq, embd_dim_kv]
-
-#if 0
-    std::cout<<"print x_norm"<<std::endl;
-    x_norm.print(10);
-    std::cout<<"print in init xq, xk xv shape and params"<<std::endl;
-    x_q.print(20);
-    x_k.print(20);
-    x_v.print(20);
-
-    std::cout<<"print_mat "<<std::endl;
-    print_mat(x_q, 128, 20);
-    print_mat(x_k, 128, 20);
-    print_mat(x_v, 128, 20);
+    Mat x_q = wq.gemm(x_norm); // xq shape is [bsz, seq, embed], x_norm shape is [embed, embed], after shape, is the same.
+    Mat x_k = wk.gemm(x_norm); // k and v may has different shape with q, use Group-query attention.
+    Mat x_v = wv.gemm(x_norm); // wk and wv shape is [embed, embd_dim_kv], x_k = [bsz, seq, embd_dim_kv]
 
-#endif
+    // bias在RoPE之前加上，按行广播
+    add_bias(x_q, bq);
+    add_bias(x_k, bk);
+    add_bias(x_v, bv);
 
     M_Assert(embd_dim_head % 2 == 0);
     int embd_dim_head_complex = embd_dim_head / 2;
 
-    std::vector<float> freqs_cis(embd_dim_head_complex); // [embd_vec_len]
+    // 临时buffer都使用Mat，forward时由Session的scratch allocator分配
+    Mat freqs_cis_buf = Mat({embd_dim_head_complex}, DT_32F); // [embd_vec_len]
+    float* freqs_cis = (float *)freqs_cis_buf.data;
 
     // implementation Q K RoPe
     for (int i = 0; i < embd_dim_head_complex; i++)
@@ -183,13 +284,14 @@ void AttentionLayer::forward(const std::vector<Mat *> &input, std::vector<Mat *>
         freqs_cis[i] = 1.0f / powf(10000.0f, i*2 / (float)(embd_dim_head));
     }
 
-    std::vector<float > freqs_sin_cos(seq_len * embd_dim_head_complex * 2); // [seq_len, embd_dim_head_complex, 2]
+    Mat freqs_sin_cos_buf = Mat({rows, embd_dim_head_complex * 2}, DT_32F); // [rows, embd_dim_head_complex, 2]
+    float* freqs_sin_cos = (float *)freqs_sin_cos_buf.data;
 
-    for (int i = 0; i < seq_len; i++)
+    for (int i = 0; i < rows; i++)
     {
-        float* p_data = freqs_sin_cos.data() + i * embd_dim_head_complex * 2;
+        float* p_data = freqs_sin_cos + i * embd_dim_head_complex * 2;
 
-        int cur_seq = i + start_pos;
+        int cur_seq = i % seq_len + start_pos[i / seq_len];
         for (int j = 0; j < embd_dim_head_complex; j++)
         {
             p_data[j*2] = sinf(cur_seq * freqs_cis[j]);
@@ -197,30 +299,11 @@ void AttentionLayer::forward(const std::vector<Mat *> &input, std::vector<Mat *>
         }
     }
 
-#if 0
-    // debug freqs_sin_cos
-    std::cout<<"freqs sin = ";
-    for (int i = 0; i < 10; i++)
-    {
-        std::cout<<freqs_sin_cos[i*2]<<",";
-    }
-    std::cout<<std::endl;
-
-    std::cout<<"freqs cos = ";
-    for (int i = 0; i < 10; i++)
-    {
-        std::cout<<freqs_sin_cos[i*2 + 1]<<",";
-    }
-    std::cout<<std::endl;
-
-#endif
-
     // freqs_cis = embd_vec_len * 2
     // kv shape is x_k = [bsz, seq, embd_dim_kv]
-    // Debug this part code.
-    for (int i = 0; i < seq_len; i++) // seq
+    for (int i = 0; i < rows; i++) // seq
     {
-        float* p_data = freqs_sin_cos.data() + i * embd_dim_head_complex * 2;
+        float* p_data = freqs_sin_cos + i * embd_dim_head_complex * 2;
         float* p_x_q = (float *)x_q.data + i * embd_dim_head_complex * 2 * head_count;
         float* p_x_k = (float *)x_k.data + i * embd_dim_head_complex * 2 * head_count_kv;
 
@@ -257,194 +340,67 @@ void AttentionLayer::forward(const std::vector<Mat *> &input, std::vector<Mat *>
         }
     }
 
-    // TODO repeat kv based on repeat
-
-#if 0
-    std::cout<<"print after RoPE xq, xk, xv shape and params"<<std::endl;
-    x_q.print(10);
-    x_k.print(10);
-
-    std::cout<<"print_mat "<<std::endl;
-    print_mat(x_q, 128, 20);
-    print_mat(x_k, 128, 20);
-#endif
-
-    // because x_q, x_k, x_v are two dim, we need to reshape it to [seq, bsz, embd_dim_head]
-    // TODO check if we should use head_count_kv?
-    std::vector<int> new_shape_q = {seq_len, head_count, embd_dim_head};
-    std::vector<int> new_shape_kv = {seq_len, head_count_kv, embd_dim_head};
-
-    x_q = x_q.reshape(new_shape_q);
-    x_k = x_k.reshape(new_shape_kv);
-    x_v = x_v.reshape(new_shape_kv);
-
-    // Repeat K and V to match Q's head count for Grouped Query Attention
-    if (repeat_kv > 1) {
-        // Need to repeat K and V along the head dimension
-        // x_k shape: [seq_len, head_count_kv, embd_dim_head] -> [seq_len, head_count, embd_dim_head]
-        // x_v shape: [seq_len, head_count_kv, embd_dim_head] -> [seq_len, head_count, embd_dim_head]
-        
-        Mat x_k_repeated = Mat({seq_len, head_count, embd_dim_head}, x_k.type());
-        Mat x_v_repeated = Mat({seq_len, head_count, embd_dim_head}, x_v.type());
-        
-        float* k_src = (float*)x_k.data;
-        float* v_src = (float*)x_v.data;
-        float* k_dst = (float*)x_k_repeated.data;
-        float* v_dst = (float*)x_v_repeated.data;
-        
-        for (int s = 0; s < seq_len; s++) {
-            for (int h = 0; h < head_count; h++) {
-                int kv_head = h / repeat_kv; // Which kv head to copy from
-                
-                // Copy K
-                memcpy(k_dst + (s * head_count + h) * embd_dim_head,
-                       k_src + (s * head_count_kv + kv_head) * embd_dim_head,
-                       embd_dim_head * sizeof(float));
-                
-                // Copy V
-                memcpy(v_dst + (s * head_count + h) * embd_dim_head,
-                       v_src + (s * head_count_kv + kv_head) * embd_dim_head,
-                       embd_dim_head * sizeof(float));
-            }
-        }
-        
-        x_k = x_k_repeated;
-        x_v = x_v_repeated;
+    // 将本次的k v写入会话的kv cache，计算 softmax(q * k^T / sqrt(d)) * v。
+    // 没有加入Net的layer，layerId为-1，只会使用临时的kv cache
+    const int cache_id = std::max(layerId, 0);
+    for (int b = 0; b < batch; b++)
+    {
+        kv_caches[b]->prepare(cache_id, max_seq_len, embd_dim_kv, kv_groups);
     }
 
-    // py code: scores = self.attn.forward(q, k, v)
-    x_q = transposeND(x_q, {1, 0, 2});
-    x_k = transposeND(x_k, {1, 0, 2});
-    x_v = transposeND(x_v, {1, 0, 2});
-
-#if 0
-    std::cout<<"print after transpose xq, xk, xv shape and params"<<std::endl;
-    x_q.print(20);
-    x_k.print(20);
-    x_v.print(20);
-
-    Mat tx = Mat({10}, x_q.type(), (float *)x_k.data + 256*16);
-    Mat tq = Mat({10}, x_q.type(), (float *)x_q.data + 256*16);
-
-    std::cout<<"q1 reshape"<<std::endl;
-    tx.print();
-    tq.print();
-#endif
-
-    // implementation Q K matmul and mask
-    Mat qk = gemm(x_q, x_k, false, true); // qk shape is [bsz, seq_len, seq_len + cache_len]
-
-//    std::cout<<"print qk shape and params"<<std::endl;
-//    qk.print(10);
-
-    // implementation softmax
-    Mat qk_sqrt = qk / sqrtf(embd_dim_head); // score
-
-//    std::cout<<"print qk_sqrt shape and params"<<std::endl;
-//    qk_sqrt.print(10);
-
-#if 0
-    std::cout<<"print after rope xq, xk, qk, qk_sqrt shape and params"<<std::endl;
-    x_q.print(10);
-    x_k.print(10);
-    qk.print(20);
-    qk_sqrt.print(20);
-    std::cout<<"sqrtf(embd_dim_head) = "<<sqrtf(embd_dim_head)<<std::endl;
-#endif
-
-    // construct Mask Mat
-    int dim_qk = qk_sqrt.size.dims();
-    M_Assert(dim_qk >= 2);
-    std::vector<int> mask_shape(dim_qk, 1);
-    size_t m = qk_sqrt.size.p[dim_qk - 2];
-    size_t n = qk_sqrt.size.p[dim_qk - 1];
-
-    mask_shape[dim_qk - 1] = qk_sqrt.size.p[dim_qk - 1];
-    mask_shape[dim_qk - 2] = qk_sqrt.size.p[dim_qk - 2];
-
-    Mat mask = Mat(mask_shape, DT_32F);
-    float* p_mask = (float*)mask.data;
-    for (int i = 0; i < m; i++)
+    const int max_start = *std::max_element(start_pos, start_pos + batch);
+    const int query_block = std::min(seq_len, ATTEN_QUERY_BLOCK);
+    const int score_ld = max_start + seq_len;
+    Mat score_buf = Mat({kv_groups, query_block, score_ld}, DT_32F); // 每组一个score buffer
+
+    Mat qkv = Mat({rows, embd_dim}, DT_32F); // [bsz * seq_len, head_count * embd_dim_head]
+
+    AttentionTask task = {this, kv_caches, start_pos, cache_id, seq_len, (const float *)x_q.data,
+                          (const float *)x_k.data, (const float *)x_v.data, (float *)score_buf.data,
+                          score_ld, (float *)qkv.data};
+    const AttentionTask* t = &task;
+    if (pool)
     {
-        float* p_mask_i = p_mask + i*n;
-        for (int j = 0; j < n; j++)
-        {
-            p_mask_i[j] = i >= j ? 1 : 0;
-        }
+        // NUMA模式：第g个worker写入和计算第g组kv head，kv cache的page在worker所在的node上分配，
+        // decode时每个node只读取本地的kv cache
+        pool->run([t, batch](int worker) {
+            if (worker >= t->layer->kv_groups)
+                return;
+            for (int b = 0; b < batch; b++)
+                t->compute(b, worker);
+        });
+    }
+    else
+    {
+        for (int b = 0; b < batch; b++)
+            task.compute(b, 0);
     }
-
-    // std::cout<<"before print_mat mask  mask_1e20"<<std::endl;
-    // mask.print(10);
-    // print_mat(mask, 0, 20);
-    // print_mat(mask, 256, 20);
-    // print_mat(mask, 256 * 2, 20);
-
-    Mat mask_1e20 = (1.f - mask) * 1e20f;
-
-    // std::cout<<"print_mat mask  mask_1e20"<<std::endl;
-    // mask_1e20.print(10);
-    // print_mat(mask_1e20, 0, 20);
-    // print_mat(mask_1e20, 256, 20);
-    // print_mat(mask_1e20, 256 * 2, 20);
-    // qk_sqrt.print(10);
-    // 8 x 256 x 256
-    qk_sqrt = qk_sqrt * mask - mask_1e20;
-
-    // std::cout<<"print_mat mask "<<std::endl;
-    // print_mat(qk_sqrt, 0, 20);
-    // print_mat(qk_sqrt, 256*256, 20);
-    // print_mat(qk_sqrt,  256*256*2, 20);
-    //
-    // apply the softmax to score
-    Mat score = softmax(qk_sqrt);
-
-#if 0
-    score.print(20);
-    print_mat(score, 0, 20);
-    print_mat(score, 256*256, 20);
-
-    std::cout<<"print after mask, print qk_sqrt, score and x_v shape and params"<<std::endl;
-    qk_sqrt.print(2);
-    score.print(2);
-    x_v.print(2);
-#endif
-    // implementation matmul V
-    Mat qkv = gemm(score, x_v); // qk shape is [bsz, seq_len, seq_len + cache_len]
 
     // implementation out linear.
-    Mat out = *output[0];
-    Mat x_out = Mat(out.size.dims() - 1, out.size.p+1, out.type(), out.data);
-
-    // Transpose qkv from [head_count, seq_len, embd_dim_head] to [seq_len, head_count, embd_dim_head]
-    // and then reshape it to [seq_len, head_count * embd_dim_head]
-    Mat qkvT= transposeND(qkv, {1, 0, 2});
-    qkvT = qkvT.reshape({seq_len, head_count * embd_dim_head});
-
-    // std::cout<<"qkvT.print("<<std::endl;
-    // qkvT.print(20);
-    // print_mat(qkvT, 128, 20);
-    // print_mat(qkvT, 128*2, 20);
-    // print_mat(qkvT, 128*3, 20);
-    // print_mat(qkvT, 128*4, 20);
-    // wout.print(20);
-    // print_mat(wout, 128, 20);
-    // print_mat(wout, 128*2, 20);
-    gemm(qkvT, wout, false, false).copyTo(x_out);
-    //
-    // std::cout<<"out, 0"<<std::endl;
-    // print_mat(out, 0, 20);
-    // print_mat(out, 128, 20);
-    // print_mat(out, 128 * 2, 20);
-    // print_mat(out, 128 * 3, 20);
-    out = x_out + *input[0];
-
-    // 最后加上这次的seq len
-    start_pos += seq_len;
+    // 投影的结果直接和残差相加写入output，之前不会写output，所以output可以和input[0]共享内存。
+    Mat x_in = Mat({rows, embd_dim}, input[0]->type(), input[0]->data);
+    Mat x_out = Mat({rows, embd_dim}, output[0]->type(), output[0]->data);
+    Mat proj = wout.gemm(qkv);
+    add_bias(proj, bout);
+    add(proj, x_in, x_out);
 }
 
-void precompute_freq_cis(int dim, int end, int rms_eps)
+int AttentionLayer::getInplaceInput()
 {
+    return 0;
+}
 
+size_t AttentionLayer::getWorkspaceSize(const std::vector<Mat*>& input, const std::vector<Mat*>& output)
+{
+    const int batch = input[0]->size[0];
+    const size_t rows = (size_t)batch * input[0]->size[1];
+
+    // x_norm、x_q、qkv、输出投影各 [rows, embd_dim]，x_k、x_v各 [rows, embd_dim_kv]，
+    // RoPE的sin/cos为 [rows, embd_dim_head]，每组kv head的score最大为 [ATTEN_QUERY_BLOCK, max_seq_len]，每个batch的起始位置
+    const size_t query_block = std::min(input[0]->size[1], ATTEN_QUERY_BLOCK);
+    return 4 * workspaceBytes(rows * embd_dim) + 2 * workspaceBytes(rows * embd_dim_kv) +
+           workspaceBytes(embd_dim_head / 2) + workspaceBytes(rows * embd_dim_head) +
+           workspaceBytes(kv_groups * query_block * max_seq_len) + workspaceBytes(batch, DT_32S);
 }
 
 void AttentionLayer::init(const std::vector<Mat *> &input, std::vector<Mat *> &output)
@@ -459,6 +415,17 @@ void AttentionLayer::init(const std::vector<Mat *> &input, std::vector<Mat *> &o
     output[0]->setSize(*input[0]);
 }
 
+std::vector<Mat*> AttentionLayer::getWeights()
+{
+    std::vector<Mat*> weights = {&norm, &bq, &bk, &bv, &bout};
+    for (NumaWeight* w : {&wq, &wk, &wv, &wout})
+    {
+        std::vector<Mat*> ws = w->getWeights();
+        weights.insert(weights.end(), ws.begin(), ws.end());
+    }
+    return weights;
+}
+
 AttentionLayer::~AttentionLayer()
 {
 
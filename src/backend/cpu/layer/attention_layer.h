@@ -7,6 +7,7 @@
 
 #include "minfer.h"
 #include "common_layer.h"
+#include "numa.h"
 
 namespace minfer {
 
@@ -38,16 +39,28 @@ public:
 
     void finalize(const std::vector<Mat*>& input, std::vector<Mat*>& output) override;
 
+    // 使用临时kv cache，从位置0开始推理
     void forward(const std::vector<Mat*>& input, std::vector<Mat*>& output) override;
 
+    // 使用会话中的kv cache和位置
+    void forward(const std::vector<Mat*>& input, std::vector<Mat*>& output, LayerContext& ctx) override;
+
+    // output[0]可以和input[0]共享内存
+    int getInplaceInput() override;
+
+    size_t getWorkspaceSize(const std::vector<Mat*>& input, const std::vector<Mat*>& output) override;
+
+    std::vector<Mat*> getWeights() override;
+
 private:
+    struct AttentionTask;
+
     Mat norm;
-    Mat wq;
-    Mat wk;
-    Mat wv;
-    Mat wout;
+    NumaWeight wq;
+    NumaWeight wk;
+    NumaWeight wv;
+    NumaWeight wout;
 
-    bool has_bias;
     Mat bq;
     Mat bk;
     Mat bv;
@@ -62,7 +75,8 @@ private:
     int embd_dim_head;     // embd_dim of each head. d_k otherwise.
     int embd_dim_kv;       // embd_dim of kv
 
-    int start_pos = 0;     // 标志从哪里开始开始推理
+    std::shared_ptr<NumaPool> pool; // NUMA模式下创建时的pool，为空时在当前线程计算attention
+    int kv_groups;         // kv head的分组数量，NUMA模式下每组由pool的一个worker计算
 
     AttentionLayer(const std::shared_ptr<AttentionLayerParams> param);
 };
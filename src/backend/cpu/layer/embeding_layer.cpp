@@ -3,6 +3,8 @@
 //
 
 #include "embeding_layer.h"
+#include "gguf_model/ggml_quant.h"
+#include "gguf_model/gguf_utils.h"
 
 namespace minfer {
 
@@ -18,31 +20,36 @@ EmbeddingLayer::EmbeddingLayer(const std::shared_ptr<EmbeddingLayerParams> param
     MatShape w_shape = param->w.shape();
     M_Assert(w_shape.size() == 2);
 
-
-    auto tt = param->w.total();
-    auto t = param->w.type();
-
-    Mat wFp32;
-    param->w.convertTo(wFp32, DT_32F);
+    // 权重保持源模型中的类型（FP32、FP16或者量化的block），forward时只转换查询的那几行
+    quant_type = param->quant_type;
+    if (quant_type != QUANT_NONE)
+    {
+        // 量化的block只能按行存放：[vocab_dim, 每行的字节数]
+        M_Assert(param->w.type() == DT_8U);
+        M_Assert(w_shape[0] == vocab_dim);
+        M_Assert(w_shape[1] == ggml_row_size((GGML_TYPE)quant_type, embd_dim) && "Quantized embedding row size mismatch!");
+        transposed = false;
+        w = param->w;
+        return;
+    }
 
     // 有的模型会将embedding的weight设置为[embd_dim, vocab_dim]，有的模型会设置为[vocab_dim, embd_dim]
+    // [embd_dim, vocab_dim]时不做转置，查表时按列读取，这样和输出层共享权重（tied embedding）时只需要一份内存
     if (w_shape[0] == vocab_dim && w_shape[1] == embd_dim)
     {
-        // 这种情况是[vocab_dim, embd_dim]
-        w = wFp32;
+        transposed = false;
     }
     else if (w_shape[0] == embd_dim && w_shape[1] == vocab_dim)
     {
-        // 这种情况是[embd_dim, vocab_dim]
-        std::vector<int> new_shape = {vocab_dim, embd_dim};
-        w = transpose(wFp32);
+        transposed = true;
     }
     else
         M_Error(NULL, "EmbeddingLayer weight shape is not supported! ");
 
-    MatShape w_shape2 = w.shape();
-    M_Assert(w_shape2[0] == vocab_dim);
-    M_Assert(w_shape2[1] == embd_dim);
+    if (param->w.type() == DT_32F || param->w.type() == DT_16F)
+        w = param->w;
+    else
+        weightToFloat(param->w, w);
 }
 
 EmbeddingLayer::~EmbeddingLayer()
@@ -79,36 +86,69 @@ void EmbeddingLayer::forward(const std::vector<Mat*> &input, std::vector<Mat*> &
     M_Assert(output.size() == 1);
 
     // 维度对齐
-    MatShape in_shape = input[0]->shape();
-    M_Assert(in_shape.size() == 2); // [batch, seq_len]
+    const Mat& in = *input[0];
+    const Mat& out = *output[0];
+    M_Assert(in.dims == 2); // [batch, seq_len]
 
-    // TODO Multi batch
-    M_Assert(in_shape[0] == 1 && "Currently, only support single batch!");
     M_Assert(input[0]->type() == DT_32S); // 输入必须是整型
     M_Assert(output[0]->type() == DT_32F); // 输入必须是整型
 
-    MatShape out_shape = output[0]->shape();
-
-    M_Assert(out_shape.size() == 3); // [batch, seq_len, embd_dim]
-    M_Assert(out_shape[0] == 1);
-    M_Assert(out_shape[1] == in_shape[1]); // seq_len should be same
-    M_Assert(out_shape[2] == embd_dim);
+    M_Assert(out.dims == 3); // [batch, seq_len, embd_dim]
+    M_Assert(out.size[0] == in.size[0]);
+    M_Assert(out.size[1] == in.size[1]); // seq_len should be same
+    M_Assert(out.size[2] == embd_dim);
 
-    size_t seq_len = in_shape[1];
+    // 所有batch的token依次查表
+    size_t seq_len = in.size[0] * in.size[1];
 
     int* index = (int*)input[0]->data;
-    float* w_ptr = (float*)w.data;
     float* output_ptr = (float*)output[0]->data;
 
     for (int i = 0; i < seq_len; i++)
     {
         int word_id = index[i];
+        M_Assert(word_id >= 0 && word_id < vocab_dim && "Token id is out of vocabulary!");
         float* embd = output_ptr + i * embd_dim;
 
-        memcpy(embd, w_ptr + word_id * embd_dim, embd_dim * sizeof(float));
+        if (quant_type != QUANT_NONE)
+        {
+            dequantize_row((GGML_TYPE)quant_type, w.data + (size_t)word_id * w.size[1], embd, embd_dim);
+        }
+        else if (w.type() == DT_16F)
+        {
+            const hfloat* w_ptr = (const hfloat*)w.data;
+            if (transposed)
+            {
+                const hfloat* col = w_ptr + word_id;
+                for (int j = 0; j < embd_dim; j++)
+                    embd[j] = (float)col[(size_t)j * vocab_dim];
+            }
+            else
+            {
+                const hfloat* row = w_ptr + (size_t)word_id * embd_dim;
+                for (int j = 0; j < embd_dim; j++)
+                    embd[j] = (float)row[j];
+            }
+        }
+        else if (transposed)
+        {
+            // [embd_dim, vocab_dim]，第word_id列
+            const float* col = (const float*)w.data + word_id;
+            for (int j = 0; j < embd_dim; j++)
+                embd[j] = col[(size_t)j * vocab_dim];
+        }
+        else
+        {
+            memcpy(embd, (const float*)w.data + (size_t)word_id * embd_dim, embd_dim * sizeof(float));
+        }
     }
 }
 
+std::vector<Mat*> EmbeddingLayer::getWeights()
+{
+    return {&w};
+}
+
 std::shared_ptr<EmbeddingLayer> EmbeddingLayer::create(const std::shared_ptr<LayerParams> param)
 {
     std::shared_ptr<EmbeddingLayerParams> e_param = std::dynamic_pointer_cast<EmbeddingLayerParams>(param);
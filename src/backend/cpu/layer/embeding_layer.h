@@ -30,12 +30,16 @@ public:
     // and the forward can be run several times
     void forward(const std::vector<Mat*>& input, std::vector<Mat*>& output) override;
 
+    std::vector<Mat*> getWeights() override;
+
 private:
     EmbeddingLayer(const std::shared_ptr<EmbeddingLayerParams> param);
 
     int vocab_dim;  // input, the length of vocabulary
     int embd_dim;   // output, embedding feature length.
-    Mat w;          // Embedding layer params
+    Mat w;          // Embedding layer params，FP32、FP16或者量化的block
+    bool transposed = false; // w的shape是[embd_dim, vocab_dim]
+    QuantType quant_type = QUANT_NONE;
 
     Mode model = LOOKUP; // 目前仅支持 loopup模式，projection 情况目前是用 linear层实现。
 };
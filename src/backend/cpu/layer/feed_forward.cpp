@@ -2,7 +2,7 @@
 // Created by mzh on 2024/7/23.
 //
 
-#include <functional>
+#include <algorithm>
 #include "feed_forward.h"
 #define FFN_DEBUG 0
 namespace minfer
@@ -15,18 +15,23 @@ FeedForwardLayer::FeedForwardLayer(const std::shared_ptr<FeedForwardLayerParams>
     ffn_dim = param->ffn_dim;
     rms_eps = param->rms_eps;
 
-    param->norm.convertTo(norm, DT_32F);
-    param->up.convertTo(up, DT_32F);
-    param->gate.convertTo(gate, DT_32F);
-    param->down.convertTo(down, DT_32F);
+    weightToFloat(param->norm, norm);
+    // 每个权重使用单独的Mat，convertTo不能写入已经交给NumaWeight的内存
+    Mat w_up, w_gate, w_down;
+    weightToFloat(param->up, w_up, param->getQuantType(&param->up));
+    weightToFloat(param->gate, w_gate, param->getQuantType(&param->gate));
+    weightToFloat(param->down, w_down, param->getQuantType(&param->down));
+    up.reset(w_up);
+    gate.reset(w_gate);
+    down.reset(w_down);
 
     activateType = param->actType;
 #if ATTEN_DEBUG
     std::cout<<"print in init norm up gate down shape and params"<<std::endl;
     norm.print(2);
-    up.print(2);
-    gate.print(2);
-    down.print(2);
+    up.getMat().print(2);
+    gate.getMat().print(2);
+    down.getMat().print(2);
 #endif
 }
 
@@ -46,40 +51,23 @@ void FeedForwardLayer::forward(const std::vector<Mat *> &input, std::vector<Mat
 
     M_Assert(input[0]->type() == output[0]->type());
 
-    MatShape in_shape = input[0]->shape();
-
-    M_Assert(in_shape.size() == 3);
-    M_Assert(in_shape[2] == embd_dim);
-    M_Assert(in_shape[0] == 1 && "Currently, only support single batch!");
+    const Mat& in = *input[0];
+    M_Assert(in.dims == 3);
+    M_Assert(in.size[2] == embd_dim);
 
     // pos_stripe 确定细节pos对计算对影响。
     // size_t pos_stripe = start_pos * total(in_shape, 1) * DT_ELEM_SIZE(input[0]->type());
 
-    Mat x = *input[0];
-    Mat x_norm = Mat(x.dims, x.size.p, DT_32F); // shape [bsz, seq_len, embed]
+    // batch和seq_len合并成行，shape [bsz * seq_len, embed]
+    int seq_len = in.size[0] * in.size[1];
+
+    Mat x = in;
+    Mat x_norm = Mat({seq_len, embd_dim}, DT_32F);
     float* p = (float *)x_norm.data;
     float* pi = (float *)(x.data);
     float * p_norm = (float *)norm.data;
 
-    int seq_len = in_shape[1];
-
-    // relu act
-    std::function<float(const float )> act_func;
-    if (activateType == ActivateType::RELU)
-    {
-        act_func = [&](const float v)
-        {
-            return std::max(0.f, v);
-        };
-    }
-    else if (activateType == ActivateType::SILU)
-    {
-        act_func = [&](const float v)
-        {
-            return v/(1 + exp(-v));
-        };
-    }
-    else
+    if (activateType != ActivateType::RELU && activateType != ActivateType::SILU)
     {
         M_Error(NULL, "Un-supported activation type!");
     }
@@ -105,30 +93,47 @@ void FeedForwardLayer::forward(const std::vector<Mat *> &input, std::vector<Mat
     }
 
     // x1 = silu(self.linear1.forward(x))
-    Mat x1 = gemm(x_norm, gate, false, false);
+    Mat x1 = gate.gemm(x_norm);
 
     // Apply activation function to all elements
     float* p_x1 = (float *)x1.data;
     size_t total_elements = x1.total();
-    for (size_t i = 0; i < total_elements; i++)
+    // 直接按照激活类型分支，不使用std::function，避免每次forward分配内存
+    if (activateType == ActivateType::RELU)
+    {
+        for (size_t i = 0; i < total_elements; i++)
+        {
+            p_x1[i] = std::max(0.f, p_x1[i]);
+        }
+    }
+    else
     {
-        p_x1[i] = act_func(p_x1[i]);
+        for (size_t i = 0; i < total_elements; i++)
+        {
+            p_x1[i] = p_x1[i]/(1 + exp(-p_x1[i]));
+        }
     }
 
     // x3 = self.linear3.forward(x)
-    Mat x3 = gemm(x_norm, up, false, false);
+    Mat x3 = up.gemm(x_norm);
 
-    // x_out = self.linear2.forward(x1 * x3)
-    Mat out = *output[0];
-    Mat x_out = Mat(out.size.dims(), out.size.p, out.type(), out.data);
+    // x_out = self.linear2.forward(x1 * x3) + x
+    // 之前不会写output，所以output可以和input[0]共享内存。
+    Mat x_out = Mat({seq_len, embd_dim}, output[0]->type(), output[0]->data);
+    add(down.gemm(x1 * x3), Mat({seq_len, embd_dim}, x.type(), x.data), x_out);
+}
 
-    gemm(x1 * x3, down, false, false).copyTo(out);
+int FeedForwardLayer::getInplaceInput()
+{
+    return 0;
+}
 
-    // std::cout<<"out gemm"<<std::endl;
-    // out.print(10);
+size_t FeedForwardLayer::getWorkspaceSize(const std::vector<Mat*>& input, const std::vector<Mat*>& output)
+{
+    const size_t rows = (size_t)input[0]->size[0] * input[0]->size[1];
 
-    // std::cout<<"out +="<<std::endl;
-    out += *input[0];
+    // x_norm和down的结果为 [rows, embd_dim]，x1、x3、x1 * x3为 [rows, ffn_dim]
+    return 2 * workspaceBytes(rows * embd_dim) + 3 * workspaceBytes(rows * ffn_dim);
 }
 
 void FeedForwardLayer::finalize(const std::vector<Mat*>& input, std::vector<Mat*>& output)
@@ -136,6 +141,17 @@ void FeedForwardLayer::finalize(const std::vector<Mat*>& input, std::vector<Mat*
 
 }
 
+std::vector<Mat*> FeedForwardLayer::getWeights()
+{
+    std::vector<Mat*> weights = {&norm};
+    for (NumaWeight* w : {&gate, &up, &down})
+    {
+        std::vector<Mat*> ws = w->getWeights();
+        weights.insert(weights.end(), ws.begin(), ws.end());
+    }
+    return weights;
+}
+
 FeedForwardLayer::~FeedForwardLayer()
 {
 
@@ -6,6 +6,7 @@
 #define MINFER_FEED_FORWARD_H
 
 #include "common_layer.h"
+#include "numa.h"
 
 namespace minfer {
 
@@ -23,6 +24,13 @@ public:
 
     void finalize(const std::vector<Mat*>& input, std::vector<Mat*>& output) override;
 
+    // output[0]可以和input[0]共享内存
+    int getInplaceInput() override;
+
+    size_t getWorkspaceSize(const std::vector<Mat*>& input, const std::vector<Mat*>& output) override;
+
+    std::vector<Mat*> getWeights() override;
+
 private:
     FeedForwardLayer(const std::shared_ptr<FeedForwardLayerParams> param);
 
@@ -30,9 +38,9 @@ private:
     int ffn_dim;  // ffn feature length
     float rms_eps;
     Mat norm;
-    Mat gate;
-    Mat up;
-    Mat down;
+    NumaWeight gate;
+    NumaWeight up;
+    NumaWeight down;
     ActivateType activateType;
 };
 
@@ -0,0 +1,89 @@
+//
+// Created by mzh on 2025/3/14.
+//
+
+#include "get_rows_layer.h"
+#include <cstring>
+
+namespace minfer {
+
+void GetRowsLayer::init(const std::vector<Mat *> &input, std::vector<Mat *> &output)
+{
+    LayerContext ctx;
+    init(input, output, ctx);
+}
+
+void GetRowsLayer::init(const std::vector<Mat *> &input, std::vector<Mat *> &output, LayerContext &ctx)
+{
+    M_Assert(input.size() == output.size() && input.size() == 1);
+
+    MatShape in_shape = input[0]->shape();
+    M_Assert(in_shape.size() == 3); // [batch, seq_len, embd_dim]
+
+    const std::vector<int>& rows = ctx.output_rows;
+    for (int i = 0; i < rows.size(); i++)
+    {
+        M_Assert(rows[i] >= 0 && rows[i] < in_shape[1] && "The output row is out of the input sequence!");
+    }
+
+    MatShape out_shape = in_shape;
+    if (!rows.empty())
+        out_shape[1] = rows.size();
+
+    output[0]->setSize(out_shape);
+}
+
+void GetRowsLayer::forward(const std::vector<Mat *> &input, std::vector<Mat *> &output)
+{
+    LayerContext ctx;
+    forward(input, output, ctx);
+}
+
+void GetRowsLayer::forward(const std::vector<Mat *> &input, std::vector<Mat *> &output, LayerContext &ctx)
+{
+    M_Assert(input.size() == output.size() && input.size() == 1);
+
+    const Mat& in = *input[0];
+    Mat& out = *output[0];
+    const int batch = in.size[0];
+    const int seq_len = in.size[1];
+    const std::vector<int>& rows = ctx.output_rows;
+    const int n_rows = rows.empty() ? seq_len : rows.size();
+    M_Assert(out.dims == 3 && out.size[0] == batch && out.size[1] == n_rows);
+
+    const size_t rowSize = in.total(2) * DT_ELEM_SIZE(in.type());
+    for (int b = 0; b < batch; b++)
+    {
+        const uchar* src = in.data + (size_t)b * seq_len * rowSize;
+        uchar* dst = out.data + (size_t)b * n_rows * rowSize;
+        if (rows.empty())
+        {
+            memcpy(dst, src, seq_len * rowSize);
+            continue;
+        }
+
+        for (int i = 0; i < n_rows; i++)
+        {
+            memcpy(dst + i * rowSize, src + (size_t)rows[i] * rowSize, rowSize);
+        }
+    }
+}
+
+GetRowsLayer::~GetRowsLayer()
+{
+
+}
+
+GetRowsLayer::GetRowsLayer(const std::shared_ptr<LayerParams> param)
+{
+    layerNamePrefix = "GetRowsLayer_";
+    M_Assert(param->type == LayerType::GetRows);
+    getBasicInfo(param);
+}
+
+std::shared_ptr<GetRowsLayer> GetRowsLayer::create(const std::shared_ptr<LayerParams> param)
+{
+    return std::shared_ptr<GetRowsLayer>(new GetRowsLayer(param));
+}
+
+}
@@ -0,0 +1,36 @@
+//
+// Created by mzh on 2025/3/14.
+//
+
+#ifndef MINFER_GET_ROWS_LAYER_H
+#define MINFER_GET_ROWS_LAYER_H
+
+#include "common_layer.h"
+
+namespace minfer {
+
+// 从 [batch, seq_len, embd] 中取出ctx.output_rows指定的位置，输出 [batch, n_rows, embd]。
+// 放在output norm之前，prefill时只有需要的位置会计算norm和vocab的投影。
+class GetRowsLayer : public Layer
+{
+public:
+    static std::shared_ptr<GetRowsLayer> create(const std::shared_ptr<LayerParams> param);
+
+    ~GetRowsLayer();
+
+    // 不带上下文时保留所有位置
+    void init(const std::vector<Mat*>& input, std::vector<Mat*>& output) override;
+
+    void init(const std::vector<Mat*>& input, std::vector<Mat*>& output, LayerContext& ctx) override;
+
+    void forward(const std::vector<Mat*>& input, std::vector<Mat*>& output) override;
+
+    void forward(const std::vector<Mat*>& input, std::vector<Mat*>& output, LayerContext& ctx) override;
+
+private:
+    GetRowsLayer(const std::shared_ptr<LayerParams> param);
+};
+
+}
+
+#endif //MINFER_GET_ROWS_LAYER_H
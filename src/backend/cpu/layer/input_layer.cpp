@@ -16,25 +16,26 @@ void InputLayer::init(const std::vector<Mat *> &input, std::vector<Mat *> &outpu
     M_Assert(input.size() == output.size() && input.size() == 1);
     if (input[0]->empty())
         M_Error(Error::Code::StsBadArg, "The input Mat at InputLayer::init is empty! Please set input data before call init()!");
-    // 设置同样的shape
+    // 设置同样的shape和数据类型，token ids的输入是DT_32S
     output[0]->setSize(*input[0]);
+    output[0]->matType = input[0]->type();
 }
 
 void InputLayer::forward(const std::vector<Mat *> &input, std::vector<Mat *> &output)
 {
     M_Assert(input.size() == output.size() && input.size() == 1);
 
-    // (*input[0]).print();
-    if (output[0]->data != input[0]->data || output[0]->empty())
+    // output Mat的内存由Net分配，这里直接拷贝，不再clone新的内存。
+    if (output[0]->data != input[0]->data)
     {
-        // size_t totalSize = input[0]->total() * DT_ELEM_SIZE(input[0]->type());
-        *output[0] = input[0]->clone();
+        M_Assert(output[0]->total() == input[0]->total());
+        size_t totalSize = input[0]->total() * DT_ELEM_SIZE(input[0]->type());
+        memcpy(output[0]->data, input[0]->data, totalSize);
     }
     else
     {
         std::cout<<"WARNING: output[0]->data == input[0]->data at InputLayer::forward"<<std::endl;
     }
-    // (*output[0]).print();
 }
 
 InputLayer::InputLayer(const std::shared_ptr<LayerParams> param)
@@ -12,23 +12,27 @@ LinearLayer::LinearLayer(const std::shared_ptr<LinearLayerParams> param)
     M_Assert(param->type == LayerType::Linear);
     getBasicInfo(param);
 
-    MatShape w_shape = param->w.shape();
+    // 量化的权重反量化之后才是真正的shape
+    Mat wFp32;
+    weightToFloat(param->w, wFp32, param->getQuantType(&param->w));
+
+    MatShape w_shape = wFp32.shape();
     M_Assert(w_shape.size() == 2);
     in_features = param->in_features;
     out_features = param->out_features;
 
-    param->w.convertTo(w, DT_32F);
-
     if (w_shape[0] == out_features && w_shape[1] == in_features)
     {
         // 这种情况是[out_features, in_features]
         transposeW = true;
     }
 
+    w.reset(wFp32, transposeW);
+
     if (!param->b.empty())
     {
         M_Assert(param->b.shape().size() == 1 && param->b.shape()[0] == out_features);
-        param->b.convertTo(b, DT_32F);
+        weightToFloat(param->b, b);
     }
 }
 
@@ -41,9 +45,9 @@ void LinearLayer::init(const std::vector<Mat*> &input, std::vector<Mat*> &output
 {
     M_Assert(input.size() == output.size() && input.size() == 1);
 
-    MatShape in_shape = input[0]->shape();
-    MatShape w_shape = w.shape();
-    MatShape output_shape = get_gemm_shape(in_shape, w_shape);
+    // 最后一维变为out_features，w为[out_features, in_features]时同样适用
+    MatShape output_shape = input[0]->shape();
+    output_shape.back() = out_features;
 
     output[0]->setSize(output_shape);
 }
@@ -59,14 +63,14 @@ void LinearLayer::forward(const std::vector<Mat*> &input, std::vector<Mat*> &out
     Mat out = *output[0];
 
     // check input shape
-    MatShape in_shape = x.shape();
-    M_Assert(in_shape.size() == 3);
-    M_Assert(in_shape[0] == 1 && "Currently, only support single batch!");
-    M_Assert(in_shape[2] == in_features);
+    M_Assert(x.dims == 3);
+    M_Assert(x.size[2] == in_features);
 
-    // gemm: y = alpha * A * B + beta * C
-    Mat out_tmp;
-    gemm(x, w, false, transposeW).copyTo(out);
+    // batch和seq_len合并成行，gemm: [rows, in_features] x w = [rows, out_features]
+    int rows = x.size[0] * x.size[1];
+    Mat x_2d = x.reshape({rows, in_features});
+    Mat out_2d = Mat({rows, out_features}, out.type(), out.data);
+    w.gemm(x_2d).copyTo(out_2d);
 
     // std::cout<<"out"<<std::endl;
     // out.print(10);
@@ -76,6 +80,19 @@ void LinearLayer::forward(const std::vector<Mat*> &input, std::vector<Mat*> &out
     // out_tmp.copyTo(out);
 }
 
+size_t LinearLayer::getWorkspaceSize(const std::vector<Mat*>& input, const std::vector<Mat*>& output)
+{
+    // gemm的结果 [rows, out_features]
+    return workspaceBytes(output[0]->total());
+}
+
+std::vector<Mat*> LinearLayer::getWeights()
+{
+    std::vector<Mat*> weights = w.getWeights();
+    weights.push_back(&b);
+    return weights;
+}
+
 std::shared_ptr<LinearLayer> LinearLayer::create(const std::shared_ptr<LayerParams> param)
 {
     std::shared_ptr<LinearLayerParams> l_param = std::dynamic_pointer_cast<LinearLayerParams>(param);
@@ -18,15 +18,17 @@ void OutputLayer::forward(const std::vector<Mat *> &input, std::vector<Mat *> &o
 {
     M_Assert(input.size() == output.size() && input.size() == 1);
 
+    // 和输入共享内存时不需要拷贝
     if (output[0]->data != input[0]->data)
     {
         size_t totalSize = input[0]->total() * DT_ELEM_SIZE(input[0]->type());
         memcpy(output[0]->data, input[0]->data, totalSize);
     }
-    else
-    {
-        std::cout<<"WARNING: output[0]->data == input[0]->data at OutputLayer::forward"<<std::endl;
-    }
+}
+
+int OutputLayer::getInplaceInput()
+{
+    return 0;
 }
 
 OutputLayer::~OutputLayer()
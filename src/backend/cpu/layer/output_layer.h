@@ -21,6 +21,9 @@ public:
 
     void forward(const std::vector<Mat*>& input, std::vector<Mat*>& output) override;
 
+    // output[0]可以和input[0]共享内存
+    int getInplaceInput() override;
+
 private:
     OutputLayer(const std::shared_ptr<LayerParams> param);
 };
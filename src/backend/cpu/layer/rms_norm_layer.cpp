@@ -45,17 +45,17 @@ void RMSNormLayer::forward(const std::vector<Mat*> &input, std::vector<Mat*> &ou
 
     M_Assert(input[0]->type() == output[0]->type());
 
-    MatShape in_shape = input[0]->shape();
-
-    M_Assert(in_shape.size() == 3);
-    M_Assert(in_shape[2] == embd_dim);
-    M_Assert(in_shape[0] == 1 && "Currently, only support single batch!");
+    // forward中直接读取size，不构造MatShape
+    const Mat& in = *input[0];
+    M_Assert(in.dims == 3);
+    M_Assert(in.size[2] == embd_dim);
 
     float* p = (float *)output[0]->data;
     float* pi = (float *)(input[0]->data);
     float * p_norm = (float *)w.data;
 
-    int seq_len = in_shape[1];
+    // 每个token单独做norm，batch和seq_len可以合并
+    int seq_len = in.size[0] * in.size[1];
 
     // rms-norm
     for (int i = 0; i < seq_len; i++)
@@ -78,6 +78,17 @@ void RMSNormLayer::forward(const std::vector<Mat*> &input, std::vector<Mat*> &ou
     }
 }
 
+int RMSNormLayer::getInplaceInput()
+{
+    // 每一行先读完再写，可以in-place
+    return 0;
+}
+
+std::vector<Mat*> RMSNormLayer::getWeights()
+{
+    return {&w};
+}
+
 std::shared_ptr<RMSNormLayer> RMSNormLayer::create(const std::shared_ptr<LayerParams> param)
 {
     std::shared_ptr<RMSNormLayerParams> r_param = std::dynamic_pointer_cast<RMSNormLayerParams>(param);
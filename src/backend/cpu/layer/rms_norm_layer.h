@@ -22,6 +22,11 @@ public:
     // and the forward can be run several times
     void forward(const std::vector<Mat*>& input, std::vector<Mat*>& output) override;
 
+    // output[0]可以和input[0]共享内存
+    int getInplaceInput() override;
+
+    std::vector<Mat*> getWeights() override;
+
 private:
     int embd_dim;
     float rms_eps;
@@ -12,7 +12,8 @@ namespace minfer
 class DefaultAllocatorImpl : public Allocator::AllocatorImpl
 {
 public:
-    DefaultAllocatorImpl()
+    explicit DefaultAllocatorImpl(int _memClass)
+    : memClass(_memClass)
     {
         // Do nothing
     }
@@ -25,7 +26,7 @@ public:
     virtual std::pair<void*, size_t> alloc(size_t size, size_t align)
     {
         size_t newSize = UP_DIV(size, align) * align; // 返回对齐之后的内存。
-        return std::make_pair(MMemoryAllocAlign(size, align), newSize);
+        return std::make_pair(MMemoryAllocClass(size, memClass, align), newSize);
     }
 
     virtual void release(std::pair<void*, size_t> ptr)
@@ -33,11 +34,14 @@ public:
         M_Assert(ptr.second == 0);
         MMemoryFreeAlign(ptr.first);
     }
+
+private:
+    int memClass;
 };
 
-std::shared_ptr<Allocator::AllocatorImpl> Allocator::AllocatorImpl::createDefault() {
+std::shared_ptr<Allocator::AllocatorImpl> Allocator::AllocatorImpl::createDefault(int memClass) {
     std::shared_ptr<Allocator::AllocatorImpl> _res;
-    _res.reset(new DefaultAllocatorImpl);
+    _res.reset(new DefaultAllocatorImpl(memClass));
     return _res;
 }
 
@@ -32,7 +32,8 @@ public:
         virtual ~ AllocatorImpl() = default;
         virtual std::pair<void*, size_t> alloc(size_t size, size_t align) = 0;
         virtual void release(std::pair<void*, size_t> ptr) = 0;
-        static std::shared_ptr<AllocatorImpl> createDefault();
+        // memClass见MemoryClass，对应的类别打开大页时，大块内存使用大页
+        static std::shared_ptr<AllocatorImpl> createDefault(int memClass = MEMORY_CLASS_DEFAULT);
     };
 
     Allocator(std::shared_ptr<AllocatorImpl> impl, size_t align = M_MEMORY_ALIGN_DEFAULT) : allocImpl(impl), mAlign(align)
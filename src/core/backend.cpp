@@ -36,17 +36,22 @@ void Backend::LayerFactory::registerLayer(LayerType type, Backend::LayerFactory:
 
 std::shared_ptr<Layer> Backend::LayerFactory::createLayerInstance(std::shared_ptr<LayerParams> param)
 {
-    AutoLock lk(mutex);
+    Constructor constructor = nullptr;
+    {
+        AutoLock lk(mutex);
 
-    LayerFactoryMap::iterator it = layerMap.find(param->type);
+        LayerFactoryMap::iterator it = layerMap.find(param->type);
 
-    if (it == layerMap.end())
-    {
-        M_Error_(NULL, ("createLayerInstance failed! Layer type %d was not registered!", (int)param->type));
-        return std::shared_ptr<Layer>();
+        if (it == layerMap.end())
+        {
+            M_Error_(NULL, ("createLayerInstance failed! Layer type %d was not registered!", (int)param->type));
+            return std::shared_ptr<Layer>();
+        }
+        constructor = it->second;
     }
 
-    return it->second(param);
+    // 构造layer时会转换权重，比较耗时，不持有锁，多个线程可以同时创建layer
+    return constructor(param);
 }
 
 bool Backend::LayerFactory::checkLayerSupported(std::shared_ptr<LayerParams> param)
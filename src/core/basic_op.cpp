@@ -440,17 +440,18 @@ void reshape(const Mat& input, const std::vector<int>& shape, Mat& out)
 \****************************************************************************************/
 
 // Helper contains all information used in binary BinaryOp.
+// shape和step都是固定大小的数组，layer forward中的add、multiply不会分配内存。
 class BinaryOpHelper
 {
 public:
     int max_dims;
-    MatShape inp0_shape_align;   // contains new shape of input 0
-    MatShape inp1_shape_align;
-    MatShape out_shape;
+    int inp0_shape_align[MAT_MAX_DIM];   // contains new shape of input 0
+    int inp1_shape_align[MAT_MAX_DIM];
+    int out_shape[MAT_MAX_DIM];
 
-    MatShape inp0_steps; // steps store all dimension jumping numbers of pointer.
-    MatShape inp1_steps;
-    MatShape out_steps;
+    int inp0_steps[MAT_MAX_DIM]; // steps store all dimension jumping numbers of pointer.
+    int inp1_steps[MAT_MAX_DIM];
+    int out_steps[MAT_MAX_DIM];
 
     /* Reorganize mat for [block_num x block_size] based on out_shape.
      * For example: out shape is [a x b x c], the [a x b] is block_num, and c is inner block_size
@@ -464,18 +465,19 @@ public:
     {
         M_Assert(a.type() == b.type() && "Input data type is different!");
 
-        MatShape shape0 = a.shape();
-        MatShape shape1 = b.shape();
+        int dim_0 = a.dims;
+        int dim_1 = b.dims;
 
-        int dim_0 = shape0.size();
-        int dim_1 = shape1.size();
-
-        max_dims = std::max(shape0.size(), shape1.size());
+        max_dims = std::max(dim_0, dim_1);
+        M_Assert(max_dims > 0 && max_dims <= MAT_MAX_DIM);
 
         // broadcasting the shape
-        inp0_shape_align.resize(max_dims, 1);
-        inp1_shape_align.resize(max_dims, 1);
-        out_shape.resize(max_dims, 1);
+        for (int i = 0; i < max_dims; i++)
+        {
+            inp0_shape_align[i] = 1;
+            inp1_shape_align[i] = 1;
+            out_shape[i] = 1;
+        }
 
         int idx_0 = dim_0 - 1;
         int idx_1 = dim_1 - 1;
@@ -483,20 +485,22 @@ public:
 
         while (idx >= 0)
         {
-            if (shape0[idx_0] == shape1[idx_1])
+            const int s0 = idx_0 >= 0 ? a.size[idx_0] : 1;
+            const int s1 = idx_1 >= 0 ? b.size[idx_1] : 1;
+            if (s0 == s1)
             {
-                out_shape[idx] = shape0[idx_0];
-                inp0_shape_align[idx] = shape0[idx_0];
-                inp1_shape_align[idx] = shape0[idx_0];
+                out_shape[idx] = s0;
+                inp0_shape_align[idx] = s0;
+                inp1_shape_align[idx] = s0;
             }
-            else if (idx_0 < 0 || shape0[idx_0] == 1)
+            else if (s0 == 1)
             {
-                out_shape[idx] = idx_1 >= 0 ? shape1[idx_1] : 1;
+                out_shape[idx] = s1;
                 inp1_shape_align[idx] = out_shape[idx];
             }
-            else if (idx_1 < 0 || shape1[idx_1] == 1)
+            else if (s1 == 1)
             {
-                out_shape[idx] = idx_0 >= 0 ? shape0[idx_0] : 1;
+                out_shape[idx] = s0;
                 inp0_shape_align[idx] = out_shape[idx];
             }
             else
@@ -513,16 +517,15 @@ public:
         }
 
         // set dim steps
-        auto get_step_func = [](const MatShape& i_s, MatShape& o_s) {
-            o_s.resize(i_s.size(), 1);
-            o_s[i_s.size() - 1] = 1;
-            for (int i = o_s.size() - 2; i >= 0; i--)
+        auto get_step_func = [](const int* i_s, int* o_s, int n) {
+            o_s[n - 1] = 1;
+            for (int i = n - 2; i >= 0; i--)
             {
-                o_s[i] *= i_s[i+1] * o_s[i+1];
+                o_s[i] = i_s[i+1] * o_s[i+1];
             }
 
             // from the first dim to the last dim, if pre shape is 1, then step is 0.
-            for (int i = 0; i < i_s.size(); i++)
+            for (int i = 0; i < n; i++)
             {
                 if (i_s[i] == 1)
                     o_s[i] = 0;
@@ -531,11 +534,15 @@ public:
             }
         };
 
-        get_step_func(inp0_shape_align, inp0_steps);
-        get_step_func(inp1_shape_align, inp1_steps);
-        get_step_func(out_shape, out_steps);
+        get_step_func(inp0_shape_align, inp0_steps, max_dims);
+        get_step_func(inp1_shape_align, inp1_steps, max_dims);
+        get_step_func(out_shape, out_steps, max_dims);
 
-        block_num = total(out_shape, 0, max_dims - 1);
+        block_num = 1;
+        for (int i = 0; i < max_dims - 1; i++)
+        {
+            block_num *= out_shape[i];
+        }
         block_size = out_shape[max_dims - 1];
         isInit = true; // set isInit as true.
     }
@@ -548,11 +555,8 @@ void binary_forward(const Func& op, const BinaryOpHelper& helper,  const uchar*
     M_Assert(helper.isInit && "BinaryOp has not been inited!");
 
     int max_dims = helper.max_dims;
-    int block_size = helper.out_shape[helper.max_dims - 1];
-    size_t total_num = total(helper.out_shape);
-    int block_num = total_num / block_size;
-
-    M_Assert(total_num % block_size == 0);
+    int block_size = helper.block_size;
+    int block_num = helper.block_num;
     const int esz = sizeof(T); // element size
 
     const int inner_0 = helper.inp0_shape_align[max_dims - 1] == 1 ? 0 : 1;
@@ -727,12 +731,16 @@ void binaryFunc(BinaryOp op, const Mat& a, const Mat& b, Mat& c)
 
     if (c.empty())
     {
-        c = Mat(helper.out_shape, a.type());
+        c = Mat(helper.max_dims, helper.out_shape, a.type());
         typeDispatch(a.type(), op, helper, a.data, b.data, c.data);
     }
     else
     {
-        M_Assert(c.shape() == helper.out_shape);
+        M_Assert(c.dims == helper.max_dims);
+        for (int i = 0; i < c.dims; i++)
+        {
+            M_Assert(c.size[i] == helper.out_shape[i]);
+        }
         typeDispatch(a.type(), op, helper, a.data, b.data, c.data);
     }
 }
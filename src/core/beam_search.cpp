@@ -0,0 +1,196 @@
+//
+// Created by mzh on 2025/3/10.
+//
+
+#include "session.impl.h"
+#include "sampler.h"
+
+#include <algorithm>
+#include <cfloat>
+#include <cmath>
+#include <cstring>
+
+namespace minfer
+{
+
+namespace
+{
+
+struct Beam
+{
+    std::vector<int> tokens;
+    float sum_logprob = 0.f;
+    KVCache cache;          // 和其他beam共享前缀的page
+};
+
+struct Candidate
+{
+    float sum_logprob;
+    int beam;
+    int token;
+};
+
+inline float length_normalize(float sum_logprob, int len, float length_penalty)
+{
+    return sum_logprob / powf((float)std::max(len, 1), length_penalty);
+}
+
+}
+
+void Session::SessionImpl::beamSearch(const std::vector<int>& prompt_ids, const BeamSearchParams& params,
+                                      std::vector<BeamHypothesis>& out)
+{
+    M_Assert(!prompt_ids.empty() && "The prompt of beam search can not be empty!");
+    M_Assert(params.beam_size > 0 && params.max_new_tokens > 0);
+
+    const int beam_size = params.beam_size;
+    out.clear();
+
+    // 只需要最后一个位置的logits，结束或者抛出异常时恢复用户的设置
+    OutputGuard guard(*this);
+    setOutputPositions({-1});
+
+    // step0: prefill prompt，只计算一次，最后一个位置的logits作为第一步的输入
+    Mat prompt = Mat({1, (int)prompt_ids.size()}, DT_32S);
+    memcpy(prompt.data, prompt_ids.data(), prompt_ids.size() * sizeof(int));
+    setInput(prompt, -1);
+    Mat logits = forward();
+    M_Assert(logits.dims == 3 && logits.type() == DT_32F);
+
+    const int n_vocab = logits.size[2];
+    const float* p_logits = (const float *)logits.data + (size_t)(logits.size[1] - 1) * n_vocab;
+
+    std::vector<Beam> beams(1);
+    beams[0].cache = kvCache.fork();
+
+    std::vector<Candidate> heap;
+    std::vector<Candidate> candidates;
+    std::vector<BeamHypothesis> finished;
+
+    // 堆顶是保留的token中logit最小的
+    auto greater = [](const Candidate& a, const Candidate& b) { return a.sum_logprob > b.sum_logprob; };
+    const int k = std::min(n_vocab, 2 * beam_size);
+
+    for (int step = 0; step < params.max_new_tokens; step++)
+    {
+        // step1: 每个beam只保留logit最大的 2 * beam_size 个token，合并后保留得分最高的 2 * beam_size 个，
+        // 这样即使其中一半是eos，也能补满beam_size个存活的beam。
+        // log_softmax不改变一行内的顺序，只需要对保留的token计算 logits[t] - lse。
+        const int live = beams.size();
+        candidates.clear();
+        for (int b = 0; b < live; b++)
+        {
+            const float* row = p_logits + (size_t)b * n_vocab;
+            const float lse = Sampler::logSumExp(row, n_vocab);
+
+            heap.resize(k);
+            for (int t = 0; t < k; t++)
+            {
+                heap[t] = {row[t], b, t};
+            }
+            std::make_heap(heap.begin(), heap.end(), greater);
+
+            float th = heap.front().sum_logprob;
+            for (int t = k; t < n_vocab; t++)
+            {
+                if (row[t] <= th)
+                    continue;
+
+                std::pop_heap(heap.begin(), heap.end(), greater);
+                heap.back() = {row[t], b, t};
+                std::push_heap(heap.begin(), heap.end(), greater);
+                th = heap.front().sum_logprob;
+            }
+
+            for (auto& c : heap)
+            {
+                c.sum_logprob = beams[b].sum_logprob + (c.sum_logprob - lse);
+                candidates.push_back(c);
+            }
+        }
+
+        int top_k = std::min((int)candidates.size(), 2 * beam_size);
+        std::partial_sort(candidates.begin(), candidates.begin() + top_k, candidates.end(), greater);
+
+        // step2: 按得分依次选择，eos进入结果列表，其余的成为下一步的beam。
+        // 新的beam复制父beam的kv cache，只拷贝page指针，写入下一个token时只会拷贝最后一个共享的page。
+        std::vector<Beam> next_beams;
+        for (int i = 0; i < top_k && next_beams.size() < beam_size; i++)
+        {
+            const Candidate& c = candidates[i];
+            const Beam& parent = beams[c.beam];
+
+            if (c.token == params.eos_id)
+            {
+                // 排在beam_size之后的eos不会比存活的beam更好
+                if (i >= beam_size)
+                    continue;
+
+                BeamHypothesis h;
+                h.tokens = parent.tokens;
+                h.tokens.push_back(c.token);
+                h.sum_logprob = c.sum_logprob;
+                h.score = length_normalize(h.sum_logprob, h.tokens.size(), params.length_penalty);
+                finished.push_back(h);
+                continue;
+            }
+
+            Beam nb;
+            nb.tokens = parent.tokens;
+            nb.tokens.push_back(c.token);
+            nb.sum_logprob = c.sum_logprob;
+            nb.cache = parent.cache;
+            next_beams.push_back(std::move(nb));
+        }
+        beams = std::move(next_beams);
+
+        if (beams.empty() || step + 1 == params.max_new_tokens)
+            break;
+
+        // step3: 已经有beam_size个结果，并且存活的beam中最好的得分不会超过最差的结果时，提前结束。
+        if (finished.size() >= beam_size)
+        {
+            float worst = FLT_MAX;
+            for (const auto& h : finished)
+            {
+                worst = std::min(worst, h.score);
+            }
+
+            float best_live = length_normalize(beams[0].sum_logprob, beams[0].tokens.size(), params.length_penalty);
+            if (best_live <= worst)
+                break;
+        }
+
+        // step4: 所有beam的最后一个token作为一个batch推理，shape为 [live, 1]
+        Mat batch_input = Mat({(int)beams.size(), 1}, DT_32S);
+        std::vector<KVCache*> caches(beams.size());
+        for (int b = 0; b < beams.size(); b++)
+        {
+            ((int *)batch_input.data)[b] = beams[b].tokens.back();
+            caches[b] = &beams[b].cache;
+        }
+        setInput(batch_input, -1);
+
+        logits = forwardBatch(caches);
+        p_logits = (const float *)logits.data;
+    }
+
+    // 没有结束的beam也作为结果
+    for (const auto& b : beams)
+    {
+        BeamHypothesis h;
+        h.tokens = b.tokens;
+        h.sum_logprob = b.sum_logprob;
+        h.score = length_normalize(h.sum_logprob, h.tokens.size(), params.length_penalty);
+        finished.push_back(h);
+    }
+
+    std::stable_sort(finished.begin(), finished.end(),
+                     [](const BeamHypothesis& a, const BeamHypothesis& b) { return a.score > b.score; });
+    if (finished.size() > beam_size)
+        finished.resize(beam_size);
+
+    out = finished;
+}
+
+}
@@ -0,0 +1,125 @@
+//
+// Created by mzh on 2025/3/13.
+//
+
+#include "session.impl.h"
+
+#include <algorithm>
+#include <cmath>
+#include <cstring>
+#include <map>
+
+namespace minfer
+{
+
+namespace
+{
+
+// 对 [seq_len, n_embd] 的hidden state做pooling，结果写入dst
+void pool_hidden(const float* hidden, int seqLen, int n_embd, PoolingType pooling, float* dst)
+{
+    if (pooling == POOLING_MEAN)
+    {
+        memset(dst, 0, n_embd * sizeof(float));
+        for (int i = 0; i < seqLen; i++)
+        {
+            const float* h = hidden + (size_t)i * n_embd;
+            for (int j = 0; j < n_embd; j++)
+                dst[j] += h[j];
+        }
+
+        const float scale = 1.f / seqLen;
+        for (int j = 0; j < n_embd; j++)
+            dst[j] *= scale;
+    }
+    else
+    {
+        int row = pooling == POOLING_LAST ? seqLen - 1 : 0;
+        memcpy(dst, hidden + (size_t)row * n_embd, n_embd * sizeof(float));
+    }
+}
+
+void l2_normalize(float* x, int n)
+{
+    float sum = 0.f;
+    for (int i = 0; i < n; i++)
+        sum += x[i] * x[i];
+
+    const float scale = 1.f / std::max(sqrtf(sum), 1e-12f);
+    for (int i = 0; i < n; i++)
+        x[i] *= scale;
+}
+
+}
+
+void Session::SessionImpl::embed(const std::vector<std::vector<int> >& texts, const EmbeddingParams& params, Mat& out)
+{
+    M_Assert(!texts.empty());
+    M_Assert(hiddenLayer >= 0 && "Can not find the output norm before the vocab projection of Net!");
+    M_Assert(params.pooling == POOLING_MEAN || params.pooling == POOLING_LAST || params.pooling == POOLING_CLS);
+
+    // 只运行到output norm，GetRows层只保留pooling需要的位置，结束或者抛出异常时恢复用户的设置
+    OutputGuard guard(*this);
+    if (params.pooling == POOLING_MEAN)
+        setOutputPositions({});
+    else
+        setOutputPositions({params.pooling == POOLING_LAST ? -1 : 0});
+    setLastLayer(hiddenLayer);
+
+    // 长度相同的文本放在一个batch中，不需要padding和attention mask
+    std::map<int, std::vector<int> > lenToTexts;
+    for (int i = 0; i < texts.size(); i++)
+    {
+        M_Assert(!texts[i].empty() && "The text of embedding can not be empty!");
+        lenToTexts[texts[i].size()].push_back(i);
+    }
+
+    int n_embd = 0;
+    for (const auto& group : lenToTexts)
+    {
+        const int seqLen = group.first;
+        const std::vector<int>& ids = group.second;
+        const int maxBatch = params.batch_size > 0 ? params.batch_size : (int)ids.size();
+
+        for (int begin = 0; begin < ids.size(); begin += maxBatch)
+        {
+            const int batch = std::min(maxBatch, (int)ids.size() - begin);
+
+            Mat input = Mat({batch, seqLen}, DT_32S);
+            for (int b = 0; b < batch; b++)
+            {
+                memcpy((int *)input.data + (size_t)b * seqLen, texts[ids[begin + b]].data(), seqLen * sizeof(int));
+            }
+            setInput(input, -1);
+
+            // 每个文本使用自己的临时kv cache，从位置0开始
+            std::vector<KVCache> caches(batch);
+            std::vector<KVCache*> cachePtrs(batch);
+            for (int b = 0; b < batch; b++)
+                cachePtrs[b] = &caches[b];
+
+            Mat hidden = forwardBatch(cachePtrs);
+            M_Assert(hidden.dims == 3 && hidden.size[0] == batch && hidden.type() == DT_32F);
+
+            if (n_embd == 0)
+            {
+                n_embd = hidden.size[2];
+                out = Mat({(int)texts.size(), n_embd}, DT_32F);
+            }
+
+            const int rowNum = hidden.size[1];
+            for (int b = 0; b < batch; b++)
+            {
+                const float* h = (const float *)hidden.data + (size_t)b * rowNum * n_embd;
+                float* dst = (float *)out.data + (size_t)ids[begin + b] * n_embd;
+
+                // GetRows层只保留一个位置时rowNum为1，POOLING_LAST和POOLING_CLS都取第0行
+                pool_hidden(h, rowNum, n_embd, params.pooling, dst);
+                if (params.normalize)
+                    l2_normalize(dst, n_embd);
+            }
+        }
+    }
+}
+
+}
@@ -8,11 +8,240 @@
 #include <float.h>
 #include <stdlib.h>
 #include <stdio.h>
+#include <algorithm>
+#include <atomic>
 
 #include "ggml_quant.h"
 
 namespace minfer
 {
 
-} // namespace minfer
+static inline float half_to_fp32(ggml_half v)
+{
+    hfloat h;
+    memcpy(h.get_ptr(), &v, sizeof(v));
+    return (float)h;
+}
+
+static inline ggml_half fp32_to_half(float f)
+{
+    hfloat h(f);
+    ggml_half v;
+    memcpy(&v, h.get_ptr(), sizeof(v));
+    return v;
+}
+
+// <<<<<<<<<<<<<<<<<<<<<<<<<<<<<<<<< Quantize >>>>>>>>>>>>>>>>>>>>>>>>>>>>>>>>>>>>>>
+void quantize_row_q4_0(const float* x, block_q4_0* y, int64_t k)
+{
+    static const int qk = QK4_0;
+    M_Assert(k % qk == 0);
+    const int64_t nb = k / qk;
+
+    for (int64_t i = 0; i < nb; i++)
+    {
+        float amax = 0.0f; // absolute max
+        float max  = 0.0f;
+
+        for (int j = 0; j < qk; j++)
+        {
+            const float v = x[i*qk + j];
+            if (amax < fabsf(v))
+            {
+                amax = fabsf(v);
+                max  = v;
+            }
+        }
+
+        const float d  = max / -8;
+        const float id = d ? 1.0f/d : 0.0f;
+
+        y[i].d = fp32_to_half(d);
+
+        for (int j = 0; j < qk/2; ++j)
+        {
+            const float x0 = x[i*qk + 0    + j]*id;
+            const float x1 = x[i*qk + qk/2 + j]*id;
+
+            const uint8_t xi0 = std::min((int8_t)15, (int8_t)(x0 + 8.5f));
+            const uint8_t xi1 = std::min((int8_t)15, (int8_t)(x1 + 8.5f));
+
+            y[i].qs[j]  = xi0;
+            y[i].qs[j] |= xi1 << 4;
+        }
+    }
+}
+
+void quantize_row_q4_1(const float* x, block_q4_1* y, int64_t k)
+{
+    const int qk = QK4_1;
+    M_Assert(k % qk == 0);
+    const int64_t nb = k / qk;
+
+    for (int64_t i = 0; i < nb; i++)
+    {
+        float min = FLT_MAX;
+        float max = -FLT_MAX;
+
+        for (int j = 0; j < qk; j++)
+        {
+            const float v = x[i*qk + j];
+            if (v < min) min = v;
+            if (v > max) max = v;
+        }
+
+        const float d  = (max - min) / ((1 << 4) - 1);
+        const float id = d ? 1.0f/d : 0.0f;
+
+        y[i].GGML_COMMON_AGGR.d = fp32_to_half(d);
+        y[i].GGML_COMMON_AGGR.m = fp32_to_half(min);
+
+        for (int j = 0; j < qk/2; ++j)
+        {
+            const float x0 = (x[i*qk + 0    + j] - min)*id;
+            const float x1 = (x[i*qk + qk/2 + j] - min)*id;
+
+            const uint8_t xi0 = std::min((int8_t)15, (int8_t)(x0 + 0.5f));
+            const uint8_t xi1 = std::min((int8_t)15, (int8_t)(x1 + 0.5f));
+
+            y[i].qs[j]  = xi0;
+            y[i].qs[j] |= xi1 << 4;
+        }
+    }
+}
+
+void quantize_row_q8_0(const float* x, block_q8_0* y, int64_t k)
+{
+    M_Assert(k % QK8_0 == 0);
+    const int64_t nb = k / QK8_0;
+
+    for (int64_t i = 0; i < nb; i++)
+    {
+        float amax = 0.0f; // absolute max
+
+        for (int j = 0; j < QK8_0; j++)
+        {
+            const float v = x[i*QK8_0 + j];
+            amax = std::max(amax, fabsf(v));
+        }
 
+        const float d = amax / ((1 << 7) - 1);
+        const float id = d ? 1.0f/d : 0.0f;
+
+        y[i].d = fp32_to_half(d);
+
+        for (int j = 0; j < QK8_0; ++j)
+        {
+            const float x0 = x[i*QK8_0 + j]*id;
+
+            y[i].qs[j] = roundf(x0);
+        }
+    }
+}
+
+// <<<<<<<<<<<<<<<<<<<<<<<<<<<<<<<<< De-quantize >>>>>>>>>>>>>>>>>>>>>>>>>>>>>>>>>>>>>>
+void dequantize_row_q4_0(const block_q4_0* x, float* y, int64_t k)
+{
+    static const int qk = QK4_0;
+    M_Assert(k % qk == 0);
+    const int64_t nb = k / qk;
+
+    for (int64_t i = 0; i < nb; i++)
+    {
+        const float d = half_to_fp32(x[i].d);
+
+        for (int j = 0; j < qk/2; ++j)
+        {
+            const int x0 = (x[i].qs[j] & 0x0F) - 8;
+            const int x1 = (x[i].qs[j] >>   4) - 8;
+
+            y[i*qk + j + 0   ] = x0*d;
+            y[i*qk + j + qk/2] = x1*d;
+        }
+    }
+}
+
+void dequantize_row_q4_1(const block_q4_1* x, float* y, int64_t k)
+{
+    static const int qk = QK4_1;
+    M_Assert(k % qk == 0);
+    const int64_t nb = k / qk;
+
+    for (int64_t i = 0; i < nb; i++)
+    {
+        const float d = half_to_fp32(x[i].GGML_COMMON_AGGR.d);
+        const float m = half_to_fp32(x[i].GGML_COMMON_AGGR.m);
+
+        for (int j = 0; j < qk/2; ++j)
+        {
+            const int x0 = (x[i].qs[j] & 0x0F);
+            const int x1 = (x[i].qs[j] >>   4);
+
+            y[i*qk + j + 0   ] = x0*d + m;
+            y[i*qk + j + qk/2] = x1*d + m;
+        }
+    }
+}
+
+void dequantize_row_q8_0(const block_q8_0* x, float* y, int64_t k)
+{
+    static const int qk = QK8_0;
+    M_Assert(k % qk == 0);
+    const int64_t nb = k / qk;
+
+    for (int64_t i = 0; i < nb; i++)
+    {
+        const float d = half_to_fp32(x[i].d);
+
+        for (int j = 0; j < qk; ++j)
+        {
+            y[i*qk + j] = x[i].qs[j]*d;
+        }
+    }
+}
+
+void quantize_row(GGML_TYPE type, const float* x, void* y, int64_t k)
+{
+    switch (type)
+    {
+        case GGML_TYPE_Q4_0:
+            quantize_row_q4_0(x, (block_q4_0 *)y, k);
+            break;
+        case GGML_TYPE_Q4_1:
+            quantize_row_q4_1(x, (block_q4_1 *)y, k);
+            break;
+        case GGML_TYPE_Q8_0:
+            quantize_row_q8_0(x, (block_q8_0 *)y, k);
+            break;
+        default:
+            M_Error_(Error::Code::StsNotImplemented, ("Unsupported quantized type = %d!", (int)type));
+    }
+}
+
+static std::atomic<size_t> g_dequantizedCount(0);
+
+void dequantize_row(GGML_TYPE type, const void* x, float* y, int64_t k)
+{
+    g_dequantizedCount += k;
+    switch (type)
+    {
+        case GGML_TYPE_Q4_0:
+            dequantize_row_q4_0((const block_q4_0 *)x, y, k);
+            break;
+        case GGML_TYPE_Q4_1:
+            dequantize_row_q4_1((const block_q4_1 *)x, y, k);
+            break;
+        case GGML_TYPE_Q8_0:
+            dequantize_row_q8_0((const block_q8_0 *)x, y, k);
+            break;
+        default:
+            M_Error_(Error::Code::StsNotImplemented, ("Unsupported quantized type = %d!", (int)type));
+    }
+}
+
+size_t getDequantizedCount()
+{
+    return g_dequantizedCount.load();
+}
+
+} // namespace minfer
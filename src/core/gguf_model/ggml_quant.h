@@ -27,6 +27,9 @@ typedef uint32_t ggml_half2;
 
 typedef uint16_t ggml_fp16_t;
 
+// 和ggml的C++版本一致，给union中的匿名struct命名
+#define GGML_COMMON_AGGR data
+
 // Currently, we only support partial llama.cpp quantized data type.
 
 // <<<<<<<<<<<<<<<<<<<<<<<<<<<<<<<<< Define different quantized type >>>>>>>>>>>>>>>>>>>>>>>>>>>>>>>>>>>>>>
@@ -134,19 +137,19 @@ static const ggml_type_traits_t typeTraits[GGML_TYPE_COUNT] = {
     // GGML_TYPE_F16 = 1
     {"f16", 1, sizeof(ggml_fp16_t), false, GGML_TYPE_F16, 1, true},
     // GGML_TYPE_Q4_0 = 2
-    // {"q4_0", QK4_0, sizeof(block_q4_0), true, GGML_TYPE_Q4_0, 1, false},
-    // // GGML_TYPE_Q4_1 = 3
-    // {"q4_1", QK4_1, sizeof(block_q4_1), true, GGML_TYPE_Q4_1, 1, false},
-    // // GGML_TYPE_Q4_2 = 4 (deprecated)
-    // {"DEPRECATED", 0, 0, false, GGML_TYPE_F32, 1, false},
-    // // GGML_TYPE_Q4_3 = 5 (deprecated)
-    // {"DEPRECATED", 0, 0, false, GGML_TYPE_F32, 1, false},
-    // // GGML_TYPE_Q5_0 = 6
-    // {"q5_0", QK5_0, sizeof(block_q8_0), true, GGML_TYPE_Q8_0, 1, false},
-    // // GGML_TYPE_Q5_1 = 7
-    // {"q5_1", QK5_1, sizeof(block_q5_1), true, GGML_TYPE_Q8_1, 1, false},
-    // // GGML_TYPE_Q8_0 = 8
-    {"q8_0", QK8_0, sizeof(block_q8_0), true, GGML_TYPE_Q8_0, 1, false},
+    {"q4_0", QK4_0, sizeof(block_q4_0), true, GGML_TYPE_Q8_0, 1, true},
+    // GGML_TYPE_Q4_1 = 3
+    {"q4_1", QK4_1, sizeof(block_q4_1), true, GGML_TYPE_Q8_0, 1, true},
+    // GGML_TYPE_Q4_2 = 4 (deprecated)
+    {"DEPRECATED", 1, 0, false, GGML_TYPE_F32, 1, false},
+    // GGML_TYPE_Q4_3 = 5 (deprecated)
+    {"DEPRECATED", 1, 0, false, GGML_TYPE_F32, 1, false},
+    // GGML_TYPE_Q5_0 = 6
+    {"q5_0", QK5_0, sizeof(block_q5_0), true, GGML_TYPE_Q8_0, 1, false},
+    // GGML_TYPE_Q5_1 = 7
+    {"q5_1", QK5_1, sizeof(block_q5_1), true, GGML_TYPE_Q8_0, 1, false},
+    // GGML_TYPE_Q8_0 = 8
+    {"q8_0", QK8_0, sizeof(block_q8_0), true, GGML_TYPE_Q8_0, 1, true},
     // // GGML_TYPE_Q8_1 = 9
     // {"q8_1", QK8_1, sizeof(block_q8_1), true, GGML_TYPE_Q8_1, 1, false},
     // // GGML_TYPE_Q2_K = 10
@@ -194,6 +197,21 @@ static const ggml_type_traits_t typeTraits[GGML_TYPE_COUNT] = {
 // <<<<<<<<<<<<<<<<<<<<<<<<<<<<<<<<< Common function  >>>>>>>>>>>>>>>>>>>>>>>>>>>>>>>>>>>>>>
 
 // <<<<<<<<<<<<<<<<<<<<<<<<<<<<<<<<< Define quantized and de-quantized func  >>>>>>>>>>>>>>>>>>>>>>>>>>>>>>>>>>>>>>
+// k是元素个数，必须是block大小的整数倍，和llama.cpp中的参考实现结果一致。
+void quantize_row_q4_0(const float* x, block_q4_0* y, int64_t k);
+void quantize_row_q4_1(const float* x, block_q4_1* y, int64_t k);
+void quantize_row_q8_0(const float* x, block_q8_0* y, int64_t k);
+
+void dequantize_row_q4_0(const block_q4_0* x, float* y, int64_t k);
+void dequantize_row_q4_1(const block_q4_1* x, float* y, int64_t k);
+void dequantize_row_q8_0(const block_q8_0* x, float* y, int64_t k);
+
+// 按照type量化/反量化一行，type是支持的量化类型（Q4_0、Q4_1、Q8_0）
+void quantize_row(GGML_TYPE type, const float* x, void* y, int64_t k);
+void dequantize_row(GGML_TYPE type, const void* x, float* y, int64_t k);
+
+// 所有线程中dequantize_row反量化的元素总数，测试中用来检查权重缓存命中时不再反量化权重
+size_t getDequantizedCount();
 
 // <<<<<<<<<<<<<<<<<<<<<<<<<<<<<<<<< Compute function  >>>>>>>>>>>>>>>>>>>>>>>>>>>>>>>>>>>>>>
 
@@ -41,6 +41,7 @@
 #include "../memory_utils.h"
 #include "ggml_quant.h"
 #include "gguf_utils.h"
+#include "../parallel.h"
 #include <queue>
 #include <forward_list>
 
@@ -225,6 +226,9 @@ static void gguf_tensor_info_sanitize(struct GGUF_tensor* info)
 {
     M_Assert(info->n_dims <= GGML_MAX_DIMS);
     M_Assert(0 <= info->type && info->type < GGML_TYPE_COUNT);
+    if (!typeTraits[info->type].is_supported)
+        M_Error_(Error::Code::StsNotImplemented, ("Tensor %s with type %s is not supported!",
+                 info->name.data, typeTraits[info->type].type_name));
 
     for (uint32_t i = 0; i < info->n_dims; ++i)
     {
@@ -237,7 +241,7 @@ static void gguf_tensor_info_sanitize(struct GGUF_tensor* info)
     M_Assert(INT64_MAX/info->ne[3] > info->ne[0]*info->ne[1]*info->ne[2]);
 }
 
-std::shared_ptr<GGUF_context> gguf_init_from_file(const char* fname)
+std::shared_ptr<GGUF_context> gguf_init_from_file(const char* fname, bool use_mmap)
 {
     std::shared_ptr<GGUF_context> ctx = std::make_shared<GGUF_context>();
 
@@ -489,12 +493,39 @@ std::shared_ptr<GGUF_context> gguf_init_from_file(const char* fname)
 
         // loading tensor data
         {
-            // Alloc memory
-            size_t mem_size = M_PAD(ctx->size, GGML_MEM_ALIGN);
-            ctx->data = MMemoryAllocAlign(mem_size);
-
-            // loading all data from binary to data
-            ok = ok & gguf_fread_el(file, ctx->data, ctx->size, &offset);
+            char* data_base = nullptr;
+            if (use_mmap)
+            {
+                // 只建立映射，tensor数据在第一次访问时由操作系统按页读入
+                LLama_file mfile(fname, "rb");
+                if (ctx->offset + ctx->size > mfile.size)
+                {
+                    fprintf(stderr, "%s: data section is out of the file range!\n", __func__);
+                    fclose(file);
+                    ctx.reset();
+                    return NULL;
+                }
+                ctx->mapping = std::make_shared<LLama_mmap>(&mfile);
+                data_base = (char *)ctx->mapping->addr + ctx->offset;
+            }
+            else
+            {
+                // Alloc memory
+                size_t mem_size = M_PAD(ctx->size, GGML_MEM_ALIGN);
+                ctx->data = MMemoryAllocAlign(mem_size);
+
+                // 数据段按块划分，多个线程各自打开文件并行读取
+                const size_t chunk_size = GGUF_READ_CHUNK_SIZE;
+                const int n_chunks = (int)((ctx->size + chunk_size - 1) / chunk_size);
+                parallel_for(0, n_chunks, [&](int c) {
+                    size_t begin = c * chunk_size;
+                    LLama_file chunk_file(fname, "rb");
+                    chunk_file.seek(ctx->offset + begin, SEEK_SET);
+                    chunk_file.read_raw((char *)ctx->data + begin, std::min(chunk_size, ctx->size - begin));
+                });
+                offset += ctx->size;
+                data_base = (char *)ctx->data;
+            }
 
             // create and loading tensor one by one.
             for (int i = 0; i < ctx->header.n_tensors; i++)
@@ -515,7 +546,7 @@ std::shared_ptr<GGUF_context> gguf_init_from_file(const char* fname)
                 }
 
                 tensor->size = data_size;
-                tensor->data = (char *)ctx->data + tensor->offset;
+                tensor->data = data_base + tensor->offset;
             }
         }
 
@@ -525,6 +556,16 @@ std::shared_ptr<GGUF_context> gguf_init_from_file(const char* fname)
     return ctx;
 }
 
+bool gguf_owns_data(const GGUF_context* ctx, const void* p)
+{
+    if (!ctx || !p)
+        return false;
+
+    const char* base = ctx->mapping ? (const char *)ctx->mapping->addr : (const char *)ctx->data;
+    size_t size = ctx->mapping ? ctx->mapping->size : ctx->size;
+    return base && (const char *)p >= base && (const char *)p < base + size;
+}
+
 static
 void replace_all(std::string & s, const std::string & search, const std::string & replace) {
     if (search.empty()) {
@@ -624,6 +665,7 @@ struct LLama_loader
     std::unordered_map<std::string, struct LLama_model_kv_override> kv_overrides;
 
     std::shared_ptr<GGUF_context> meta;
+    std::map<const void*, QuantType> quant_types; // create_mat返回的量化tensor，key为tensor的数据
 
     std::string arch_name;
     LLM_KV_Impl llmKv = LLM_KV_Impl(LLM_ARCH_UNKNOWN);
@@ -727,8 +769,14 @@ struct LLama_loader
             case GGML_TYPE_F16:
                 m = Mat(dims, DT_16F, const_cast<void *>(t->data));
                 break;
+            case GGML_TYPE_Q4_0:
+            case GGML_TYPE_Q4_1:
             case GGML_TYPE_Q8_0:
-                m = Mat(dims, DT_8U, const_cast<void *>(t->data));
+                // 保持量化的block，引用映射的内存，layer构造时才反量化（权重缓存命中时不需要反量化），
+                // DT_8U的Mat，shape为[ne1, ne0这一行的字节数]
+                M_Assert(t->n_dims == 2 && "Only 2D quantized tensor is supported!");
+                m = Mat({(int)t->ne[1], (int)ggml_row_size(t->type, t->ne[0])}, DT_8U, const_cast<void *>(t->data));
+                quant_types[t->data] = (QuantType)t->type;
                 break;
             default:
                 M_Error_(Error::Code::StsNullPtr, ("Fail to create mat with type = %d !!", (int )t->type));
@@ -736,6 +784,33 @@ struct LLama_loader
         return m;
     }
 
+    // 和create_mat一样，同时返回量化类型，不是量化的tensor时为QUANT_NONE
+    Mat create_quant_mat(const std::string& name, QuantType& quant_type)
+    {
+        Mat m = create_mat(name);
+        quant_type = get_quant_type(m.data);
+        return m;
+    }
+
+    QuantType get_quant_type(const void* data) const
+    {
+        auto it = quant_types.find(data);
+        return it == quant_types.end() ? QUANT_NONE : it->second;
+    }
+
+    // 把create_mat返回的量化权重的类型记录到对应的LayerParams中
+    void set_quant_types(const std::vector<std::shared_ptr<LayerParams> >& netParams) const
+    {
+        for (auto& param : netParams)
+        {
+            for (Mat* w : param->getWeights())
+            {
+                if (!w->empty())
+                    param->setQuantType(w, get_quant_type(w->data));
+            }
+        }
+    }
+
     // TODO support the param overrider p argument!
     // 这个类别只需要做到，能够自由的加载所有参数到内存，以及方便的获取key-value键值对就行。
     LLama_loader(const std::string& fname, bool use_mmap, const struct LLama_model_kv_override* param_overrides_p)
@@ -755,7 +830,7 @@ struct LLama_loader
             }
         }
 
-        meta = gguf_init_from_file(fname.c_str());
+        meta = gguf_init_from_file(fname.c_str(), use_mmap);
 
         // get architecture
         get_key(llmKv(LLM_KV_GENERAL_ARCHITECTURE), arch_name, false);
@@ -843,15 +918,18 @@ struct LLM_TN {
     }
 };
 
-void readGGUF(const std::string path, std::vector<std::shared_ptr<LayerParams> >& netParams, std::shared_ptr<GGUF_Vocab>& gguf_vocab)
+void readGGUF(const std::string path, std::vector<std::shared_ptr<LayerParams> >& netParams, std::shared_ptr<GGUF_Vocab>& gguf_vocab,
+              std::shared_ptr<GGUF_context>& modelData)
 {
     netParams.clear();
 
     // different platform has different structure?
     // how to construct the model from context
 
-    // TODO: 目前会通过loader去持有内存，从而让内存在create net的阶段可读。
-    static LLama_loader loader = LLama_loader(path, false, nullptr);
+    // 使用mmap加载，FP32权重直接引用映射内存，不需要把整个模型读入堆内存。
+    // 映射由loader.meta持有，最后交给调用者，由调用者决定什么时候释放。
+    LLama_loader loader = LLama_loader(path, true, nullptr);
+    modelData = loader.meta;
     LLM_ARCH arch = loader.get_arch();
 
     std::cout<<"Arch = "<<LLM_ARCH_NAMES.at(arch)<<std::endl;
@@ -880,7 +958,9 @@ void readGGUF(const std::string path, std::vector<std::shared_ptr<LayerParams> >
         std::string out;
 
         // handle tok_embedding
-        Mat embdMat = loader.create_mat(getTensorName(LLM_TENSOR_TOKEN_EMBD, "weight"));
+        // embedding每次只查询几行，保持源模型中的类型，forward时只转换查询的行
+        QuantType embdQuantType = QUANT_NONE;
+        Mat embdMat = loader.create_quant_mat(getTensorName(LLM_TENSOR_TOKEN_EMBD, "weight"), embdQuantType);
         M_Assert(!embdMat.empty() && "Error when to create llama mat!");
 
         // set model input
@@ -888,9 +968,9 @@ void readGGUF(const std::string path, std::vector<std::shared_ptr<LayerParams> >
                 std::shared_ptr<LayerParams>(new LayerParams(LayerType::Input, {0}, {1}))
                 );
 
-        netParams.push_back(
-                std::shared_ptr<LayerParams>(
-                new EmbeddingLayerParams({1}, {2}, p.n_vocab, p.n_embd, embdMat)));
+        std::shared_ptr<EmbeddingLayerParams> embdParam(
+                new EmbeddingLayerParams({1}, {2}, p.n_vocab, p.n_embd, embdMat, embdQuantType));
+        netParams.push_back(embdParam);
 
         int layer_id = 2;
         // handle multi attention layer
@@ -939,6 +1019,11 @@ void readGGUF(const std::string path, std::vector<std::shared_ptr<LayerParams> >
 
         // handle output
         {
+            // 只保留需要输出logits的位置，默认只有最后一个位置，减少prefill时output norm和vocab投影的计算
+            netParams.push_back(std::shared_ptr<LayerParams>(
+                    new LayerParams(LayerType::GetRows, {layer_id}, {layer_id + 1})));
+            layer_id++;
+
             // create output norm
             Mat out_norm = loader.create_mat(getTensorName(LLM_TENSOR_OUTPUT_NORM, "weight"));
             M_Assert(!out_norm.empty() && "Error when to create llama mat!");
@@ -953,6 +1038,7 @@ void readGGUF(const std::string path, std::vector<std::shared_ptr<LayerParams> >
             // if output is NULL, init from the input tok embed
             if (outWeight.empty())
             {
+                // 和embedding共享同一个源tensor，createNet中只转换一次（见shareTiedWeights）
                 outWeight = loader.create_mat(getTensorName(LLM_TENSOR_TOKEN_EMBD, "weight"));
             }
 
@@ -966,6 +1052,7 @@ void readGGUF(const std::string path, std::vector<std::shared_ptr<LayerParams> >
         netParams.push_back(
                 std::shared_ptr<LayerParams>(new LayerParams(LayerType::Output, {layer_id}, {layer_id + 1}))
         );
+        loader.set_quant_types(netParams);
     }
 }
 
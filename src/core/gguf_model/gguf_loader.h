@@ -18,13 +18,13 @@ namespace minfer
 enum GGML_TYPE {
     GGML_TYPE_F32     = 0,
     GGML_TYPE_F16     = 1,
-    // GGML_TYPE_Q4_0    = 2,
-    // GGML_TYPE_Q4_1    = 3,
-    // // GGML_TYPE_Q4_2 = 4, support has been removed
-    // // GGML_TYPE_Q4_3 = 5, support has been removed
-    // GGML_TYPE_Q5_0    = 6,
-    // GGML_TYPE_Q5_1    = 7,
-    GGML_TYPE_Q8_0    = 2,
+    GGML_TYPE_Q4_0    = 2,
+    GGML_TYPE_Q4_1    = 3,
+    // GGML_TYPE_Q4_2 = 4, support has been removed
+    // GGML_TYPE_Q4_3 = 5, support has been removed
+    GGML_TYPE_Q5_0    = 6,
+    GGML_TYPE_Q5_1    = 7,
+    GGML_TYPE_Q8_0    = 8,
     // GGML_TYPE_Q8_1    = 9,
     // GGML_TYPE_Q2_K    = 10,
     // GGML_TYPE_Q3_K    = 11,
@@ -423,10 +423,13 @@ enum llama_split_mode {
 };
 
 class GGUF_Vocab;
+struct GGUF_context;
 /// 创建gguf net params
 /// \param path gguf 模型路径
 /// \param allLayerParams
-void readGGUF(const std::string path, std::vector<std::shared_ptr<LayerParams> >& netParams, std::shared_ptr<GGUF_Vocab>& gguf_vocab);
+/// \param modelData 持有tensor内存（或者mmap映射）的context，netParams中的权重直接指向这里，使用权重期间必须保持存活
+void readGGUF(const std::string path, std::vector<std::shared_ptr<LayerParams> >& netParams, std::shared_ptr<GGUF_Vocab>& gguf_vocab,
+              std::shared_ptr<GGUF_context>& modelData);
 
 /* *********************************************************************************************************************
  *                                                >>>   Tokenizer   <<<
@@ -5,6 +5,7 @@
 #ifndef MINFER_GGUF_UTILS_H
 #define MINFER_GGUF_UTILS_H
 
+#include <inttypes.h>
 #include "minfer.h"
 #include "../memory_utils.h"
 #include "gguf_loader.h"
@@ -16,6 +17,7 @@ namespace minfer
 #define GGML_MAX_DIMS           4
 #define GGUF_DEFAULT_ALIGNMENT 32
 #define GGML_MEM_ALIGN 16
+#define GGUF_READ_CHUNK_SIZE (64 << 20) // 不使用mmap时，每个线程一次读取的大小
 #define GGUF_MAGIC "GGUF"
 
 #if defined(_MSC_VER)
@@ -121,6 +123,8 @@ struct GGUF_tensor {
     size_t size;
 };
 
+struct LLama_mmap;
+
 struct GGUF_context {
     struct GGUF_header header;
     struct GGUF_kv *kv;           // pointer to all the kv list. What is kv? kv means the gguf key-value data struct, and the kv list contains all key-value info where the model has.
@@ -130,11 +134,20 @@ struct GGUF_context {
     size_t offset;     // offset of data from beginning of file.
     size_t size;       // size of data in bytes
 
-    void* data;
+    void* data;        // 读取到内存中的数据，使用mmap时为空
+
+    // mmap加载时持有整个文件的映射，tensor的data直接指向映射内存。多个进程加载同一个模型时共享page cache。
+    std::shared_ptr<LLama_mmap> mapping;
 
     ~GGUF_context();
 };
 
+// 解析gguf文件。use_mmap为true时不拷贝tensor数据，而是把文件映射到内存中。
+std::shared_ptr<GGUF_context> gguf_init_from_file(const char* fname, bool use_mmap = false);
+
+// p是否指向ctx持有的tensor内存（或者mmap映射）
+bool gguf_owns_data(const GGUF_context* ctx, const void* p);
+
 
 //>>>>>>>>>>>>>>>>>>>>>> file  <<<<<<<<<<<<<<<<<<<<<<<<<<<<
 FILE* gguf_fopen(const char* fname, const char* mode);
@@ -0,0 +1,437 @@
+//
+// Created by mzh on 2025/3/18.
+//
+
+#include "weight_cache.h"
+#include "gguf_utils.h"
+#include "memory_utils.h"
+
+#include <cstdio>
+#include <cstring>
+#include <iostream>
+#include <map>
+#include <random>
+#include <sys/stat.h>
+#if defined(_WIN32)
+#include <process.h>
+#else
+#include <unistd.h>
+#endif
+
+namespace minfer
+{
+
+#define WEIGHT_CACHE_FORMAT_VERSION 3
+#define WEIGHT_CACHE_KEY_FORMAT      "minfer.cache.format"
+#define WEIGHT_CACHE_KEY_ISA         "minfer.cache.isa"
+#define WEIGHT_CACHE_KEY_SOURCE      "minfer.cache.source"
+#define WEIGHT_CACHE_KEY_SOURCE_HASH "minfer.cache.source_hash"
+
+// 编译时的CPU指令集，不同指令集的kernel以后可能使用不同的权重布局
+static std::string cacheIsa()
+{
+    std::string isa;
+#if defined(__x86_64__) || defined(_M_X64)
+    isa = "x86_64";
+#elif defined(__aarch64__) || defined(_M_ARM64)
+    isa = "arm64";
+#else
+    isa = "generic";
+#endif
+
+#if defined(__AVX512F__)
+    isa += "-avx512f";
+#endif
+#if defined(__AVX2__)
+    isa += "-avx2";
+#endif
+#if defined(__FMA__)
+    isa += "-fma";
+#endif
+#if defined(__F16C__)
+    isa += "-f16c";
+#endif
+#if defined(__ARM_NEON)
+    isa += "-neon";
+#endif
+    return isa;
+}
+
+// 缓存格式版本和库版本
+static std::string cacheFormat()
+{
+    return format("%d-%s", WEIGHT_CACHE_FORMAT_VERSION, M_VERSION);
+}
+
+static std::string cacheTensorName(int layerIdx, int weightIdx)
+{
+    return format("l%d.%d", layerIdx, weightIdx);
+}
+
+// FNV-1a
+static uint64_t hashBytes(uint64_t h, const void* data, size_t len)
+{
+    const unsigned char* p = (const unsigned char *)data;
+    for (size_t i = 0; i < len; i++)
+    {
+        h ^= p[i];
+        h *= 1099511628211ULL;
+    }
+    return h;
+}
+
+// 每次8个字节，比按字节的FNV快很多，用于hash所有的权重数据
+static uint64_t hashWords(uint64_t h, const void* data, size_t len)
+{
+    const unsigned char* p = (const unsigned char *)data;
+    size_t n = len / sizeof(uint64_t);
+    for (size_t i = 0; i < n; i++)
+    {
+        uint64_t v;
+        memcpy(&v, p + i * sizeof(uint64_t), sizeof(v));
+        h = (h ^ v) * 1099511628211ULL;
+        h ^= h >> 29;
+    }
+    return hashBytes(h, p + n * sizeof(uint64_t), len - n * sizeof(uint64_t));
+}
+
+// header、kv和tensor信息的hash，它们都在数据段之前
+static uint64_t hashMetadata(const std::string& modelPath, const GGUF_context* ctx)
+{
+    std::vector<char> meta(ctx->offset);
+    FILE* file = gguf_fopen(modelPath.c_str(), "rb");
+    M_Assert(file);
+    size_t n = fread(meta.data(), 1, meta.size(), file);
+    fclose(file);
+    M_Assert(n == meta.size());
+    return hashBytes(14695981039346656037ULL, meta.data(), meta.size());
+}
+
+// 文件的大小、修改时间（精确到纳秒）、所在设备和inode，原地修改或者替换文件时都会变化
+static uint64_t hashFileIdentity(uint64_t h, const std::string& modelPath)
+{
+#if defined(_WIN32)
+    struct _stat64 st;
+    M_Assert(_stat64(modelPath.c_str(), &st) == 0);
+    int64_t mtimeNs = 0;
+#else
+    struct stat st;
+    M_Assert(stat(modelPath.c_str(), &st) == 0);
+#if defined(__APPLE__)
+    int64_t mtimeNs = st.st_mtimespec.tv_nsec;
+#else
+    int64_t mtimeNs = st.st_mtim.tv_nsec;
+#endif
+#endif
+    int64_t identity[] = {(int64_t)st.st_size, (int64_t)st.st_mtime, mtimeNs, (int64_t)st.st_dev, (int64_t)st.st_ino};
+    return hashBytes(h, identity, sizeof(identity));
+}
+
+std::string weightCacheSourceKey(const std::string& modelPath)
+{
+    std::shared_ptr<GGUF_context> ctx = gguf_init_from_file(modelPath.c_str(), true);
+    M_Assert(ctx && "Fail to read the gguf model!");
+
+    uint64_t h = hashMetadata(modelPath, ctx.get());
+    h = hashFileIdentity(h, modelPath);
+    return format("%016" PRIx64, h);
+}
+
+std::string weightCacheSourceHash(const std::string& modelPath)
+{
+    std::shared_ptr<GGUF_context> ctx = gguf_init_from_file(modelPath.c_str(), true);
+    M_Assert(ctx && "Fail to read the gguf model!");
+
+    uint64_t h = hashMetadata(modelPath, ctx.get());
+    for (uint64_t i = 0; i < ctx->header.n_tensors; i++)
+    {
+        const GGUF_tensor& t = ctx->tensors[i];
+        h = hashWords(h, t.data, t.size);
+
+        // 读过的映射内存页不再需要
+        MMemoryDiscard(t.data, t.size);
+    }
+    return format("%016" PRIx64, h);
+}
+
+static void writeRaw(FILE* f, const void* data, size_t len)
+{
+    if (len > 0 && fwrite(data, 1, len, f) != len)
+        M_Error(Error::Code::StsError, "Fail to write the weight cache!");
+}
+
+// 在缓存文件旁边创建一个只属于当前写入者的临时文件（进程id + 随机数，"x"模式保证文件之前不存在），
+// 多个进程同时生成同一个缓存时不会写入同一个临时文件
+static FILE* createTempFile(const std::string& cachePath, std::string& tmpPath)
+{
+#if defined(_WIN32)
+    const int pid = _getpid();
+#else
+    const int pid = getpid();
+#endif
+    std::random_device rd;
+    for (int i = 0; i < 16; i++)
+    {
+        tmpPath = format("%s.%d.%08x.tmp", cachePath.c_str(), pid, (unsigned)rd());
+        if (FILE* f = gguf_fopen(tmpPath.c_str(), "wbx"))
+            return f;
+    }
+    M_Error_(Error::Code::StsBadArg, ("Fail to create the temporary file of weight cache %s!", cachePath.c_str()));
+    return nullptr;
+}
+
+static void writeStr(FILE* f, const std::string& s)
+{
+    uint64_t n = s.size();
+    writeRaw(f, &n, sizeof(n));
+    writeRaw(f, s.data(), n);
+}
+
+static void writeKvStr(FILE* f, const std::string& key, const std::string& value)
+{
+    uint32_t type = GGUF_TYPE_STRING;
+    writeStr(f, key);
+    writeRaw(f, &type, sizeof(type));
+    writeStr(f, value);
+}
+
+static void writePadding(FILE* f, size_t& offset, size_t alignment)
+{
+    static const char zeros[M_MEMORY_ALIGN_DEFAULT] = {0};
+    size_t pad = M_PAD(offset, alignment) - offset;
+    writeRaw(f, zeros, pad);
+    offset += pad;
+}
+
+// 权重转换为FP32之后的shape，量化的block [ne1, 每行的字节数] 反量化之后为 [ne0, ne1]
+static MatShape floatShape(const Mat& w, QuantType quantType)
+{
+    if (quantType == QUANT_NONE)
+        return w.shape();
+    GGML_TYPE type = (GGML_TYPE)quantType;
+    return {(int)(w.size[1] / ggml_type_size(type) * ggml_blck_size(type)), w.size[0]};
+}
+
+void writeWeightCache(const std::string& cachePath, const std::string& sourceKey, const std::string& sourceHash,
+                      const std::vector<std::shared_ptr<LayerParams> >& params)
+{
+    const size_t alignment = M_MEMORY_ALIGN_DEFAULT;
+
+    struct Entry
+    {
+        std::string name;
+        Mat* w;
+        QuantType quantType;
+        MatShape shape; // FP32的shape
+        size_t offset;
+    };
+
+    std::vector<Entry> entries;
+    std::map<const void*, int> written; // 共享同一个源tensor的权重只写一次
+    size_t dataSize = 0;
+    for (int i = 0; i < params.size(); i++)
+    {
+        if (!params[i]->convertsWeights())
+            continue;
+
+        std::vector<Mat*> weights = params[i]->getWeights();
+        for (int k = 0; k < weights.size(); k++)
+        {
+            Mat* w = weights[k];
+            if (w->empty() || !written.insert({w->data, (int)entries.size()}).second)
+                continue;
+
+            M_Assert(w->dims <= GGML_MAX_DIMS);
+            QuantType quantType = params[i]->getQuantType(w);
+            MatShape shape = floatShape(*w, quantType);
+            entries.push_back({cacheTensorName(i, k), w, quantType, shape, dataSize});
+            dataSize += M_PAD(total(shape) * sizeof(float), alignment);
+        }
+    }
+
+    std::string tmpPath;
+    FILE* f = createTempFile(cachePath, tmpPath);
+
+    // 写入失败时删除临时文件，不会留下或者重命名写了一半的缓存
+    try
+    {
+        // header
+        uint32_t version = 3;
+        uint64_t n_tensors = entries.size();
+        uint64_t n_kv = 5;
+        writeRaw(f, GGUF_MAGIC, 4);
+        writeRaw(f, &version, sizeof(version));
+        writeRaw(f, &n_tensors, sizeof(n_tensors));
+        writeRaw(f, &n_kv, sizeof(n_kv));
+
+        // kv
+        {
+            uint32_t type = GGUF_TYPE_UINT32;
+            uint32_t align = alignment;
+            writeStr(f, "general.alignment");
+            writeRaw(f, &type, sizeof(type));
+            writeRaw(f, &align, sizeof(align));
+        }
+        writeKvStr(f, WEIGHT_CACHE_KEY_FORMAT, cacheFormat());
+        writeKvStr(f, WEIGHT_CACHE_KEY_ISA, cacheIsa());
+        writeKvStr(f, WEIGHT_CACHE_KEY_SOURCE, sourceKey);
+        writeKvStr(f, WEIGHT_CACHE_KEY_SOURCE_HASH, sourceHash);
+
+        // tensor信息，所有权重都是FP32
+        for (const Entry& e : entries)
+        {
+            writeStr(f, e.name);
+            uint32_t n_dims = e.shape.size();
+            writeRaw(f, &n_dims, sizeof(n_dims));
+            for (int d = 0; d < n_dims; d++)
+            {
+                int64_t ne = e.shape[d];
+                writeRaw(f, &ne, sizeof(ne));
+            }
+            uint32_t type = GGML_TYPE_F32;
+            uint64_t offset = e.offset;
+            writeRaw(f, &type, sizeof(type));
+            writeRaw(f, &offset, sizeof(offset));
+        }
+
+        size_t offset = ftell(f);
+        writePadding(f, offset, alignment);
+
+        // 数据段，每次只转换一个权重
+        for (const Entry& e : entries)
+        {
+            Mat w;
+            Layer::weightToFloat(*e.w, w, e.quantType);
+            size_t bytes = w.total() * sizeof(float);
+            writeRaw(f, w.data, bytes);
+            offset += bytes;
+            writePadding(f, offset, alignment);
+        }
+        int closed = fclose(f);
+        f = nullptr;
+        if (closed != 0)
+            M_Error(Error::Code::StsError, "Fail to write the weight cache!");
+    }
+    catch (...)
+    {
+        if (f)
+            fclose(f);
+        std::remove(tmpPath.c_str());
+        throw;
+    }
+
+    if (std::rename(tmpPath.c_str(), cachePath.c_str()) != 0)
+    {
+        // Windows上目标文件存在时rename会失败
+        std::remove(cachePath.c_str());
+        if (std::rename(tmpPath.c_str(), cachePath.c_str()) != 0)
+        {
+            std::remove(tmpPath.c_str());
+            M_Error_(Error::Code::StsError, ("Fail to rename the weight cache to %s!", cachePath.c_str()));
+        }
+    }
+}
+
+static bool checkKvStr(const GGUF_context* ctx, const char* key, const std::string& value)
+{
+    int idx = gguf_find_key(ctx, key);
+    if (idx < 0 || gguf_get_kv_type(ctx, idx) != GGUF_TYPE_STRING)
+        return false;
+    return value == gguf_get_val_str(ctx, idx);
+}
+
+std::shared_ptr<GGUF_context> loadWeightCache(const std::string& cachePath, const std::string& sourceKey,
+                                              std::vector<std::shared_ptr<LayerParams> >& params,
+                                              const std::string& sourceHash)
+{
+    FILE* f = gguf_fopen(cachePath.c_str(), "rb");
+    if (!f)
+        return nullptr;
+    fclose(f);
+
+    std::shared_ptr<GGUF_context> ctx;
+    try
+    {
+        ctx = gguf_init_from_file(cachePath.c_str(), true);
+    }
+    catch (const std::exception& e)
+    {
+        std::cout<<"warning: the weight cache "<<cachePath<<" is broken: "<<e.what()<<std::endl;
+        return nullptr;
+    }
+
+    if (!ctx || !checkKvStr(ctx.get(), WEIGHT_CACHE_KEY_FORMAT, cacheFormat()) ||
+        !checkKvStr(ctx.get(), WEIGHT_CACHE_KEY_ISA, cacheIsa()))
+    {
+        return nullptr;
+    }
+
+    // 文件被touch或者复制之后key会变化，这时比较所有数据的hash，内容没有变化时缓存仍然有效
+    if (!checkKvStr(ctx.get(), WEIGHT_CACHE_KEY_SOURCE, sourceKey) &&
+        (sourceHash.empty() || !checkKvStr(ctx.get(), WEIGHT_CACHE_KEY_SOURCE_HASH, sourceHash)))
+    {
+        return nullptr;
+    }
+
+    // 先检查所有权重的shape，全部匹配之后才替换，避免只替换了一部分
+    struct Replaced
+    {
+        LayerParams* param;
+        Mat* w;
+        MatShape shape;
+        const GGUF_tensor* t;
+    };
+    std::vector<Replaced> replaced;
+    std::map<const void*, const GGUF_tensor*> source2Tensor; // 共享同一个源tensor的权重使用第一次出现时的缓存
+    for (int i = 0; i < params.size(); i++)
+    {
+        if (!params[i]->convertsWeights())
+            continue;
+
+        std::vector<Mat*> weights = params[i]->getWeights();
+        for (int k = 0; k < weights.size(); k++)
+        {
+            Mat* w = weights[k];
+            if (w->empty())
+                continue;
+
+            const GGUF_tensor* t = nullptr;
+            auto itSource = source2Tensor.find(w->data);
+            if (itSource != source2Tensor.end())
+            {
+                t = itSource->second;
+            }
+            else
+            {
+                int idx = gguf_find_tensor(ctx.get(), cacheTensorName(i, k).c_str());
+                if (idx < 0)
+                    return nullptr;
+                t = &ctx->tensors[idx];
+                source2Tensor[w->data] = t;
+            }
+
+            MatShape shape = floatShape(*w, params[i]->getQuantType(w));
+            if (t->type != GGML_TYPE_F32 || t->n_dims != shape.size())
+                return nullptr;
+            for (int d = 0; d < shape.size(); d++)
+            {
+                if (t->ne[d] != (uint64_t)shape[d])
+                    return nullptr;
+            }
+            replaced.push_back({params[i].get(), w, shape, t});
+        }
+    }
+
+    if (source2Tensor.size() != ctx->header.n_tensors)
+        return nullptr;
+
+    // 量化的权重替换之后不再需要反量化
+    for (auto& r : replaced)
+    {
+        *r.w = Mat(r.shape, DT_32F, const_cast<void *>(r.t->data));
+        r.param->setQuantType(r.w, QUANT_NONE);
+    }
+    return ctx;
+}
+
+}
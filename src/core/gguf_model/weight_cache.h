@@ -0,0 +1,46 @@
+//
+// Created by mzh on 2025/3/18.
+//
+
+#ifndef MINFER_WEIGHT_CACHE_H
+#define MINFER_WEIGHT_CACHE_H
+
+#include "minfer/layer.h"
+
+#include <memory>
+#include <string>
+#include <vector>
+
+namespace minfer
+{
+
+struct GGUF_context;
+
+// 权重缓存：把所有层最终使用的权重（目前是转换之后的FP32）保存成一个gguf文件，之后启动时直接mmap，不再做类型转换。
+// 缓存的key包含缓存格式版本、库版本、编译时的CPU指令集和源模型的key，任意一个不一致时缓存失效。
+// tensor按照 "l<层序号>.<权重序号>" 命名，对应LayerParams::getWeights()的顺序。
+// layer直接使用源类型的权重（LayerParams::convertsWeights()为false）不保存，仍然从源模型中读取。
+// 多个权重引用同一个源tensor时（tied embedding）只保存第一次出现的那一个，加载后仍然共享同一块内存。
+
+// 源gguf模型的key：header和metadata的hash，加上文件的大小、修改时间、设备和inode，不需要读取权重。
+std::string weightCacheSourceKey(const std::string& modelPath);
+
+// 源gguf模型所有数据（metadata和全部权重）的hash，需要读取整个文件，只在写缓存和key不一致时计算。
+std::string weightCacheSourceHash(const std::string& modelPath);
+
+// 把params中的权重转换为FP32写入缓存文件。每个写入者先写自己的临时文件（进程id + 随机数），完整写入之后再重命名，
+// 失败时删除临时文件，多个进程同时写时不会互相覆盖，也不会读到写了一半的缓存。
+void writeWeightCache(const std::string& cachePath, const std::string& sourceKey, const std::string& sourceHash,
+                      const std::vector<std::shared_ptr<LayerParams> >& params);
+
+// 缓存有效时，mmap缓存文件，并把params中的权重替换为指向映射内存的FP32 Mat，返回持有映射的context，
+// 权重使用期间必须保持返回值存活。缓存不存在、key不一致或者和模型结构不匹配时返回空，params不变。
+// key不一致时，如果给出了sourceHash（weightCacheSourceHash），和缓存中保存的hash比较，一致时缓存仍然有效
+// （比如文件只是被touch或者复制）。缓存中的key不会更新，之后每次启动仍然要重新计算hash。
+std::shared_ptr<GGUF_context> loadWeightCache(const std::string& cachePath, const std::string& sourceKey,
+                                              std::vector<std::shared_ptr<LayerParams> >& params,
+                                              const std::string& sourceHash = std::string());
+
+}
+
+#endif //MINFER_WEIGHT_CACHE_H
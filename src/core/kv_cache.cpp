@@ -0,0 +1,215 @@
+//
+// Created by mzh on 2025/3/6.
+//
+
+#include "kv_cache.h"
+#include "define.impl.h"
+#include "memory_utils.h"
+#include <cstring>
+#include <map>
+
+namespace minfer
+{
+
+#define M_KV_CACHE_CHUNK_SIZE (2 << 20) // 和大页一样大
+
+std::atomic<size_t> KVCache::allocatedBytes(0);
+
+// 一个KVCache和fork出来的cache共用，chunk在所有page释放之后才释放。释放的page按大小复用。
+class KVCache::PagePool
+{
+public:
+    ~PagePool()
+    {
+        for (void* c : chunks)
+            MMemoryFreeAlign(c);
+    }
+
+    void* acquire(size_t bytes)
+    {
+        AutoLock lk(mutex);
+        std::vector<void*>& slots = freeSlots[bytes];
+        if (!slots.empty())
+        {
+            void* p = slots.back();
+            slots.pop_back();
+            return p;
+        }
+
+        const size_t alignedBytes = UP_DIV(bytes, M_MEMORY_ALIGN_DEFAULT) * M_MEMORY_ALIGN_DEFAULT;
+        if (chunkUsed + alignedBytes > chunkSize)
+        {
+            chunkSize = std::max((size_t)M_KV_CACHE_CHUNK_SIZE, alignedBytes);
+            chunk = (uchar *)MMemoryAllocClass(chunkSize, MEMORY_CLASS_KV_CACHE);
+            chunks.push_back(chunk);
+            chunkUsed = 0;
+        }
+
+        void* p = chunk + chunkUsed;
+        chunkUsed += alignedBytes;
+        return p;
+    }
+
+    void release(void* p, size_t bytes)
+    {
+        AutoLock lk(mutex);
+        freeSlots[bytes].push_back(p);
+    }
+
+private:
+    Mutex mutex;
+    std::vector<void*> chunks;
+    uchar* chunk = nullptr;
+    size_t chunkSize = 0;
+    size_t chunkUsed = 0;
+    std::map<size_t, std::vector<void*> > freeSlots;
+};
+
+// page在layer forward中分配，但是比forward存活更久，不能使用线程的scratch allocator
+static Mat allocPageMat(int pageSize, int kvDim)
+{
+    MemoryClassScope memScope(MEMORY_CLASS_KV_CACHE);
+    Mat m;
+    m.allocator = Mat::getStdAllocator();
+    m.create({pageSize, kvDim}, DT_32F);
+    return m;
+}
+
+KVCache::Page::Page(int pageSize, int kvDim, const std::shared_ptr<PagePool>& _pool)
+: pool(_pool)
+{
+    const size_t bytes = (size_t)pageSize * kvDim * sizeof(float);
+    if (pool)
+    {
+        k = Mat({pageSize, kvDim}, DT_32F, pool->acquire(bytes));
+        v = Mat({pageSize, kvDim}, DT_32F, pool->acquire(bytes));
+    }
+    else
+    {
+        k = allocPageMat(pageSize, kvDim);
+        v = allocPageMat(pageSize, kvDim);
+    }
+    allocatedBytes += 2 * bytes;
+}
+
+KVCache::Page::Page(const Page& p)
+: Page(p.k.size[0], p.k.size[1], p.pool)
+{
+    p.k.copyTo(k);
+    p.v.copyTo(v);
+}
+
+KVCache::Page::~Page()
+{
+    const size_t bytes = k.total() * sizeof(float);
+    if (pool)
+    {
+        pool->release(k.data, bytes);
+        pool->release(v.data, bytes);
+    }
+    allocatedBytes -= 2 * bytes;
+}
+
+KVCache::KVCache(int _pageSize)
+: pageSize(_pageSize)
+{
+    M_Assert(pageSize > 0);
+    hugePages = getHugePageMode(MEMORY_CLASS_KV_CACHE) != HUGE_PAGE_OFF;
+}
+
+KVCache::~KVCache()
+{
+}
+
+void KVCache::prepare(int layerId, int maxSeqLen, int kvDim, int groups)
+{
+    M_Assert(layerId >= 0);
+    if (layerId >= (int)layers.size())
+        layers.resize(layerId + 1);
+
+    LayerCache& lc = layers[layerId];
+    if (lc.kvDim != 0)
+    {
+        M_Assert(lc.maxSeqLen == maxSeqLen && lc.kvDim == kvDim && lc.groups == groups && "KV cache shape changed!");
+        return;
+    }
+
+    M_Assert(groups > 0 && kvDim % groups == 0);
+    lc.maxSeqLen = maxSeqLen;
+    lc.kvDim = kvDim;
+    lc.groups = groups;
+    lc.groupDim = kvDim / groups;
+    lc.pages.resize(groups);
+
+    // 所有layer的第g组共用第g个pool
+    while (hugePages && (int)pools.size() < groups)
+        pools.push_back(std::make_shared<PagePool>());
+}
+
+void KVCache::write(int layerId, int pos, const float* k, const float* v)
+{
+    M_Assert(layerId < (int)layers.size() && layers[layerId].kvDim != 0 && "KV cache is not prepared!");
+    const LayerCache& lc = layers[layerId];
+    for (int g = 0; g < lc.groups; g++)
+        writeGroup(layerId, pos, g, k + (size_t)g * lc.groupDim, v + (size_t)g * lc.groupDim);
+}
+
+void KVCache::writeGroup(int layerId, int pos, int group, const float* k, const float* v)
+{
+    M_Assert(layerId < (int)layers.size() && layers[layerId].kvDim != 0 && "KV cache is not prepared!");
+    LayerCache& lc = layers[layerId];
+    M_Assert(pos >= 0 && pos < lc.maxSeqLen && "The sequence length exceeds max_seq_len of kv cache!");
+    M_Assert(group >= 0 && group < lc.groups);
+
+    // 每组只修改自己的page列表，不同的组可以同时写入
+    std::vector<std::shared_ptr<Page> >& pages = lc.pages[group];
+    int pageId = pos / pageSize;
+    while (pages.size() <= pageId)
+    {
+        pages.push_back(std::make_shared<Page>(pageSize, lc.groupDim, hugePages ? pools[group] : nullptr));
+    }
+
+    // page被其他cache共享时，先拷贝一份再写入
+    std::shared_ptr<Page>& page = pages[pageId];
+    if (page.use_count() > 1)
+    {
+        page = std::make_shared<Page>(*page);
+    }
+
+    size_t offset = (size_t)(pos % pageSize) * lc.groupDim;
+    memcpy((float *)page->k.data + offset, k, lc.groupDim * sizeof(float));
+    memcpy((float *)page->v.data + offset, v, lc.groupDim * sizeof(float));
+}
+
+int KVCache::size() const
+{
+    return length;
+}
+
+void KVCache::advance(int n)
+{
+    length += n;
+}
+
+void KVCache::clear()
+{
+    length = 0;
+}
+
+void KVCache::truncate(int n)
+{
+    M_Assert(n >= 0 && n <= length && "Can not truncate kv cache to a longer length!");
+    length = n;
+}
+
+KVCache KVCache::fork() const
+{
+    return *this;
+}
+
+size_t KVCache::getAllocatedBytes()
+{
+    return allocatedBytes.load();
+}
+
+}
@@ -0,0 +1,112 @@
+//
+// Created by mzh on 2025/3/6.
+//
+
+#ifndef MINFER_KV_CACHE_H
+#define MINFER_KV_CACHE_H
+
+#include "minfer/mat.h"
+
+#include <atomic>
+#include <memory>
+#include <vector>
+
+namespace minfer
+{
+
+#define M_KV_CACHE_PAGE_SIZE 16 // 每个kv cache page保存的token数量
+
+// 会话级别的kv cache，由Session持有。
+// 每个attention层在cache中有自己的k和v，通过layerId索引。k和v按page分配，每个page保存pageSize个token，
+// page是引用计数的，fork出来的cache和原cache共享所有page，写入共享的page时才会拷贝（copy-on-write）。
+// kvDim可以按head切分成groups组，每组有自己的page，NUMA模式下每组由一个worker写入和读取，page分配在worker所在的node上。
+class KVCache
+{
+public:
+    explicit KVCache(int pageSize = M_KV_CACHE_PAGE_SIZE);
+    ~KVCache();
+
+    // 为layerId准备kv cache，page在写入时才分配。kvDim按groups平均切分，每组kvDim / groups。
+    void prepare(int layerId, int maxSeqLen, int kvDim, int groups = 1);
+
+    // 写入第pos个token的k和v，长度都为kvDim
+    void write(int layerId, int pos, const float* k, const float* v);
+
+    // 只写入第group组的k和v，长度都为kvDim / groups。不同的组可以在不同的线程中同时写入，
+    // page由写入的线程分配和第一次写入。
+    void writeGroup(int layerId, int pos, int group, const float* k, const float* v);
+
+    // 读取第pos个token第group组的k和v，同一个page中相邻token的步长为kvDim / groups
+    inline const float* k(int layerId, int pos, int group = 0) const
+    {
+        const LayerCache& lc = layers[layerId];
+        return (const float *)lc.pages[group][pos / pageSize]->k.data + (size_t)(pos % pageSize) * lc.groupDim;
+    }
+
+    inline const float* v(int layerId, int pos, int group = 0) const
+    {
+        const LayerCache& lc = layers[layerId];
+        return (const float *)lc.pages[group][pos / pageSize]->v.data + (size_t)(pos % pageSize) * lc.groupDim;
+    }
+
+    // 每个page保存的token数量，[p * pageSize, (p + 1) * pageSize) 的k和v在内存中连续
+    inline int getPageSize() const
+    {
+        return pageSize;
+    }
+
+    // cache中已经保存的token数量，也是下一个输入token的位置
+    int size() const;
+
+    // 本次forward的token都写入之后调用
+    void advance(int n);
+
+    // 清空cache，开始新的序列，已分配的page会被保留
+    void clear();
+
+    // 只保留前n个token，之后的位置会被重新写入，比如投机解码中被拒绝的token
+    void truncate(int n);
+
+    // 复制一个共享所有page的cache，只拷贝page的指针。
+    KVCache fork() const;
+
+    // 所有KVCache当前持有的page内存总和，共享的page只计算一次。
+    static size_t getAllocatedBytes();
+
+private:
+    // kv cache使用大页时（见setHugePageMode），page从按大页大小申请的chunk中切分，否则每个page单独分配
+    class PagePool;
+
+    struct Page
+    {
+        Page(int pageSize, int kvDim, const std::shared_ptr<PagePool>& pool);
+        Page(const Page& p);
+        ~Page();
+
+        Mat k; // [pageSize, groupDim]
+        Mat v;
+        std::shared_ptr<PagePool> pool; // 为空时k和v是单独分配的
+    };
+
+    struct LayerCache
+    {
+        int maxSeqLen = 0;
+        int kvDim = 0;
+        int groups = 1;
+        int groupDim = 0; // kvDim / groups
+        std::vector<std::vector<std::shared_ptr<Page> > > pages; // [group][page]
+    };
+
+    int pageSize;
+    bool hugePages;
+    // 每组kv一个pool，NUMA模式下每组的chunk只由对应的worker第一次写入，整个大页落在这个worker的node上
+    std::vector<std::shared_ptr<PagePool> > pools;
+    std::vector<LayerCache> layers; // layerId -> LayerCache
+    int length = 0;
+
+    static std::atomic<size_t> allocatedBytes;
+};
+
+}
+
+#endif //MINFER_KV_CACHE_H
@@ -3,6 +3,10 @@
 //
 
 #include "minfer/layer.h"
+#include "define.impl.h"
+#include "memory_utils.h"
+#include "gguf_model/ggml_quant.h"
+#include "gguf_model/gguf_utils.h"
 
 namespace minfer
 {
@@ -31,6 +35,11 @@ void Layer::init(const std::vector<Mat*> &, std::vector<Mat*> &)
     M_Error_(Error::StsNotImplemented, ("Not implementation at  Layer::init, layer type = %d, name = %s!", (int)layerType, layerName.c_str()));
 }
 
+void Layer::init(const std::vector<Mat*> & input, std::vector<Mat*> & output, LayerContext&)
+{
+    this->init(input, output);
+}
+
 void Layer::finalize(const std::vector<Mat *> &, std::vector<Mat *> &)
 {
     M_Error_(Error::StsNotImplemented, ("Not implementation at  Layer::finalize, layer type = %d, name = %s!", (int)layerType, layerName.c_str()));
@@ -41,7 +50,7 @@ void Layer::forward(const std::vector<Mat*> &, std::vector<Mat*> &)
     M_Error_(Error::StsNotImplemented, ("Not implementation at  Layer::forward, layer type = %d, name = %s!", (int)layerType, layerName.c_str()));
 }
 
-void Layer::forward(const std::vector<Mat*> & input, std::vector<Mat*> & output, int)
+void Layer::forward(const std::vector<Mat*> & input, std::vector<Mat*> & output, LayerContext&)
 {
     this->forward(input, output);
 }
@@ -56,6 +65,42 @@ std::string Layer::getName()
     return layerName;
 }
 
+int Layer::getInplaceInput()
+{
+    return -1;
+}
+
+size_t Layer::getWorkspaceSize(const std::vector<Mat*>& input, const std::vector<Mat*>& output)
+{
+    return 0;
+}
+
+std::vector<Mat*> Layer::getWeights()
+{
+    return {};
+}
+
+size_t Layer::workspaceBytes(size_t elemNum, int type)
+{
+    return UP_DIV(elemNum * DT_ELEM_SIZE(type), M_MEMORY_ALIGN_DEFAULT) * M_MEMORY_ALIGN_DEFAULT;
+}
+
+void Layer::weightToFloat(const Mat& src, Mat& dst, QuantType quantType)
+{
+    if (!src.empty() && quantType != QUANT_NONE)
+    {
+        GGML_TYPE type = (GGML_TYPE)quantType;
+        M_Assert(src.type() == DT_8U && src.dims == 2 && src.size[1] % ggml_type_size(type) == 0);
+        const int ne0 = src.size[1] / ggml_type_size(type) * ggml_blck_size(type);
+        dst = Mat({ne0, src.size[0]}, DT_32F);
+        dequantize_row(type, src.data, (float *)dst.data, dst.total());
+    }
+    else if (src.empty() || src.type() == DT_32F)
+        dst = src;
+    else
+        src.convertTo(dst, DT_32F);
+}
+
 LayerType Layer::getType()
 {
     return layerType;
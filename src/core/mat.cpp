@@ -7,6 +7,7 @@
 #include "minfer/utils.h"
 #include "minfer/saturate.h"
 #include "minfer/define.h"
+#include "memory_utils.h"
 #include <stdatomic.h>
 
 // If is not Mac or IOS, then include the following code.
@@ -28,29 +29,15 @@ template<typename _Tp> static inline _Tp* alignPtr(_Tp* ptr, int n=(int)sizeof(_
 }
 
 #define  MAT_MALLOC_ALIGN    64
+// 和其他内存一样经过MMemoryAllocAlign，使用当前线程的内存类别（见MemoryClassScope），大的Mat可以放在大页上
 void* fastMalloc(size_t size)
 {
-    // size + one more pointer + alignment_size
-    uchar* udata = (uchar*) malloc(size + sizeof(void*) + MAT_MALLOC_ALIGN);
-    if (!udata)
-    {
-        std::cerr<<"Out of memory in fastMalloc"<<std::endl;
-        return nullptr;
-    }
-
-    uchar** adata = alignPtr((uchar**)udata + 1, MAT_MALLOC_ALIGN);
-    adata[-1] = udata;
-    return adata;
+    return MMemoryAllocAlign(size, MAT_MALLOC_ALIGN);
 }
 
 void fastFree(void* ptr)
 {
-    if (ptr)
-    {
-        uchar* udata = ((uchar**)ptr)[-1];
-        assert(udata < (uchar*) ptr && ((uchar*)ptr - udata) <= (sizeof(void *) + MAT_MALLOC_ALIGN));
-        free(udata);
-    }
+    MMemoryFreeAlign(ptr);
 }
 
 // <<<<<<<<<<<<<<<<<<<<<   MatData   >>>>>>>>>>>>
@@ -133,12 +120,23 @@ void MatAllocator::unmap(MatData* u) const
 }
 
 // <<<<<<<<<<<<<<<<<<<<<   MatSize   >>>>>>>>>>>>
-MatSize::MatSize(int *_p):p0(_p)
+MatSize::MatSize()
+:p0(buf), p(buf + 1)
 {
-    if (_p)
-        p = _p + 1;
-    else
-        p = nullptr;
+    buf[0] = 0;
+}
+
+MatSize::MatSize(const MatSize& sz)
+:p0(buf), p(buf + 1)
+{
+    memcpy(buf, sz.buf, sizeof(buf));
+}
+
+MatSize& MatSize::operator=(const MatSize& sz)
+{
+    if (this != &sz)
+        memcpy(buf, sz.buf, sizeof(buf));
+    return *this;
 }
 
 int MatSize::dims() const
@@ -184,14 +182,7 @@ void _setSize(Mat& m, int _dim, const int* _sz)
 {
     M_Assert(_dim <= MAT_MAX_DIM && _dim >= 0);
 
-    if (_dim != m.dims)
-    {
-        fastFree(m.size.p0); // free and reset the dim
-        m.size.p0 = (int *) fastMalloc((_dim + 1) * sizeof( int)); // one more for dim
-        m.size.p = m.size.p0 + 1;
-        m.size.p0[0] = _dim;
-    }
-
+    m.size.p0[0] = _dim;
     m.dims = _dim;
 
     if (!_sz)
@@ -217,9 +208,18 @@ MatAllocator*& getDefaultAllocatorMatRef()
     return g_matAllocator;
 }
 
+static thread_local MatAllocator* g_threadMatAllocator = nullptr;
+
 MatAllocator *Mat::getDefaultAllocator()
 {
-    return getDefaultAllocatorMatRef();
+    return g_threadMatAllocator ? g_threadMatAllocator : getDefaultAllocatorMatRef();
+}
+
+MatAllocator *Mat::setThreadAllocator(MatAllocator *allocator)
+{
+    MatAllocator* prev = g_threadMatAllocator;
+    g_threadMatAllocator = allocator;
+    return prev;
 }
 
 MatAllocator *Mat::getStdAllocator()
@@ -230,7 +230,6 @@ MatAllocator *Mat::getStdAllocator()
 
 void Mat::copySize(const Mat &m)
 {
-    // This code will free and alloc a new buffer for m.size.
     _setSize(*this, m.dims, 0);
 
     for (int i = 0; i < dims; i++)
@@ -241,24 +240,30 @@ void Mat::copySize(const Mat &m)
 
 // Create empty Mat
 Mat::Mat()
-:dims(0), data(0), allocator(0), u(0), size(0), matType(DT_32F)
+:dims(0), data(0), allocator(0), u(0), matType(DT_32F)
 {
 }
 
 Mat::Mat(int _dims, const int* _sizes, int _type)
-:dims(0), data(0), allocator(0), u(0), size(0), matType(DT_32F)
+:dims(0), data(0), allocator(0), u(0), matType(DT_32F)
 {
     create(_dims, _sizes, _type);
 }
 
 Mat::Mat(const std::vector<int> _sizes, int _type)
-:dims(0), data(0), allocator(0), u(0), size(0), matType(DT_32F)
+:dims(0), data(0), allocator(0), u(0), matType(DT_32F)
 {
     create(_sizes, _type);
 }
 
+Mat::Mat(std::initializer_list<int> _sizes, int _type)
+:dims(0), data(0), allocator(0), u(0), matType(DT_32F)
+{
+    create(_sizes.size(), _sizes.begin(), _type);
+}
+
 Mat::Mat(int _dims, const int* _sizes, int _type, int v)
-:dims(0), data(0), allocator(0), u(0), size(0), matType(_type)
+:dims(0), data(0), allocator(0), u(0), matType(_type)
 {
     M_Assert(_type == DT_32S || _type == DT_32U || _type == DT_32F);
     int type = _type;
@@ -274,7 +279,7 @@ Mat::Mat(int _dims, const int* _sizes, int _type, int v)
 }
 
 Mat::Mat(const std::vector<int> _sizes, int _type, int v)
-:dims(0), data(0), allocator(0), u(0), size(0), matType(_type)
+:dims(0), data(0), allocator(0), u(0), matType(_type)
 {
     M_Assert(_type == DT_32S || _type == DT_32U || _type == DT_32F);
     int type = _type;
@@ -290,7 +295,7 @@ Mat::Mat(const std::vector<int> _sizes, int _type, int v)
 }
 
 Mat::Mat(const Mat& m)
-:dims(m.dims), data(m.data), allocator(m.allocator), u(m.u), size(0), matType(m.matType)
+:dims(m.dims), data(m.data), allocator(m.allocator), u(m.u), matType(m.matType)
 {
     if (u)
     {
@@ -303,23 +308,29 @@ Mat::Mat(const Mat& m)
 }
 
 Mat::Mat(int _dims, const int* _sizes, int _type, void* _data)
-:dims(0), data(0), allocator(0), u(0), size(nullptr), matType(_type)
+:dims(0), data(0), allocator(0), u(0), matType(_type)
 {
     data = (uchar*)_data;
     _setSize(*this, _dims, _sizes);
 }
 
 Mat::Mat(const std::vector<int> _sizes, int _type, void* _data)
-:dims(0), data(0), allocator(0), u(0), size(nullptr), matType(_type)
+:dims(0), data(0), allocator(0), u(0), matType(_type)
 {
     data = (uchar*)_data;
     _setSize(*this, _sizes.size(), _sizes.data());
 }
 
+Mat::Mat(std::initializer_list<int> _sizes, int _type, void* _data)
+:dims(0), data(0), allocator(0), u(0), matType(_type)
+{
+    data = (uchar*)_data;
+    _setSize(*this, _sizes.size(), _sizes.begin());
+}
+
 Mat::~Mat()
 {
     release();
-    fastFree(size.p0);
 }
 
 // Not copy mat data, only add reference counter.
@@ -429,6 +440,11 @@ Mat Mat::reshape(const std::vector<int> newSizes) const
     return this->reshape(newSizes.size(), newSizes.data());
 }
 
+Mat Mat::reshape(std::initializer_list<int> newSizes) const
+{
+    return this->reshape(newSizes.size(), newSizes.begin());
+}
+
 Mat Mat::reshape(int newDims, const int* newSizes) const
 {
     size_t new_total = 1;
@@ -555,6 +571,11 @@ void Mat::create(const std::vector<int> _sizes, int _type)
     create(_sizes.size(), _sizes.data(), _type);
 }
 
+void Mat::create(std::initializer_list<int> _sizes, int _type)
+{
+    create(_sizes.size(), _sizes.begin(), _type);
+}
+
 void Mat::release()
 {
     if (u && M_XADD(&u->refcount, -1) == 1)
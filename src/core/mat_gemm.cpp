@@ -7,118 +7,201 @@
 #include "minfer/system.h"
 #include "minfer/utils.h"
 
+#include <algorithm>
+#include <cstring>
+
 namespace minfer
 {
 
 
+// shape和stride都使用固定大小的数组，gemm在decode中每一步都会调用，这里不分配内存。
+// 按照numpy的广播规则计算前面的batch维度，写入shape_c，返回batch维度的数量。
+static inline
+int gemm_batch_shape(const Mat& a, const Mat& b, int* shape_c)
+{
+    M_Assert(a.dims >= 2 && b.dims >= 2 && "Mat shapes on gemm function are miss matching!");
+
+    const int batch_a = a.dims - 2;
+    const int batch_b = b.dims - 2;
+    const int batch_c = std::max(batch_a, batch_b);
+    for (int i = batch_c - 1, ia = batch_a - 1, ib = batch_b - 1; i >= 0; i--, ia--, ib--)
+    {
+        const int sa = ia >= 0 ? a.size[ia] : 1;
+        const int sb = ib >= 0 ? b.size[ib] : 1;
+        if (sa != sb && sa != 1 && sb != 1)
+            M_Error(NULL, "Mat shapes on gemm function are miss matching!");
+        shape_c[i] = sa == 1 ? sb : sa;
+    }
+    return batch_c;
+}
+
+// 排除最后2个维度，他们作为内部循环，而其他的作为外部循环
 static inline
-MatShape make_strides(const MatShape& shape)
+void make_strides(const int* shape, int batch, size_t* strides)
 {
-    MatShape strides(shape.size() - 2);
     size_t stride = 1;
-    // 排除最后2个维度，他们作为内部循环，而其他的作为外部循环
-    for (int i = (int)shape.size() - 2 - 1; i >= 0; i--)
+    for (int i = batch - 1; i >= 0; i--)
     {
         strides[i] = stride;
         stride *= shape[i];
     }
+}
+
+// c的第i个batch对应a和b中的batch，维度数不同时右对齐，维度为1时广播
+static inline
+void gemm_batch_offset(size_t i, const int* shape_c, const size_t* stride_c, int batch_c,
+                       const Mat& a, const size_t* stride_a, const Mat& b, const size_t* stride_b,
+                       size_t& lin_a, size_t& lin_b)
+{
+    const int batch_a = a.dims - 2;
+    const int batch_b = b.dims - 2;
+    lin_a = 0;
+    lin_b = 0;
+    for (int d = 0; d < batch_c; d++)
+    {
+        const size_t idx = i / stride_c[d];
+        i %= stride_c[d];
 
-    if (strides.empty())
-        strides.push_back(1);
-    return strides;
+        const int da = d - (batch_c - batch_a);
+        if (da >= 0 && a.size[da] != 1)
+            lin_a += idx * stride_a[da];
+
+        const int db = d - (batch_c - batch_b);
+        if (db >= 0 && b.size[db] != 1)
+            lin_b += idx * stride_b[db];
+    }
+}
+
+// c的第n列是a的每一行和b的第n行的点积，每次计算4列，a的每个元素读取一次用于4个累加
+static inline
+void gemm_kernel_trans_b(int M, int N, int K, const float* a, size_t lda, const float* b, size_t ldb,
+                         float* c, size_t ldc, bool accumulate)
+{
+    for (int m = 0; m < M; m++)
+    {
+        const float* am = a + m * lda;
+        float* cm = c + m * ldc;
+
+        int n = 0;
+        for (; n + 4 <= N; n += 4)
+        {
+            const float* b0 = b + n * ldb;
+            const float* b1 = b0 + ldb;
+            const float* b2 = b1 + ldb;
+            const float* b3 = b2 + ldb;
+            float s0 = 0, s1 = 0, s2 = 0, s3 = 0;
+            for (int k = 0; k < K; k++)
+            {
+                const float av = am[k];
+                s0 += av * b0[k];
+                s1 += av * b1[k];
+                s2 += av * b2[k];
+                s3 += av * b3[k];
+            }
+
+            if (accumulate)
+            {
+                cm[n] += s0; cm[n + 1] += s1; cm[n + 2] += s2; cm[n + 3] += s3;
+            }
+            else
+            {
+                cm[n] = s0; cm[n + 1] = s1; cm[n + 2] = s2; cm[n + 3] = s3;
+            }
+        }
+
+        for (; n < N; n++)
+        {
+            const float* bn = b + n * ldb;
+            float sum = 0;
+            for (int k = 0; k < K; k++)
+                sum += am[k] * bn[k];
+            cm[n] = accumulate ? cm[n] + sum : sum;
+        }
+    }
+}
+
+// c的每一行是b的各行按a中对应元素加权的和，内层循环连续读写b和c的一行
+static inline
+void gemm_kernel_no_trans(int M, int N, int K, const float* a, size_t lda, const float* b, size_t ldb,
+                          float* c, size_t ldc, bool accumulate)
+{
+    for (int m = 0; m < M; m++)
+    {
+        const float* am = a + m * lda;
+        float* cm = c + m * ldc;
+        if (!accumulate)
+            memset(cm, 0, N * sizeof(float));
+
+        for (int k = 0; k < K; k++)
+        {
+            const float av = am[k];
+            const float* bk = b + k * ldb;
+            for (int n = 0; n < N; n++)
+                cm[n] += av * bk[n];
+        }
+    }
+}
+
+void gemm_kernel(int M, int N, int K, const float* a, size_t lda, const float* b, size_t ldb, bool transB,
+                 float* c, size_t ldc, bool accumulate)
+{
+    if (transB)
+        gemm_kernel_trans_b(M, N, K, a, lda, b, ldb, c, ldc, accumulate);
+    else
+        gemm_kernel_no_trans(M, N, K, a, lda, b, ldb, c, ldc, accumulate);
 }
 
 // naive impl, [M x K] x [K x N] = M x N
 static inline
 void gemm_impl_naive(const Mat& a, const Mat& b, Mat& c)
 {
-    MatShape shape_a = a.shape();
-    MatShape shape_b = b.shape();
-
     // 目前不处理 K x KxN 这种情况。
-    M_Assert(shape_a.size() >= 2 && shape_b.size() >= 2 && "Mat shapes on gemm function are miss matching!");
-
     // generate output shape with brodcast rule
-    // need to handle When a and b shape is 1xK x KxN, or MxK x 1xN, or MxK x Kx1
-    MatShape shape_c = get_gemm_shape(shape_a, shape_b);
+    int shape_c[MAT_MAX_DIM];
+    const int batch_c = gemm_batch_shape(a, b, shape_c);
 
-    // M_Assert(shape_a.size() == shape_b.size() && "Two Mat dimension on gemm function are different!");
-    int len_s = shape_a.size();
-    M_Assert(len_s >= 2 && "Only multi-dimension Mat is supported for gemm function!");
+    const int M = a.size[a.dims - 2];
+    const int K = a.size[a.dims - 1];
+    const int N = b.size[b.dims - 1];
 
-    int M = shape_a.size() == 1 ? 1 : shape_a[shape_a.size() - 2];
-    int K = shape_a[shape_a.size() - 1];
-    int N = shape_b.size() == 1 ? 1 : shape_b[shape_b.size() - 1];
-
-    M_Assert(K == shape_b[shape_b.size() - 2]); // 目前不支持有一个矩阵K为1的情况，后续考虑支持。
+    M_Assert(K == b.size[b.dims - 2]); // 目前不支持有一个矩阵K为1的情况，后续考虑支持。
     M_Assert(a.type() == b.type());
 
     M_Assert(a.type() == DT_32F && "Currently only FP32 mat is supported!");
 
     // For dimension > 2, use numpy broadcasting rule for previous dimension.
-    c = Mat(shape_c, DT_32F);
+    shape_c[batch_c] = M;
+    shape_c[batch_c + 1] = N;
+    c.create(batch_c + 2, shape_c, DT_32F);
+
+    size_t stride_a[MAT_MAX_DIM], stride_b[MAT_MAX_DIM], stride_c[MAT_MAX_DIM];
+    make_strides(a.size.p, a.dims - 2, stride_a);
+    make_strides(b.size.p, b.dims - 2, stride_b);
+    make_strides(shape_c, batch_c, stride_c);
+
+    size_t out_loop = 1;
+    for (int d = 0; d < batch_c; d++)
+        out_loop *= shape_c[d];
 
-    size_t out_loop = len_s > 2 ? total(shape_c, 0, shape_c.size() - 2): 1;
     size_t step_a = M * K;
     size_t step_b = K * N;
     size_t step_c = M * N;
 
-    MatShape stride_a = make_strides(shape_a);
-    MatShape stride_b = make_strides(shape_b);
-    MatShape stride_c = make_strides(shape_c);
-
     const float* pa = (const float*)a.data;
     const float* pb = (const float*)b.data;
     float* pc = (float*)c.data;
 
-    for (int i = 0; i < out_loop; i++)
+    for (size_t i = 0; i < out_loop; i++)
     {
-        size_t tmp = i;
-        std::vector<int> idx_c(stride_c.size());
-        for (int d = 0; d < (int)stride_c.size(); d++)
-        {
-            idx_c[d] = tmp / stride_c[d];
-            tmp %= stride_c[d];
-        }
-
-        // --- 广播到 a 的 batch index ---
-        size_t lin_a = 0;
-        for (int d = 0; d < (int)stride_a.size(); d++)
-        {
-            int coord = (shape_a[d] == 1) ? 0 : idx_c[d];
-            lin_a += coord * stride_a[d];
-        }
-
-        // --- 广播到 b 的 batch index ---
-        size_t lin_b = 0;
-        for (int d = 0; d < (int)stride_b.size(); d++)
-        {
-            int coord = (shape_b[d] == 1) ? 0 : idx_c[d];
-            lin_b += coord * stride_b[d];
-        }
+        // --- 广播到 a 和 b 的 batch index ---
+        size_t lin_a, lin_b;
+        gemm_batch_offset(i, shape_c, stride_c, batch_c, a, stride_a, b, stride_b, lin_a, lin_b);
 
         const float* pai = lin_a * step_a + pa;
         const float* pbi = lin_b * step_b + pb;
         float* pci = i * step_c + pc;
 
-        // TODO optimize the gemm kernel, the following is naive implementation.
-        for (int m = 0; m < M; m++)
-        {
-            const float* paim = pai + K * m;
-            float* pcim = pci + N * m;
-
-            for (int n = 0; n < N; n++)
-            {
-                const float* pbin = pbi + n;
-                float sum = 0;
-                for (int k = 0; k < K; k++)
-                {
-                    sum += paim[k] * pbin[k * N];
-                }
-
-                pcim[n] = sum;
-            }
-        }
+        gemm_kernel(M, N, K, pai, K, pbi, N, false, pci, N, false);
     }
 }
 
@@ -126,147 +209,51 @@ void gemm_impl_naive(const Mat& a, const Mat& b, Mat& c)
 static inline
 void gemm_impl_row(const Mat& a, const Mat& b, Mat& c)
 {
-    MatShape shape_a = a.shape();
-    MatShape shape_b = b.shape();
-
-    // 目前不处理 K x KxN 这种情况。
-    M_Assert(shape_a.size() >= 2 && shape_b.size() >= 2 && "Mat shapes on gemm function are miss matching!");
-
-    // generate output shape with brodcast rule
-    // need to handle When a and b shape is 1xK x KxN, or MxK x 1xN, or MxK x Kx1
-    MatShape shape_c;
+    int shape_c[MAT_MAX_DIM];
+    const int batch_c = gemm_batch_shape(a, b, shape_c);
 
-    int index_a = shape_a.size() - 2;
-    int index_b = shape_b.size() - 2;
+    const int M = a.size[a.dims - 2];
+    const int K = a.size[a.dims - 1];
+    const int N = b.size[b.dims - 2];
 
-    while (index_a > 0 || index_b > 0)
-    {
-        if (index_a > 0 && index_b > 0)
-        {
-            if (shape_a[index_a - 1] == shape_b[index_b - 1])
-            {
-                shape_c.insert(shape_c.begin(), shape_a[index_a - 1]);
-            }
-            else if (shape_a[index_a - 1] == 1)
-            {
-                shape_c.insert(shape_c.begin(), shape_b[index_b - 1]);
-            }
-            else if (shape_b[index_b - 1] == 1)
-            {
-                shape_c.insert(shape_c.begin(), shape_a[index_a - 1]);
-            }
-            else
-            {
-                M_Error(NULL, "Mat shapes on gemm function are miss matching!");
-            }
-            index_a--;
-            index_b--;
-        }
-        else if (index_a > 0)
-        {
-            shape_c.insert(shape_c.begin(), shape_a[index_a - 1]);
-            index_a--;
-        }
-        else if (index_b > 0)
-        {
-            shape_c.insert(shape_c.begin(), shape_b[index_b - 1]);
-            index_b--;
-        }
-        else
-            M_Error(NULL, "Mat shapes on gemm function are miss matching!");
-    }
-
-    // 如果有一个维度为1维度，说明 出现 MxK x K = M的情况
-    if (shape_a.size() == 1 || shape_b.size() == 1)
-    {
-        if (shape_a.size() == 1 && shape_b.size() == 1)
-        {
-            shape_c = {1}; // 处理 1xK x Kx1 = 1的情况
-        }
-    }
-    else
-    {
-        shape_c.push_back(shape_a[shape_a.size() - 2]);
-        shape_c.push_back(shape_b[shape_b.size() - 2]);
-    }
-
-    // M_Assert(shape_a.size() == shape_b.size() && "Two Mat dimension on gemm function are different!");
-    int len_s = shape_a.size();
-    M_Assert(len_s >= 2 && "Only multi-dimension Mat is supported for gemm function!");
-
-    int M = shape_a.size() == 1 ? 1 : shape_a[shape_a.size() - 2];
-    int K = shape_a[shape_a.size() - 1];
-    int N = shape_b.size() == 1 ? 1 : shape_b[shape_b.size() - 2];
-
-    if (K != shape_b[shape_b.size() - 1])
-    M_Assert(K == shape_b[shape_b.size() - 1]); // 目前不支持有一个矩阵K为1的情况，后续考虑支持。
+    M_Assert(K == b.size[b.dims - 1]); // 目前不支持有一个矩阵K为1的情况，后续考虑支持。
     M_Assert(a.type() == b.type());
 
     M_Assert(a.type() == DT_32F && "Currently only FP32 mat is supported!");
 
     // For dimension > 2, use numpy broadcasting rule for previous dimension.
-    c = Mat(shape_c, DT_32F);
+    shape_c[batch_c] = M;
+    shape_c[batch_c + 1] = N;
+    c.create(batch_c + 2, shape_c, DT_32F);
+
+    size_t stride_a[MAT_MAX_DIM], stride_b[MAT_MAX_DIM], stride_c[MAT_MAX_DIM];
+    make_strides(a.size.p, a.dims - 2, stride_a);
+    make_strides(b.size.p, b.dims - 2, stride_b);
+    make_strides(shape_c, batch_c, stride_c);
+
+    size_t out_loop = 1;
+    for (int d = 0; d < batch_c; d++)
+        out_loop *= shape_c[d];
 
-    size_t out_loop = len_s > 2 ? total(shape_c, 0, shape_c.size() - 2): 1;
     size_t step_a = M * K;
     size_t step_b = K * N;
     size_t step_c = M * N;
 
-    MatShape stride_a = make_strides(shape_a);
-    MatShape stride_b = make_strides(shape_b);
-    MatShape stride_c = make_strides(shape_c);
     const float* pa = (const float*)a.data;
     const float* pb = (const float*)b.data;
     float* pc = (float*)c.data;
 
-    for (int i = 0; i < out_loop; i++)
+    for (size_t i = 0; i < out_loop; i++)
     {
-        size_t tmp = i;
-        std::vector<int> idx_c(stride_c.size());
-        for (int d = 0; d < (int)stride_c.size(); d++)
-        {
-            idx_c[d] = tmp / stride_c[d];
-            tmp %= stride_c[d];
-        }
-
-        // --- 广播到 a 的 batch index ---
-        size_t lin_a = 0;
-        for (int d = 0; d < (int)stride_a.size(); d++)
-        {
-            int coord = (shape_a[d] == 1) ? 0 : idx_c[d];
-            lin_a += coord * stride_a[d];
-        }
+        // --- 广播到 a 和 b 的 batch index ---
+        size_t lin_a, lin_b;
+        gemm_batch_offset(i, shape_c, stride_c, batch_c, a, stride_a, b, stride_b, lin_a, lin_b);
 
-        // --- 广播到 b 的 batch index ---
-        size_t lin_b = 0;
-        for (int d = 0; d < (int)stride_b.size(); d++)
-        {
-            int coord = (shape_b[d] == 1) ? 0 : idx_c[d];
-            lin_b += coord * stride_b[d];
-        }
-
-        const float* pai = i * step_a + pa;
-        const float* pbi = i * step_b + pb;
+        const float* pai = lin_a * step_a + pa;
+        const float* pbi = lin_b * step_b + pb;
         float* pci = i * step_c + pc;
 
-        // TODO optimize the gemm kernel, the following is naive implementation.
-        for (int m = 0; m < M; m++)
-        {
-            const float* paim = pai + K * m;
-            float* pcim = pci + N * m;
-
-            for (int n = 0; n < N; n++)
-            {
-                const float* pbin = pbi + n * K;
-                float sum = 0;
-                for (int k = 0; k < K; k++)
-                {
-                    sum += paim[k] * pbin[k];
-                }
-
-                pcim[n] = sum;
-            }
-        }
+        gemm_kernel(M, N, K, pai, K, pbi, K, true, pci, N, false);
     }
 }
 
@@ -0,0 +1,148 @@
+//
+// Created by mzh on 2025/3/15.
+//
+
+#include "memory_planner.h"
+#include "define.impl.h"
+#include "minfer/system.h"
+
+#include <algorithm>
+
+namespace minfer
+{
+
+MemoryPlanner::MemoryPlanner(size_t _align)
+: align(_align)
+{
+    M_Assert(align > 0);
+}
+
+int MemoryPlanner::addBuffer(size_t size, int start, int end)
+{
+    M_Assert(start <= end);
+    Buffer b;
+    b.size = UP_DIV(size, align) * align;
+    b.start = start;
+    b.end = end;
+    b.alias = -1;
+    b.offset = 0;
+    buffers.push_back(b);
+    return buffers.size() - 1;
+}
+
+int MemoryPlanner::root(int buffer) const
+{
+    while (buffers[buffer].alias >= 0)
+        buffer = buffers[buffer].alias;
+    return buffer;
+}
+
+void MemoryPlanner::setAlias(int buffer, int target)
+{
+    M_Assert(buffer >= 0 && buffer < buffers.size() && target >= 0 && target < buffers.size());
+
+    int r = root(target);
+    M_Assert(r != buffer && "Can not alias the buffer to itself!");
+
+    // 合并后的生存区间和size都记录在root上
+    Buffer& rb = buffers[r];
+    Buffer& b = buffers[buffer];
+    rb.start = std::min(rb.start, b.start);
+    rb.end = std::max(rb.end, b.end);
+    rb.size = std::max(rb.size, b.size);
+    b.alias = r;
+}
+
+size_t MemoryPlanner::plan()
+{
+    std::vector<int> order;
+    for (int i = 0; i < buffers.size(); i++)
+    {
+        if (buffers[i].alias < 0)
+            order.push_back(i);
+    }
+
+    // 大的buffer先放，小的buffer更容易填进空隙
+    std::stable_sort(order.begin(), order.end(), [&](int a, int b) {
+        return buffers[a].size > buffers[b].size;
+    });
+
+    std::vector<int> placed;        // 按照offset从小到大排列
+    std::vector<int> overlaps;
+    plannedSize = 0;
+    for (int id : order)
+    {
+        Buffer& b = buffers[id];
+
+        overlaps.clear();
+        for (int p : placed)
+        {
+            const Buffer& o = buffers[p];
+            if (o.start <= b.end && b.start <= o.end)
+                overlaps.push_back(p);
+        }
+
+        // 在生存区间重叠的buffer之间找到能放下的最小空隙，找不到时放在最后
+        size_t bestOffset = 0;
+        size_t bestGap = (size_t)-1;
+        size_t prevEnd = 0;
+        for (int p : overlaps)
+        {
+            const Buffer& o = buffers[p];
+            if (o.offset >= prevEnd)
+            {
+                size_t gap = o.offset - prevEnd;
+                if (gap >= b.size && gap < bestGap)
+                {
+                    bestGap = gap;
+                    bestOffset = prevEnd;
+                }
+            }
+            prevEnd = std::max(prevEnd, o.offset + o.size);
+        }
+
+        b.offset = bestGap == (size_t)-1 ? prevEnd : bestOffset;
+        plannedSize = std::max(plannedSize, b.offset + b.size);
+
+        auto it = std::upper_bound(placed.begin(), placed.end(), id, [&](int a, int c) {
+            return buffers[a].offset < buffers[c].offset;
+        });
+        placed.insert(it, id);
+    }
+
+    for (int i = 0; i < buffers.size(); i++)
+    {
+        if (buffers[i].alias >= 0)
+            buffers[i].offset = buffers[root(i)].offset;
+    }
+    return plannedSize;
+}
+
+size_t MemoryPlanner::getOffset(int buffer) const
+{
+    M_Assert(buffer >= 0 && buffer < buffers.size());
+    return buffers[buffer].offset;
+}
+
+size_t MemoryPlanner::getPlannedSize() const
+{
+    return plannedSize;
+}
+
+size_t MemoryPlanner::getNaiveSize() const
+{
+    size_t total = 0;
+    for (const auto& b : buffers)
+    {
+        total += b.size;
+    }
+    return total;
+}
+
+void MemoryPlanner::clear()
+{
+    buffers.clear();
+    plannedSize = 0;
+}
+
+}
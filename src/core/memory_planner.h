@@ -0,0 +1,62 @@
+//
+// Created by mzh on 2025/3/15.
+//
+
+#ifndef MINFER_MEMORY_PLANNER_H
+#define MINFER_MEMORY_PLANNER_H
+
+#include "memory_utils.h"
+
+#include <vector>
+
+namespace minfer
+{
+
+// 静态内存规划器。
+// 每个buffer有自己的生存区间 [start, end]（第一次写入和最后一次读取的层），生存区间不重叠的buffer可以共享同一段内存。
+// plan时按照size从大到小依次放置，每个buffer放在和它生存区间重叠的buffer之间最小的空隙中（best fit），
+// 最后所有buffer都是一块连续内存（arena）中的offset。
+class MemoryPlanner
+{
+public:
+    explicit MemoryPlanner(size_t align = M_MEMORY_ALIGN_DEFAULT);
+
+    // 添加一个buffer，在第start层写入，最后在第end层读取，返回buffer id
+    int addBuffer(size_t size, int start, int end);
+
+    // buffer和target共享内存（in-place），两者的生存区间合并。调用者需要保证target在buffer写入之后不再被读取。
+    void setAlias(int buffer, int target);
+
+    // 计算每个buffer的offset，返回arena的大小
+    size_t plan();
+
+    size_t getOffset(int buffer) const;
+
+    // plan之后arena的大小，即所有时刻激活值内存的峰值
+    size_t getPlannedSize() const;
+
+    // 每个buffer单独分配时需要的内存之和
+    size_t getNaiveSize() const;
+
+    void clear();
+
+private:
+    struct Buffer
+    {
+        size_t size;
+        int start;
+        int end;
+        int alias;      // 共享内存的buffer，-1表示自己拥有内存
+        size_t offset;
+    };
+
+    int root(int buffer) const;
+
+    size_t align;
+    size_t plannedSize = 0;
+    std::vector<Buffer> buffers;
+};
+
+}
+
+#endif //MINFER_MEMORY_PLANNER_H
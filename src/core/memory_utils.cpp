@@ -1,52 +1,366 @@
 #include "memory_utils.h"
 #include "minfer/system.h"
 
-static inline void **alignPointer(void **ptr, size_t alignment) {
-    return (void **)((intptr_t)((unsigned char *)ptr + alignment - 1) & -alignment);
-}
+#include <algorithm>
+#include <atomic>
+#include <cstdlib>
+#include <cstring>
+#include <map>
+#include <mutex>
 
-extern "C" void *MMemoryAllocAlign(size_t size, size_t alignment) {
-    M_Assert(size > 0);
+#ifdef __has_include
+#if __has_include(<unistd.h>)
+#include <unistd.h>
+#include <sys/mman.h>
+#endif
+#endif
 
-#ifdef MU_DEBUG_MEMORY
-    return malloc(size);
+static size_t pageSize() {
+#if defined(_POSIX_MAPPED_FILES)
+    static const size_t size = (size_t)sysconf(_SC_PAGESIZE);
+    return size;
 #else
-    void **origin = (void **)malloc(size + sizeof(void *) + alignment); // 这个size是以byte为单位。
+    return 4096;
+#endif
+}
+
+#define M_HUGE_PAGE_SIZE (2 << 20)
+
+static inline uintptr_t alignUp(uintptr_t p, size_t alignment) {
+    return (p + alignment - 1) & ~(uintptr_t)(alignment - 1);
+}
+
+// 放在返回的指针之前，释放时根据kind决定free还是munmap
+struct MemoryHeader {
+    void* origin;
+    size_t mapSize;
+    int memClass;
+    int kind;
+};
+
+enum MemoryKind {
+    MEMORY_KIND_MALLOC = 0,
+    MEMORY_KIND_FALLBACK,   // 申请大页失败，使用malloc，mapSize记录申请的大小
+    MEMORY_KIND_THP,
+    MEMORY_KIND_HUGETLB,
+};
+
+static inline MemoryHeader* getHeader(void* aligned) {
+    return (MemoryHeader *)aligned - 1;
+}
+
+struct HugePageRegion {
+    size_t size;
+    int memClass;
+    int kind;
+};
+
+struct HugePageState {
+    std::mutex mutex;
+    std::atomic<int> modes[minfer::MEMORY_CLASS_COUNT]; // 每次分配都会读取，不加锁
+    minfer::HugePageInfo infos[minfer::MEMORY_CLASS_COUNT];
+    std::map<uintptr_t, HugePageRegion> regions; // 大页内存的起始地址 -> 大小
+
+    HugePageState() {
+        for (int c = 0; c < minfer::MEMORY_CLASS_COUNT; c++)
+            modes[c] = minfer::HUGE_PAGE_OFF;
+
+        // 环境变量为权重、kv cache和激活值打开大页
+        if (const char* env = getenv("MINFER_HUGE_PAGES")) {
+            int mode = minfer::HUGE_PAGE_OFF;
+            if (strcmp(env, "madvise") == 0 || strcmp(env, "thp") == 0)
+                mode = minfer::HUGE_PAGE_MADVISE;
+            else if (strcmp(env, "hugetlb") == 0)
+                mode = minfer::HUGE_PAGE_HUGETLB;
+            for (int c = minfer::MEMORY_CLASS_WEIGHT; c < minfer::MEMORY_CLASS_COUNT; c++)
+                modes[c] = mode;
+        }
+    }
+};
+
+static HugePageState& hugePageState() {
+    static HugePageState* state = new HugePageState(); // 不析构，静态对象析构之后仍然可能释放内存
+    return *state;
+}
+
+static thread_local int g_threadMemoryClass = minfer::MEMORY_CLASS_DEFAULT;
+
+static void* allocMalloc(size_t size, size_t alignment, int memClass, bool zero) {
+    void* origin = zero ? calloc(size + sizeof(MemoryHeader) + alignment, 1)
+                        : malloc(size + sizeof(MemoryHeader) + alignment); // 这个size是以byte为单位。
     M_Assert(origin != NULL);
     if (!origin) {
         return NULL;
     }
 
-    void **aligned = alignPointer(origin + 1, alignment);
-    aligned[-1]    = origin;
+    void* aligned = (void *)alignUp((uintptr_t)origin + sizeof(MemoryHeader), alignment);
+    MemoryHeader* header = getHeader(aligned);
+    header->origin = origin;
+    header->mapSize = 0;
+    header->memClass = memClass;
+    header->kind = MEMORY_KIND_MALLOC;
     return aligned;
+}
+
+#if defined(__linux__) && defined(_POSIX_MAPPED_FILES)
+// 使用hugetlbfs的大页，需要系统预留大页（/proc/sys/vm/nr_hugepages），头信息放在映射的开头
+static void* allocHugetlb(size_t size, size_t alignment, size_t& mapSize) {
+#if defined(MAP_HUGETLB)
+    const size_t offset = alignUp(sizeof(MemoryHeader), alignment);
+    mapSize = alignUp(size + offset, M_HUGE_PAGE_SIZE);
+    void* base = mmap(NULL, mapSize, PROT_READ | PROT_WRITE, MAP_PRIVATE | MAP_ANONYMOUS | MAP_HUGETLB, -1, 0);
+    if (base == MAP_FAILED) {
+        return NULL;
+    }
+    MemoryHeader* header = (MemoryHeader *)((char *)base + offset) - 1;
+    header->origin = base;
+    return (char *)base + offset;
+#else
+    return NULL;
 #endif
 }
 
-extern "C" void *MMemoryCallocAlign(size_t size, size_t alignment) {
+// 透明大页：数据按大页对齐，之前多映射一个普通页放头信息，数据部分madvise(MADV_HUGEPAGE)
+static void* allocThp(size_t size, size_t& mapSize) {
+#if defined(MADV_HUGEPAGE)
+    const size_t page = pageSize();
+    const size_t dataSize = alignUp(size, M_HUGE_PAGE_SIZE);
+    const size_t rawSize = dataSize + M_HUGE_PAGE_SIZE + page;
+    char* raw = (char *)mmap(NULL, rawSize, PROT_READ | PROT_WRITE, MAP_PRIVATE | MAP_ANONYMOUS, -1, 0);
+    if ((void *)raw == MAP_FAILED) {
+        return NULL;
+    }
+
+    // 去掉对齐多出来的部分
+    char* data = (char *)alignUp((uintptr_t)raw + page, M_HUGE_PAGE_SIZE);
+    char* start = data - page;
+    char* end = data + dataSize;
+    if (start > raw)
+        munmap(raw, start - raw);
+    if (raw + rawSize > end)
+        munmap(end, raw + rawSize - end);
+
+    madvise(data, dataSize, MADV_HUGEPAGE);
+    mapSize = page + dataSize;
+    getHeader(data)->origin = start;
+    return data;
+#else
+    return NULL;
+#endif
+}
+#endif
+
+static void* allocHugePage(size_t size, size_t alignment, int memClass, int mode) {
+#if defined(__linux__) && defined(_POSIX_MAPPED_FILES)
+    void* aligned = NULL;
+    size_t mapSize = 0;
+    int kind = MEMORY_KIND_MALLOC;
+    if (mode == minfer::HUGE_PAGE_HUGETLB && (aligned = allocHugetlb(size, alignment, mapSize)) != NULL) {
+        kind = MEMORY_KIND_HUGETLB;
+    } else if (alignment <= M_HUGE_PAGE_SIZE && (aligned = allocThp(size, mapSize)) != NULL) {
+        kind = MEMORY_KIND_THP;
+    }
+
+    if (!aligned) {
+        return NULL;
+    }
+
+    HugePageState& state = hugePageState();
+    std::lock_guard<std::mutex> lk(state.mutex);
+    minfer::HugePageInfo& info = state.infos[memClass];
+    info.requested_bytes += size;
+    if (kind == MEMORY_KIND_HUGETLB)
+        info.hugetlb_bytes += size;
+
+    MemoryHeader* header = getHeader(aligned);
+    header->mapSize = mapSize;
+    header->memClass = memClass;
+    header->kind = kind;
+    state.regions[(uintptr_t)aligned] = {size, memClass, kind};
+    return aligned;
+#else
+    return NULL;
+#endif
+}
+
+static void freeHugePage(void* aligned) {
+    MemoryHeader* header = getHeader(aligned);
+    if (header->kind == MEMORY_KIND_FALLBACK) {
+        HugePageState& state = hugePageState();
+        std::lock_guard<std::mutex> lk(state.mutex);
+        minfer::HugePageInfo& info = state.infos[header->memClass];
+        info.requested_bytes -= header->mapSize;
+        info.fallback_bytes -= header->mapSize;
+        free(header->origin);
+        return;
+    }
+
+    {
+        HugePageState& state = hugePageState();
+        std::lock_guard<std::mutex> lk(state.mutex);
+        auto it = state.regions.find((uintptr_t)aligned);
+        M_Assert(it != state.regions.end());
+        minfer::HugePageInfo& info = state.infos[it->second.memClass];
+        info.requested_bytes -= it->second.size;
+        if (it->second.kind == MEMORY_KIND_HUGETLB)
+            info.hugetlb_bytes -= it->second.size;
+        state.regions.erase(it);
+    }
+#if defined(_POSIX_MAPPED_FILES)
+    munmap(header->origin, header->mapSize);
+#endif
+}
+
+static void* allocClass(size_t size, int memClass, size_t alignment, bool zero) {
     M_Assert(size > 0);
+    M_Assert(0 <= memClass && memClass < minfer::MEMORY_CLASS_COUNT);
+    minfer::addAllocationCount();
+    alignment = std::max(alignment, sizeof(void *));
 
 #ifdef MU_DEBUG_MEMORY
-    return calloc(size, 1);
+    return zero ? calloc(size, 1) : malloc(size);
 #else
-    void **origin = (void **)calloc(size + sizeof(void *) + alignment, 1);
-    M_Assert(origin != NULL);
-    if (!origin) {
-        return NULL;
+    const int mode = minfer::getHugePageMode((minfer::MemoryClass)memClass);
+    if (size < M_HUGE_PAGE_SIZE || mode == minfer::HUGE_PAGE_OFF) {
+        return allocMalloc(size, alignment, memClass, zero);
+    }
+
+    // 匿名映射的内存本身就是0
+    void* aligned = allocHugePage(size, alignment, memClass, mode);
+    if (aligned) {
+        return aligned;
     }
-    void **aligned = alignPointer(origin + 1, alignment);
-    aligned[-1]    = origin;
+
+    aligned = allocMalloc(size, alignment, memClass, zero);
+    MemoryHeader* header = getHeader(aligned);
+    header->kind = MEMORY_KIND_FALLBACK;
+    header->mapSize = size;
+
+    HugePageState& state = hugePageState();
+    std::lock_guard<std::mutex> lk(state.mutex);
+    state.infos[memClass].requested_bytes += size;
+    state.infos[memClass].fallback_bytes += size;
     return aligned;
 #endif
 }
 
+extern "C" void *MMemoryAllocAlign(size_t size, size_t alignment) {
+    return allocClass(size, g_threadMemoryClass, alignment, false);
+}
+
+extern "C" void *MMemoryCallocAlign(size_t size, size_t alignment) {
+    return allocClass(size, g_threadMemoryClass, alignment, true);
+}
+
+extern "C" void *MMemoryAllocClass(size_t size, int memClass, size_t alignment) {
+    return allocClass(size, memClass, alignment, false);
+}
+
+extern "C" int MMemorySetThreadClass(int memClass) {
+    M_Assert(0 <= memClass && memClass < minfer::MEMORY_CLASS_COUNT);
+    int prev = g_threadMemoryClass;
+    g_threadMemoryClass = memClass;
+    return prev;
+}
+
 extern "C" void MMemoryFreeAlign(void *aligned) {
 #ifdef MU_DEBUG_MEMORY
     free(aligned);
 #else
     if (aligned) {
-        void *origin = ((void **)aligned)[-1];
-        free(origin);
+        MemoryHeader* header = getHeader(aligned);
+        if (header->kind == MEMORY_KIND_MALLOC)
+            free(header->origin);
+        else
+            freeHugePage(aligned);
     }
 #endif
 }
+
+extern "C" void MMemoryPrefetch(const void *addr, size_t size) {
+#if defined(_POSIX_MAPPED_FILES)
+    if (!addr || size == 0) {
+        return;
+    }
+    // 起始地址向下对齐到页
+    const size_t page = pageSize();
+    uintptr_t first = (uintptr_t)addr & ~(uintptr_t)(page - 1);
+    uintptr_t last = (uintptr_t)addr + size;
+    posix_madvise((void *)first, last - first, POSIX_MADV_WILLNEED);
+#endif
+}
+
+extern "C" void MMemoryDiscard(const void *addr, size_t size) {
+#if defined(_POSIX_MAPPED_FILES)
+    if (!addr || size == 0) {
+        return;
+    }
+    // 只丢弃完全在范围内的页，不影响相邻的数据
+    const size_t page = pageSize();
+    uintptr_t first = ((uintptr_t)addr + page - 1) & ~(uintptr_t)(page - 1);
+    uintptr_t last = ((uintptr_t)addr + size) & ~(uintptr_t)(page - 1);
+    if (last <= first) {
+        return;
+    }
+#if defined(MADV_DONTNEED)
+    // glibc中posix_madvise(POSIX_MADV_DONTNEED)不做任何事情，需要使用madvise
+    madvise((void *)first, last - first, MADV_DONTNEED);
+#else
+    posix_madvise((void *)first, last - first, POSIX_MADV_DONTNEED);
+#endif
+#endif
+}
+
+namespace minfer
+{
+
+void setHugePageMode(MemoryClass memClass, HugePageMode mode)
+{
+    M_Assert(0 <= memClass && memClass < MEMORY_CLASS_COUNT);
+    hugePageState().modes[memClass] = mode;
+}
+
+HugePageMode getHugePageMode(MemoryClass memClass)
+{
+    M_Assert(0 <= memClass && memClass < MEMORY_CLASS_COUNT);
+    return (HugePageMode)hugePageState().modes[memClass].load();
+}
+
+HugePageInfo getHugePageInfo(MemoryClass memClass)
+{
+    M_Assert(0 <= memClass && memClass < MEMORY_CLASS_COUNT);
+    HugePageState& state = hugePageState();
+    std::lock_guard<std::mutex> lk(state.mutex);
+    HugePageInfo info = state.infos[memClass];
+
+#if defined(__linux__)
+    // 透明大页是否生效由内核决定，从smaps中读取每个映射实际使用的大页。
+    // madvise之后大页部分是单独的映射，起始地址就是返回的指针。
+    FILE* f = fopen("/proc/self/smaps", "r");
+    if (!f)
+        return info;
+
+    char line[512];
+    const HugePageRegion* cur = nullptr;
+    while (fgets(line, sizeof(line), f))
+    {
+        unsigned long start = 0, end = 0;
+        size_t kb = 0;
+        if (sscanf(line, "%lx-%lx ", &start, &end) == 2)
+        {
+            auto it = state.regions.find((uintptr_t)start);
+            cur = it != state.regions.end() && it->second.kind == MEMORY_KIND_THP &&
+                    it->second.memClass == memClass ? &it->second : nullptr;
+        }
+        else if (cur && sscanf(line, "AnonHugePages: %zu kB", &kb) == 1)
+        {
+            info.thp_bytes += std::min(kb << 10, cur->size);
+            cur = nullptr;
+        }
+    }
+    fclose(f);
+#endif
+    return info;
+}
+
+}
@@ -25,6 +25,19 @@ extern "C" {
  */
 M_PUBLIC void* MMemoryAllocAlign(size_t size, size_t align = M_MEMORY_ALIGN_DEFAULT);
 
+/**
+ * @brief alloc memory for the given memory class (minfer::MemoryClass), it uses huge pages when the class enables them
+ * (see minfer::setHugePageMode) and size is not less than one huge page. `MMemoryAllocAlign` uses the class of current thread.
+ * @warning use `MMemoryFreeAlign` to free returned pointer.
+ */
+M_PUBLIC void* MMemoryAllocClass(size_t size, int memClass, size_t align = M_MEMORY_ALIGN_DEFAULT);
+
+/**
+ * @brief set the memory class used by `MMemoryAllocAlign` in current thread.
+ * @return the previous memory class.
+ */
+M_PUBLIC int MMemorySetThreadClass(int memClass);
+
 /**
  * @brief alloc memory with given size & alignment, and fill memory space with 0.
  * @param size  given size. size should > 0.
@@ -44,8 +57,45 @@ M_PUBLIC void* MMemoryCallocAlign(size_t size, size_t align = M_MEMORY_ALIGN_DEF
  */
 M_PUBLIC void MMemoryFreeAlign(void* mem);
 
+/**
+ * @brief ask the OS to read the pages of a file mapping in background, it returns immediately.
+ * @param addr  start address in the mapping, it will be aligned down to the page.
+ * @param size  size in bytes.
+ */
+M_PUBLIC void MMemoryPrefetch(const void* addr, size_t size);
+
+/**
+ * @brief drop the pages of a read-only file mapping from the process, they are read from the file again on next access.
+ * only the pages fully inside [addr, addr + size) are dropped.
+ * @warning do NOT pass the anonymous memory (e.g. returned by `MMemoryAllocAlign`), its content will be lost.
+ */
+M_PUBLIC void MMemoryDiscard(const void* addr, size_t size);
+
 
 #ifdef __cplusplus
+}
+
+namespace minfer
+{
+
+// 作用域内当前线程的MMemoryAllocAlign（包括Mat的内存）使用memClass，结束时恢复
+class MemoryClassScope
+{
+public:
+    explicit MemoryClassScope(int memClass)
+    : prev(MMemorySetThreadClass(memClass))
+    {
+    }
+
+    ~MemoryClassScope()
+    {
+        MMemorySetThreadClass(prev);
+    }
+
+private:
+    int prev;
+};
+
 }
 #endif
 #endif //MINFER_MEMORY_UTILS_H
@@ -15,6 +15,7 @@ Net::Net()
 
 Net::~Net()
 {
+    delete impl;
 }
 
 int Net::createLayer(std::shared_ptr<LayerParams> param)
@@ -35,6 +36,24 @@ void Net::readNet(const std::string path, const std::string modelType)
     return impl->readNet(path, modelType);
 }
 
+void Net::setWeightCachePath(const std::string& cachePath)
+{
+    M_Assert(impl != nullptr);
+    return impl->setWeightCachePath(cachePath);
+}
+
+void Net::setWeightStreaming(int window)
+{
+    M_Assert(impl != nullptr);
+    return impl->setWeightStreaming(window);
+}
+
+std::shared_ptr<Session> Net::createSession()
+{
+    M_Assert(impl != nullptr);
+    return impl->createSession();
+}
+
 void Net::setInput(const Mat input, const int mIndx)
 {
     M_Assert(impl != nullptr);
@@ -59,10 +78,44 @@ void Net::forward(Mat& out)
     return impl->forward(out);
 }
 
-void Net::generate(minfer::Mat &out)
+void Net::setPrefillChunkSize(int chunkSize)
 {
     M_Assert(impl != nullptr);
-    return impl->forward(out);
+    return impl->setPrefillChunkSize(chunkSize);
+}
+
+void Net::setOutputPositions(const std::vector<int>& positions)
+{
+    M_Assert(impl != nullptr);
+    return impl->setOutputPositions(positions);
+}
+
+void Net::generate(const std::vector<int>& prompt_ids, const SamplingParams& params, std::vector<int>& out_ids,
+                   const TokenCallback& callback)
+{
+    M_Assert(impl != nullptr);
+    return impl->generate(prompt_ids, params, out_ids, callback);
+}
+
+void Net::beamSearch(const std::vector<int>& prompt_ids, const BeamSearchParams& params, std::vector<BeamHypothesis>& out)
+{
+    M_Assert(impl != nullptr);
+    std::shared_ptr<Session> session = impl->createSession();
+    return session->beamSearch(prompt_ids, params, out);
+}
+
+void Net::embed(const std::vector<std::vector<int> >& texts, const EmbeddingParams& params, Mat& out)
+{
+    M_Assert(impl != nullptr);
+    std::shared_ptr<Session> session = impl->createSession();
+    return session->embed(texts, params, out);
+}
+
+void Net::score(const std::vector<int>& tokens, const ScoreParams& params, ScoreResult& result)
+{
+    M_Assert(impl != nullptr);
+    std::shared_ptr<Session> session = impl->createSession();
+    return session->score(tokens, params, result);
 }
 
 void Net::encode(const std::string text, std::vector<int> &out_ids)
@@ -78,6 +131,37 @@ void Net::decode(const std::vector<int> &out_ids, std::string &out_text)
     return impl->decode(out_ids, out_text);
 }
 
+size_t Net::getWeightBytes() const
+{
+    M_Assert(impl != nullptr);
+    return impl->getWeightBytes();
+}
+
+std::shared_ptr<Net> getModel(const std::string& path)
+{
+    return Runtime::getRuntime()->getModel(path);
+}
+
+void setModelMemoryBudget(size_t bytes)
+{
+    Runtime::getRuntime()->setModelMemoryBudget(bytes);
+}
+
+void setModelLoader(const ModelLoader& loader)
+{
+    Runtime::getRuntime()->setModelLoader(loader);
+}
+
+bool evictModel(const std::string& path)
+{
+    return Runtime::getRuntime()->evictModel(path);
+}
+
+ModelRegistryInfo getModelRegistryInfo()
+{
+    return Runtime::getRuntime()->getModelRegistryInfo();
+}
+
 
 //void Net::forward(std::vector<Mat>& outs, const std::vector<std::string> names)
 //{
@@ -3,7 +3,14 @@
 //
 
 #include "net.impl.h"
+#include "session.impl.h"
 #include "gguf_model/gguf_loader.h"
+#include "gguf_model/gguf_utils.h"
+#include "gguf_model/weight_cache.h"
+#include "parallel.h"
+#include "memory_utils.h"
+
+#include <set>
 
 namespace minfer
 {
@@ -27,187 +34,178 @@ void Net::NetImpl::readNet(const std::string path, const std::string modelType)
     // TODO Add model model type supported!
     std::vector<std::shared_ptr<LayerParams> > netParams;
     M_Assert(modelType == "gguf" && "Only GGUF model has been supported!");
+    M_Assert(lds.empty() && "The net has been created, please use a new Net to read another model!");
 
-    readGGUF(path, netParams, gguf_vocab);
+    readGGUF(path, netParams, gguf_vocab, modelData);
 
-    createNet(netParams);
-}
-
-void Net::NetImpl::setInput(const Mat input, const int _mIndx)
-{
-    int mIndx = _mIndx;
-    if (mIndx == -1)
+    if (!weightCachePath.empty())
     {
-        M_Assert(inputMatId.size() == 1);
-        mIndx = inputMatId[0];
+        // key不一致时才读取整个源模型计算hash，内容没有变化时仍然使用缓存，否则重新生成，
+        // 然后同样从缓存中加载，保证两种情况下layer使用的权重一致
+        std::string sourceKey = weightCacheSourceKey(path);
+        weightCache = loadWeightCache(weightCachePath, sourceKey, netParams);
+        if (!weightCache)
+        {
+            std::string sourceHash = weightCacheSourceHash(path);
+            weightCache = loadWeightCache(weightCachePath, sourceKey, netParams, sourceHash);
+            if (!weightCache)
+            {
+                writeWeightCache(weightCachePath, sourceKey, sourceHash, netParams);
+                weightCache = loadWeightCache(weightCachePath, sourceKey, netParams);
+                M_Assert(weightCache && "Fail to load the weight cache which is just written!");
+            }
+        }
     }
 
-    auto it = std::find(inputMatId.begin(), inputMatId.end(), mIndx);
-    const int index = it - inputMatId.begin();
+    createNet(netParams);
 
-    if (hasInit)
+    // 权重使用大页时，映射的内存只能是4KB的页，所以layer引用的映射内存全部拷贝到权重类别的内存中（weight streaming也就不再起作用）。
+    // 否则只在引用的部分不到映射的一半时拷贝，比如FP16或者量化的模型只剩下norm和embedding，NUMA模式下矩阵乘的权重已经切分。
+    // 没有layer引用的映射直接释放。
+    const bool hugePageWeights = getHugePageMode(MEMORY_CLASS_WEIGHT) != HUGE_PAGE_OFF;
+    for (std::shared_ptr<GGUF_context>* ctx : {&modelData, &weightCache})
     {
-        M_Assert(!inputMatClone[index].empty() && "Input Mat has not been set!");
+        if (!*ctx)
+            continue;
 
-        if (inputMatClone[index].size != input.size || inputMatClone[index].type() != input.type())
+        size_t bytes = 0;
+        std::set<const void*> counted;
+        for (auto& ld : lds)
         {
-            // 输入的Mat和之前的Mat不一样，需要重新初始化，重新分配内存
-            hasInit = false;
+            for (Mat* w : ld.layer->getWeights())
+            {
+                if (!w->empty() && gguf_owns_data(ctx->get(), w->data) && counted.insert(w->data).second)
+                    bytes += w->total() * DT_ELEM_SIZE(w->type());
+            }
         }
-    }
-    inputMatClone[index] = input.clone();
 
-    // Update input Mat pointer.
-    auto itLayerId = matId2layer.find(mIndx);
-    M_Assert(itLayerId != matId2layer.end());
+        if (bytes > 0 && (hugePageWeights || bytes * 2 < (*ctx)->size))
+        {
+            // 多个layer引用同一块内存时（tied embedding）替换为同一份拷贝
+            MemoryClassScope memScope(MEMORY_CLASS_WEIGHT);
+            std::map<const void*, Mat> copies;
+            for (auto& ld : lds)
+            {
+                for (Mat* w : ld.layer->getWeights())
+                {
+                    if (w->empty() || !gguf_owns_data(ctx->get(), w->data))
+                        continue;
+                    auto it = copies.find(w->data);
+                    if (it == copies.end())
+                        it = copies.insert({w->data, w->clone()}).first;
+                    *w = it->second;
+                }
+            }
+            bytes = 0;
+        }
+
+        if (bytes == 0)
+            *ctx = nullptr;
+    }
 
-    auto& ld = lds[itLayerId->second];
-    if (ld.layer->getType() == LayerType::Input)
+    // weight streaming按层换入换出的映射内存
+    for (auto& ld : lds)
     {
-        M_Assert(ld.inputsIdx.size() == 1);
+        for (Mat* w : ld.layer->getWeights())
+        {
+            if (!w->empty() && isMappedWeight(w->data))
+                ld.mappedWeights.push_back({w->data, w->total() * DT_ELEM_SIZE(w->type())});
+        }
+    }
+}
 
-        ld.inputs[0] = &inputMatClone[index];
+void Net::NetImpl::setWeightCachePath(const std::string& cachePath)
+{
+    weightCachePath = cachePath;
+}
 
-        auto itM = mats.find(index);
-        M_Assert(itM != mats.end());
+size_t Net::NetImpl::getWeightBytes() const
+{
+    return weightBytes;
+}
 
-        itM->second = &inputMatClone[index];
-    }
+void Net::NetImpl::setWeightStreaming(int window)
+{
+    M_Assert(window >= 0);
+    streamWindow = window;
 }
 
-void Net::NetImpl::forward(Mat& out)
+bool Net::NetImpl::isMappedWeight(const void* p) const
 {
-    if (!hasInit)
+    for (const GGUF_context* ctx : {modelData.get(), weightCache.get()})
     {
-        this->init();
-        hasInit = true;
+        if (ctx && ctx->mapping && gguf_owns_data(ctx, p))
+            return true;
     }
-    out = this->forward();
+    return false;
 }
 
-Mat Net::NetImpl::forward()
+void Net::NetImpl::prefetchLayerWeights(int layerId) const
 {
-    // TODO 完成这一步实现
-    for (auto it = lds.begin(); it != lds.end(); it++)
-    {
-        it->layer->forward(it->inputs, it->outputs);
-    }
+    for (const auto& w : lds[layerId].mappedWeights)
+        MMemoryPrefetch(w.first, w.second);
+}
 
-    M_Assert(outputMatId.size() == 1);
+void Net::NetImpl::discardLayerWeights(int layerId) const
+{
+    for (const auto& w : lds[layerId].mappedWeights)
+        MMemoryDiscard(w.first, w.second);
+}
 
-    Mat* m = this->getMat(outputMatId[0]);
-    M_Assert(m && "m can not be empty!");
-    return *m;
+std::shared_ptr<Session> Net::NetImpl::createSession()
+{
+    M_Assert(!lds.empty() && "Net is empty, please create net before creating session!");
+    return std::shared_ptr<Session>(new Session(new Session::SessionImpl(this)));
 }
 
-void Net::NetImpl::init()
+Session* Net::NetImpl::getDefaultSession()
 {
-    // build layerId 2 Custom
-    // TODO 优化下面代码，添加forward layer order部分优化，找到最佳的forward顺序。
-    // 为什么需要调用两次这个代码？考虑到创建是的layerId和Params中的LayerId是不一样的，创建好的和实际运行速度最优的layer order也是不一样。
-    // 所以这两个不一样需要调用两次这部分代码
-    for (auto it = lds.begin(); it != lds.end(); it++)
+    AutoLock lk(mutex);
+    if (!defaultSession)
     {
-        std::vector<int> currCustom = {};
-
-        // 如果只有一个输出，只需要找哪些层需要这个输出作为输入就行
-        const std::vector<int>& outputIndex = it->outputsIdx;
-
-        for (int i = 0; i < outputIndex.size(); i++)
-        {
-            int currOutIdx = outputIndex[i];
-            for (auto it2 = lds.begin(); it2 != lds.end(); it2++)
-            {
-                const std::vector<int> inputIndex = it2->inputsIdx;
-                auto itFind = std::find(inputIndex.begin(), inputIndex.end(), currOutIdx);
-                if (itFind != inputIndex.end())
-                {
-                    currCustom.push_back(it2->layerId);
-                }
-            }
-        }
-
-        it->layerCustomers = currCustom;
+        defaultSession = createSession();
     }
+    return defaultSession.get();
+}
 
-    // TODO 考虑将下面这段代码加入GPU
-    // 建立Mat的使用表格，能达到最好的复用策略。
-    // Mat表格指的是创建的Mat能在哪一层被释放
-    std::map<int, int> matReleaseAtLayer; // mat Id to layerId
-    for (auto it = mats.begin(); it != mats.end(); it++)
-    {
-        auto itLy = matId2layer.find(it->first);
-        M_Assert(itLy != matId2layer.end());
-
-        auto itLd = lds[itLy->second];
-
-        if (itLd.layerCustomers.size() == 0)
-            matReleaseAtLayer[it->first] = -1;
-        else
-        {
-            int lastCustomId = -1;
-            for (int i = 0; i < itLd.layerCustomers.size(); i++)
-            {
-                // ⚠️ 这里把最后一个包含此Mat的customId为释放的flag
-                int customId = itLd.layerCustomers[i];
-                if (customId > lastCustomId)
-                {
-                    // 查找这个custome layer的input是否包含这个Mat
-                    auto ld = lds[customId];
-
-                    const std::vector<int>& inputsIds = ld.inputsIdx;
-                    if (std::find(inputsIds.begin(), inputsIds.end(), it->first) != inputsIds.end())
-                    {
-                        lastCustomId = customId;
-                    }
-                }
-            }
+void Net::NetImpl::setInput(const Mat input, const int mIndx)
+{
+    getDefaultSession()->setInput(input, mIndx);
+}
 
-            // 找到这个mat能在那一层运行完之后被释放
-            matReleaseAtLayer[it->first] = lastCustomId;
-        }
-    }
+void Net::NetImpl::forward(Mat& out)
+{
+    getDefaultSession()->forward(out);
+}
 
-    // 调用runtime 分配和释放内存
-    for (auto it = lds.begin(); it != lds.end(); it++)
-    {
-        it->layer->init(it->inputs, it->outputs); // 计算shape
+Mat Net::NetImpl::forward()
+{
+    return getDefaultSession()->forward();
+}
 
-        // 分配内存
-        for (int i = 0; i < it->outputsIdx.size(); i++)
-        {
-            runtime->allocMat(it->outputs[i]);
+void Net::NetImpl::setPrefillChunkSize(int chunkSize)
+{
+    getDefaultSession()->setPrefillChunkSize(chunkSize);
+}
 
-            int outId = it->outputsIdx[i];
-            auto it2 = matReleaseAtLayer.find(outId);
+void Net::NetImpl::setOutputPositions(const std::vector<int>& positions)
+{
+    getDefaultSession()->setOutputPositions(positions);
+}
 
-            M_Assert(it2 != matReleaseAtLayer.end());
+void Net::NetImpl::generate(const std::vector<int>& prompt_ids, const SamplingParams& params, std::vector<int>& out_ids,
+                            const TokenCallback& callback)
+{
+    getDefaultSession()->generate(prompt_ids, params, out_ids, callback);
+}
 
-            if (it2->second == it->layerId)
-            {
-                runtime->deallocMat(it->outputs[i]); // 回收当前资源
-            }
-        }
-        //
-        // // 释放不用的资源，查找释放flag，确定是否在当前layerId释放
-        // for (int i = 0; i < it->outputsIdx.size(); i++)
-        // {
-        //     int outId = it->outputsIdx[i];
-        //     auto it2 = matReleaseAtLayer.find(outId);
-        //
-        //     M_Assert(it2 != matReleaseAtLayer.end());
-        //
-        //     if (it2->second == it->layerId)
-        //     {
-        //         runtime->deallocMat(it->outputs[i]); // 回收当前资源
-        //     }
-        // }
-    }
-    hasInit = true;
+void Net::NetImpl::init()
+{
+    getDefaultSession()->init();
 }
 
 void Net::NetImpl::createLayerRecurve(int layerIdx, std::vector<int>& isLayerCreated, const std::map<int,
-        std::vector<int> >& layer2Parent, const std::vector<std::shared_ptr<LayerParams> >& allLayerParams)
+        std::vector<int> >& layer2Parent, std::vector<int>& createOrder)
 {
     if (isLayerCreated[layerIdx])
     {
@@ -220,12 +218,48 @@ void Net::NetImpl::createLayerRecurve(int layerIdx, std::vector<int>& isLayerCre
 
     for (int i = 0; i < it->second.size(); i++)
     {
-        createLayerRecurve(it->second[i], isLayerCreated, layer2Parent, allLayerParams);
+        createLayerRecurve(it->second[i], isLayerCreated, layer2Parent, createOrder);
     }
 
-    if (createLayer(allLayerParams[layerIdx]) >= 0)
+    createOrder.push_back(layerIdx);
+    isLayerCreated[layerIdx] = 1;
+}
+
+// 多个layer引用同一个源tensor时（例如tied embedding，输出层直接使用token_embd.weight），
+// 非FP32的权重在这里只转换（或者反量化）一次，所有引用替换为同一个FP32 Mat，layer构造时通过weightToFloat共享这一份内存。
+static void shareTiedWeights(const std::vector<std::shared_ptr<LayerParams> >& allLayerParams)
+{
+    std::map<const void*, std::vector<std::pair<LayerParams*, Mat*> > > source2Weights;
+    for (auto& param : allLayerParams)
+    {
+        for (Mat* w : param->getWeights())
+        {
+            if (!w->empty() && w->type() != DT_32F)
+                source2Weights[w->data].push_back({param.get(), w});
+        }
+    }
+
+    for (auto& it : source2Weights)
     {
-        isLayerCreated[layerIdx] = 1;
+        auto& ws = it.second;
+        if (ws.size() < 2)
+            continue;
+
+        const Mat* w0 = ws[0].second;
+        const QuantType quantType = ws[0].first->getQuantType(w0);
+        for (auto& w : ws)
+        {
+            M_Assert(w.second->type() == w0->type() && w.second->shape() == w0->shape() &&
+                     w.first->getQuantType(w.second) == quantType && "Tied weights must have the same type and shape!");
+        }
+
+        Mat wFp32;
+        Layer::weightToFloat(*w0, wFp32, quantType);
+        for (auto& w : ws)
+        {
+            *w.second = wFp32;
+            w.first->setQuantType(w.second, QUANT_NONE);
+        }
     }
 }
 
@@ -265,15 +299,51 @@ void Net::NetImpl::createNet(const std::vector<std::shared_ptr<LayerParams> >& a
 
     M_Assert(outLayerIndex.size() > 0 && "Model is broken, it does not have output!!");
 
+    // 转换之后的权重属于权重类别的内存，可以使用大页
+    {
+        MemoryClassScope memScope(MEMORY_CLASS_WEIGHT);
+        shareTiedWeights(allLayerParams);
+    }
+
     std::vector<int> isLayerCreated(allLayerParams.size(), 0);
-    // 递归的调用createLayerParents，建立是否创建表格。
+    std::vector<int> createOrder;
+    // 递归的调用createLayerParents，建立是否创建表格，得到创建顺序。
     for (int i = 0; i < outLayerIndex.size(); i++)
     {
-        createLayerRecurve(outLayerIndex[i], isLayerCreated, layer2Parent, allLayerParams);
+        createLayerRecurve(outLayerIndex[i], isLayerCreated, layer2Parent, createOrder);
+    }
+
+    // layer的构造函数会读取并转换权重（mmap时第一次访问才从文件中读入），是启动时最耗时的部分。
+    // 各个layer之间没有依赖，多线程同时构造，之后再按照创建顺序依次加入Net，layer id和串行创建时一样。
+    std::vector<std::shared_ptr<Layer> > layers(createOrder.size());
+    parallel_for(0, createOrder.size(), [&](int i) {
+        MemoryClassScope memScope(MEMORY_CLASS_WEIGHT);
+        layers[i] = runtime->createLayer(allLayerParams[createOrder[i]]);
+    });
+
+    for (int i = 0; i < createOrder.size(); i++)
+    {
+        createLayer(allLayerParams[createOrder[i]], layers[i]);
+    }
+
+    // 按照layer实际持有的权重计算（转换、切分之后的），共享的权重只计算一次
+    std::set<const void*> counted;
+    for (auto& layer : layers)
+    {
+        for (Mat* w : layer->getWeights())
+        {
+            if (!w->empty() && counted.insert(w->data).second)
+                weightBytes += w->total() * DT_ELEM_SIZE(w->type());
+        }
     }
 }
 
 int Net::NetImpl::createLayer(std::shared_ptr<LayerParams> param)
+{
+    return createLayer(param, runtime->createLayer(param));
+}
+
+int Net::NetImpl::createLayer(std::shared_ptr<LayerParams> param, std::shared_ptr<Layer> layer)
 {
     AutoLock lk(mutex);
     // TODO 对inputlayer和outputlayer的特殊处理
@@ -284,7 +354,6 @@ int Net::NetImpl::createLayer(std::shared_ptr<LayerParams> param)
 
     LayerData ld = {};
     int layerId = lds.size();
-    std::shared_ptr<Layer> layer = runtime->createLayer(param);
 
     if (!layer)
     {
@@ -295,10 +364,8 @@ int Net::NetImpl::createLayer(std::shared_ptr<LayerParams> param)
     // 输入将会在setinput中进行初始化。
     if (param->type == LayerType::Input)
     {
-        inputMatClone.push_back(Mat());
-        inputMatId.push_back(param->inputIndex[0]);
         M_Assert(param->inputIndex.size() == 1);
-        mats[param->inputIndex[0]] = &inputMatClone[inputMatClone.size() - 1];
+        inputMatId.push_back(param->inputIndex[0]);
         inputLayers.push_back(layerId);
         matId2layer[param->inputIndex[0]] = layerId;
     }
@@ -310,31 +377,34 @@ int Net::NetImpl::createLayer(std::shared_ptr<LayerParams> param)
     }
 
     // 每一个层只管理自己的outputMat，而inputMat是由上面传下来的
-    std::vector<Mat*> inps(inputSize, nullptr);
+    // 这里只记录连接关系，Mat实体在Session中创建。
     for (int i = 0; i < inputSize; ++i)
     {
         int inputId = param->inputIndex[i];
-        Mat* m = getMat(inputId);
-        M_Assert(m && "The input Mat has not been created!");
-        inps[i] = m;
+        auto itLy = matId2layer.find(inputId);
+        M_Assert(itLy != matId2layer.end() && "The input Mat has not been created!");
+
+        // 记录上一层的customer
+        int parentId = itLy->second;
+        if (parentId != layerId)
+        {
+            auto& customers = lds[parentId].layerCustomers;
+            if (std::find(customers.begin(), customers.end(), layerId) == customers.end())
+                customers.push_back(layerId);
+        }
     }
 
     layer->setId(layerId);
     M_PRINT_DBG_(NULL, ("Creating Layer %s \n", layer->getName().c_str()));
-    std::vector<Mat*> outs(outputSize, nullptr);
     for (int i = 0; i < outputSize; ++i)
     {
         int outputMatId = param->outputIndex[i];
-        outs[i] = new Mat();
-        mats[outputMatId] = outs[i];
         matId2layer[outputMatId] = layerId;
     }
 
     ld.layerId = layerId;
     ld.layer = layer;
-    ld.inputs = inps;
     ld.inputsIdx = param->inputIndex;
-    ld.outputs = outs;
     ld.outputsIdx = param->outputIndex;
 
     lds.push_back(ld);
@@ -342,31 +412,6 @@ int Net::NetImpl::createLayer(std::shared_ptr<LayerParams> param)
     return layerId;
 }
 
-Mat *Net::NetImpl::getMat(const int matIdx)
-{
-    auto it = mats.find(matIdx);
-
-    if (it != mats.end())
-    {
-        return it->second;
-    }
-    else
-    {
-        return nullptr;
-    }
-}
-
-void Net::NetImpl::getMats(const std::vector<int> matsIdx, std::vector<Mat *> &mats)
-{
-    mats.clear();
-    mats.resize(matsIdx.size(), nullptr);
-
-    for (int i = 0; i < matsIdx.size(); i++)
-    {
-        mats[i] = getMat(matsIdx[i]);
-    }
-}
-
 void Net::NetImpl::decode(const std::vector<int> &out_ids, std::string &out_text)
 {
     M_Assert(gguf_vocab && "gguf_vocab is empty, can not decode!");
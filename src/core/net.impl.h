@@ -18,16 +18,19 @@ namespace minfer
 {
 
 class GGUF_Vocab;
+struct GGUF_context;
 
+// LayerData 只保存层和层之间的连接关系，Mat实体由Session持有。
 struct LayerData
 {
     int layerId = -1;
     std::shared_ptr<Layer> layer;
-    std::vector<Mat*> inputs;
     std::vector<int> inputsIdx;
-    std::vector<Mat*> outputs;
     std::vector<int> outputsIdx;
     std::vector<int> layerCustomers;
+
+    // layer直接引用的、在只读文件映射中的权重（地址，字节数），weight streaming时按层换入换出
+    std::vector<std::pair<const uchar*, size_t> > mappedWeights;
 };
 
 class Net::NetImpl
@@ -39,6 +42,22 @@ public:
     // 内部需要解析多个模型结构
     void readNet(const std::string path, const std::string modelType);
 
+    void setWeightCachePath(const std::string& cachePath);
+
+    size_t getWeightBytes() const;
+
+    // weight streaming，window为同时驻留内存的层数，0表示关闭
+    void setWeightStreaming(int window);
+
+    // 通知系统在后台读入第layerId层的权重
+    void prefetchLayerWeights(int layerId) const;
+
+    // 丢弃第layerId层权重的内存页，下次访问时重新从文件读取
+    void discardLayerWeights(int layerId) const;
+
+    std::shared_ptr<Session> createSession();
+
+    // 下面几个接口作用在默认的Session上
     void setInput(const Mat input, const int mIndx);
 
     // 此处转换出去的Mat必须是CPU内存
@@ -46,8 +65,19 @@ public:
 
     Mat forward();
 
+    // 设置prefill的chunk大小，<= 0表示不切分。
+    void setPrefillChunkSize(int chunkSize);
+
+    void setOutputPositions(const std::vector<int>& positions);
+
+    void generate(const std::vector<int>& prompt_ids, const SamplingParams& params, std::vector<int>& out_ids,
+                  const TokenCallback& callback);
+
     int createLayer(std::shared_ptr<LayerParams> param);
 
+    // 加入已经构造好的layer，返回layer id
+    int createLayer(std::shared_ptr<LayerParams> param, std::shared_ptr<Layer> layer);
+
     void createNet(const std::vector<std::shared_ptr<LayerParams> >& allLayerParams);
 
     void init(); // 初始化之后，调用系统中已经注册好的全局Backend变量。
@@ -57,30 +87,40 @@ public:
     void encode(const std::string text, std::vector<int> &out_ids);
 
 private:
+    friend class Session;
+
+    // p是否在源模型或者权重缓存的只读文件映射中
+    bool isMappedWeight(const void* p) const;
+
     void createLayerRecurve(int layerIdx, std::vector<int>& isLayerCreated, const std::map<int,
-            std::vector<int> >& layer2Parent, const std::vector<std::shared_ptr<LayerParams> >& allLayerParams);
+            std::vector<int> >& layer2Parent, std::vector<int>& createOrder);
 
-    Mat* getMat(const int matIdx);
-    void getMats(const std::vector<int> matsIdx, std::vector<Mat*>& mats);
+    // 兼容Net::setInput/forward的旧接口，第一次使用时创建
+    Session* getDefaultSession();
 
-    bool hasInit = false;           // 是否被初始化
     Mutex mutex;
-    std::vector<LayerData> lds;     // contains all layer data inform
-    std::map<int, Mat*> mats;       // Mat是用于层之间的数据传输的，这里建立MatId和Mat的对应关系
+    std::vector<LayerData> lds;     // contains all layer data inform, 创建完成之后不再修改
     std::map<int, int> matId2layer; // matId -> layerId, 每个Mat都属于一个层，一个层可以拥有多个Mat。实际这里的Mat都是对应层的output Mat。
 
-    std::vector<Mat> inputMatClone; // 包含Net输入Mat实体
     std::vector<int> inputMatId;    // 包含模型的输入Mat id
     std::vector<int> outputMatId;   // 包含模型的输出Mat
     std::vector<int> inputLayers;   // 存储input layer id
     std::vector<int> outputLayers;  // 存储output layer id
 
+    std::shared_ptr<Session> defaultSession = nullptr;
+
     // Runtime 相当于全局的资源管理器，其中包含多个。
     // TODO, 一个Net应该包含多个runtime或者backend，互相连接
     Runtime* runtime = nullptr; // 这里需要一个Runtime，用来管理所有的Device，以及所有的Tensor。// 是不是用Backend就可以，还是需要再封一层？
     // 需要一个全局单例模式去管理所有Device，然后再指向这个Device。
 
     std::shared_ptr<GGUF_Vocab> gguf_vocab = nullptr; // 用于存储gguf模型的vocab
+
+    size_t weightBytes = 0;                      // layer持有的权重的总和
+    std::shared_ptr<GGUF_context> modelData;     // 源模型的tensor内存或者mmap映射，还有layer直接引用时才保留
+    std::string weightCachePath;                 // 为空时不使用权重缓存
+    int streamWindow = 0;                        // weight streaming同时驻留的层数，0表示关闭
+    std::shared_ptr<GGUF_context> weightCache;   // 持有权重缓存的映射，layer直接引用其中的权重
 };
 
 }
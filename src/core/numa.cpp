@@ -0,0 +1,354 @@
+//
+// Created by mzh on 2025/3/19.
+//
+
+#include "numa.h"
+#include "parallel.h"
+#include "memory_utils.h"
+
+#include <cstdio>
+#include <cstdlib>
+#include <cstring>
+
+#if defined(__linux__)
+#include <sched.h>
+#endif
+
+namespace minfer
+{
+
+// 每个node的cpu列表，cpulist的格式为 "0-3,8-11"
+static std::vector<std::vector<int> > readNumaNodes()
+{
+    std::vector<std::vector<int> > nodes;
+#if defined(__linux__)
+    for (int node = 0; ; node++)
+    {
+        char path[128];
+        snprintf(path, sizeof(path), "/sys/devices/system/node/node%d/cpulist", node);
+        FILE* f = fopen(path, "r");
+        if (!f)
+            break;
+
+        std::vector<int> cpus;
+        char line[4096] = {0};
+        if (fgets(line, sizeof(line), f))
+        {
+            char* save = nullptr;
+            for (char* tok = strtok_r(line, ",\n", &save); tok; tok = strtok_r(nullptr, ",\n", &save))
+            {
+                int first = 0, last = 0;
+                int n = sscanf(tok, "%d-%d", &first, &last);
+                if (n == 1)
+                    last = first;
+                for (int c = first; n >= 1 && c <= last; c++)
+                    cpus.push_back(c);
+            }
+        }
+        fclose(f);
+        nodes.push_back(cpus);
+    }
+#endif
+    if (nodes.empty())
+        nodes.resize(1); // 空的cpu列表表示不绑定
+    return nodes;
+}
+
+static const std::vector<std::vector<int> >& numaNodes()
+{
+    static const std::vector<std::vector<int> > nodes = readNumaNodes();
+    return nodes;
+}
+
+int getNumaNodeCount()
+{
+    return (int)numaNodes().size();
+}
+
+bool bindThreadToNumaNode(int node)
+{
+#if defined(__linux__)
+    M_Assert(node >= 0 && node < getNumaNodeCount());
+    const std::vector<int>& cpus = numaNodes()[node];
+    if (cpus.empty())
+        return false;
+
+    cpu_set_t set;
+    CPU_ZERO(&set);
+    for (int c : cpus)
+    {
+        if (c < CPU_SETSIZE)
+            CPU_SET(c, &set);
+    }
+    return sched_setaffinity(0, sizeof(set), &set) == 0;
+#else
+    return false;
+#endif
+}
+
+// <<<<<<<<<<<<<<<<<<<<<   NumaPool   >>>>>>>>>>>>>>>>>>>>>>
+
+NumaPool::NumaPool(int _nodes, int workers)
+: nodes(_nodes)
+{
+    M_Assert(nodes > 0 && workers >= nodes);
+    threads.reserve(workers);
+    for (int i = 0; i < workers; i++)
+        threads.emplace_back(&NumaPool::workerLoop, this, i);
+}
+
+NumaPool::~NumaPool()
+{
+    {
+        std::lock_guard<std::mutex> lk(mutex);
+        stop = true;
+    }
+    taskCv.notify_all();
+    for (auto& th : threads)
+        th.join();
+}
+
+int NumaPool::getWorkerCount() const
+{
+    return (int)threads.size();
+}
+
+int NumaPool::getWorkerNode(int worker) const
+{
+    return worker % nodes;
+}
+
+void NumaPool::workerLoop(int worker)
+{
+    // 指定的node数量多于系统中的node时，多出来的部分绑定到已有的node上
+    bindThreadToNumaNode(getWorkerNode(worker) % getNumaNodeCount());
+
+    size_t seen = 0;
+    std::unique_lock<std::mutex> lk(mutex);
+    while (true)
+    {
+        taskCv.wait(lk, [&]() { return stop || generation != seen; });
+        if (stop)
+            return;
+        seen = generation;
+        const std::function<void(int)>* body = task;
+        lk.unlock();
+
+        try
+        {
+            (*body)(worker);
+        }
+        catch (...)
+        {
+            std::lock_guard<std::mutex> errLk(mutex);
+            if (!error)
+                error = std::current_exception();
+        }
+
+        lk.lock();
+        if (--pending == 0)
+            doneCv.notify_all();
+    }
+}
+
+void NumaPool::run(const std::function<void(int)>& body)
+{
+    std::lock_guard<std::mutex> runLk(runMutex);
+    std::exception_ptr err;
+    {
+        std::unique_lock<std::mutex> lk(mutex);
+        task = &body;
+        pending = (int)threads.size();
+        error = nullptr;
+        generation++;
+        taskCv.notify_all();
+        doneCv.wait(lk, [&]() { return pending == 0; });
+        task = nullptr;
+        std::swap(err, error);
+    }
+
+    if (err)
+        std::rethrow_exception(err);
+}
+
+// NUMA模式，见setNumaNodes
+struct NumaState
+{
+    std::mutex mutex;
+    int nodes = 0;
+    std::shared_ptr<NumaPool> pool;
+
+    NumaState()
+    {
+        if (const char* env = getenv("MINFER_NUMA_NODES"))
+            setNodes(atoi(env));
+    }
+
+    void setNodes(int n)
+    {
+        if (n < 0)
+            n = getNumaNodeCount();
+        if (n == nodes)
+            return;
+
+        pool.reset();
+        nodes = n;
+        if (nodes > 0)
+        {
+            // 每个node的worker数量相同
+            int perNode = std::max(1, getNumThreads() / nodes);
+            pool.reset(new NumaPool(nodes, perNode * nodes));
+        }
+    }
+};
+
+static NumaState& numaState()
+{
+    static NumaState state;
+    return state;
+}
+
+std::shared_ptr<NumaPool> NumaPool::get()
+{
+    NumaState& state = numaState();
+    std::lock_guard<std::mutex> lk(state.mutex);
+    return state.pool;
+}
+
+void setNumaNodes(int nodes)
+{
+    NumaState& state = numaState();
+    std::lock_guard<std::mutex> lk(state.mutex);
+    state.setNodes(nodes);
+}
+
+int getNumaNodes()
+{
+    NumaState& state = numaState();
+    std::lock_guard<std::mutex> lk(state.mutex);
+    return state.nodes;
+}
+
+// <<<<<<<<<<<<<<<<<<<<<   NumaWeight   >>>>>>>>>>>>>>>>>>>>>>
+
+void NumaWeight::reset(const Mat& _w, bool _transB)
+{
+    w = _w;
+    transB = _transB;
+    pool = nullptr;
+    shards.clear();
+    colBegin.clear();
+    if (w.empty())
+        return;
+
+    M_Assert(w.dims == 2);
+    in = transB ? w.size[1] : w.size[0];
+    out = transB ? w.size[0] : w.size[1];
+
+    pool = NumaPool::get();
+    if (!pool)
+        return;
+
+    M_Assert(w.type() == DT_32F);
+    const int workers = pool->getWorkerCount();
+    shards.resize(workers);
+    colBegin.resize(workers + 1);
+    for (int i = 0; i <= workers; i++)
+        colBegin[i] = (int)((int64_t)out * i / workers);
+
+    // 每个worker拷贝自己的那一段，第一次写入的线程决定内存页所在的node
+    const float* pw = (const float *)w.data;
+    pool->run([&](int i) {
+        const int c0 = colBegin[i];
+        const int n = colBegin[i + 1] - c0;
+        if (n == 0)
+            return;
+
+        MemoryClassScope memScope(MEMORY_CLASS_WEIGHT);
+        Mat s({n, in}, DT_32F);
+        float* ps = (float *)s.data;
+        if (transB)
+        {
+            memcpy(ps, pw + (size_t)c0 * in, (size_t)n * in * sizeof(float));
+        }
+        else
+        {
+            for (int k = 0; k < in; k++)
+            {
+                const float* row = pw + (size_t)k * out + c0;
+                for (int j = 0; j < n; j++)
+                    ps[(size_t)j * in + k] = row[j];
+            }
+        }
+        shards[i] = s;
+    });
+
+    // 之后只使用切分之后的权重
+    w = Mat();
+}
+
+namespace
+{
+struct NumaGemmTask
+{
+    const NumaWeight* weight;
+    const std::vector<Mat>* shards;
+    const std::vector<int>* colBegin;
+    const float* a;
+    float* c;
+    int rows;
+    int in;
+    int out;
+
+    // 每个worker使用gemm的kernel计算自己的那一段输出列，直接写入c中对应的列，不分配内存
+    void compute(int i) const
+    {
+        const int c0 = (*colBegin)[i];
+        const int n = (*colBegin)[i + 1] - c0;
+        if (n == 0)
+            return;
+        gemm_kernel(rows, n, in, a, in, (const float *)(*shards)[i].data, in, true, c + c0, out, false);
+    }
+};
+}
+
+Mat NumaWeight::gemm(const Mat& a) const
+{
+    if (shards.empty())
+        return minfer::gemm(a, w, false, transB);
+
+    M_Assert(a.type() == DT_32F && a.dims >= 2 && a.size[a.dims - 1] == in);
+
+    // 不使用MatShape，decode时不在堆上分配内存
+    int sizes[MAT_MAX_DIM];
+    for (int d = 0; d < a.dims; d++)
+        sizes[d] = a.size[d];
+    sizes[a.dims - 1] = out;
+    Mat c(a.dims, sizes, DT_32F);
+
+    NumaGemmTask task = {this, &shards, &colBegin, (const float *)a.data, (float *)c.data,
+                         (int)(a.total() / in), in, out};
+    const NumaGemmTask* t = &task;
+    pool->run([t](int i) { t->compute(i); });
+    return c;
+}
+
+bool NumaWeight::empty() const
+{
+    return w.empty() && shards.empty();
+}
+
+const Mat& NumaWeight::getMat() const
+{
+    return w;
+}
+
+std::vector<Mat*> NumaWeight::getWeights()
+{
+    std::vector<Mat*> weights = {&w};
+    for (Mat& s : shards)
+        weights.push_back(&s);
+    return weights;
+}
+
+}
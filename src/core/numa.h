@@ -0,0 +1,95 @@
+//
+// Created by mzh on 2025/3/19.
+//
+
+#ifndef MINFER_NUMA_H
+#define MINFER_NUMA_H
+
+#include "minfer/mat.h"
+
+#include <condition_variable>
+#include <exception>
+#include <functional>
+#include <memory>
+#include <mutex>
+#include <thread>
+#include <vector>
+
+namespace minfer
+{
+
+// 系统中的NUMA node，从/sys/devices/system/node读取，不支持时只有一个node
+int getNumaNodeCount();
+
+// 把当前线程绑定到node的cpu上，失败时返回false，线程仍然可以运行在任意cpu上
+bool bindThreadToNumaNode(int node);
+
+// NUMA模式下forward使用的worker，每个worker绑定到一个node，线程一直存在，不会每次forward都创建。
+// worker按node平均分配，worker i属于node i % nodes。
+class NumaPool
+{
+public:
+    NumaPool(int nodes, int workers);
+    ~NumaPool();
+
+    // 当前NUMA模式的pool，没有打开NUMA模式时返回空。setNumaNodes替换pool之后，
+    // 已经取得的pool仍然可以使用，直到最后一个持有者释放。
+    static std::shared_ptr<NumaPool> get();
+
+    int getWorkerCount() const;
+    int getWorkerNode(int worker) const;
+
+    // 所有worker执行body(worker)，当前线程等待全部完成。不分配内存，多个线程同时调用时依次执行。
+    // 任意一个worker抛出的异常在全部完成之后重新抛出。
+    void run(const std::function<void(int)>& body);
+
+private:
+    void workerLoop(int worker);
+
+    int nodes;
+    std::vector<std::thread> threads;
+
+    std::mutex runMutex;        // 同一时间只有一个任务
+    std::mutex mutex;
+    std::condition_variable taskCv;
+    std::condition_variable doneCv;
+    const std::function<void(int)>* task = nullptr;
+    size_t generation = 0;
+    int pending = 0;
+    bool stop = false;
+    std::exception_ptr error;
+};
+
+// 按输出列切分的权重矩阵。NUMA模式下每个worker持有一段连续的输出列，由worker自己拷贝（first-touch），
+// 内存落在worker所在的node上，gemm时每个worker只读取本地的权重。没有打开NUMA模式时只引用原来的权重。
+// 切分之后一直使用切分时的pool，之后修改NUMA模式不影响已经创建的权重。
+class NumaWeight
+{
+public:
+    // w为[in, out]，transB时为[out, in]
+    void reset(const Mat& w, bool transB = false);
+
+    // 和gemm(a, w, false, transB)相同，a为[..., in]，返回[..., out]
+    Mat gemm(const Mat& a) const;
+
+    bool empty() const;
+
+    // 没有切分时的权重，切分之后为空
+    const Mat& getMat() const;
+
+    // 持有的所有权重：没有切分时的权重和每个worker的一段，见Layer::getWeights
+    std::vector<Mat*> getWeights();
+
+private:
+    Mat w;
+    std::shared_ptr<NumaPool> pool; // 切分时使用的pool，gemm时由同一组worker计算
+    bool transB = false;
+    int in = 0;
+    int out = 0;
+    std::vector<Mat> shards;   // 每个worker一段，[cols, in]，每个输出列的权重连续存放
+    std::vector<int> colBegin; // 每段的起始列，最后一个是out
+};
+
+}
+
+#endif //MINFER_NUMA_H
@@ -0,0 +1,82 @@
+//
+// Created by mzh on 2025/3/18.
+//
+
+#include "parallel.h"
+
+#include <algorithm>
+#include <atomic>
+#include <cstdlib>
+#include <exception>
+#include <mutex>
+#include <thread>
+#include <vector>
+
+namespace minfer
+{
+
+int getNumThreads()
+{
+    if (const char* env = getenv("MINFER_NUM_THREADS"))
+    {
+        int n = atoi(env);
+        if (n > 0)
+            return n;
+    }
+
+    int n = (int)std::thread::hardware_concurrency();
+    return n > 0 ? n : 1;
+}
+
+void parallel_for(int begin, int end, const std::function<void(int)>& body, int nthreads)
+{
+    if (end <= begin)
+        return;
+
+    if (nthreads <= 0)
+        nthreads = getNumThreads();
+    nthreads = std::min(nthreads, end - begin);
+
+    if (nthreads == 1)
+    {
+        for (int i = begin; i < end; i++)
+            body(i);
+        return;
+    }
+
+    std::atomic<int> next(begin);
+    std::exception_ptr error;
+    std::mutex errorMutex;
+
+    auto worker = [&]() {
+        for (int i = next++; i < end; i = next++)
+        {
+            try
+            {
+                body(i);
+            }
+            catch (...)
+            {
+                std::lock_guard<std::mutex> lk(errorMutex);
+                if (!error)
+                    error = std::current_exception();
+                next = end; // 出错之后不再领取新的任务
+            }
+        }
+    };
+
+    // 当前线程也参与计算
+    std::vector<std::thread> threads;
+    threads.reserve(nthreads - 1);
+    for (int t = 1; t < nthreads; t++)
+        threads.emplace_back(worker);
+    worker();
+
+    for (auto& th : threads)
+        th.join();
+
+    if (error)
+        std::rethrow_exception(error);
+}
+
+}
@@ -0,0 +1,22 @@
+//
+// Created by mzh on 2025/3/18.
+//
+
+#ifndef MINFER_PARALLEL_H
+#define MINFER_PARALLEL_H
+
+#include <functional>
+
+namespace minfer
+{
+
+// 默认的线程数，可以通过环境变量MINFER_NUM_THREADS设置，否则使用硬件线程数
+int getNumThreads();
+
+// 在多个线程中执行body(i)，i属于[begin, end)。每个线程依次领取下一个i，所以耗时不均匀的任务也能保持负载均衡。
+// nthreads <= 0 时使用getNumThreads()。任意一个任务抛出的异常会在所有线程结束之后重新抛出。
+void parallel_for(int begin, int end, const std::function<void(int)>& body, int nthreads = 0);
+
+}
+
+#endif //MINFER_PARALLEL_H
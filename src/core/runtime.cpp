@@ -62,4 +62,169 @@ int Runtime::deallocMat(Mat *m)
     return backendCPU->deallocMat(m);
 }
 
+// 加载之前用文件大小估计模型的权重大小，文件不存在时返回0
+static size_t estimateModelBytes(const std::string& path)
+{
+    FILE* f = fopen(path.c_str(), "rb");
+    if (!f)
+        return 0;
+    fseek(f, 0, SEEK_END);
+    long size = ftell(f);
+    fclose(f);
+    return size > 0 ? (size_t)size : 0;
+}
+
+std::shared_ptr<Net> Runtime::getModel(const std::string& path)
+{
+    std::unique_lock<Mutex> lk(modelMutex);
+    while (true)
+    {
+        auto it = models.find(path);
+        if (it != models.end())
+        {
+            modelLru.splice(modelLru.begin(), modelLru, it->second.lruIt);
+            modelInfo.hit_count++;
+            return it->second.net;
+        }
+
+        // 其他线程正在加载同一个模型时等待它完成，加载失败时由这里重新加载
+        if (!loadingModels.count(path))
+            break;
+        modelCv.wait(lk);
+    }
+
+    // 先按照文件大小腾出空间，避免加载时内存峰值超出预算太多
+    evictForBudget(estimateModelBytes(path), "");
+
+    // 加载时不持有锁，其他模型的getModel不需要等待
+    loadingModels.insert(path);
+    ModelLoader loader = modelLoader;
+    lk.unlock();
+
+    std::shared_ptr<Net> net;
+    try
+    {
+        if (loader)
+        {
+            net = loader(path);
+        }
+        else
+        {
+            net = std::make_shared<Net>();
+            net->readNet(path);
+        }
+        M_Assert(net && "Fail to load the model!");
+    }
+    catch (...)
+    {
+        lk.lock();
+        loadingModels.erase(path);
+        modelCv.notify_all();
+        throw;
+    }
+
+    lk.lock();
+    loadingModels.erase(path);
+    modelCv.notify_all();
+
+    ModelEntry& entry = models[path];
+    entry.net = net;
+    entry.bytes = net->getWeightBytes();
+    modelLru.push_front(path);
+    entry.lruIt = modelLru.begin();
+    modelInfo.resident_bytes += entry.bytes;
+    modelInfo.load_count++;
+
+    // 实际大小可能比估计的大（例如FP16转换为FP32）
+    evictForBudget(0, path);
+
+    if (modelInfo.budget_bytes > 0 && modelInfo.resident_bytes + modelInfo.evicted_bytes > modelInfo.budget_bytes)
+        modelInfo.over_budget_count++;
+    return net;
+}
+
+void Runtime::evictForBudget(size_t incoming, const std::string& keep)
+{
+    collectEvictedModels();
+    if (modelInfo.budget_bytes == 0)
+        return;
+
+    auto lruIt = modelLru.end();
+    while (modelInfo.resident_bytes + modelInfo.evicted_bytes + incoming > modelInfo.budget_bytes &&
+           lruIt != modelLru.begin())
+    {
+        --lruIt;
+        if (*lruIt == keep)
+            continue;
+
+        removeModel(models.find(*lruIt));
+        modelInfo.evict_count++;
+        lruIt = modelLru.erase(lruIt);
+    }
+}
+
+void Runtime::removeModel(std::map<std::string, ModelEntry>::iterator it)
+{
+    modelInfo.resident_bytes -= it->second.bytes;
+
+    EvictedModel evicted;
+    evicted.net = it->second.net;
+    evicted.bytes = it->second.bytes;
+    models.erase(it);
+
+    if (!evicted.net.expired())
+    {
+        modelInfo.evicted_bytes += evicted.bytes;
+        evictedModels.push_back(evicted);
+    }
+}
+
+void Runtime::collectEvictedModels()
+{
+    for (auto it = evictedModels.begin(); it != evictedModels.end();)
+    {
+        if (it->net.expired())
+        {
+            modelInfo.evicted_bytes -= it->bytes;
+            it = evictedModels.erase(it);
+        }
+        else
+            ++it;
+    }
+}
+
+void Runtime::setModelMemoryBudget(size_t bytes)
+{
+    AutoLock lk(modelMutex);
+    modelInfo.budget_bytes = bytes;
+    evictForBudget(0, "");
+}
+
+void Runtime::setModelLoader(const ModelLoader& loader)
+{
+    AutoLock lk(modelMutex);
+    modelLoader = loader;
+}
+
+bool Runtime::evictModel(const std::string& path)
+{
+    AutoLock lk(modelMutex);
+    auto it = models.find(path);
+    if (it == models.end())
+        return false;
+
+    modelLru.erase(it->second.lruIt);
+    removeModel(it);
+    return true;
+}
+
+ModelRegistryInfo Runtime::getModelRegistryInfo()
+{
+    AutoLock lk(modelMutex);
+    collectEvictedModels();
+    ModelRegistryInfo info = modelInfo;
+    info.model_count = models.size();
+    return info;
+}
+
 }
\ No newline at end of file
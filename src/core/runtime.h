@@ -2,8 +2,14 @@
 #ifndef MINFER_RUNTIME_H
 #define MINFER_RUNTIME_H
 
+#include <condition_variable>
+#include <list>
+#include <map>
 #include <memory>
+#include <set>
 #include "minfer/layer.h"
+#include "minfer/net.h"
+#include "define.impl.h"
 
 // Add all backend here
 #include "backend/cpu/backend_cpu.h"
@@ -32,8 +38,52 @@ public:
 
     int deallocMat(Mat* m);
 
+    // >>>>>>>>>>>>>>>>>>>>>> 模型注册表 <<<<<<<<<<<<<<<<<<<<<<<<<<<<
+    // 按照路径缓存Net，超过内存预算时按照LRU释放。接口说明见net.h中的getModel等函数。
+    std::shared_ptr<Net> getModel(const std::string& path);
+
+    void setModelMemoryBudget(size_t bytes);
+
+    void setModelLoader(const ModelLoader& loader);
+
+    bool evictModel(const std::string& path);
+
+    ModelRegistryInfo getModelRegistryInfo();
+
 private:
     Runtime(); //Runtime 管理所有的Backend
+
+    // 从最久没有使用的模型开始释放，直到加入incoming字节之后不超过预算，keep不会被释放
+    void evictForBudget(size_t incoming, const std::string& keep);
+
+    struct ModelEntry
+    {
+        std::shared_ptr<Net> net;
+        size_t bytes = 0;
+        std::list<std::string>::iterator lruIt;
+    };
+
+    // 已经从注册表中释放、但是外部仍然持有shared_ptr的模型，内存在外部释放之前仍然计入预算
+    struct EvictedModel
+    {
+        std::weak_ptr<Net> net;
+        size_t bytes = 0;
+    };
+
+    // 从注册表中移除模型，外部仍然持有时记录到evictedModels，不修改modelLru
+    void removeModel(std::map<std::string, ModelEntry>::iterator it);
+
+    // 移除evictedModels中已经真正释放的模型
+    void collectEvictedModels();
+
+    Mutex modelMutex;
+    std::condition_variable_any modelCv;  // 模型加载完成（或者失败）时通知
+    std::map<std::string, ModelEntry> models;
+    std::set<std::string> loadingModels;  // 正在加载的模型，加载时不持有modelMutex
+    std::list<std::string> modelLru;      // 最近使用的在最前面
+    std::list<EvictedModel> evictedModels;
+    ModelLoader modelLoader;
+    ModelRegistryInfo modelInfo;
     std::shared_ptr<BackendCPU> backendCPU = nullptr; // cpu backend
 //    std::shared_ptr<BackendGPU> backendGPU = nullptr; // cpu backend
 };
@@ -0,0 +1,505 @@
+//
+// Created by mzh on 2025/3/12.
+//
+
+#include "sampler.h"
+#include "minfer/system.h"
+
+#include <algorithm>
+#include <cfloat>
+#include <cmath>
+#include <cstring>
+
+#if defined(__SSE2__)
+#include <emmintrin.h>
+#elif defined(__ARM_NEON)
+#include <arm_neon.h>
+#endif
+
+namespace minfer
+{
+
+namespace
+{
+
+// exp的多项式近似，和cephes库中的expf一致
+#define EXP_HI 88.3762626647949f
+#define EXP_LO -88.3762626647949f
+#define LOG2EF 1.44269504088896341f
+#define EXP_C1 0.693359375f
+#define EXP_C2 -2.12194440e-4f
+#define EXP_P0 1.9875691500E-4f
+#define EXP_P1 1.3981999507E-3f
+#define EXP_P2 8.3334519073E-3f
+#define EXP_P3 4.1665795894E-2f
+#define EXP_P4 1.6666665459E-1f
+#define EXP_P5 5.0000001201E-1f
+
+#if defined(__SSE2__)
+inline __m128 exp_ps(__m128 x)
+{
+    const __m128 one = _mm_set1_ps(1.f);
+    x = _mm_min_ps(x, _mm_set1_ps(EXP_HI));
+    x = _mm_max_ps(x, _mm_set1_ps(EXP_LO));
+
+    // fx = floor(x * log2(e) + 0.5)
+    __m128 fx = _mm_add_ps(_mm_mul_ps(x, _mm_set1_ps(LOG2EF)), _mm_set1_ps(0.5f));
+    __m128 tmp = _mm_cvtepi32_ps(_mm_cvttps_epi32(fx));
+    __m128 mask = _mm_and_ps(_mm_cmpgt_ps(tmp, fx), one);
+    fx = _mm_sub_ps(tmp, mask);
+
+    x = _mm_sub_ps(x, _mm_mul_ps(fx, _mm_set1_ps(EXP_C1)));
+    x = _mm_sub_ps(x, _mm_mul_ps(fx, _mm_set1_ps(EXP_C2)));
+    __m128 z = _mm_mul_ps(x, x);
+
+    __m128 y = _mm_set1_ps(EXP_P0);
+    y = _mm_add_ps(_mm_mul_ps(y, x), _mm_set1_ps(EXP_P1));
+    y = _mm_add_ps(_mm_mul_ps(y, x), _mm_set1_ps(EXP_P2));
+    y = _mm_add_ps(_mm_mul_ps(y, x), _mm_set1_ps(EXP_P3));
+    y = _mm_add_ps(_mm_mul_ps(y, x), _mm_set1_ps(EXP_P4));
+    y = _mm_add_ps(_mm_mul_ps(y, x), _mm_set1_ps(EXP_P5));
+    y = _mm_add_ps(_mm_mul_ps(y, z), x);
+    y = _mm_add_ps(y, one);
+
+    // 2^n
+    __m128i emm0 = _mm_cvttps_epi32(fx);
+    emm0 = _mm_add_epi32(emm0, _mm_set1_epi32(0x7f));
+    emm0 = _mm_slli_epi32(emm0, 23);
+    return _mm_mul_ps(y, _mm_castsi128_ps(emm0));
+}
+
+inline float hmax_ps(__m128 v)
+{
+    v = _mm_max_ps(v, _mm_shuffle_ps(v, v, _MM_SHUFFLE(1, 0, 3, 2)));
+    v = _mm_max_ps(v, _mm_shuffle_ps(v, v, _MM_SHUFFLE(2, 3, 0, 1)));
+    return _mm_cvtss_f32(v);
+}
+
+inline float hsum_ps(__m128 v)
+{
+    v = _mm_add_ps(v, _mm_shuffle_ps(v, v, _MM_SHUFFLE(1, 0, 3, 2)));
+    v = _mm_add_ps(v, _mm_shuffle_ps(v, v, _MM_SHUFFLE(2, 3, 0, 1)));
+    return _mm_cvtss_f32(v);
+}
+#elif defined(__ARM_NEON)
+inline float32x4_t exp_ps(float32x4_t x)
+{
+    const float32x4_t one = vdupq_n_f32(1.f);
+    x = vminq_f32(x, vdupq_n_f32(EXP_HI));
+    x = vmaxq_f32(x, vdupq_n_f32(EXP_LO));
+
+    // fx = floor(x * log2(e) + 0.5)
+    float32x4_t fx = vmlaq_f32(vdupq_n_f32(0.5f), x, vdupq_n_f32(LOG2EF));
+    float32x4_t tmp = vcvtq_f32_s32(vcvtq_s32_f32(fx));
+    uint32x4_t mask = vandq_u32(vcgtq_f32(tmp, fx), vreinterpretq_u32_f32(one));
+    fx = vsubq_f32(tmp, vreinterpretq_f32_u32(mask));
+
+    x = vmlsq_f32(x, fx, vdupq_n_f32(EXP_C1));
+    x = vmlsq_f32(x, fx, vdupq_n_f32(EXP_C2));
+    float32x4_t z = vmulq_f32(x, x);
+
+    float32x4_t y = vdupq_n_f32(EXP_P0);
+    y = vmlaq_f32(vdupq_n_f32(EXP_P1), y, x);
+    y = vmlaq_f32(vdupq_n_f32(EXP_P2), y, x);
+    y = vmlaq_f32(vdupq_n_f32(EXP_P3), y, x);
+    y = vmlaq_f32(vdupq_n_f32(EXP_P4), y, x);
+    y = vmlaq_f32(vdupq_n_f32(EXP_P5), y, x);
+    y = vmlaq_f32(x, y, z);
+    y = vaddq_f32(y, one);
+
+    // 2^n
+    int32x4_t mm = vcvtq_s32_f32(fx);
+    mm = vaddq_s32(mm, vdupq_n_s32(0x7f));
+    mm = vshlq_n_s32(mm, 23);
+    return vmulq_f32(y, vreinterpretq_f32_s32(mm));
+}
+
+inline float hmax_ps(float32x4_t v)
+{
+    float32x2_t m = vpmax_f32(vget_low_f32(v), vget_high_f32(v));
+    m = vpmax_f32(m, m);
+    return vget_lane_f32(m, 0);
+}
+
+inline float hsum_ps(float32x4_t v)
+{
+    float32x2_t s = vadd_f32(vget_low_f32(v), vget_high_f32(v));
+    s = vpadd_f32(s, s);
+    return vget_lane_f32(s, 0);
+}
+#endif
+
+float reduce_max(const float* x, int n)
+{
+    int i = 0;
+    float max_val = -FLT_MAX;
+#if defined(__SSE2__)
+    __m128 vmax = _mm_set1_ps(-FLT_MAX);
+    for (; i + 4 <= n; i += 4)
+    {
+        vmax = _mm_max_ps(vmax, _mm_loadu_ps(x + i));
+    }
+    max_val = hmax_ps(vmax);
+#elif defined(__ARM_NEON)
+    float32x4_t vmax = vdupq_n_f32(-FLT_MAX);
+    for (; i + 4 <= n; i += 4)
+    {
+        vmax = vmaxq_f32(vmax, vld1q_f32(x + i));
+    }
+    max_val = hmax_ps(vmax);
+#endif
+    for (; i < n; i++)
+    {
+        max_val = std::max(max_val, x[i]);
+    }
+    return max_val;
+}
+
+// y = exp((x - max_val) * scale)，返回sum(y)，y为空时只计算sum
+float exp_sum(const float* x, int n, float max_val, float scale, float* y)
+{
+    int i = 0;
+    float sum = 0.f;
+#if defined(__SSE2__)
+    const __m128 vmax = _mm_set1_ps(max_val);
+    const __m128 vscale = _mm_set1_ps(scale);
+    __m128 vsum = _mm_setzero_ps();
+    for (; i + 4 <= n; i += 4)
+    {
+        __m128 v = exp_ps(_mm_mul_ps(_mm_sub_ps(_mm_loadu_ps(x + i), vmax), vscale));
+        if (y)
+            _mm_storeu_ps(y + i, v);
+        vsum = _mm_add_ps(vsum, v);
+    }
+    sum = hsum_ps(vsum);
+#elif defined(__ARM_NEON)
+    const float32x4_t vmax = vdupq_n_f32(max_val);
+    const float32x4_t vscale = vdupq_n_f32(scale);
+    float32x4_t vsum = vdupq_n_f32(0.f);
+    for (; i + 4 <= n; i += 4)
+    {
+        float32x4_t v = exp_ps(vmulq_f32(vsubq_f32(vld1q_f32(x + i), vmax), vscale));
+        if (y)
+            vst1q_f32(y + i, v);
+        vsum = vaddq_f32(vsum, v);
+    }
+    sum = hsum_ps(vsum);
+#endif
+    for (; i < n; i++)
+    {
+        float v = expf((x[i] - max_val) * scale);
+        if (y)
+            y[i] = v;
+        sum += v;
+    }
+    return sum;
+}
+
+void scale_inplace(float* x, int n, float s)
+{
+    int i = 0;
+#if defined(__SSE2__)
+    const __m128 vs = _mm_set1_ps(s);
+    for (; i + 4 <= n; i += 4)
+    {
+        _mm_storeu_ps(x + i, _mm_mul_ps(_mm_loadu_ps(x + i), vs));
+    }
+#elif defined(__ARM_NEON)
+    const float32x4_t vs = vdupq_n_f32(s);
+    for (; i + 4 <= n; i += 4)
+    {
+        vst1q_f32(x + i, vmulq_f32(vld1q_f32(x + i), vs));
+    }
+#endif
+    for (; i < n; i++)
+    {
+        x[i] *= s;
+    }
+}
+
+}
+
+Sampler::Sampler(const SamplingParams& _params)
+: params(_params), rng(_params.seed)
+{
+}
+
+float Sampler::softmax(const float* logits, int n, float temperature, float* probs)
+{
+    M_Assert(n > 0 && temperature > 0.f);
+
+    // 一次遍历求max，一次遍历计算exp和sum，最后一次遍历归一化
+    const float scale = 1.f / temperature;
+    const float max_val = reduce_max(logits, n);
+    const float sum = exp_sum(logits, n, max_val, scale, probs);
+    scale_inplace(probs, n, 1.f / sum);
+    return logf(sum);
+}
+
+float Sampler::logSumExp(const float* logits, int n)
+{
+    M_Assert(n > 0);
+
+    // 一次遍历求max，一次遍历累加exp，不写出概率
+    const float max_val = reduce_max(logits, n);
+    return max_val + logf(exp_sum(logits, n, max_val, 1.f, nullptr));
+}
+
+const float* Sampler::applyRepetitionPenalty(const float* logits, int n_vocab, const std::vector<int>* history)
+{
+    if (!history || history->empty() || params.repetition_penalty == 1.0f || params.penalty_last_n == 0)
+        return logits;
+
+    const std::vector<int>& h = *history;
+    int start = params.penalty_last_n < 0 ? 0 : std::max(0, (int)h.size() - params.penalty_last_n);
+
+    // 同一个token出现多次只惩罚一次
+    penalized.assign(h.begin() + start, h.end());
+    std::sort(penalized.begin(), penalized.end());
+    penalized.erase(std::unique(penalized.begin(), penalized.end()), penalized.end());
+
+    logitsBuf.resize(n_vocab);
+    memcpy(logitsBuf.data(), logits, n_vocab * sizeof(float));
+    for (int id : penalized)
+    {
+        if (id < 0 || id >= n_vocab)
+            continue;
+
+        float& l = logitsBuf[id];
+        l = l > 0 ? l / params.repetition_penalty : l * params.repetition_penalty;
+    }
+    return logitsBuf.data();
+}
+
+void Sampler::selectTopK(const float* logits, int n_vocab, int k)
+{
+    // 堆顶是k个token中最小的，大部分token只需要和堆顶比较一次
+    auto greater = [](const TokenProb& a, const TokenProb& b) { return a.p > b.p; };
+
+    candidates.resize(k);
+    for (int i = 0; i < k; i++)
+    {
+        candidates[i] = {i, logits[i]};
+    }
+    std::make_heap(candidates.begin(), candidates.end(), greater);
+
+    float th = candidates.front().p;
+    for (int i = k; i < n_vocab; i++)
+    {
+        if (logits[i] <= th)
+            continue;
+
+        std::pop_heap(candidates.begin(), candidates.end(), greater);
+        candidates.back() = {i, logits[i]};
+        std::push_heap(candidates.begin(), candidates.end(), greater);
+        th = candidates.front().p;
+    }
+
+    // 从大到小排列
+    std::sort_heap(candidates.begin(), candidates.end(), greater);
+}
+
+int Sampler::prepareCandidates(const float* _logits, int n_vocab, const std::vector<int>* history)
+{
+    M_Assert(_logits && n_vocab > 0);
+
+    const float* logits = applyRepetitionPenalty(_logits, n_vocab, history);
+
+    // greedy，只有一个概率为1的候选
+    if (params.temperature <= 0.f)
+    {
+        const float max_val = reduce_max(logits, n_vocab);
+        candidates.resize(1);
+        candidates[0] = {(int)(std::find(logits, logits + n_vocab, max_val) - logits), 1.f};
+        return 1;
+    }
+
+    auto greater = [](const TokenProb& a, const TokenProb& b) { return a.p > b.p; };
+    const float inv_temp = 1.f / params.temperature;
+
+    int n = 0;
+    bool sorted = false;    // candidates是否已经按概率从大到小排列
+    float max_p = 0.f;
+
+    if (params.top_k > 0 && params.top_k < n_vocab)
+    {
+        // top-k之后只需要对k个token做softmax
+        n = params.top_k;
+        selectTopK(logits, n_vocab, n);
+
+        const float max_val = candidates[0].p;
+        float sum = 0.f;
+        for (int i = 0; i < n; i++)
+        {
+            candidates[i].p = expf((candidates[i].p - max_val) * inv_temp);
+            sum += candidates[i].p;
+        }
+        for (int i = 0; i < n; i++)
+        {
+            candidates[i].p /= sum;
+        }
+        sorted = true;
+        max_p = candidates[0].p;
+    }
+    else
+    {
+        // 整个vocab的softmax，概率最大的token的exp为1，所以 max_p = 1 / sum
+        probs.resize(n_vocab);
+        const float max_val = reduce_max(logits, n_vocab);
+        const float sum = exp_sum(logits, n_vocab, max_val, inv_temp, probs.data());
+        scale_inplace(probs.data(), n_vocab, 1.f / sum);
+        max_p = 1.f / sum;
+
+        // min-p 在收集候选的时候直接过滤
+        const float th = params.min_p > 0.f ? params.min_p * max_p : 0.f;
+        candidates.resize(n_vocab);
+        for (int i = 0; i < n_vocab; i++)
+        {
+            if (probs[i] >= th)
+                candidates[n++] = {i, probs[i]};
+        }
+    }
+
+    // min-p，至少保留概率最大的token
+    if (sorted && params.min_p > 0.f)
+    {
+        const float th = params.min_p * max_p;
+        int keep = 1;
+        while (keep < n && candidates[keep].p >= th)
+            keep++;
+        n = keep;
+    }
+
+    // top-p，没有排序时只对前m个做partial sort，累计概率不够时扩大m
+    if (params.top_p < 1.f)
+    {
+        if (!sorted)
+        {
+            int m = std::min(n, 64);
+            while (true)
+            {
+                std::partial_sort(candidates.begin(), candidates.begin() + m, candidates.begin() + n, greater);
+
+                float cum = 0.f;
+                for (int i = 0; i < m; i++)
+                    cum += candidates[i].p;
+
+                if (cum >= params.top_p || m == n)
+                    break;
+                m = std::min(n, m * 4);
+            }
+        }
+
+        float cum = 0.f;
+        int keep = 0;
+        while (keep < n)
+        {
+            cum += candidates[keep].p;
+            keep++;
+            if (cum >= params.top_p)
+                break;
+        }
+        n = keep;
+    }
+
+    return n;
+}
+
+int Sampler::sampleRow(const float* logits, int n_vocab, const std::vector<int>* history)
+{
+    const int n = prepareCandidates(logits, n_vocab, history);
+    if (n == 1)
+        return candidates[0].id;
+
+    // 在剩下的token中按概率采样，不需要排序
+    float total = 0.f;
+    for (int i = 0; i < n; i++)
+    {
+        total += candidates[i].p;
+    }
+
+    std::uniform_real_distribution<float> dist(0.f, total);
+    float r = dist(rng);
+    float acc = 0.f;
+    for (int i = 0; i < n; i++)
+    {
+        acc += candidates[i].p;
+        if (r < acc)
+            return candidates[i].id;
+    }
+    return candidates[n - 1].id;
+}
+
+void Sampler::getProbs(const float* logits, int n_vocab, const std::vector<int>& history, float* probs_out)
+{
+    const int n = prepareCandidates(logits, n_vocab, &history);
+
+    float total = 0.f;
+    for (int i = 0; i < n; i++)
+    {
+        total += candidates[i].p;
+    }
+
+    memset(probs_out, 0, n_vocab * sizeof(float));
+    const float inv_total = 1.f / total;
+    for (int i = 0; i < n; i++)
+    {
+        probs_out[candidates[i].id] = candidates[i].p * inv_total;
+    }
+}
+
+int Sampler::sampleProbs(const float* probs_in, int n)
+{
+    float total = 0.f;
+    for (int i = 0; i < n; i++)
+    {
+        total += probs_in[i];
+    }
+    M_Assert(total > 0.f && "The probability distribution is empty!");
+
+    float r = uniform() * total;
+    float acc = 0.f;
+    int last = 0;
+    for (int i = 0; i < n; i++)
+    {
+        if (probs_in[i] <= 0.f)
+            continue;
+
+        acc += probs_in[i];
+        last = i;
+        if (r < acc)
+            return i;
+    }
+    return last;
+}
+
+float Sampler::uniform()
+{
+    std::uniform_real_distribution<float> dist(0.f, 1.f);
+    return dist(rng);
+}
+
+int Sampler::sample(const float* logits, int n_vocab, const std::vector<int>& history)
+{
+    return sampleRow(logits, n_vocab, &history);
+}
+
+void Sampler::sample(const Mat& logits, const std::vector<std::vector<int> >& histories, std::vector<int>& out_ids)
+{
+    M_Assert((logits.dims == 2 || logits.dims == 3) && logits.type() == DT_32F);
+
+    const int batch = logits.size[0];
+    const int n_vocab = logits.size[logits.dims - 1];
+    const size_t rowStep = logits.total(1);     // 每个batch的元素数量
+    const size_t lastPos = rowStep - n_vocab;   // 最后一个位置的偏移
+    M_Assert(histories.empty() || histories.size() == batch);
+
+    out_ids.resize(batch);
+    for (int b = 0; b < batch; b++)
+    {
+        const float* p = (const float *)logits.data + b * rowStep + lastPos;
+        out_ids[b] = sampleRow(p, n_vocab, histories.empty() ? nullptr : &histories[b]);
+    }
+}
+
+}
@@ -0,0 +1,76 @@
+//
+// Created by mzh on 2025/3/12.
+//
+
+#ifndef MINFER_SAMPLER_H
+#define MINFER_SAMPLER_H
+
+#include "minfer/generate.h"
+#include "minfer/mat.h"
+
+#include <random>
+#include <vector>
+
+namespace minfer
+{
+
+// 根据SamplingParams从logits中选择下一个token。
+// 内部的buffer在多次调用之间复用，decode阶段不会重新分配内存。
+// 开启top_k时只对top_k个token计算exp；不开启时使用SIMD计算整个vocab的softmax，top_p只对需要的部分做partial sort。
+class Sampler
+{
+public:
+    explicit Sampler(const SamplingParams& params);
+
+    // logits长度为n_vocab，history为已经出现过的token（prompt + 生成的token），用于repetition penalty
+    int sample(const float* logits, int n_vocab, const std::vector<int>& history);
+
+    // 直接使用LinearLayer输出的logits，shape为 [batch, seq_len, n_vocab] 或 [batch, n_vocab]，
+    // 每个batch使用最后一个位置的logits采样一个token。histories为空或者和batch一一对应。
+    void sample(const Mat& logits, const std::vector<std::vector<int> >& histories, std::vector<int>& out_ids);
+
+    // 采样使用的概率分布，长度为n_vocab，被过滤掉的token概率为0，greedy时为one-hot。
+    void getProbs(const float* logits, int n_vocab, const std::vector<int>& history, float* probs);
+
+    // 按照概率（不需要归一化）采样，概率为0的token不会被选中
+    int sampleProbs(const float* probs, int n);
+
+    // [0, 1) 均匀分布的随机数
+    float uniform();
+
+    // probs = softmax(logits / temperature)，temperature必须大于0，返回 log(sum(exp(logits/temperature - max)))。
+    static float softmax(const float* logits, int n, float temperature, float* probs);
+
+    // log(sum(exp(logits)))，不需要额外的buffer，log_softmax(logits)[t] = logits[t] - logSumExp(logits, n)
+    static float logSumExp(const float* logits, int n);
+
+private:
+    struct TokenProb
+    {
+        int id;
+        float p;    // 先保存logits，softmax之后保存概率
+    };
+
+    int sampleRow(const float* logits, int n_vocab, const std::vector<int>* history);
+
+    // 依次执行penalty、top-k、temperature、min-p、top-p，剩下的token和概率（没有归一化）保存在candidates的前n个，返回n
+    int prepareCandidates(const float* logits, int n_vocab, const std::vector<int>* history);
+
+    // 返回做过repetition penalty的logits，没有惩罚时直接返回输入
+    const float* applyRepetitionPenalty(const float* logits, int n_vocab, const std::vector<int>* history);
+
+    // 使用大小为k的最小堆选择logits最大的k个token，结果从大到小排列
+    void selectTopK(const float* logits, int n_vocab, int k);
+
+    SamplingParams params;
+    std::mt19937 rng;
+
+    std::vector<float> logitsBuf;       // [n_vocab]，repetition penalty之后的logits
+    std::vector<float> probs;           // [n_vocab]，不开启top_k时的概率
+    std::vector<TokenProb> candidates;  // 参与采样的token
+    std::vector<int> penalized;         // 已经惩罚过的token
+};
+
+}
+
+#endif //MINFER_SAMPLER_H
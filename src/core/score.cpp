@@ -0,0 +1,72 @@
+//
+// Created by mzh on 2025/3/14.
+//
+
+#include "session.impl.h"
+#include "sampler.h"
+
+#include <algorithm>
+#include <chrono>
+#include <cmath>
+#include <cstring>
+
+namespace minfer
+{
+
+void Session::SessionImpl::score(const std::vector<int>& tokens, const ScoreParams& params, ScoreResult& result)
+{
+    M_Assert(tokens.size() >= 2 && "At least two tokens are needed for scoring!");
+    M_Assert(params.chunk_size > 0);
+
+    result = ScoreResult();
+    if (params.keep_token_logprobs)
+        result.token_logprobs.reserve(tokens.size() - 1);
+
+    // 每个位置的logits都需要，这里已经按照chunk推理，不再使用prefill的chunk切分。结束后恢复用户的设置
+    std::vector<int> userPositions = outputPositions;
+    const int userChunkSize = prefillChunkSize;
+    setOutputPositions({});
+    prefillChunkSize = 0;
+
+    auto t0 = std::chrono::steady_clock::now();
+
+    // 最后一个token只作为target，不需要输入
+    const int n = tokens.size() - 1;
+    Mat chunk;
+    for (int start = 0; start < n; start += params.chunk_size)
+    {
+        const int len = std::min(params.chunk_size, n - start);
+
+        // 只有最后一个较短的chunk会改变输入的shape
+        if (chunk.empty() || chunk.size[1] != len)
+            chunk = Mat({1, len}, DT_32S);
+        memcpy(chunk.data, tokens.data() + start, len * sizeof(int));
+        setInput(chunk, -1);
+
+        Mat logits = forward();
+        M_Assert(logits.dims == 3 && logits.size[1] == len && logits.type() == DT_32F);
+
+        const int n_vocab = logits.size[2];
+        for (int i = 0; i < len; i++)
+        {
+            const float* row = (const float *)logits.data + (size_t)i * n_vocab;
+            const int target = tokens[start + i + 1];
+            M_Assert(target >= 0 && target < n_vocab && "The token id is out of the vocab!");
+
+            float logprob = row[target] - Sampler::logSumExp(row, n_vocab);
+            result.sum_logprob += logprob;
+            if (params.keep_token_logprobs)
+                result.token_logprobs.push_back(logprob);
+        }
+    }
+
+    result.n_tokens = n;
+    result.perplexity = exp(-result.sum_logprob / n);
+    result.seconds = std::chrono::duration<double>(std::chrono::steady_clock::now() - t0).count();
+    result.tokens_per_second = result.seconds > 0 ? n / result.seconds : 0.0;
+
+    prefillChunkSize = userChunkSize;
+    setOutputPositions(userPositions);
+}
+
+}
@@ -0,0 +1,144 @@
+//
+// Created by mzh on 2025/3/16.
+//
+
+#include "scratch_allocator.h"
+#include "define.impl.h"
+#include "minfer/system.h"
+
+#include <algorithm>
+
+namespace minfer
+{
+
+ScratchAllocator::ScratchAllocator(size_t _align)
+: align(_align)
+{
+    M_Assert(align > 0);
+}
+
+ScratchAllocator::~ScratchAllocator()
+{
+    M_Assert(live == 0 && "Some temporary Mat is still alive when the scratch allocator is released!");
+    for (MatData* u : freeData)
+    {
+        delete u;
+    }
+
+    if (buffer)
+        MMemoryFreeAlign(buffer);
+}
+
+void ScratchAllocator::reserve(size_t bytes)
+{
+    M_Assert(live == 0 && "Can not resize the scratch memory when some temporary Mat is alive!");
+    bytes = UP_DIV(bytes, align) * align;
+    if (bytes <= capacity)
+        return;
+
+    if (buffer)
+        MMemoryFreeAlign(buffer);
+    buffer = (uchar *)MMemoryAllocClass(bytes, MEMORY_CLASS_ACTIVATION, align);
+    M_Assert(buffer && "Fail to allocate the scratch memory!");
+    capacity = bytes;
+    offset = 0;
+}
+
+void ScratchAllocator::reset()
+{
+    // 还有临时Mat被外部持有时不能回到起始位置，继续向后分配
+    if (live > 0)
+        return;
+
+    if (peak > capacity)
+        reserve(peak);
+
+    offset = 0;
+    peak = 0;
+}
+
+size_t ScratchAllocator::getCapacity() const
+{
+    return capacity;
+}
+
+size_t ScratchAllocator::getOverflowCount() const
+{
+    return overflowCount;
+}
+
+bool ScratchAllocator::inBuffer(const uchar* p) const
+{
+    return buffer && p >= buffer && p < buffer + capacity;
+}
+
+MatData* ScratchAllocator::allocate(int dims, const int* sizes, int type, void* data0) const
+{
+    size_t total = DT_ELEM_SIZE(type);
+    for (int i = dims - 1; i >= 0; i--)
+    {
+        total *= sizes[i];
+    }
+
+    MatData* u = nullptr;
+    if (freeData.empty())
+    {
+        u = new MatData(this);
+    }
+    else
+    {
+        u = freeData.back();
+        freeData.pop_back();
+        u->allocator = this;
+        u->refcount = 0;
+        u->flags = static_cast<MatData::MemoryFlag>(0);
+    }
+    u->size = total;
+
+    if (data0)
+    {
+        u->data = (uchar *)data0;
+        u->flags = MatData::USER_MEMORY;
+        return u;
+    }
+
+    const size_t alignedSize = UP_DIV(total, align) * align;
+    if (offset + alignedSize <= capacity)
+    {
+        u->data = buffer + offset;
+        offset += alignedSize;
+    }
+    else
+    {
+        // 容量不够，临时从堆上分配
+        u->data = (uchar *)MMemoryAllocClass(alignedSize, MEMORY_CLASS_ACTIVATION, align);
+        overflowCount++;
+    }
+    peak += alignedSize;
+    live++;
+    return u;
+}
+
+bool ScratchAllocator::allocate(MatData* u, MatDataUsageFlags) const
+{
+    return u != nullptr;
+}
+
+void ScratchAllocator::deallocate(MatData* u) const
+{
+    if (!u)
+        return;
+
+    M_Assert(u->refcount == 0);
+    if (u->flags != MatData::USER_MEMORY)
+    {
+        if (!inBuffer(u->data))
+            MMemoryFreeAlign(u->data);
+        live--;
+    }
+
+    u->data = nullptr;
+    freeData.push_back(u);
+}
+
+}
@@ -0,0 +1,75 @@
+//
+// Created by mzh on 2025/3/16.
+//
+
+#ifndef MINFER_SCRATCH_ALLOCATOR_H
+#define MINFER_SCRATCH_ALLOCATOR_H
+
+#include "minfer/mat.h"
+#include "memory_utils.h"
+
+#include <vector>
+
+namespace minfer
+{
+
+// layer forward中临时Mat使用的bump-pointer allocator，由Session持有。
+// 每个layer forward结束之后调用reset，下一个layer从头开始分配，所以容量只需要最大的layer workspace。
+// 放不下的Mat临时从堆上分配，同时记录峰值，下一次reset时扩容，之后的forward不会再调用malloc。
+// MatData也在内部复用，不会每次new/delete。只能在一个线程中使用。
+class ScratchAllocator : public MatAllocator
+{
+public:
+    explicit ScratchAllocator(size_t align = M_MEMORY_ALIGN_DEFAULT);
+    ~ScratchAllocator() override;
+
+    // 保证至少有bytes大小的内存，必须在没有存活的临时Mat时调用
+    void reserve(size_t bytes);
+
+    // 所有临时Mat都已经释放时，回到起始位置；如果上一轮超出了容量，按照峰值扩容
+    void reset();
+
+    size_t getCapacity() const;
+
+    // 超出容量，从堆上分配的次数
+    size_t getOverflowCount() const;
+
+    MatData* allocate(int dims, const int* sizes, int type, void* data) const override;
+    bool allocate(MatData* data, MatDataUsageFlags usageFlags) const override;
+    void deallocate(MatData* data) const override;
+
+private:
+    bool inBuffer(const uchar* p) const;
+
+    size_t align;
+    uchar* buffer = nullptr;
+    size_t capacity = 0;
+
+    mutable size_t offset = 0;          // 下一个Mat的起始位置
+    mutable size_t peak = 0;            // 本轮需要的内存，包含放不下的部分
+    mutable int live = 0;               // 还没有释放的临时Mat数量
+    mutable size_t overflowCount = 0;
+    mutable std::vector<MatData*> freeData; // 复用的MatData
+};
+
+// 作用域内当前线程新建的Mat使用scratch allocator，结束时恢复之前的allocator
+class ScratchScope
+{
+public:
+    explicit ScratchScope(ScratchAllocator* allocator)
+    : prev(Mat::setThreadAllocator(allocator))
+    {
+    }
+
+    ~ScratchScope()
+    {
+        Mat::setThreadAllocator(prev);
+    }
+
+private:
+    MatAllocator* prev;
+};
+
+}
+
+#endif //MINFER_SCRATCH_ALLOCATOR_H
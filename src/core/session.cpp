@@ -0,0 +1,112 @@
+//
+// Created by mzh on 2025/3/6.
+//
+
+#include "minfer/session.h"
+#include "session.impl.h"
+
+namespace minfer
+{
+
+Session::Session(SessionImpl* _impl)
+: impl(_impl)
+{
+}
+
+Session::~Session()
+{
+    delete impl;
+}
+
+void Session::setInput(const Mat input, const int mIndx)
+{
+    M_Assert(impl != nullptr);
+    return impl->setInput(input, mIndx);
+}
+
+void Session::init()
+{
+    M_Assert(impl != nullptr);
+    return impl->init();
+}
+
+void Session::forward(Mat& out)
+{
+    M_Assert(impl != nullptr);
+    out = impl->forward();
+}
+
+Mat Session::forward()
+{
+    M_Assert(impl != nullptr);
+    return impl->forward();
+}
+
+void Session::setPrefillChunkSize(int chunkSize)
+{
+    M_Assert(impl != nullptr);
+    return impl->setPrefillChunkSize(chunkSize);
+}
+
+void Session::setOutputPositions(const std::vector<int>& positions)
+{
+    M_Assert(impl != nullptr);
+    return impl->setOutputPositions(positions);
+}
+
+void Session::reset()
+{
+    M_Assert(impl != nullptr);
+    return impl->reset();
+}
+
+int Session::getPosition() const
+{
+    M_Assert(impl != nullptr);
+    return impl->getPosition();
+}
+
+Session::MemoryInfo Session::getMemoryInfo() const
+{
+    M_Assert(impl != nullptr);
+    return impl->getMemoryInfo();
+}
+
+void Session::truncate(int position)
+{
+    M_Assert(impl != nullptr);
+    return impl->truncate(position);
+}
+
+std::shared_ptr<Session> Session::fork() const
+{
+    M_Assert(impl != nullptr);
+    return std::shared_ptr<Session>(new Session(impl->fork()));
+}
+
+void Session::generate(const std::vector<int>& prompt_ids, const SamplingParams& params, std::vector<int>& out_ids,
+                       const TokenCallback& callback)
+{
+    M_Assert(impl != nullptr);
+    return impl->generate(prompt_ids, params, out_ids, callback);
+}
+
+void Session::beamSearch(const std::vector<int>& prompt_ids, const BeamSearchParams& params, std::vector<BeamHypothesis>& out)
+{
+    M_Assert(impl != nullptr);
+    return impl->beamSearch(prompt_ids, params, out);
+}
+
+void Session::embed(const std::vector<std::vector<int> >& texts, const EmbeddingParams& params, Mat& out)
+{
+    M_Assert(impl != nullptr);
+    return impl->embed(texts, params, out);
+}
+
+void Session::score(const std::vector<int>& tokens, const ScoreParams& params, ScoreResult& result)
+{
+    M_Assert(impl != nullptr);
+    return impl->score(tokens, params, result);
+}
+
+}
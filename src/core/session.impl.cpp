@@ -0,0 +1,682 @@
+//
+// Created by mzh on 2025/3/6.
+//
+
+#include "session.impl.h"
+#include "sampler.h"
+#include "define.impl.h"
+
+#include <algorithm>
+#include <cstring>
+
+namespace minfer
+{
+
+// 计算shape时输出Mat的占位地址。Mat::empty()在data为空时成立，下一层的init需要读取上一层输出的shape，
+// 所以init时先指向这里，layer的init不会访问数据，planMemory之后换成arena中的地址。
+static uchar g_shapeOnlyData[M_MEMORY_ALIGN_DEFAULT];
+
+Session::SessionImpl::SessionImpl(Net::NetImpl* _net)
+: net(_net)
+{
+    M_Assert(net);
+    runtime = net->runtime;
+
+    // 建立本会话的Mat，std::map中元素的地址不会改变，所以可以直接保存指针。
+    for (int i = 0; i < net->inputMatId.size(); i++)
+    {
+        mats[net->inputMatId[i]] = Mat();
+    }
+
+    const auto& lds = net->lds;
+    for (int i = 0; i < lds.size(); i++)
+    {
+        if (lds[i].layer->getType() == LayerType::GetRows)
+            hasGetRows = true;
+    }
+
+    // Output <- Linear(vocab投影) <- output norm，embedding模式只需要运行到output norm
+    if (net->outputLayers.size() == 1)
+    {
+        const LayerData& outLd = lds[net->outputLayers[0]];
+        auto it = net->matId2layer.find(outLd.inputsIdx[0]);
+        if (it != net->matId2layer.end() && lds[it->second].layer->getType() == LayerType::Linear)
+        {
+            const LayerData& headLd = lds[it->second];
+            auto itHidden = net->matId2layer.find(headLd.inputsIdx[0]);
+            if (itHidden != net->matId2layer.end())
+                hiddenLayer = itHidden->second;
+        }
+    }
+
+    layerInputs.resize(lds.size());
+    layerOutputs.resize(lds.size());
+    for (int i = 0; i < lds.size(); i++)
+    {
+        for (int j = 0; j < lds[i].outputsIdx.size(); j++)
+        {
+            layerOutputs[i].push_back(&mats[lds[i].outputsIdx[j]]);
+        }
+    }
+
+    for (int i = 0; i < lds.size(); i++)
+    {
+        for (int j = 0; j < lds[i].inputsIdx.size(); j++)
+        {
+            auto it = mats.find(lds[i].inputsIdx[j]);
+            M_Assert(it != mats.end() && "The input Mat has not been created!");
+            layerInputs[i].push_back(&it->second);
+        }
+    }
+}
+
+Session::SessionImpl::~SessionImpl()
+{
+    releaseMats();
+}
+
+void Session::SessionImpl::releaseMats()
+{
+    for (int i = 0; i < layerOutputs.size(); i++)
+    {
+        for (Mat* m : layerOutputs[i])
+        {
+            m->data = nullptr;
+        }
+    }
+
+    if (arena)
+    {
+        MMemoryFreeAlign(arena);
+        arena = nullptr;
+        arenaCapacity = 0;
+    }
+}
+
+int Session::SessionImpl::layerEnd() const
+{
+    return lastLayer < 0 ? (int)net->lds.size() : lastLayer + 1;
+}
+
+void Session::SessionImpl::setInput(const Mat input, const int _mIndx)
+{
+    int mIndx = _mIndx;
+    if (mIndx == -1)
+    {
+        M_Assert(net->inputMatId.size() == 1);
+        mIndx = net->inputMatId[0];
+    }
+
+    const auto& ids = net->inputMatId;
+    M_Assert(std::find(ids.begin(), ids.end(), mIndx) != ids.end() && "The given Mat index is not the input of Net!");
+
+    Mat& m = mats[mIndx];
+    if (m.u && m.size == input.size && m.type() == input.type())
+    {
+        // shape不变时直接拷贝，不需要重新分配内存和初始化
+        input.copyTo(m);
+    }
+    else
+    {
+        // 输入的Mat和之前的Mat不一样，需要重新初始化，重新分配内存
+        m = input.clone();
+        hasInit = false;
+    }
+}
+
+void Session::SessionImpl::init()
+{
+    std::vector<int> rows;
+    if (hasGetRows)
+    {
+        const Mat& inp = mats[net->inputMatId[0]];
+        M_Assert(inp.dims >= 2);
+        rows = resolveOutputRows(inp.size[1]);
+    }
+    initWithRows(rows);
+}
+
+std::vector<int> Session::SessionImpl::resolveOutputRows(int seqLen) const
+{
+    std::vector<int> rows;
+    for (int p : outputPositions)
+    {
+        int row = p < 0 ? seqLen + p : p;
+        M_Assert(row >= 0 && row < seqLen && "The output position is out of the input sequence!");
+        rows.push_back(row);
+    }
+
+    std::sort(rows.begin(), rows.end());
+    rows.erase(std::unique(rows.begin(), rows.end()), rows.end());
+    return rows;
+}
+
+// 执行计划按照seq_len分桶缓存：1（decode）、<=64、<=512，更长的输入按照512的倍数向上取整。
+// 同一个bucket中的输入使用按照bucket上限规划的内存，prefill和decode交替时只需要重新推理shape。
+static int seqBucket(int seqLen)
+{
+    if (seqLen <= 1)
+        return 1;
+    if (seqLen <= 64)
+        return 64;
+    return UP_DIV(seqLen, 512) * 512;
+}
+
+std::vector<int> Session::SessionImpl::planKey(const std::vector<int>& rows, MatShape& bucketShape) const
+{
+    // 输出的位置只影响GetRows之后的行数，rows为空时输出所有位置
+    std::vector<int> key = {lastLayer, (int)rows.size()};
+
+    bucketShape.clear();
+    if (net->inputMatId.size() == 1)
+    {
+        const Mat& inp = mats.at(net->inputMatId[0]);
+        bucketShape = inp.shape();
+        if (bucketShape.size() >= 2)
+            bucketShape[1] = seqBucket(bucketShape[1]);
+        key.insert(key.end(), bucketShape.begin(), bucketShape.end());
+    }
+    else
+    {
+        // 多个输入时不分桶，按照每个输入的shape区分
+        for (int id : net->inputMatId)
+        {
+            MatShape shape = mats.at(id).shape();
+            key.push_back(shape.size());
+            key.insert(key.end(), shape.begin(), shape.end());
+        }
+    }
+    return key;
+}
+
+void Session::SessionImpl::inferShapes(const std::vector<int>& rows)
+{
+    const auto& lds = net->lds;
+
+    LayerContext ctx;
+    ctx.output_rows = rows;
+
+    // 不运行的层没有内存
+    const int end = layerEnd();
+    for (int i = 0; i < lds.size(); i++)
+    {
+        for (Mat* m : layerOutputs[i])
+        {
+            m->data = nullptr;
+        }
+
+        if (i >= end)
+            continue;
+
+        lds[i].layer->init(layerInputs[i], layerOutputs[i], ctx); // 计算shape
+        for (Mat* m : layerOutputs[i])
+        {
+            m->data = g_shapeOnlyData;
+        }
+    }
+}
+
+void Session::SessionImpl::initWithRows(const std::vector<int>& rows)
+{
+    const auto& lds = net->lds;
+    M_Assert(layerOutputs.size() == lds.size() && "Net has been changed after the session was created!");
+    outputRows = rows;
+    const int end = layerEnd();
+
+    MatShape bucketShape;
+    std::vector<int> key = planKey(rows, bucketShape);
+    auto it = plans.find(key);
+    if (it == plans.end())
+    {
+        // 第一次遇到这个bucket：按照bucket的最大长度推理shape，规划内存并准备scratch
+        Mat* inp = nullptr;
+        Mat actualInput;
+        if (!bucketShape.empty())
+        {
+            inp = &mats[net->inputMatId[0]];
+            actualInput = *inp;
+            *inp = Mat(bucketShape, actualInput.type(), g_shapeOnlyData);
+        }
+
+        inferShapes(rows);
+        ExecPlan& plan = plans[key];
+        planMemory(end, plan);
+
+        // scratch内存按照最大的layer workspace准备
+        size_t workspace = 0;
+        for (int i = 0; i < end; i++)
+        {
+            workspace = std::max(workspace, lds[i].layer->getWorkspaceSize(layerInputs[i], layerOutputs[i]));
+        }
+        scratch.reserve(workspace);
+
+        if (inp)
+            *inp = actualInput;
+        it = plans.find(key);
+    }
+
+    // 按照实际的输入推理shape，每个输出Mat使用计划中的offset，长度不超过bucket上限，内存一定足够
+    inferShapes(rows);
+    const ExecPlan& plan = it->second;
+    int k = 0;
+    for (int i = 0; i < end; i++)
+    {
+        for (Mat* m : layerOutputs[i])
+        {
+            M_Assert(m->total() * DT_ELEM_SIZE(m->type()) <= plan.sizes[k]);
+            m->data = arena + plan.offsets[k++];
+        }
+    }
+    currentPlan = &plan;
+
+    hasInit = true;
+}
+
+void Session::SessionImpl::planMemory(int end, ExecPlan& plan)
+{
+    const auto& lds = net->lds;
+
+    // step1: 每个输出Mat的生存区间，从产生它的层到最后一个读取它的层。
+    // Net的输出以及embedding模式最后一层的输出在forward结束后还需要被读取，一直存活到最后。
+    std::map<int, int> matToBuffer;
+    std::map<int, int> lastUse;
+    for (int i = 0; i < end; i++)
+    {
+        for (int id : lds[i].inputsIdx)
+            lastUse[id] = i;
+    }
+
+    std::vector<int> keepAlive = net->outputMatId;
+    if (lastLayer >= 0)
+        keepAlive.insert(keepAlive.end(), lds[lastLayer].outputsIdx.begin(), lds[lastLayer].outputsIdx.end());
+
+    planner.clear();
+    for (int i = 0; i < end; i++)
+    {
+        for (int j = 0; j < lds[i].outputsIdx.size(); j++)
+        {
+            const int id = lds[i].outputsIdx[j];
+            const Mat* m = layerOutputs[i][j];
+
+            int last = i;
+            auto it = lastUse.find(id);
+            if (it != lastUse.end())
+                last = std::max(last, it->second);
+            if (std::find(keepAlive.begin(), keepAlive.end(), id) != keepAlive.end())
+                last = end;
+
+            matToBuffer[id] = planner.addBuffer(m->total() * DT_ELEM_SIZE(m->type()), i, last);
+        }
+    }
+
+    // step2: in-place，输入在这一层之后不再被使用，并且大小相同时，输出直接使用输入的内存（残差、Output层等）
+    for (int i = 0; i < end; i++)
+    {
+        int k = lds[i].layer->getInplaceInput();
+        if (k < 0 || k >= lds[i].inputsIdx.size() || lds[i].outputsIdx.empty())
+            continue;
+
+        const int inId = lds[i].inputsIdx[k];
+        auto itIn = matToBuffer.find(inId);     // Net的输入Mat由Session持有，不参与规划
+        if (itIn == matToBuffer.end() || lastUse[inId] != i)
+            continue;
+        if (std::find(keepAlive.begin(), keepAlive.end(), inId) != keepAlive.end())
+            continue;
+
+        const Mat* in = layerInputs[i][k];
+        const Mat* out = layerOutputs[i][0];
+        if (in->total() * DT_ELEM_SIZE(in->type()) != out->total() * DT_ELEM_SIZE(out->type()))
+            continue;
+
+        planner.setAlias(matToBuffer[lds[i].outputsIdx[0]], itIn->second);
+    }
+
+    // step3: 所有激活值放在一块内存中，所有计划共用同一个arena，按照最大的计划分配
+    size_t arenaSize = planner.plan();
+    if (arenaSize > arenaCapacity)
+    {
+        if (arena)
+            MMemoryFreeAlign(arena);
+        arena = (uchar *)MMemoryAllocClass(arenaSize, MEMORY_CLASS_ACTIVATION, M_MEMORY_ALIGN_DEFAULT);
+        M_Assert(arena && "Fail to allocate the activation memory!");
+        arenaCapacity = arenaSize;
+    }
+
+    plan.offsets.clear();
+    plan.sizes.clear();
+    for (int i = 0; i < end; i++)
+    {
+        for (int j = 0; j < lds[i].outputsIdx.size(); j++)
+        {
+            const Mat* m = layerOutputs[i][j];
+            plan.offsets.push_back(planner.getOffset(matToBuffer[lds[i].outputsIdx[j]]));
+            plan.sizes.push_back(m->total() * DT_ELEM_SIZE(m->type()));
+        }
+    }
+    plan.plannedBytes = planner.getPlannedSize();
+    plan.naiveBytes = planner.getNaiveSize();
+
+    M_PRINT_DBG_(NULL, ("Activation memory: planned = %zu bytes, naive = %zu bytes\n",
+            plan.plannedBytes, plan.naiveBytes));
+}
+
+Mat Session::SessionImpl::forward()
+{
+    M_Assert(net->outputMatId.size() == 1);
+    const size_t allocBegin = getAllocationCount();
+
+    Mat out;
+    // chunk prefill时按照chunk的shape初始化，这里不需要按完整的输入初始化
+    if (needChunkedPrefill())
+    {
+        out = forwardChunked();
+    }
+    else
+    {
+        if (!hasInit)
+            init();
+        out = forwardOnce();
+    }
+
+    forwardAllocations = getAllocationCount() - allocBegin;
+    return out;
+}
+
+bool Session::SessionImpl::needChunkedPrefill() const
+{
+    if (prefillChunkSize <= 0 || net->inputMatId.size() != 1)
+        return false;
+
+    const Mat& inp = mats.at(net->inputMatId[0]);
+    return inp.dims >= 2 && inp.size[1] > prefillChunkSize;
+}
+
+Mat Session::SessionImpl::forwardOnce()
+{
+    // 复用同一个LayerContext，output_rows容量足够时赋值不会分配内存
+    LayerContext& ctx = forwardCtx;
+    ctx.start_pos = kvCache.size();
+    ctx.kv_cache = &kvCache;
+    ctx.kv_caches.clear();
+    ctx.output_rows = outputRows;
+
+    runLayers(ctx);
+
+    // 输入shape为 [batch, seq_len]，本次的token都已经写入kv cache
+    const Mat& inp = mats[net->inputMatId[0]];
+    if (inp.dims >= 2)
+        kvCache.advance(inp.size[1]);
+
+    auto it = mats.find(net->outputMatId[0]);
+    M_Assert(it != mats.end() && "m can not be empty!");
+    return it->second;
+}
+
+void Session::SessionImpl::runLayers(LayerContext& ctx)
+{
+    const auto& lds = net->lds;
+    const int end = layerEnd();
+
+    // weight streaming：计算第i层时第i+window-1层的权重在后台读入，第i层计算完成之后丢弃。
+    // 多个Session同时推理时只会多读几次文件，不影响结果。
+    const int window = net->streamWindow;
+    for (int i = 0; i < std::min(window - 1, end); i++)
+        net->prefetchLayerWeights(i);
+
+    // layer中的临时Mat都从scratch内存分配，每一层结束后全部释放，下一层从头复用
+    ScratchScope scope(&scratch);
+    for (int i = 0; i < end; i++)
+    {
+        if (window > 0 && i + window - 1 < end)
+            net->prefetchLayerWeights(i + window - 1);
+
+        lds[i].layer->forward(layerInputs[i], layerOutputs[i], ctx);
+        scratch.reset();
+
+        if (window > 0)
+            net->discardLayerWeights(i);
+    }
+}
+
+Mat Session::SessionImpl::forwardBatch(const std::vector<KVCache*>& caches)
+{
+    M_Assert(net->inputMatId.size() == 1 && net->outputMatId.size() == 1);
+
+    const Mat& inp = mats[net->inputMatId[0]];
+    M_Assert(inp.dims >= 2 && inp.size[0] == caches.size() && "Every batch needs its own kv cache!");
+
+    if (!hasInit)
+        init();
+
+    LayerContext ctx;
+    ctx.kv_caches = caches;
+    ctx.output_rows = outputRows;
+
+    runLayers(ctx);
+
+    for (KVCache* c : caches)
+    {
+        c->advance(inp.size[1]);
+    }
+
+    if (lastLayer >= 0)
+        return *layerOutputs[lastLayer][0];
+    return mats[net->outputMatId[0]];
+}
+
+Mat Session::SessionImpl::forwardChunked()
+{
+    // 输入shape为 [batch, seq_len, ...]，沿着seq_len切分。
+    Mat& inputMat = mats[net->inputMatId[0]];
+    Mat fullInput = inputMat;
+    MatShape fullShape = fullInput.shape();
+    M_Assert(fullShape[0] == 1 && "Chunked prefill only supports single batch!");
+    const int seqLen = fullShape[1];
+    const size_t inStep = fullInput.total(2) * DT_ELEM_SIZE(fullInput.type());
+
+    // 整个输入中需要输出的位置，结果只保存这些行，峰值内存不随prompt长度增长。
+    // 没有GetRows层时每个chunk仍然计算所有位置，但同样只拷贝需要的行。
+    std::vector<int> fullRows = resolveOutputRows(seqLen);
+    if (fullRows.empty())
+    {
+        fullRows.resize(seqLen);
+        for (int i = 0; i < seqLen; i++)
+            fullRows[i] = i;
+    }
+
+    Mat result;
+    size_t outStep = 0;
+    int k = 0;  // fullRows中下一个需要输出的位置
+    std::vector<int> chunkRows;
+    for (int start = 0; start < seqLen; start += prefillChunkSize)
+    {
+        int chunkLen = std::min(prefillChunkSize, seqLen - start);
+
+        // 本chunk中需要输出的位置，没有时只保留最后一个位置，保证shape合法，结果不会被使用
+        const int kBegin = k;
+        chunkRows.clear();
+        while (k < fullRows.size() && fullRows[k] < start + chunkLen)
+        {
+            chunkRows.push_back(fullRows[k++] - start);
+        }
+        const int outNum = chunkRows.size();
+        if (chunkRows.empty())
+            chunkRows.push_back(chunkLen - 1);
+
+        std::vector<int> rows = hasGetRows ? chunkRows : std::vector<int>();
+
+        MatShape chunkShape = fullShape;
+        chunkShape[1] = chunkLen;
+
+        // chunk 直接引用输入数据，不拷贝
+        bool shapeChanged = inputMat.shape() != chunkShape;
+        inputMat = Mat(chunkShape, fullInput.type(), fullInput.data + start * inStep);
+
+        if (!hasInit || shapeChanged || rows != outputRows)
+        {
+            // 只有第一个chunk、最后一个较短的chunk以及输出位置变化时需要重新计算shape和分配内存
+            initWithRows(rows);
+        }
+
+        Mat out = forwardOnce();
+        if (outNum == 0)
+            continue;
+
+        if (result.empty())
+        {
+            MatShape outShape = out.shape();
+            M_Assert(outShape.size() >= 2);
+            outStep = out.total(2) * DT_ELEM_SIZE(out.type());
+            outShape[1] = fullRows.size();
+            result = Mat(outShape, out.type());
+        }
+
+        for (int j = 0; j < outNum; j++)
+        {
+            // 没有GetRows层时，chunk的输出包含所有位置
+            int outRow = hasGetRows ? j : chunkRows[j];
+            memcpy(result.data + (kBegin + j) * outStep, out.data + outRow * outStep, outStep);
+        }
+    }
+
+    inputMat = fullInput;
+    hasInit = false; // 中间Mat的shape是按照chunk计算的，下一次forward需要重新init
+    return result;
+}
+
+void Session::SessionImpl::generate(const std::vector<int>& prompt_ids, const SamplingParams& params,
+                                    std::vector<int>& out_ids, const TokenCallback& callback)
+{
+    M_Assert(!prompt_ids.empty() && "The prompt of generate can not be empty!");
+    if (params.max_new_tokens <= 0)
+        return;
+
+    Sampler sampler(params);
+
+    // 生成时只需要最后一个位置的logits，结束或者callback抛出异常时恢复用户的设置
+    OutputGuard guard(*this);
+    setOutputPositions({-1});
+
+    // repetition penalty需要的历史token
+    std::vector<int> history = prompt_ids;
+    history.reserve(prompt_ids.size() + params.max_new_tokens);
+
+    // prefill，只使用最后一个位置的logits
+    Mat prompt = Mat({1, (int)prompt_ids.size()}, DT_32S);
+    memcpy(prompt.data, prompt_ids.data(), prompt_ids.size() * sizeof(int));
+    setInput(prompt, -1);
+    Mat logits = forward();
+    M_Assert(logits.dims == 3 && logits.type() == DT_32F);
+
+    const int n_vocab = logits.size[2];
+    const float* p_logits = (const float *)logits.data + (size_t)(logits.size[1] - 1) * n_vocab;
+
+    // decode阶段输入的shape固定为 [1, 1]，只有第一步需要重新init，之后直接拷贝token，复用所有内存。
+    // 每个输出的token（包括最后一个）都会写入kv cache，下一次generate从这里继续。
+    Mat token = Mat({1, 1}, DT_32S);
+    for (int step = 0; step < params.max_new_tokens; step++)
+    {
+        int id = sampler.sample(p_logits, n_vocab, history);
+        out_ids.push_back(id);
+        history.push_back(id);
+
+        bool goOn = !callback || callback(id);
+
+        ((int *)token.data)[0] = id;
+        setInput(token, -1);
+
+        // 最后一个token的logits没有人使用，只写入kv cache
+        if (!goOn || id == params.eos_id || step + 1 == params.max_new_tokens)
+        {
+            forwardToCache();
+            break;
+        }
+
+        logits = forward();
+        p_logits = (const float *)logits.data;
+    }
+}
+
+void Session::SessionImpl::forwardToCache()
+{
+    OutputGuard guard(*this);
+    setOutputPositions({-1});
+    setLastLayer(hiddenLayer);
+    forward();
+}
+
+void Session::SessionImpl::setPrefillChunkSize(int chunkSize)
+{
+    prefillChunkSize = chunkSize;
+}
+
+void Session::SessionImpl::setOutputPositions(const std::vector<int>& positions)
+{
+    if (positions == outputPositions)
+        return;
+
+    outputPositions = positions;
+    hasInit = false;
+}
+
+void Session::SessionImpl::setLastLayer(int layer)
+{
+    if (layer == lastLayer)
+        return;
+
+    lastLayer = layer;
+    hasInit = false;
+}
+
+Session::SessionImpl::OutputGuard::OutputGuard(SessionImpl& _session)
+: session(_session), positions(_session.outputPositions), lastLayer(_session.lastLayer)
+{
+}
+
+Session::SessionImpl::OutputGuard::~OutputGuard()
+{
+    session.setOutputPositions(positions);
+    session.setLastLayer(lastLayer);
+}
+
+void Session::SessionImpl::reset()
+{
+    kvCache.clear();
+}
+
+Session::MemoryInfo Session::SessionImpl::getMemoryInfo() const
+{
+    MemoryInfo info;
+    if (currentPlan)
+    {
+        info.planned_bytes = currentPlan->plannedBytes;
+        info.naive_bytes = currentPlan->naiveBytes;
+    }
+    info.plan_count = plans.size();
+    info.arena_bytes = arenaCapacity;
+    info.scratch_bytes = scratch.getCapacity();
+    info.scratch_overflows = scratch.getOverflowCount();
+    info.forward_allocations = forwardAllocations;
+    return info;
+}
+
+int Session::SessionImpl::getPosition() const
+{
+    return kvCache.size();
+}
+
+void Session::SessionImpl::truncate(int position)
+{
+    kvCache.truncate(position);
+}
+
+Session::SessionImpl* Session::SessionImpl::fork() const
+{
+    SessionImpl* child = new SessionImpl(net);
+    child->prefillChunkSize = prefillChunkSize;
+    child->outputPositions = outputPositions;
+    child->kvCache = kvCache.fork();
+    return child;
+}
+
+}
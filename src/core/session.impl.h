@@ -0,0 +1,157 @@
+//
+// Created by mzh on 2025/3/6.
+//
+
+#ifndef MINFER_SESSION_IMPL_H
+#define MINFER_SESSION_IMPL_H
+
+#include "minfer/session.h"
+#include "net.impl.h"
+#include "kv_cache.h"
+#include "memory_planner.h"
+#include "scratch_allocator.h"
+
+#include <map>
+#include <vector>
+
+namespace minfer
+{
+
+class Session::SessionImpl
+{
+public:
+    explicit SessionImpl(Net::NetImpl* net);
+    ~SessionImpl();
+
+    void setInput(const Mat input, const int mIndx);
+
+    void init();
+
+    Mat forward();
+
+    void setPrefillChunkSize(int chunkSize);
+
+    void setOutputPositions(const std::vector<int>& positions);
+
+    void reset();
+
+    int getPosition() const;
+
+    MemoryInfo getMemoryInfo() const;
+
+    void truncate(int position);
+
+    // 新的SessionImpl共享kv cache的page，激活值内存单独分配
+    SessionImpl* fork() const;
+
+    void generate(const std::vector<int>& prompt_ids, const SamplingParams& params, std::vector<int>& out_ids,
+                  const TokenCallback& callback);
+
+    // 实现在beam_search.cpp
+    void beamSearch(const std::vector<int>& prompt_ids, const BeamSearchParams& params, std::vector<BeamHypothesis>& out);
+
+    // 实现在embedding.cpp
+    void embed(const std::vector<std::vector<int> >& texts, const EmbeddingParams& params, Mat& out);
+
+    // 实现在score.cpp
+    void score(const std::vector<int>& tokens, const ScoreParams& params, ScoreResult& result);
+
+    // 输入为 [batch, seq_len]，第b个batch使用caches[b]，推理结束后每个cache前进seq_len。会话自己的kv cache不变。
+    Mat forwardBatch(const std::vector<KVCache*>& caches);
+
+    // 只把当前input写入kv cache，不需要logits时使用：运行到output norm为止，跳过vocab投影
+    void forwardToCache();
+
+    // generate、beam search、embedding等临时修改输出位置（以及embedding模式下运行的层数）时使用，
+    // 析构时恢复用户的设置，forward或者callback抛出异常时同样会恢复。
+    class OutputGuard
+    {
+    public:
+        explicit OutputGuard(SessionImpl& session);
+        ~OutputGuard();
+
+    private:
+        SessionImpl& session;
+        std::vector<int> positions;
+        int lastLayer;
+    };
+
+private:
+    bool needChunkedPrefill() const;
+
+    // 一个shape bucket的执行计划：前layerEnd()层每个输出Mat在arena中的offset，按照层和输出的顺序排列
+    struct ExecPlan
+    {
+        std::vector<size_t> offsets;
+        std::vector<size_t> sizes;      // 按照bucket上限计算的大小
+        size_t plannedBytes = 0;
+        size_t naiveBytes = 0;
+    };
+
+    // 按照GetRows层保留的位置计算每一层的shape，使用对应bucket的执行计划，没有时先规划内存
+    void initWithRows(const std::vector<int>& rows);
+
+    // 按照当前的输入和保留的位置，调用每一层的init计算输出shape
+    void inferShapes(const std::vector<int>& rows);
+
+    // 执行计划的key，同时返回按照bucket取整之后的输入shape（多个输入时为空，不分桶）
+    std::vector<int> planKey(const std::vector<int>& rows, MatShape& bucketShape) const;
+
+    // 根据前end层输出Mat的生存区间规划内存，所有激活值放在arena中
+    void planMemory(int end, ExecPlan& plan);
+
+    // 把outputPositions转换成长度为seqLen的输入中从小到大排列的位置，为空表示所有位置
+    std::vector<int> resolveOutputRows(int seqLen) const;
+
+    // 依次运行前layerEnd()层，临时Mat使用scratch内存
+    void runLayers(LayerContext& ctx);
+
+    // 不切分chunk，所有层forward一次
+    Mat forwardOnce();
+
+    // 将长的prompt按照prefillChunkSize切分，依次forward，kv cache会逐渐增长
+    Mat forwardChunked();
+
+    // 释放所有层的输出内存
+    void releaseMats();
+
+    // 本次推理运行的层数，embedding模式下只运行到output norm
+    int layerEnd() const;
+
+    // 只运行到第layer层，-1运行所有层
+    void setLastLayer(int layer);
+
+    Net::NetImpl* net = nullptr;    // Session只读取Net中的层和连接关系
+    Runtime* runtime = nullptr;
+
+    bool hasInit = false;           // 是否被初始化
+    int prefillChunkSize = 0;       // prefill阶段每个chunk的token数量，峰值内存由chunk大小决定
+
+    bool hasGetRows = false;        // Net中是否有GetRows层，没有时总是输出所有位置
+    std::vector<int> outputPositions = {-1};    // 用户设置的输出位置，默认只输出最后一个位置
+    std::vector<int> outputRows;    // 当前init使用的位置，forward时传给GetRows层
+
+    int hiddenLayer = -1;           // vocab投影的Linear层的输入来自哪一层（output norm），没有时为-1
+    int lastLayer = -1;             // >= 0 时只运行到这一层，后面的层不init也不分配内存
+
+    std::map<int, Mat> mats;        // matId -> Mat，包含Net的输入Mat和每一层的输出Mat
+    std::vector<std::vector<Mat*> > layerInputs;  // 和net->lds一一对应
+    std::vector<std::vector<Mat*> > layerOutputs; // 和net->lds一一对应，内存是arena中的一段
+
+    MemoryPlanner planner;
+    std::map<std::vector<int>, ExecPlan> plans;  // 缓存的执行计划，输入shape在同一个bucket中时不需要重新规划
+    const ExecPlan* currentPlan = nullptr;
+    uchar* arena = nullptr;         // 所有执行计划和激活值共用的内存，只在需要更大的内存时重新分配
+    size_t arenaCapacity = 0;
+
+    ScratchAllocator scratch;       // layer forward中的临时Mat
+
+    KVCache kvCache;
+    LayerContext forwardCtx;        // forwardOnce使用的上下文
+
+    size_t forwardAllocations = 0;  // 最近一次forward中堆内存分配的次数
+};
+
+}
+
+#endif //MINFER_SESSION_IMPL_H
@@ -0,0 +1,282 @@
+//
+// Created by mzh on 2025/3/16.
+//
+
+#include "minfer/speculative.h"
+#include "sampler.h"
+#include "session.impl.h"
+
+#include <algorithm>
+#include <cstring>
+#include <memory>
+
+namespace minfer
+{
+
+namespace
+{
+
+Mat toTokenMat(const std::vector<int>& ids)
+{
+    Mat m = Mat({1, (int)ids.size()}, DT_32S);
+    memcpy(m.data, ids.data(), ids.size() * sizeof(int));
+    return m;
+}
+
+// 在history中查找和结尾的n-gram相同的、最近的一次出现，把它后面最多k个token作为draft
+void promptLookup(const std::vector<int>& history, const PromptLookupParams& lookup, int k, std::vector<int>& drafts)
+{
+    drafts.clear();
+    const int size = history.size();
+    for (int n = std::min(lookup.ngram_max, size - 1); n >= lookup.ngram_min && n > 0; n--)
+    {
+        const int tail = size - n;
+        for (int start = size - n - 1; start >= 0; start--)
+        {
+            if (!std::equal(history.begin() + start, history.begin() + start + n, history.begin() + tail))
+                continue;
+
+            int end = std::min(size, start + n + k);
+            drafts.assign(history.begin() + start + n, history.begin() + end);
+            return;
+        }
+    }
+}
+
+}
+
+SpeculativeGenerator::SpeculativeGenerator(Net& _target, Net& _draft, int _nDraft)
+: nDraft(_nDraft)
+{
+    M_Assert(nDraft > 0);
+    target = _target.createSession();
+    draft = _draft.createSession();
+}
+
+SpeculativeGenerator::SpeculativeGenerator(Net& _target, const PromptLookupParams& _lookup)
+: nDraft(_lookup.n_draft), lookup(_lookup)
+{
+    M_Assert(nDraft > 0 && lookup.ngram_min > 0 && lookup.ngram_max >= lookup.ngram_min);
+    target = _target.createSession();
+}
+
+void SpeculativeGenerator::reset()
+{
+    target->reset();
+    if (draft)
+        draft->reset();
+}
+
+int SpeculativeGenerator::getDraftedTokens() const
+{
+    return draftedTokens;
+}
+
+int SpeculativeGenerator::getAcceptedTokens() const
+{
+    return acceptedTokens;
+}
+
+std::shared_ptr<Session> SpeculativeGenerator::getTargetSession() const
+{
+    return target;
+}
+
+std::shared_ptr<Session> SpeculativeGenerator::getDraftSession() const
+{
+    return draft;
+}
+
+void SpeculativeGenerator::generate(const std::vector<int>& prompt_ids, const SamplingParams& params,
+                                    std::vector<int>& out_ids, const TokenCallback& callback)
+{
+    M_Assert(!prompt_ids.empty() && "The prompt of generate can not be empty!");
+    M_Assert(!draft || target->getPosition() == draft->getPosition());
+    if (params.max_new_tokens <= 0)
+        return;
+
+    const int startPos = target->getPosition();
+
+    // 下面会修改两个会话的输出位置，结束或者抛出异常时恢复用户的设置
+    Session::SessionImpl::OutputGuard targetGuard(*target->impl);
+    std::unique_ptr<Session::SessionImpl::OutputGuard> draftGuard;
+    if (draft)
+        draftGuard.reset(new Session::SessionImpl::OutputGuard(*draft->impl));
+
+    // target和draft使用各自的随机数，draft的过滤参数和target一致，q和p才是可比较的分布
+    Sampler targetSampler(params);
+    SamplingParams draftParams = params;
+    draftParams.seed = params.seed + 1;
+    Sampler draftSampler(draftParams);
+
+    std::vector<int> history = prompt_ids;
+    int produced = 0;
+
+    // 输出一个token，返回是否继续生成
+    auto emit = [&](int id) {
+        out_ids.push_back(id);
+        history.push_back(id);
+        produced++;
+        bool goOn = !callback || callback(id);
+        return goOn && id != params.eos_id && produced < params.max_new_tokens;
+    };
+
+    // step0: 两个模型都prefill prompt，第一个token由target采样
+    target->setOutputPositions({-1});
+    target->setInput(toTokenMat(prompt_ids));
+    Mat logits = target->forward();
+    const int n_vocab = logits.size[2];
+
+    Mat draftLogits;
+    if (draft)
+    {
+        draft->setOutputPositions({-1});
+        draft->setInput(toTokenMat(prompt_ids));
+        draftLogits = draft->forward();
+        M_Assert(draftLogits.size[2] == n_vocab && "The target and draft model must share the same vocabulary!");
+    }
+
+    int pending = targetSampler.sample((const float *)logits.data, n_vocab, history);
+    bool running = emit(pending);
+
+    // pending是已经输出、但还没有写入target kv cache的token；draftPending是还没有写入draft kv cache的token
+    std::vector<int> draftPending = {pending};
+    std::vector<int> drafts;
+    std::vector<int> seq;
+    std::vector<int> draftHistory;
+    std::vector<float> q((size_t)nDraft * n_vocab);
+    std::vector<float> p(n_vocab);
+
+    // 验证时需要所有位置的logits
+    target->setOutputPositions({});
+
+    while (running)
+    {
+        const int base = target->getPosition(); // pending的位置
+        int k = std::min(nDraft, params.max_new_tokens - produced);
+
+        // step1: draft模型逐个起草k个token，保存每一步的分布q
+        drafts.clear();
+        draftHistory = history;
+        if (draft)
+        {
+            for (int i = 0; i < k; i++)
+            {
+                draft->setInput(toTokenMat(draftPending));
+                draftLogits = draft->forward();
+
+                float* qi = q.data() + (size_t)i * n_vocab;
+                draftSampler.getProbs((const float *)draftLogits.data, n_vocab, draftHistory, qi);
+                int d = draftSampler.sampleProbs(qi, n_vocab);
+
+                drafts.push_back(d);
+                draftHistory.push_back(d);
+                draftPending = {d};
+            }
+        }
+        else
+        {
+            // prompt lookup的draft是确定的，q是one-hot，找不到时k为0，退化成普通的decode
+            promptLookup(history, lookup, k, drafts);
+            k = drafts.size();
+            for (int i = 0; i < k; i++)
+            {
+                float* qi = q.data() + (size_t)i * n_vocab;
+                memset(qi, 0, n_vocab * sizeof(float));
+                qi[drafts[i]] = 1.f;
+            }
+        }
+
+        // step2: target一次forward验证 [pending, d_1, ..., d_k]，第i个位置的输出是d_(i+1)的分布
+        seq.assign(1, pending);
+        seq.insert(seq.end(), drafts.begin(), drafts.end());
+        target->setInput(toTokenMat(seq));
+        logits = target->forward();
+        M_Assert(logits.size[1] == k + 1);
+
+        // step3: rejection sampling，以 min(1, p/q) 的概率接受d_i，拒绝时从 max(0, p - q) 中重新采样
+        int accepted = 0;
+        int next = -1;
+        draftHistory = history;
+        for (int i = 0; i < k; i++)
+        {
+            const int d = drafts[i];
+            const float* qi = q.data() + (size_t)i * n_vocab;
+            targetSampler.getProbs((const float *)logits.data + (size_t)i * n_vocab, n_vocab, draftHistory, p.data());
+
+            if (qi[d] > 0.f && targetSampler.uniform() * qi[d] < p[d])
+            {
+                accepted++;
+                draftHistory.push_back(d);
+                continue;
+            }
+
+            float residual = 0.f;
+            for (int j = 0; j < n_vocab; j++)
+            {
+                p[j] = std::max(0.f, p[j] - qi[j]);
+                residual += p[j];
+            }
+
+            // p和q完全一致时不会被拒绝，这里只是防止数值误差
+            if (residual <= 0.f)
+                targetSampler.getProbs((const float *)logits.data + (size_t)i * n_vocab, n_vocab, draftHistory, p.data());
+
+            next = targetSampler.sampleProbs(p.data(), n_vocab);
+            break;
+        }
+
+        // 所有的draft都被接受，从最后一个位置的分布中再采样一个token
+        if (next < 0)
+        {
+            targetSampler.getProbs((const float *)logits.data + (size_t)k * n_vocab, n_vocab, draftHistory, p.data());
+            next = targetSampler.sampleProbs(p.data(), n_vocab);
+        }
+
+        draftedTokens += k;
+        acceptedTokens += accepted;
+
+        // step4: 输出接受的token和新采样的token
+        for (int i = 0; i < accepted && running; i++)
+        {
+            running = emit(drafts[i]);
+        }
+        if (running)
+            running = emit(next);
+
+        // step5: 回退kv cache，只保留 pending 和被接受的draft
+        const int keep = base + 1 + accepted;
+        target->truncate(keep);
+
+        // draft的cache中没有最后一个draft，全部接受时需要在下一轮补上
+        if (draft)
+        {
+            const int draftLen = std::min(draft->getPosition(), keep);
+            draft->truncate(draftLen);
+            draftPending.assign(seq.begin() + (draftLen - base), seq.begin() + (keep - base));
+            draftPending.push_back(next);
+        }
+        pending = next;
+    }
+
+    // 和Session::generate一致，prompt和所有输出的token都写入kv cache，下一次generate从这里继续。
+    // history从startPos开始，cache中多出来的token被回退，缺少的token（最后一个输出的token，
+    // 以及draft中没有的被接受的draft）在这里补上。
+    const int validLen = startPos + history.size();
+    auto catchUp = [&](Session& s) {
+        s.truncate(std::min(s.getPosition(), validLen));
+        const int from = s.getPosition() - startPos;
+        if (from < history.size())
+        {
+            s.setInput(toTokenMat(std::vector<int>(history.begin() + from, history.end())));
+            s.impl->forwardToCache();
+        }
+        M_Assert(s.getPosition() == validLen);
+    };
+
+    catchUp(*target);
+    if (draft)
+        catchUp(*draft);
+}
+
+}
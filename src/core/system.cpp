@@ -93,6 +93,18 @@ std::string format( const char* fmt, ... )
     }
 }
 
+static thread_local size_t g_allocationCount = 0;
+
+void addAllocationCount()
+{
+    g_allocationCount++;
+}
+
+size_t getAllocationCount()
+{
+    return g_allocationCount;
+}
+
 Exception::Exception()
 {
     code = 0;
@@ -3,6 +3,7 @@
 //
 
 #include "../../src/core/allocator.h"
+#include "../../src/core/kv_cache.h"
 #include "gtest/gtest.h"
 
 using namespace minfer;
@@ -35,4 +36,75 @@ TEST(Allocator, memory_test)
     auto p4 = allocator->alloc(1100);
 
     M_Assert(p2.first == p4.first);
-}
\ No newline at end of file
+}
+
+TEST(Allocator, huge_page_test)
+{
+    const size_t hugePage = 2 << 20;
+    const size_t before = getHugePageInfo(MEMORY_CLASS_WEIGHT).requested_bytes;
+
+    for (HugePageMode mode : {HUGE_PAGE_MADVISE, HUGE_PAGE_HUGETLB})
+    {
+        setHugePageMode(MEMORY_CLASS_WEIGHT, mode);
+
+        // 小于一个大页的内存不使用大页
+        void* small = MMemoryAllocClass(4096, MEMORY_CLASS_WEIGHT);
+        M_Assert(getHugePageInfo(MEMORY_CLASS_WEIGHT).requested_bytes == before);
+
+        const size_t size = 2 * hugePage + 100;
+        char* p = (char *)MMemoryAllocClass(size, MEMORY_CLASS_WEIGHT, 128);
+        M_Assert(p && (uintptr_t)p % 128 == 0);
+        memset(p, 1, size);
+
+        // 没有预留hugetlbfs的大页或者不支持透明大页时退回普通内存，三者之和总是申请的大小
+        HugePageInfo info = getHugePageInfo(MEMORY_CLASS_WEIGHT);
+        std::cout<<"huge page mode "<<mode<<": hugetlb "<<info.hugetlb_bytes<<", thp "<<info.thp_bytes
+                 <<", fallback "<<info.fallback_bytes<<std::endl;
+        M_Assert(info.requested_bytes == before + size);
+        M_Assert(info.thp_bytes + info.hugetlb_bytes + info.fallback_bytes <= info.requested_bytes);
+        M_Assert(info.hugetlb_bytes == 0 || mode == HUGE_PAGE_HUGETLB);
+
+        MMemoryFreeAlign(p);
+        MMemoryFreeAlign(small);
+        info = getHugePageInfo(MEMORY_CLASS_WEIGHT);
+        M_Assert(info.requested_bytes == before);
+
+        // Mat的内存使用当前线程的内存类别
+        {
+            MemoryClassScope scope(MEMORY_CLASS_WEIGHT);
+            Mat m({1024, 1024}, DT_32F);
+            M_Assert(getHugePageInfo(MEMORY_CLASS_WEIGHT).requested_bytes == before + m.total() * sizeof(float));
+        }
+        M_Assert(getHugePageInfo(MEMORY_CLASS_WEIGHT).requested_bytes == before);
+    }
+    setHugePageMode(MEMORY_CLASS_WEIGHT, HUGE_PAGE_OFF);
+}
+
+TEST(Allocator, huge_page_kv_cache_test)
+{
+    setHugePageMode(MEMORY_CLASS_KV_CACHE, HUGE_PAGE_MADVISE);
+    {
+        // page从大页的chunk中切分，fork之后写入仍然是copy-on-write
+        const int kvDim = 8;
+        KVCache cache(4);
+        cache.prepare(0, 64, kvDim);
+        std::vector<float> k(kvDim), v(kvDim);
+        for (int pos = 0; pos < 10; pos++)
+        {
+            std::fill(k.begin(), k.end(), (float)pos);
+            std::fill(v.begin(), v.end(), -(float)pos);
+            cache.write(0, pos, k.data(), v.data());
+        }
+        cache.advance(10);
+        M_Assert(getHugePageInfo(MEMORY_CLASS_KV_CACHE).requested_bytes >= (2 << 20));
+
+        KVCache forked = cache.fork();
+        std::fill(k.begin(), k.end(), 100.f);
+        forked.write(0, 5, k.data(), v.data());
+        M_Assert(cache.k(0, 5)[0] == 5.f && forked.k(0, 5)[0] == 100.f);
+        for (int pos = 0; pos < 10; pos++)
+            M_Assert(cache.k(0, pos)[kvDim - 1] == pos && cache.v(0, pos)[0] == -pos);
+    }
+    M_Assert(getHugePageInfo(MEMORY_CLASS_KV_CACHE).requested_bytes == 0);
+    setHugePageMode(MEMORY_CLASS_KV_CACHE, HUGE_PAGE_OFF);
+}
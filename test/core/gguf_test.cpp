@@ -0,0 +1,124 @@
+//
+// Created by mzh on 2025/3/18.
+//
+
+#include "../../src/core/gguf_model/gguf_utils.h"
+#include "minfer.h"
+#include "gtest/gtest.h"
+#include <cstdio>
+#include <string>
+#include <vector>
+
+using namespace minfer;
+
+// 写一个最小的gguf文件（GGUFv3），只有general.alignment一个kv
+static void writeTinyGGUF(const std::string& path, const std::vector<std::string>& names,
+                          const std::vector<std::vector<int64_t> >& shapes, const std::vector<std::vector<float> >& datas)
+{
+    FILE* f = fopen(path.c_str(), "wb");
+    M_Assert(f);
+
+    size_t pos = 0;
+    auto write = [&](const void* p, size_t n) {
+        M_Assert(fwrite(p, 1, n, f) == n);
+        pos += n;
+    };
+
+    uint32_t version = 3;
+    uint64_t n_tensors = names.size();
+    uint64_t n_kv = 1;
+    write(GGUF_MAGIC, 4);
+    write(&version, sizeof(version));
+    write(&n_tensors, sizeof(n_tensors));
+    write(&n_kv, sizeof(n_kv));
+
+    std::string key = "general.alignment";
+    uint64_t key_len = key.size();
+    uint32_t kv_type = GGUF_TYPE_UINT32;
+    uint32_t alignment = GGUF_DEFAULT_ALIGNMENT;
+    write(&key_len, sizeof(key_len));
+    write(key.data(), key_len);
+    write(&kv_type, sizeof(kv_type));
+    write(&alignment, sizeof(alignment));
+
+    uint64_t data_offset = 0;
+    std::vector<uint64_t> offsets;
+    for (int i = 0; i < names.size(); i++)
+    {
+        uint64_t len = names[i].size();
+        write(&len, sizeof(len));
+        write(names[i].data(), len);
+
+        uint32_t n_dims = shapes[i].size();
+        write(&n_dims, sizeof(n_dims));
+        write(shapes[i].data(), n_dims * sizeof(int64_t));
+
+        uint32_t type = GGML_TYPE_F32;
+        write(&type, sizeof(type));
+        write(&data_offset, sizeof(data_offset));
+
+        offsets.push_back(data_offset);
+        data_offset += M_PAD(datas[i].size() * sizeof(float), GGUF_DEFAULT_ALIGNMENT);
+    }
+
+    std::vector<char> zeros(GGUF_DEFAULT_ALIGNMENT, 0);
+    write(zeros.data(), M_PAD(pos, GGUF_DEFAULT_ALIGNMENT) - pos);
+    size_t start = pos;
+    for (int i = 0; i < datas.size(); i++)
+    {
+        write(zeros.data(), start + offsets[i] - pos);
+        write(datas[i].data(), datas[i].size() * sizeof(float));
+    }
+    write(zeros.data(), M_PAD(pos, GGUF_DEFAULT_ALIGNMENT) - pos);
+    fclose(f);
+}
+
+TEST(GGUF_TEST, mmap_load)
+{
+    std::string path = "minfer_gguf_mmap_test.gguf";
+    // 第三个tensor跨越多个内存页
+    std::vector<std::string> names = {"token_embd.weight", "output_norm.weight", "output.weight"};
+    std::vector<std::vector<int64_t> > shapes = {{5, 3}, {8}, {64, 256}};
+    std::vector<std::vector<float> > datas(3);
+    for (int i = 0; i < 15; i++)
+        datas[0].push_back(i * 0.5f);
+    for (int i = 0; i < 8; i++)
+        datas[1].push_back(-1.f * i);
+    for (int i = 0; i < 64 * 256; i++)
+        datas[2].push_back(i % 97 - 48.f);
+
+    writeTinyGGUF(path, names, shapes, datas);
+
+    {
+        std::shared_ptr<GGUF_context> readCtx = gguf_init_from_file(path.c_str(), false);
+        std::shared_ptr<GGUF_context> mmapCtx = gguf_init_from_file(path.c_str(), true);
+        M_Assert(readCtx && mmapCtx);
+        M_Assert(readCtx->data && !readCtx->mapping);
+
+        // mmap时不分配数据内存，tensor直接指向映射
+        M_Assert(!mmapCtx->data && mmapCtx->mapping);
+        M_Assert(gguf_get_n_tensors(mmapCtx.get()) == names.size());
+
+        for (int i = 0; i < names.size(); i++)
+        {
+            const GGUF_tensor& a = readCtx->tensors[i];
+            const GGUF_tensor& b = mmapCtx->tensors[i];
+            M_Assert(std::string(b.name.data) == names[i]);
+            M_Assert(a.size == b.size && b.size == datas[i].size() * sizeof(float));
+            M_Assert(a.data != b.data);
+            M_Assert(memcmp(a.data, datas[i].data(), a.size) == 0);
+            M_Assert(memcmp(b.data, datas[i].data(), b.size) == 0);
+
+            // Net根据这个判断layer是否还在引用源模型的内存
+            M_Assert(gguf_owns_data(readCtx.get(), a.data) && !gguf_owns_data(readCtx.get(), b.data));
+            M_Assert(gguf_owns_data(mmapCtx.get(), b.data) && !gguf_owns_data(mmapCtx.get(), a.data));
+
+            // 丢弃映射的内存页之后，再次访问时重新从文件读取
+            MMemoryPrefetch(b.data, b.size);
+            MMemoryDiscard(mmapCtx->tensors[0].data, mmapCtx->size);
+            M_Assert(memcmp(b.data, datas[i].data(), b.size) == 0);
+        }
+    }
+
+    remove(path.c_str());
+}
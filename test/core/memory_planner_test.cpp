@@ -0,0 +1,78 @@
+//
+// Created by mzh on 2025/3/15.
+//
+
+#include "../../src/core/memory_planner.h"
+#include "minfer.h"
+#include "gtest/gtest.h"
+#include <random>
+
+using namespace minfer;
+
+TEST(MemoryPlanner_TEST, reuse_and_alias)
+{
+    MemoryPlanner planner(64);
+
+    // 链式的网络：每一层的输出只被下一层读取
+    int a = planner.addBuffer(1000, 0, 1);
+    int b = planner.addBuffer(1000, 1, 2);
+    int c = planner.addBuffer(1000, 2, 3);
+    int d = planner.addBuffer(100, 3, 4);
+
+    // 只需要两块1024的内存，a和c生存区间不重叠，可以共享
+    size_t size = planner.plan();
+    M_Assert(size == 2048);
+    M_Assert(planner.getNaiveSize() == 3 * 1024 + 128);
+    M_Assert(planner.getOffset(a) != planner.getOffset(b));
+    M_Assert(planner.getOffset(b) != planner.getOffset(c));
+    M_Assert(planner.getOffset(d) % 64 == 0);
+
+    // in-place：c直接使用b的内存，b和c合并之后只和a、d重叠
+    planner.clear();
+    a = planner.addBuffer(1000, 0, 1);
+    b = planner.addBuffer(1000, 1, 2);
+    c = planner.addBuffer(1000, 2, 3);
+    planner.setAlias(c, b);
+    size = planner.plan();
+    M_Assert(size == 2048);
+    M_Assert(planner.getOffset(b) == planner.getOffset(c));
+}
+
+TEST(MemoryPlanner_TEST, random_intervals)
+{
+    std::mt19937 rng(3);
+    for (int r = 0; r < 20; r++)
+    {
+        MemoryPlanner planner(64);
+        std::vector<size_t> sizes;
+        std::vector<int> starts, ends;
+        for (int i = 0; i < 50; i++)
+        {
+            int start = rng() % 40;
+            int end = start + rng() % 5;
+            size_t size = 1 + rng() % 5000;
+            planner.addBuffer(size, start, end);
+            sizes.push_back(size);
+            starts.push_back(start);
+            ends.push_back(end);
+        }
+
+        size_t total = planner.plan();
+        M_Assert(total <= planner.getNaiveSize());
+
+        // 生存区间重叠的buffer，内存不能重叠
+        for (int i = 0; i < sizes.size(); i++)
+        {
+            size_t oi = planner.getOffset(i);
+            M_Assert(oi + sizes[i] <= total);
+            for (int j = i + 1; j < sizes.size(); j++)
+            {
+                if (starts[i] > ends[j] || starts[j] > ends[i])
+                    continue;
+
+                size_t oj = planner.getOffset(j);
+                M_Assert(oi + sizes[i] <= oj || oj + sizes[j] <= oi);
+            }
+        }
+    }
+}
@@ -0,0 +1,41 @@
+//
+// Created by mzh on 2025/3/18.
+//
+
+#include "../../src/core/parallel.h"
+#include "minfer.h"
+#include "gtest/gtest.h"
+#include <atomic>
+#include <stdexcept>
+#include <vector>
+
+using namespace minfer;
+
+TEST(Parallel_TEST, parallel_for)
+{
+    // 每个任务只执行一次
+    for (int nthreads : {1, 3, 8})
+    {
+        std::vector<std::atomic<int> > hits(100);
+        for (auto& h : hits)
+            h = 0;
+
+        parallel_for(10, 100, [&](int i) { hits[i]++; }, nthreads);
+        for (int i = 0; i < 100; i++)
+            M_Assert(hits[i] == (i >= 10 ? 1 : 0));
+    }
+
+    // 空区间不执行
+    int count = 0;
+    parallel_for(5, 5, [&](int) { count++; });
+    M_Assert(count == 0);
+
+    // 任务中的异常在调用线程中重新抛出
+    std::atomic<int> done(0);
+    EXPECT_THROW(parallel_for(0, 64, [&](int i) {
+        if (i == 7)
+            throw std::runtime_error("task failed");
+        done++;
+    }, 4), std::runtime_error);
+    M_Assert(done < 64);
+}
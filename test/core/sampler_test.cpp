@@ -0,0 +1,173 @@
+//
+// Created by mzh on 2025/3/12.
+//
+
+#include "../../src/core/sampler.h"
+#include "minfer.h"
+#include "gtest/gtest.h"
+#include <algorithm>
+#include <chrono>
+#include <cmath>
+#include <random>
+
+using namespace minfer;
+
+TEST(Sampler_TEST, filters)
+{
+    // softmax后的概率约为 0.198, 0.537, 0.089, 0.132, 0.044
+    std::vector<float> logits = {1.f, 2.f, 0.2f, 0.6f, -0.5f};
+    const int n_vocab = logits.size();
+    const int n_sample = 4000;
+
+    auto histogram = [&](const SamplingParams& params) {
+        Sampler sampler(params);
+        std::vector<int> count(n_vocab, 0);
+        for (int i = 0; i < n_sample; i++)
+        {
+            count[sampler.sample(logits.data(), n_vocab, {})]++;
+        }
+        return count;
+    };
+
+    SamplingParams params;
+    params.temperature = 1.f;
+    params.top_k = 0;
+    params.top_p = 1.f;
+    params.min_p = 0.f;
+
+    // 不做过滤时，频率接近softmax的概率
+    std::vector<int> count = histogram(params);
+    float sum = 0.f;
+    for (float l : logits)
+        sum += expf(l);
+    for (int i = 0; i < n_vocab; i++)
+    {
+        M_Assert(fabsf(count[i] / (float)n_sample - expf(logits[i]) / sum) < 0.03f);
+    }
+
+    // top_k = 2 只会选择id 1 和 0
+    params.top_k = 2;
+    count = histogram(params);
+    M_Assert(count[0] + count[1] == n_sample);
+
+    // top_p = 0.6 只保留 0.537 + 0.198
+    params.top_k = 0;
+    params.top_p = 0.6f;
+    count = histogram(params);
+    M_Assert(count[0] + count[1] == n_sample && count[0] > 0);
+
+    // min_p = 0.2 丢弃概率小于 0.2 * 0.537 的token
+    params.top_p = 1.f;
+    params.min_p = 0.2f;
+    count = histogram(params);
+    M_Assert(count[2] + count[4] == 0 && count[3] > 0);
+
+    // greedy
+    params.temperature = 0.f;
+    count = histogram(params);
+    M_Assert(count[1] == n_sample);
+
+    // repetition penalty 之后 id 0 成为最大值
+    params.repetition_penalty = 4.f;
+    Sampler penalty_sampler(params);
+    M_Assert(penalty_sampler.sample(logits.data(), n_vocab, {1, 1, 3}) == 0);
+}
+
+TEST(Sampler_TEST, simd_softmax)
+{
+    // 长度不是4的倍数，覆盖尾部的标量计算
+    const int n = 1003;
+    std::vector<float> logits(n), probs(n);
+    std::mt19937 rng(7);
+    std::uniform_real_distribution<float> dist(-30.f, 30.f);
+    for (int i = 0; i < n; i++)
+        logits[i] = dist(rng);
+
+    const float temperature = 0.7f;
+    float lse = Sampler::softmax(logits.data(), n, temperature, probs.data());
+
+    double max_val = *std::max_element(logits.begin(), logits.end()) / temperature;
+    double sum = 0.0;
+    for (int i = 0; i < n; i++)
+        sum += exp(logits[i] / temperature - max_val);
+
+    double total = 0.0;
+    for (int i = 0; i < n; i++)
+    {
+        double ref = exp(logits[i] / temperature - max_val) / sum;
+        M_Assert(fabs(probs[i] - ref) <= 1e-6 + 1e-5 * ref);
+        total += probs[i];
+    }
+    M_Assert(fabs(total - 1.0) < 1e-5);
+    M_Assert(fabs(lse - log(sum)) < 1e-4);
+
+    // temperature为1时的log-sum-exp，不需要概率的buffer
+    double max_logit = *std::max_element(logits.begin(), logits.end());
+    double sum1 = 0.0;
+    for (int i = 0; i < n; i++)
+        sum1 += exp(logits[i] - max_logit);
+    M_Assert(fabs(Sampler::logSumExp(logits.data(), n) - (max_logit + log(sum1))) < 1e-4);
+}
+
+TEST(Sampler_TEST, large_vocab_batch)
+{
+    // shape和LinearLayer输出的logits一样：[batch, seq_len, n_vocab]
+    const int batch = 3, seq_len = 2, n_vocab = 151936;
+    Mat logits = Mat({batch, seq_len, n_vocab}, DT_32F);
+    float* p = (float *)logits.data;
+    std::mt19937 rng(3);
+    std::normal_distribution<float> dist(0.f, 2.f);
+    for (size_t i = 0; i < logits.total(); i++)
+        p[i] = dist(rng);
+
+    // greedy 使用每个batch最后一个位置的argmax
+    SamplingParams params;
+    params.temperature = 0.f;
+    Sampler greedy(params);
+    std::vector<int> out_ids;
+    greedy.sample(logits, {}, out_ids);
+    M_Assert(out_ids.size() == batch);
+
+    std::vector<std::vector<int> > top5(batch);
+    for (int b = 0; b < batch; b++)
+    {
+        const float* row = p + ((size_t)b * seq_len + seq_len - 1) * n_vocab;
+        M_Assert(out_ids[b] == std::max_element(row, row + n_vocab) - row);
+
+        std::vector<int> idx(n_vocab);
+        for (int i = 0; i < n_vocab; i++)
+            idx[i] = i;
+        std::partial_sort(idx.begin(), idx.begin() + 5, idx.end(), [&](int a, int c) { return row[a] > row[c]; });
+        top5[b].assign(idx.begin(), idx.begin() + 5);
+    }
+
+    // top_k = 5 只会选择最大的5个token
+    params.temperature = 1.f;
+    params.top_k = 5;
+    params.top_p = 1.f;
+    params.min_p = 0.f;
+    Sampler topk(params);
+    for (int r = 0; r < 50; r++)
+    {
+        topk.sample(logits, {}, out_ids);
+        for (int b = 0; b < batch; b++)
+            M_Assert(std::find(top5[b].begin(), top5[b].end(), out_ids[b]) != top5[b].end());
+    }
+
+    // 不开启top_k时，top_p很小只会选择概率最大的token
+    params.top_k = 0;
+    params.top_p = 1e-6f;
+    Sampler topp(params);
+    topp.sample(logits, {}, out_ids);
+    for (int b = 0; b < batch; b++)
+        M_Assert(out_ids[b] == top5[b][0]);
+
+    // 默认参数的耗时
+    Sampler sampler{SamplingParams()};
+    auto t0 = std::chrono::steady_clock::now();
+    const int loop = 20;
+    for (int r = 0; r < loop; r++)
+        sampler.sample(logits, {}, out_ids);
+    double ms = std::chrono::duration<double, std::milli>(std::chrono::steady_clock::now() - t0).count() / (loop * batch);
+    std::cout<<"sample one token from vocab "<<n_vocab<<" takes "<<ms<<" ms"<<std::endl;
+}
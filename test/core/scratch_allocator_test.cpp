@@ -0,0 +1,69 @@
+//
+// Created by mzh on 2025/3/16.
+//
+
+#include "../../src/core/scratch_allocator.h"
+#include "minfer.h"
+#include "gtest/gtest.h"
+
+using namespace minfer;
+
+TEST(ScratchAllocator_TEST, bump_and_reset)
+{
+    ScratchAllocator scratch(64);
+    scratch.reserve(1024);
+
+    uchar* first = nullptr;
+    for (int r = 0; r < 3; r++)
+    {
+        ScratchScope scope(&scratch);
+        Mat a({10, 10}, DT_32F);    // 400 -> 448
+        Mat b({4, 4}, DT_32F);      // 64
+        M_Assert(b.data == a.data + 448);
+        M_Assert((size_t)a.data % 64 == 0);
+
+        // 每一轮reset之后从同一个地址开始
+        if (r == 0)
+            first = a.data;
+        M_Assert(a.data == first);
+
+        // scope之外新建的Mat不使用scratch
+        {
+            Mat::setThreadAllocator(nullptr);
+            Mat c({4, 4}, DT_32F);
+            M_Assert(c.data < first || c.data >= first + scratch.getCapacity());
+            Mat::setThreadAllocator(&scratch);
+        }
+
+        a.release();
+        b.release();
+        scratch.reset();
+    }
+    M_Assert(scratch.getOverflowCount() == 0);
+}
+
+TEST(ScratchAllocator_TEST, overflow_then_grow)
+{
+    ScratchAllocator scratch(64);
+    scratch.reserve(256);
+
+    {
+        ScratchScope scope(&scratch);
+        Mat a({32}, DT_32F);        // 128，放在scratch中
+        Mat b({64}, DT_32F);        // 256，放不下，从堆上分配
+        M_Assert(scratch.getOverflowCount() == 1);
+        b.setTo(1.f);
+        M_Assert(((float *)b.data)[63] == 1.f);
+    }
+
+    // 按照上一轮的峰值扩容，之后不会再从堆上分配
+    scratch.reset();
+    M_Assert(scratch.getCapacity() >= 384);
+    {
+        ScratchScope scope(&scratch);
+        Mat a({32}, DT_32F);
+        Mat b({64}, DT_32F);
+    }
+    scratch.reset();
+    M_Assert(scratch.getOverflowCount() == 1);
+}
@@ -4,9 +4,31 @@
 
 #include "minfer.h"
 #include "gtest/gtest.h"
+#include <new>
 
 using namespace minfer;
 
+// 测试程序中替换全局的operator new，所有new出来的内存都计入getAllocationCount()，
+// 这样可以检查decode等热点路径中没有任何堆内存分配（包括std::vector、std::function等）。
+void* operator new(std::size_t size)
+{
+    addAllocationCount();
+    void* p = std::malloc(size == 0 ? 1 : size);
+    if (!p)
+        throw std::bad_alloc();
+    return p;
+}
+
+void operator delete(void* p) noexcept
+{
+    std::free(p);
+}
+
+void operator delete(void* p, std::size_t) noexcept
+{
+    std::free(p);
+}
+
 TEST(System, log_test)
 {
     // EXPECT_THROW({
@@ -22,4 +44,23 @@ TEST(System, log_test)
     // }, minfer::Exception);
 
 
-}
\ No newline at end of file
+}
+
+TEST(System, allocation_count)
+{
+    size_t begin = getAllocationCount();
+    std::vector<int>* v = new std::vector<int>(16);
+    M_Assert(getAllocationCount() - begin == 2);
+    delete v;
+
+    begin = getAllocationCount();
+    Mat m({4, 4}, DT_32F);
+    M_Assert(getAllocationCount() - begin >= 1);
+
+    // Mat的引用和shape不分配内存
+    begin = getAllocationCount();
+    Mat ref = m;
+    Mat view = m.reshape({16});
+    M_Assert(getAllocationCount() - begin == 0);
+    M_Assert(view.dims == 1 && ref.size == m.size);
+}
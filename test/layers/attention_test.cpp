@@ -5,6 +5,8 @@
 #include "minfer.h"
 #include "gtest/gtest.h"
 #include "../src/backend/cpu/layer/attention_layer.h"
+#include <cmath>
+#include <random>
 
 using namespace minfer;
 
@@ -68,4 +70,126 @@ TEST(Layer_TEST, attention_test)
     // double v = norm(output_checker, output, NORM_L1);
     // std::cout<<"v = "<<v<<std::endl;
     // M_Assert(v < 12);
-}
\ No newline at end of file
+}
+static Mat randomMat(const std::vector<int>& shape, std::mt19937& rng)
+{
+    std::uniform_real_distribution<float> dist(-1.f, 1.f);
+    Mat m(shape, DT_32F);
+    for (size_t i = 0; i < m.total(); i++)
+        ((float *)m.data)[i] = dist(rng);
+    return m;
+}
+
+// x: [rows, in] * w: [in, out] + b
+static std::vector<float> linear_ref(const std::vector<float>& x, int rows, const Mat& w, const Mat& b)
+{
+    const int in = w.size[0], out = w.size[1];
+    std::vector<float> y((size_t)rows * out);
+    for (int i = 0; i < rows; i++)
+    {
+        for (int j = 0; j < out; j++)
+        {
+            float sum = ((const float *)b.data)[j];
+            for (int k = 0; k < in; k++)
+                sum += x[i * in + k] * ((const float *)w.data)[k * out + j];
+            y[i * out + j] = sum;
+        }
+    }
+    return y;
+}
+
+// q k v 和输出投影带bias，和逐元素计算的参考实现比较（GQA，2个head共享1个kv head）
+TEST(Layer_TEST, attention_bias_test)
+{
+    const int seq_len = 5, d_model = 8, num_heads = 2, num_heads_kv = 1;
+    const int head_dim = d_model / num_heads, d_kv = head_dim * num_heads_kv;
+    const float rms_eps = 1e-6f;
+
+    std::mt19937 rng(3);
+    Mat input = randomMat({1, seq_len, d_model}, rng);
+    Mat norm_w = randomMat({d_model}, rng);
+    Mat wq = randomMat({d_model, d_model}, rng), bq = randomMat({d_model}, rng);
+    Mat wk = randomMat({d_model, d_kv}, rng), bk = randomMat({d_kv}, rng);
+    Mat wv = randomMat({d_model, d_kv}, rng), bv = randomMat({d_kv}, rng);
+    Mat wout = randomMat({d_model, d_model}, rng), bout = randomMat({d_model}, rng);
+
+    std::shared_ptr<AttentionLayerParams> params(new AttentionLayerParams({0}, {1}, 16, d_model, num_heads, num_heads_kv,
+                                                                          rms_eps, norm_w, wq, wk, wv, wout, bq, bk, bv, bout));
+    auto layer = AttentionLayer::create(params);
+    Mat output({1, seq_len, d_model}, DT_32F);
+    std::vector<Mat*> inputs = {&input};
+    std::vector<Mat*> outputs = {&output};
+    layer->forward(inputs, outputs);
+
+    // 参考实现
+    const float* x = (const float *)input.data;
+    std::vector<float> xn(seq_len * d_model);
+    for (int i = 0; i < seq_len; i++)
+    {
+        float sum = 0.f;
+        for (int j = 0; j < d_model; j++)
+            sum += x[i * d_model + j] * x[i * d_model + j];
+        float r = 1.f / sqrtf(sum / d_model + rms_eps);
+        for (int j = 0; j < d_model; j++)
+            xn[i * d_model + j] = x[i * d_model + j] * r * ((const float *)norm_w.data)[j];
+    }
+
+    std::vector<float> q = linear_ref(xn, seq_len, wq, bq);
+    std::vector<float> k = linear_ref(xn, seq_len, wk, bk);
+    std::vector<float> v = linear_ref(xn, seq_len, wv, bv);
+
+    auto rope = [&](std::vector<float>& t, int dim) {
+        for (int i = 0; i < seq_len; i++)
+        {
+            for (int c = 0; c < dim; c += 2)
+            {
+                float freq = 1.f / powf(10000.f, (c % head_dim) / (float)head_dim);
+                float s = sinf(i * freq), co = cosf(i * freq);
+                float r = t[i * dim + c], im = t[i * dim + c + 1];
+                t[i * dim + c] = r * co - im * s;
+                t[i * dim + c + 1] = r * s + im * co;
+            }
+        }
+    };
+    rope(q, d_model);
+    rope(k, d_kv);
+
+    std::vector<float> attn(seq_len * d_model);
+    for (int h = 0; h < num_heads; h++)
+    {
+        const int h_kv = h / (num_heads / num_heads_kv);
+        for (int i = 0; i < seq_len; i++)
+        {
+            std::vector<float> score(i + 1);
+            float max_val = -INFINITY, sum = 0.f;
+            for (int j = 0; j <= i; j++)
+            {
+                float dot = 0.f;
+                for (int c = 0; c < head_dim; c++)
+                    dot += q[i * d_model + h * head_dim + c] * k[j * d_kv + h_kv * head_dim + c];
+                score[j] = dot / sqrtf(head_dim);
+                max_val = std::max(max_val, score[j]);
+            }
+            for (int j = 0; j <= i; j++)
+            {
+                score[j] = expf(score[j] - max_val);
+                sum += score[j];
+            }
+            for (int c = 0; c < head_dim; c++)
+            {
+                float o = 0.f;
+                for (int j = 0; j <= i; j++)
+                    o += score[j] / sum * v[j * d_kv + h_kv * head_dim + c];
+                attn[i * d_model + h * head_dim + c] = o;
+            }
+        }
+    }
+
+    std::vector<float> proj = linear_ref(attn, seq_len, wout, bout);
+    float max_err = 0.f;
+    for (int i = 0; i < seq_len * d_model; i++)
+        max_err = std::max(max_err, fabsf(((const float *)output.data)[i] - (x[i] + proj[i])));
+
+    std::cout<<"attention with bias max abs error = "<<max_err<<std::endl;
+    M_Assert(max_err < 1e-4);
+}
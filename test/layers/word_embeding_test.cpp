@@ -5,6 +5,9 @@
 #include "minfer.h"
 #include "gtest/gtest.h"
 #include "../src/backend/cpu/layer/embeding_layer.h"
+#include "../src/core/gguf_model/ggml_quant.h"
+#include "../src/core/gguf_model/gguf_utils.h"
+#include <random>
 
 using namespace minfer;
 
@@ -53,4 +56,65 @@ TEST(Layer_TEST, word_embedding_test)
     // double v = norm(output, output_check, NORM_L1);
     // std::cout<<"v = "<<v<<std::endl;
     // M_Assert(v < 12);
-}
\ No newline at end of file
+}
+
+static Mat runEmbedding(const std::shared_ptr<EmbeddingLayerParams>& params, Mat& input)
+{
+    std::shared_ptr<EmbeddingLayer> layer = EmbeddingLayer::create(params);
+    Mat output({input.size[0], input.size[1], params->embd_dim}, DT_32F);
+    std::vector<Mat*> inputs = {&input};
+    std::vector<Mat*> outputs = {&output};
+    layer->forward(inputs, outputs);
+    return output;
+}
+
+// embedding保持源类型（FP16或者量化的block），forward时只转换查询的行
+TEST(Layer_TEST, word_embedding_quant_test)
+{
+    const int vocab = 50, embd = 64;
+    std::mt19937 rng(7);
+    std::uniform_real_distribution<float> dist(-1.f, 1.f);
+    Mat table({vocab, embd}, DT_32F);
+    for (size_t i = 0; i < table.total(); i++)
+        ((float *)table.data)[i] = dist(rng);
+
+    Mat input({2, 3}, DT_32S);
+    int ids[] = {0, 49, 7, 7, 23, 1};
+    memcpy(input.data, ids, sizeof(ids));
+
+    Mat ref = runEmbedding(std::make_shared<EmbeddingLayerParams>(std::vector<int>{0}, std::vector<int>{1}, vocab, embd, table), input);
+
+    {
+        Mat table16;
+        table.convertTo(table16, DT_16F);
+        Mat out = runEmbedding(std::make_shared<EmbeddingLayerParams>(std::vector<int>{0}, std::vector<int>{1}, vocab, embd, table16), input);
+        M_Assert(norm(out, ref, NORM_INF) < 1e-3);
+
+        // [embd_dim, vocab_dim]的FP16权重按列查询
+        Mat tableT16;
+        transpose(table).convertTo(tableT16, DT_16F);
+        Mat outT = runEmbedding(std::make_shared<EmbeddingLayerParams>(std::vector<int>{0}, std::vector<int>{1}, vocab, embd, tableT16), input);
+        M_Assert(norm(outT, out, NORM_INF) == 0);
+    }
+
+    std::vector<std::pair<QuantType, float> > types = {{QUANT_Q4_0, 0.2f}, {QUANT_Q4_1, 0.1f}, {QUANT_Q8_0, 0.01f}};
+    for (auto& t : types)
+    {
+        GGML_TYPE type = (GGML_TYPE)t.first;
+        const int rowBytes = ggml_row_size(type, embd);
+        Mat q({vocab, rowBytes}, DT_8U);
+        for (int i = 0; i < vocab; i++)
+            quantize_row(type, (float *)table.data + i * embd, q.data + i * rowBytes, embd);
+
+        Mat out = runEmbedding(std::make_shared<EmbeddingLayerParams>(std::vector<int>{0}, std::vector<int>{1}, vocab, embd, q, t.first), input);
+
+        // 和反量化整张表之后查询的结果完全一致
+        Mat deq({vocab, embd}, DT_32F);
+        dequantize_row(type, q.data, (float *)deq.data, deq.total());
+        Mat outDeq = runEmbedding(std::make_shared<EmbeddingLayerParams>(std::vector<int>{0}, std::vector<int>{1}, vocab, embd, deq), input);
+
+        std::cout<<ggml_type_name(type)<<" max abs error = "<<norm(out, ref, NORM_INF)<<std::endl;
+        M_Assert(norm(out, outDeq, NORM_INF) == 0);
+        M_Assert(norm(out, ref, NORM_INF) < t.second);
+    }
+}
@@ -0,0 +1,196 @@
+//
+// Created by mzh on 2025/3/10.
+//
+
+#include "minfer.h"
+#include "gtest/gtest.h"
+#include "tiny_llama.h"
+#include <cmath>
+#include <cfloat>
+
+using namespace minfer;
+
+// 对prompt + tokens做一次完整的prefill，返回tokens的log概率之和
+static float sequence_logprob(Net& net, const std::vector<int>& prompt, const std::vector<int>& tokens)
+{
+    std::vector<int> ids = prompt;
+    ids.insert(ids.end(), tokens.begin(), tokens.end());
+
+    auto session = net.createSession();
+    session->setOutputPositions({});
+    session->setInput(tinyTokens(ids));
+    Mat out = session->forward();
+    int n_vocab = out.size[2];
+
+    float sum = 0.f;
+    for (int i = 0; i < tokens.size(); i++)
+    {
+        const float* p = (const float *)out.data + (prompt.size() - 1 + i) * n_vocab;
+        float max_val = -FLT_MAX;
+        for (int j = 0; j < n_vocab; j++)
+            max_val = std::max(max_val, p[j]);
+
+        float s = 0.f;
+        for (int j = 0; j < n_vocab; j++)
+            s += expf(p[j] - max_val);
+
+        sum += p[tokens[i]] - max_val - logf(s);
+    }
+    return sum;
+}
+
+static int argmax(const float* p, int n)
+{
+    int idx = 0;
+    for (int i = 1; i < n; i++)
+    {
+        if (p[i] > p[idx])
+            idx = i;
+    }
+    return idx;
+}
+
+TEST(BeamSearch_TEST, beam1_equals_greedy)
+{
+    Net net;
+    net.createNet(createTinyLlamaParams());
+
+    std::vector<int> prompt = {1, 5, 9, 3, 17};
+    const int max_new_tokens = 8;
+
+    // 逐个token greedy decode
+    std::vector<int> greedy;
+    auto session = net.createSession();
+    session->setInput(tinyTokens(prompt));
+    Mat out = session->forward();
+    int n_vocab = out.size[2];
+    int next = argmax((const float *)out.data, n_vocab); // 默认只输出最后一个位置
+    for (int i = 0; i < max_new_tokens; i++)
+    {
+        greedy.push_back(next);
+        session->setInput(tinyTokens({next}));
+        out = session->forward();
+        next = argmax((const float *)out.data, n_vocab);
+    }
+
+    BeamSearchParams params;
+    params.beam_size = 1;
+    params.max_new_tokens = max_new_tokens;
+
+    std::vector<BeamHypothesis> hyps;
+    net.beamSearch(prompt, params, hyps);
+    M_Assert(hyps.size() == 1);
+    M_Assert(hyps[0].tokens == greedy);
+}
+
+TEST(BeamSearch_TEST, batched_beams_match_single_sequence)
+{
+    Net net;
+    net.createNet(createTinyLlamaParams());
+
+    std::vector<int> prompt = {2, 30, 11, 7, 19, 4};
+
+    BeamSearchParams params;
+    params.beam_size = 4;
+    params.max_new_tokens = 6;
+    params.length_penalty = 1.0f;
+
+    auto session = net.createSession();
+    std::vector<BeamHypothesis> hyps;
+    session->beamSearch(prompt, params, hyps);
+
+    // 会话的kv cache只包含prompt
+    M_Assert(session->getPosition() == prompt.size());
+    M_Assert(hyps.size() == params.beam_size);
+
+    for (int i = 0; i < hyps.size(); i++)
+    {
+        M_Assert(hyps[i].tokens.size() == params.max_new_tokens);
+        if (i > 0)
+        {
+            M_Assert(hyps[i - 1].score >= hyps[i].score);
+            M_Assert(hyps[i - 1].tokens != hyps[i].tokens);
+        }
+
+        // batch推理得到的log概率和单独推理每个序列一致
+        float ref = sequence_logprob(net, prompt, hyps[i].tokens);
+        M_Assert(fabsf(ref - hyps[i].sum_logprob) < 1e-3);
+        M_Assert(fabsf(hyps[i].score - hyps[i].sum_logprob / hyps[i].tokens.size()) < 1e-5);
+    }
+
+    // beam search 的最好结果不差于 beam_size 为1 的结果
+    BeamSearchParams greedy_params = params;
+    greedy_params.beam_size = 1;
+    std::vector<BeamHypothesis> greedy;
+    net.beamSearch(prompt, greedy_params, greedy);
+    M_Assert(hyps[0].sum_logprob >= greedy[0].sum_logprob - 1e-5);
+}
+
+TEST(BeamSearch_TEST, eos_stops_hypothesis)
+{
+    Net net;
+    net.createNet(createTinyLlamaParams());
+
+    std::vector<int> prompt = {1, 5, 9, 3, 17};
+
+    // 使用greedy的第二个token作为eos，保证会出现结束的候选
+    BeamSearchParams params;
+    params.beam_size = 1;
+    params.max_new_tokens = 2;
+    std::vector<BeamHypothesis> greedy;
+    net.beamSearch(prompt, params, greedy);
+
+    params.beam_size = 3;
+    params.max_new_tokens = 10;
+    params.eos_id = greedy[0].tokens[1];
+
+    std::vector<BeamHypothesis> hyps;
+    net.beamSearch(prompt, params, hyps);
+    M_Assert(!hyps.empty() && hyps.size() <= params.beam_size);
+
+    bool has_eos = false;
+    for (const auto& h : hyps)
+    {
+        // eos只会出现在结尾
+        for (int i = 0; i + 1 < h.tokens.size(); i++)
+        {
+            M_Assert(h.tokens[i] != params.eos_id);
+        }
+
+        if (h.tokens.back() == params.eos_id)
+            has_eos = true;
+        else
+            M_Assert(h.tokens.size() == params.max_new_tokens);
+
+        M_Assert(fabsf(sequence_logprob(net, prompt, h.tokens) - h.sum_logprob) < 1e-3);
+    }
+    M_Assert(has_eos);
+}
+
+TEST(BeamSearch_TEST, keeps_output_positions)
+{
+    Net net;
+    net.createNet(createTinyLlamaParams());
+
+    auto session = net.createSession();
+    session->setOutputPositions({0, -1});
+
+    BeamSearchParams params;
+    params.beam_size = 2;
+    params.max_new_tokens = 4;
+    std::vector<BeamHypothesis> hyps;
+    session->beamSearch({1, 5, 9, 3, 17}, params, hyps);
+
+    // decode超过n_ctx时抛出异常，输出位置同样恢复，会话的kv cache只包含prompt
+    TinyLlamaConfig c;
+    auto other = net.createSession();
+    other->setOutputPositions({0, -1});
+    params.max_new_tokens = 6;
+    EXPECT_ANY_THROW(other->beamSearch(std::vector<int>(c.n_ctx - 4, 3), params, hyps));
+
+    for (auto& s : {session, other})
+    {
+        s->setInput(tinyTokens({2, 4, 6}));
+        M_Assert(s->forward().size[1] == 2);
+    }
+}
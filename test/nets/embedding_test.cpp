@@ -0,0 +1,151 @@
+//
+// Created by mzh on 2025/3/13.
+//
+
+#include "minfer.h"
+#include "gtest/gtest.h"
+#include "tiny_llama.h"
+#include <cmath>
+
+using namespace minfer;
+
+// 去掉vocab投影的Linear层，Output直接输出output norm之后的hidden state
+static std::vector<std::shared_ptr<LayerParams> > createTinyLlamaHiddenParams()
+{
+    std::vector<std::shared_ptr<LayerParams> > params = createTinyLlamaParams();
+    std::shared_ptr<LayerParams> output = params.back();
+    params.pop_back();
+    std::shared_ptr<LayerParams> linear = params.back();
+    params.pop_back();
+    M_Assert(linear->type == LayerType::Linear && output->type == LayerType::Output);
+
+    output->inputIndex = linear->inputIndex;
+    params.push_back(output);
+    return params;
+}
+
+// 参考实现：单独推理每个文本，按照pooling方式计算embedding
+static std::vector<float> ref_embedding(Net& hidden_net, const std::vector<int>& ids, PoolingType pooling, bool normalize)
+{
+    auto session = hidden_net.createSession();
+    session->setOutputPositions({});
+    session->setInput(tinyTokens(ids));
+    Mat hidden = session->forward();
+    M_Assert(hidden.dims == 3 && hidden.size[1] == ids.size());
+
+    const int n_embd = hidden.size[2];
+    const float* h = (const float *)hidden.data;
+    std::vector<float> e(n_embd, 0.f);
+    for (int i = 0; i < ids.size(); i++)
+    {
+        bool used = pooling == POOLING_MEAN || (pooling == POOLING_CLS && i == 0) ||
+                    (pooling == POOLING_LAST && i + 1 == ids.size());
+        if (!used)
+            continue;
+
+        float scale = pooling == POOLING_MEAN ? 1.f / ids.size() : 1.f;
+        for (int j = 0; j < n_embd; j++)
+            e[j] += h[i * n_embd + j] * scale;
+    }
+
+    if (normalize)
+    {
+        float sum = 0.f;
+        for (float v : e)
+            sum += v * v;
+        for (float& v : e)
+            v /= sqrtf(sum);
+    }
+    return e;
+}
+
+TEST(Embedding_TEST, pooling_matches_hidden_states)
+{
+    Net net;
+    net.createNet(createTinyLlamaParams());
+
+    Net hidden_net;
+    hidden_net.createNet(createTinyLlamaHiddenParams());
+
+    // 包含长度相同的文本，会在一个batch中推理
+    std::vector<std::vector<int> > texts = {{1, 5, 9, 3, 17}, {2, 30, 11}, {4, 8, 15, 16, 23}, {7, 6, 5, 4, 3, 2, 1},
+                                            {12, 19, 26}};
+
+    std::vector<PoolingType> poolings = {POOLING_MEAN, POOLING_LAST, POOLING_CLS};
+    for (PoolingType pooling : poolings)
+    {
+        for (int normalize = 0; normalize < 2; normalize++)
+        {
+            for (int batch_size : {0, 1})
+            {
+                EmbeddingParams params;
+                params.pooling = pooling;
+                params.normalize = normalize;
+                params.batch_size = batch_size;
+
+                Mat out;
+                net.embed(texts, params, out);
+                M_Assert(out.dims == 2 && out.size[0] == texts.size());
+
+                const int n_embd = out.size[1];
+                for (int i = 0; i < texts.size(); i++)
+                {
+                    std::vector<float> ref = ref_embedding(hidden_net, texts[i], pooling, normalize);
+                    M_Assert(ref.size() == n_embd);
+
+                    const float* e = (const float *)out.data + i * n_embd;
+                    float norm2 = 0.f;
+                    for (int j = 0; j < n_embd; j++)
+                    {
+                        M_Assert(fabsf(e[j] - ref[j]) < 1e-4);
+                        norm2 += e[j] * e[j];
+                    }
+
+                    if (normalize)
+                        M_Assert(fabsf(norm2 - 1.f) < 1e-4);
+                }
+            }
+        }
+    }
+}
+
+TEST(Embedding_TEST, session_state_unchanged)
+{
+    Net net;
+    net.createNet(createTinyLlamaParams());
+
+    std::vector<int> prompt = {1, 5, 9, 3, 17};
+    std::vector<int> next_ids = {4, 8};
+
+    auto ref = net.createSession();
+    ref->setInput(tinyTokens(prompt));
+    ref->forward();
+    ref->setInput(tinyTokens({next_ids[0]}));
+    Mat ref_out0 = ref->forward().clone();
+    ref->setInput(tinyTokens({next_ids[1]}));
+    Mat ref_out1 = ref->forward().clone();
+
+    // embedding不改变会话的kv cache和输出位置，之后可以继续decode
+    auto session = net.createSession();
+    session->setInput(tinyTokens(prompt));
+    session->forward();
+
+    EmbeddingParams params;
+    Mat emb;
+    session->embed({{2, 30, 11}, {4, 8, 15, 16}}, params, emb);
+    M_Assert(session->getPosition() == prompt.size());
+
+    session->setInput(tinyTokens({next_ids[0]}));
+    M_Assert(norm(session->forward(), ref_out0, NORM_INF) < 1e-5);
+
+    session->embed({{7, 6, 5}}, params, emb);
+
+    // 文本超过max_seq_len时抛出异常，会话仍然恢复为输出logits
+    TinyLlamaConfig c;
+    EXPECT_ANY_THROW(session->embed({std::vector<int>(c.n_ctx + 1, 3)}, params, emb));
+
+    session->setInput(tinyTokens({next_ids[1]}));
+    Mat out1 = session->forward();
+    M_Assert(out1.size[2] == c.n_vocab);
+    M_Assert(norm(out1, ref_out1, NORM_INF) < 1e-5);
+}
@@ -0,0 +1,168 @@
+//
+// Created by mzh on 2025/3/12.
+//
+
+#include "minfer.h"
+#include "gtest/gtest.h"
+#include "tiny_llama.h"
+#include <set>
+#include <stdexcept>
+
+using namespace minfer;
+
+static SamplingParams greedy_params(int max_new_tokens)
+{
+    SamplingParams params;
+    params.temperature = 0.f;
+    params.max_new_tokens = max_new_tokens;
+    return params;
+}
+
+TEST(Generate_TEST, greedy_and_callback)
+{
+    Net net;
+    net.createNet(createTinyLlamaParams());
+
+    std::vector<int> prompt = {1, 5, 9, 3, 17};
+
+    // greedy 和 beam_size 为1的beam search一致
+    BeamSearchParams beam_params;
+    beam_params.beam_size = 1;
+    beam_params.max_new_tokens = 10;
+    std::vector<BeamHypothesis> hyps;
+    net.beamSearch(prompt, beam_params, hyps);
+
+    std::vector<int> streamed;
+    std::vector<int> out_ids;
+    auto session = net.createSession();
+    session->generate(prompt, greedy_params(10), out_ids, [&](int token) {
+        streamed.push_back(token);
+        return true;
+    });
+    M_Assert(out_ids == hyps[0].tokens);
+    M_Assert(streamed == out_ids);
+    M_Assert(session->getPosition() == prompt.size() + out_ids.size());
+
+    // top_k为1时和greedy一样
+    SamplingParams topk_params;
+    topk_params.top_k = 1;
+    topk_params.temperature = 1.f;
+    topk_params.max_new_tokens = 10;
+    std::vector<int> topk_ids;
+    net.createSession()->generate(prompt, topk_params, topk_ids);
+    M_Assert(topk_ids == out_ids);
+
+    // callback 返回false时停止
+    std::vector<int> stop_ids;
+    int count = 0;
+    net.createSession()->generate(prompt, greedy_params(10), stop_ids, [&](int token) {
+        return ++count < 3;
+    });
+    M_Assert(stop_ids.size() == 3);
+    M_Assert(std::equal(stop_ids.begin(), stop_ids.end(), out_ids.begin()));
+
+    // 生成eos之后停止
+    SamplingParams eos_params = greedy_params(10);
+    eos_params.eos_id = out_ids[4];
+    std::vector<int> eos_ids;
+    net.createSession()->generate(prompt, eos_params, eos_ids);
+    M_Assert(eos_ids.back() == eos_params.eos_id);
+    M_Assert(std::equal(eos_ids.begin(), eos_ids.end(), out_ids.begin()));
+}
+
+TEST(Generate_TEST, seeded_sampling)
+{
+    Net net;
+    net.createNet(createTinyLlamaParams());
+
+    std::vector<int> prompt = {2, 30, 11, 7};
+
+    SamplingParams params;
+    params.temperature = 1.2f;
+    params.top_k = 20;
+    params.top_p = 0.9f;
+    params.min_p = 0.02f;
+    params.max_new_tokens = 16;
+    params.seed = 1234;
+
+    // 相同的种子得到相同的结果
+    std::vector<int> a, b;
+    net.createSession()->generate(prompt, params, a);
+    net.createSession()->generate(prompt, params, b);
+    M_Assert(a.size() == params.max_new_tokens);
+    M_Assert(a == b);
+
+    // 默认Session上连续调用会继续之前的对话
+    std::vector<int> c;
+    net.generate(prompt, params, c);
+    M_Assert(c == a);
+    net.generate({3, 8}, greedy_params(4), c);
+    M_Assert(c.size() == a.size() + 4);
+}
+
+TEST(Generate_TEST, continue_conversation)
+{
+    Net net;
+    net.createNet(createTinyLlamaParams());
+
+    std::vector<int> prompt = {1, 5, 9, 3, 17};
+    std::vector<int> next_prompt = {4, 8};
+
+    // 两次调用，第一次由eos结束，第二次由max_new_tokens结束
+    std::vector<int> first;
+    net.createSession()->generate(prompt, greedy_params(6), first);
+    SamplingParams eos_params = greedy_params(10);
+    eos_params.eos_id = first[3];
+
+    auto session = net.createSession();
+    session->setOutputPositions({0, -1});
+    std::vector<int> out_a, out_b;
+    session->generate(prompt, eos_params, out_a);
+    M_Assert(out_a.size() == 4 && out_a.back() == eos_params.eos_id);
+    session->generate(next_prompt, greedy_params(5), out_b);
+    M_Assert(session->getPosition() == prompt.size() + out_a.size() + next_prompt.size() + out_b.size());
+
+    // 参考：把之前的所有token作为一个prompt
+    std::vector<int> full = prompt;
+    full.insert(full.end(), out_a.begin(), out_a.end());
+    full.insert(full.end(), next_prompt.begin(), next_prompt.end());
+    std::vector<int> ref;
+    net.createSession()->generate(full, greedy_params(5), ref);
+    M_Assert(out_b == ref);
+
+    // 最后一个token只写入kv cache，不计算vocab投影。
+    // 用户设置的输出位置和logits输出在结束之后恢复，callback抛出异常时同样恢复
+    TinyLlamaConfig c;
+    session->setInput(tinyTokens({2, 6, 9}));
+    Mat out = session->forward();
+    M_Assert(out.size[1] == 2 && out.size[2] == c.n_vocab);
+    EXPECT_THROW(session->generate({7}, greedy_params(5), out_b, [](int) -> bool {
+        throw std::runtime_error("callback failed");
+    }), std::runtime_error);
+    session->setInput(tinyTokens({2, 6, 9}));
+    out = session->forward();
+    M_Assert(out.size[1] == 2 && out.size[2] == c.n_vocab);
+}
+
+TEST(Generate_TEST, repetition_penalty)
+{
+    Net net;
+    net.createNet(createTinyLlamaParams());
+
+    std::vector<int> prompt = {1, 5, 9, 3, 17};
+
+    // 很大的惩罚下，greedy不会生成出现过的token
+    SamplingParams params = greedy_params(12);
+    params.repetition_penalty = 1e4f;
+    params.penalty_last_n = -1;
+
+    std::vector<int> out_ids;
+    net.createSession()->generate(prompt, params, out_ids);
+
+    std::set<int> seen(prompt.begin(), prompt.end());
+    for (int id : out_ids)
+    {
+        M_Assert(seen.count(id) == 0);
+        seen.insert(id);
+    }
+}
@@ -0,0 +1,135 @@
+//
+// Created by mzh on 2025/3/19.
+//
+
+#include "minfer.h"
+#include "gtest/gtest.h"
+#include "tiny_llama.h"
+#include <atomic>
+#include <chrono>
+#include <condition_variable>
+#include <mutex>
+#include <stdexcept>
+#include <thread>
+
+using namespace minfer;
+
+TEST(ModelRegistry_TEST, lru_eviction)
+{
+    // 用路径名作为随机种子创建tiny llama，不需要模型文件
+    setModelLoader([](const std::string& path) {
+        TinyLlamaConfig c;
+        c.seed = path[0];
+        std::shared_ptr<Net> net = std::make_shared<Net>();
+        net->createNet(createTinyLlamaParams(c));
+        return net;
+    });
+
+    ModelRegistryInfo base = getModelRegistryInfo();
+    std::shared_ptr<Net> a = getModel("a");
+    const size_t bytes = a->getWeightBytes();
+    M_Assert(bytes > 0);
+
+    // 预算只能放下两个模型
+    setModelMemoryBudget(bytes * 5 / 2);
+    std::shared_ptr<Net> b = getModel("b");
+    M_Assert(getModel("a") == a);
+
+    ModelRegistryInfo info = getModelRegistryInfo();
+    M_Assert(info.model_count == 2 && info.resident_bytes == 2 * bytes);
+    M_Assert(info.load_count == base.load_count + 2 && info.hit_count == base.hit_count + 1);
+
+    // a刚刚使用过，加载c时释放b，外部已经不再持有b，内存真正释放
+    std::weak_ptr<Net> weakB = b;
+    b.reset();
+    std::shared_ptr<Net> c = getModel("c");
+    info = getModelRegistryInfo();
+    M_Assert(info.model_count == 2 && info.evict_count == base.evict_count + 1);
+    M_Assert(weakB.expired() && info.evicted_bytes == 0);
+    M_Assert(getModel("a") == a && getModel("c") == c);
+
+    // 重新加载b时释放a和c，它们仍然被外部持有，内存计入预算，所以b单独留在注册表中
+    std::shared_ptr<Net> b2 = getModel("b");
+    info = getModelRegistryInfo();
+    M_Assert(info.load_count == base.load_count + 4 && info.evict_count == base.evict_count + 3);
+    M_Assert(info.model_count == 1 && info.resident_bytes == bytes && info.evicted_bytes == 2 * bytes);
+    M_Assert(info.over_budget_count == base.over_budget_count + 1);
+
+    // 外部持有的模型在释放之后仍然可以使用
+    auto session = a->createSession();
+    session->setInput(tinyTokens({1, 2, 3}));
+    Mat out = session->forward();
+    M_Assert(out.total() > 0);
+    session.reset();
+
+    // 外部释放之后不再计入
+    a.reset();
+    c.reset();
+    M_Assert(getModelRegistryInfo().evicted_bytes == 0);
+
+    M_Assert(evictModel("b") && !evictModel("a"));
+    M_Assert(getModelRegistryInfo().evicted_bytes == bytes);
+    b2.reset();
+    info = getModelRegistryInfo();
+    M_Assert(info.model_count == 0 && info.resident_bytes == 0 && info.evicted_bytes == 0);
+    setModelMemoryBudget(0);
+    setModelLoader(nullptr);
+}
+
+TEST(ModelRegistry_TEST, concurrent_load)
+{
+    std::mutex mutex;
+    std::condition_variable cv;
+    bool slowStarted = false;
+    bool fastLoaded = false;
+    std::atomic<int> slowLoads(0);
+
+    // "slow"一直加载到"fast"加载完成（最多等待10秒），加载时持有注册表的锁的话"fast"只能等到超时
+    setModelLoader([&](const std::string& path) {
+        if (path == "slow")
+        {
+            slowLoads++;
+            std::unique_lock<std::mutex> lk(mutex);
+            slowStarted = true;
+            cv.notify_all();
+            cv.wait_for(lk, std::chrono::seconds(10), [&]() { return fastLoaded; });
+        }
+        TinyLlamaConfig c;
+        c.seed = path[0];
+        std::shared_ptr<Net> net = std::make_shared<Net>();
+        net->createNet(createTinyLlamaParams(c));
+        return net;
+    });
+
+    std::shared_ptr<Net> slow1, slow2;
+    std::thread t1([&]() { slow1 = getModel("slow"); });
+    {
+        std::unique_lock<std::mutex> lk(mutex);
+        cv.wait(lk, [&]() { return slowStarted; });
+    }
+    // 同一个模型正在加载时等待，不会重复加载
+    std::thread t2([&]() { slow2 = getModel("slow"); });
+
+    auto begin = std::chrono::steady_clock::now();
+    std::shared_ptr<Net> fast = getModel("fast");
+    M_Assert(fast && std::chrono::steady_clock::now() - begin < std::chrono::seconds(5));
+    {
+        std::lock_guard<std::mutex> lk(mutex);
+        fastLoaded = true;
+    }
+    cv.notify_all();
+
+    t1.join();
+    t2.join();
+    M_Assert(slow1 && slow1 == slow2 && slowLoads == 1);
+
+    // 加载失败时异常传给调用者，之后可以重新加载
+    setModelLoader([](const std::string& path) -> std::shared_ptr<Net> {
+        throw std::runtime_error("load failed");
+    });
+    EXPECT_THROW(getModel("broken"), std::runtime_error);
+    EXPECT_THROW(getModel("broken"), std::runtime_error);
+
+    M_Assert(evictModel("slow") && evictModel("fast"));
+    setModelLoader(nullptr);
+}
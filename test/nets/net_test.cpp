@@ -4,6 +4,8 @@
 
 #include "minfer.h"
 #include "gtest/gtest.h"
+#include "tiny_llama.h"
+#include "tiny_gguf.h"
 
 using namespace minfer;
 
@@ -109,6 +111,135 @@ TEST(Net_TEST, simple_net_test)
 //     outM.print();
 // }
 
+TEST(Net_TEST, chunked_prefill)
+{
+    auto params = createTinyLlamaParams();
+    std::vector<int> ids = {1, 5, 9, 3, 17, 22, 8, 0, 31, 4, 12, 7, 19, 26, 2, 11, 30, 6, 14, 25};
+    Mat input = tinyTokens(ids);
+
+    // 比较所有位置的logits
+    Net net_full;
+    net_full.createNet(params);
+    net_full.setOutputPositions({});
+    net_full.setInput(input);
+    Mat out_full;
+    net_full.forward(out_full);
+    out_full = out_full.clone();
+
+    // 20个token按6个一组prefill，最后一个chunk只有2个token
+    Net net_chunk;
+    net_chunk.createNet(params);
+    net_chunk.setPrefillChunkSize(6);
+    net_chunk.setOutputPositions({});
+    net_chunk.setInput(input);
+    Mat out_chunk;
+    net_chunk.forward(out_chunk);
+
+    M_Assert(out_chunk.shape() == out_full.shape());
+    double max_err = norm(out_full, out_chunk, NORM_INF);
+    std::cout<<"chunked prefill max abs error = "<<max_err<<std::endl;
+    M_Assert(max_err < 1e-4);
+
+    // chunk prefill之后继续decode，结果应该和直接prefill 21个token的最后一个位置一致
+    std::vector<int> ids_next = ids;
+    ids_next.push_back(13);
+    Net net_ref;
+    net_ref.createNet(params);
+    net_ref.setOutputPositions({});
+    net_ref.setInput(tinyTokens(ids_next));
+    Mat out_ref;
+    net_ref.forward(out_ref);
+
+    net_chunk.setInput(tinyTokens({13}));
+    Mat out_decode;
+    net_chunk.forward(out_decode);
+
+    int n_vocab = out_ref.size[2];
+    Mat ref_last = Mat({1, 1, n_vocab}, DT_32F, (float *)out_ref.data + ids.size() * n_vocab);
+    max_err = norm(ref_last, out_decode, NORM_INF);
+    std::cout<<"decode after chunked prefill max abs error = "<<max_err<<std::endl;
+    M_Assert(max_err < 1e-4);
+}
+
+TEST(Net_TEST, output_positions)
+{
+    auto params = createTinyLlamaParams();
+    std::vector<int> ids = {1, 5, 9, 3, 17, 22, 8, 0, 31, 4, 12, 7, 19, 26, 2, 11, 30, 6, 14, 25};
+    const int seq_len = ids.size();
+
+    Net net;
+    net.createNet(params);
+
+    auto full = net.createSession();
+    full->setOutputPositions({});
+    full->setInput(tinyTokens(ids));
+    Mat out_full = full->forward().clone();
+    const int n_vocab = out_full.size[2];
+    M_Assert(out_full.size[1] == seq_len);
+
+    auto row = [&](int pos) {
+        return Mat({1, 1, n_vocab}, DT_32F, (float *)out_full.data + pos * n_vocab);
+    };
+
+    // 默认只输出最后一个位置
+    auto last = net.createSession();
+    last->setInput(tinyTokens(ids));
+    Mat out_last = last->forward();
+    M_Assert(out_last.shape() == MatShape({1, 1, n_vocab}));
+    M_Assert(norm(out_last, row(seq_len - 1), NORM_INF) < 1e-5);
+
+    // 指定的位置按照从小到大排列，负数从后往前数
+    std::vector<int> positions = {7, -1, 0};
+    std::vector<int> sorted_pos = {0, 7, seq_len - 1};
+    auto some = net.createSession();
+    some->setOutputPositions(positions);
+    some->setInput(tinyTokens(ids));
+    Mat out_some = some->forward().clone();
+    M_Assert(out_some.size[1] == sorted_pos.size());
+    for (int i = 0; i < sorted_pos.size(); i++)
+    {
+        Mat r = Mat({1, 1, n_vocab}, DT_32F, (float *)out_some.data + i * n_vocab);
+        M_Assert(norm(r, row(sorted_pos[i]), NORM_INF) < 1e-5);
+    }
+
+    // chunk prefill时每个chunk只输出自己范围内的位置，第二个chunk没有需要输出的位置
+    auto chunk = net.createSession();
+    chunk->setPrefillChunkSize(6);
+    chunk->setOutputPositions({2, 4, 13, -1});
+    chunk->setInput(tinyTokens(ids));
+    Mat out_chunk = chunk->forward().clone();
+    std::vector<int> chunk_pos = {2, 4, 13, seq_len - 1};
+    M_Assert(out_chunk.size[1] == chunk_pos.size());
+    for (int i = 0; i < chunk_pos.size(); i++)
+    {
+        Mat r = Mat({1, 1, n_vocab}, DT_32F, (float *)out_chunk.data + i * n_vocab);
+        M_Assert(norm(r, row(chunk_pos[i]), NORM_INF) < 1e-4);
+    }
+
+    // 继续decode，结果和完整prefill一致
+    std::vector<int> ids_next = ids;
+    ids_next.push_back(13);
+    auto ref = net.createSession();
+    ref->setInput(tinyTokens(ids_next));
+    Mat out_ref = ref->forward().clone();
+
+    last->setInput(tinyTokens({13}));
+    M_Assert(norm(last->forward(), out_ref, NORM_INF) < 1e-5);
+    chunk->setOutputPositions({-1});
+    chunk->setInput(tinyTokens({13}));
+    M_Assert(norm(chunk->forward(), out_ref, NORM_INF) < 1e-4);
+}
+
+// 大模型文件需要手动下载到test/big_models，参考readme.txt
+static bool big_model_exists(const std::string& path)
+{
+    FILE* f = fopen(path.c_str(), "rb");
+    if (!f)
+        return false;
+    fclose(f);
+    return true;
+}
+
 static std::vector<int> argmax_tokens(const float* logits, int batch, int seq_len, int vocab_size) {
     std::vector<int> token_ids(seq_len, -1);
 
@@ -132,8 +263,12 @@ static std::vector<int> argmax_tokens(const float* logits, int batch, int seq_le
 
 TEST(Net_TEST, tokenizer)
 {
+    std::string model_path = std::string(M_ROOT_PATH) + "/test/big_models/Lite-Oute-1-65M-FP16.gguf";
+    if (!big_model_exists(model_path))
+        GTEST_SKIP() << "model file not found: " << model_path;
+
     Net net;
-    net.readNet(std::string(M_ROOT_PATH) + "/test/big_models/Lite-Oute-1-65M-FP16.gguf");
+    net.readNet(model_path);
 
     std::vector<int> ids_ground_truth = {1, 22557, 1526, 28808, 523, 28713, 28767};
 
@@ -162,8 +297,12 @@ TEST(Net_TEST, tokenizer)
 TEST(Net_TEST, net_tiny_llama)
 {
     std::cout<<"print test on net_tiny_llama"<<std::endl;
+    std::string model_path = std::string(M_ROOT_PATH) + "/test/big_models/Lite-Oute-1-65M-FP16.gguf";
+    if (!big_model_exists(model_path))
+        GTEST_SKIP() << "model file not found: " << model_path;
+
     Net net;
-    net.readNet(std::string(M_ROOT_PATH) + "/test/big_models/Lite-Oute-1-65M-FP16.gguf");
+    net.readNet(model_path);
 
     // sentencepiece::SentencePieceProcessor sp;
     // auto status = sp.Load(std::string(M_ROOT_PATH) + "/test/big_models/Lite-Oute-1-65M-FP16_tokenizer.model");
@@ -188,11 +327,14 @@ TEST(Net_TEST, net_tiny_llama)
 
     Mat input = Mat(mat_shape, DT_32S, ids.data());
 
+    // 按位置解码整个序列，需要所有位置的logits（默认只输出最后一个位置）。
+    // 默认Session有kv cache，只forward一次，第二次会接在这次的输入之后。
+    net.setOutputPositions({});
     net.setInput(input);
     net.init();
 
     Mat output = net.forward();
-    net.forward(output);
+    M_Assert(output.dims == 3 && output.size[1] == ids.size());
 
     output.print(10);
 
@@ -210,3 +352,144 @@ TEST(Net_TEST, net_tiny_llama)
 
     // TODO add the forward type.
 }
+
+// FP32的模型由layer直接引用映射内存，需要保留源模型；FP16的模型所有权重都被转换或者拷贝，readNet之后释放源模型
+TEST(Net_TEST, release_model_data)
+{
+#if defined(__linux__)
+    std::string path32 = "minfer_net_release_fp32_test.gguf";
+    std::string path16 = "minfer_net_release_fp16_test.gguf";
+    writeTinyLlamaGGUF(path32, DT_32F);
+    writeTinyLlamaGGUF(path16, DT_16F);
+
+    auto run = [](Net& net) {
+        auto session = net.createSession();
+        session->setInput(tinyTokens({1, 5, 9, 3, 17}));
+        return session->forward().clone();
+    };
+
+    Mat out32, out16;
+    {
+        Net net;
+        net.readNet(path32);
+        M_Assert(isFileMapped(path32));
+        out32 = run(net);
+    }
+    M_Assert(!isFileMapped(path32));
+
+    {
+        Net net;
+        net.readNet(path16);
+        M_Assert(!isFileMapped(path16));
+        out16 = run(net);
+    }
+    M_Assert(norm(out16, out32, NORM_INF) < 1e-2);
+
+    remove(path32.c_str());
+    remove(path16.c_str());
+#endif
+}
+
+// weight streaming和权重常驻内存的结果一样，计算完成的层的映射内存页被丢弃
+TEST(Net_TEST, weight_streaming)
+{
+#if defined(__linux__)
+    std::string path = "minfer_net_streaming_test.gguf";
+    // 每个权重都跨越多个内存页，丢弃时不受页对齐的影响
+    TinyLlamaConfig c;
+    c.n_vocab = 256;
+    c.n_embd = 256;
+    c.n_ff = 512;
+    c.n_head = 8;
+    c.n_head_kv = 4;
+    writeTinyLlamaGGUF(path, DT_32F, c);
+
+    Net net;
+    net.readNet(path);
+
+    auto run = [&]() {
+        std::vector<Mat> outs;
+        auto session = net.createSession();
+        session->setInput(tinyTokens({1, 5, 9, 3, 17}));
+        outs.push_back(session->forward().clone());
+        for (int id : {4, 8, 15, 16})
+        {
+            session->setInput(tinyTokens({id}));
+            outs.push_back(session->forward().clone());
+        }
+        return outs;
+    };
+
+    std::vector<Mat> ref = run();
+    const size_t residentRss = mappedFileRss(path);
+    M_Assert(residentRss > net.getWeightBytes() / 2);
+
+    net.setWeightStreaming(1);
+    std::vector<Mat> outs = run();
+    for (int i = 0; i < outs.size(); i++)
+        M_Assert(norm(outs[i], ref[i], NORM_INF) < 1e-6);
+
+    // 每一层计算完成之后丢弃它的权重，最后只剩下不满一页的部分
+    const size_t streamRss = mappedFileRss(path);
+    M_Assert(streamRss < residentRss / 4);
+
+    // 关闭之后权重重新读入
+    net.setWeightStreaming(0);
+    outs = run();
+    M_Assert(norm(outs.back(), ref.back(), NORM_INF) < 1e-6);
+    M_Assert(mappedFileRss(path) > residentRss / 2);
+
+    remove(path.c_str());
+#endif
+}
+
+// 权重使用大页时，FP32的权重从mmap映射拷贝到大页内存中，不再引用模型文件
+TEST(Net_TEST, huge_page_weights)
+{
+#if defined(__linux__)
+    std::string path = "minfer_net_huge_page_test.gguf";
+    // 二维的权重都不小于一个大页（2MB）
+    TinyLlamaConfig c;
+    c.n_vocab = 1024;
+    c.n_embd = 1024;
+    c.n_ff = 1024;
+    c.n_head = 8;
+    c.n_head_kv = 4;
+    c.n_layer = 1;
+    writeTinyLlamaGGUF(path, DT_32F, c);
+
+    auto run = [](Net& net) {
+        auto session = net.createSession();
+        session->setInput(tinyTokens({1, 5, 9, 3, 17}));
+        return session->forward().clone();
+    };
+
+    Mat ref;
+    {
+        Net net;
+        net.readNet(path);
+        ref = run(net);
+    }
+
+    const size_t n_embd_kv = c.n_embd / c.n_head * c.n_head_kv;
+    const size_t bigBytes = (c.n_vocab * c.n_embd * 2 + c.n_embd * c.n_embd * 2 + c.n_embd * n_embd_kv * 2 +
+                             c.n_embd * c.n_ff * 3) * sizeof(float);
+    const size_t before = getHugePageInfo(MEMORY_CLASS_WEIGHT).requested_bytes;
+    setHugePageMode(MEMORY_CLASS_WEIGHT, HUGE_PAGE_MADVISE);
+    {
+        Net net;
+        net.readNet(path);
+        M_Assert(!isFileMapped(path));
+
+        // 所有不小于一个大页的权重都以大页方式申请
+        HugePageInfo info = getHugePageInfo(MEMORY_CLASS_WEIGHT);
+        M_Assert(info.requested_bytes - before >= bigBytes && info.requested_bytes - before <= net.getWeightBytes());
+        M_Assert(info.thp_bytes + info.hugetlb_bytes + info.fallback_bytes <= info.requested_bytes);
+        M_Assert(norm(run(net), ref, NORM_INF) < 1e-6);
+    }
+    M_Assert(getHugePageInfo(MEMORY_CLASS_WEIGHT).requested_bytes == before);
+    setHugePageMode(MEMORY_CLASS_WEIGHT, HUGE_PAGE_OFF);
+
+    remove(path.c_str());
+#endif
+}
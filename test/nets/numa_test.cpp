@@ -0,0 +1,259 @@
+//
+// Created by mzh on 2025/3/19.
+//
+
+#include "minfer.h"
+#include "gtest/gtest.h"
+#include "tiny_llama.h"
+#include "tiny_gguf.h"
+#include "../../src/core/numa.h"
+#include "../../src/core/kv_cache.h"
+#include <atomic>
+#include <random>
+#include <stdexcept>
+
+using namespace minfer;
+
+// 只有一个node的机器上，多个node的worker都绑定到node 0，切分和计算的逻辑一样
+TEST(Numa_TEST, pool_and_weight)
+{
+    M_Assert(getNumaNodeCount() >= 1);
+
+    NumaPool pool(2, 4);
+    M_Assert(pool.getWorkerCount() == 4 && pool.getWorkerNode(3) == 1);
+
+    std::vector<std::atomic<int> > hits(4);
+    for (auto& h : hits)
+        h = 0;
+    for (int k = 0; k < 3; k++)
+        pool.run([&](int i) { hits[i]++; });
+    for (int i = 0; i < 4; i++)
+        M_Assert(hits[i] == 3);
+
+    // worker中的异常在调用线程中重新抛出，之后pool仍然可以使用
+    EXPECT_THROW(pool.run([](int i) {
+        if (i == 2)
+            throw std::runtime_error("worker failed");
+    }), std::runtime_error);
+    pool.run([&](int i) { hits[i]++; });
+    M_Assert(hits[0] == 4);
+
+    // 切分之后的结果和gemm一样，包括输出列不能被worker数量整除的情况
+    setNumaNodes(2);
+    M_Assert(getNumaNodes() == 2 && NumaPool::get());
+
+    std::mt19937 rng(7);
+    Mat a = tinyRandMat({2, 3, 24}, rng, 1.f);
+    NumaWeight kept;
+    Mat keptRef;
+    for (bool transB : {false, true})
+    {
+        Mat w = transB ? tinyRandMat({13, 24}, rng, 1.f) : tinyRandMat({24, 13}, rng, 1.f);
+        Mat ref = gemm(a, w, false, transB);
+
+        NumaWeight nw;
+        nw.reset(w, transB);
+        M_Assert(!nw.empty() && nw.getMat().empty());
+
+        Mat out = nw.gemm(a);
+        M_Assert(out.shape() == ref.shape());
+        M_Assert(norm(out, ref, NORM_INF) < 1e-4);
+
+        kept = nw;
+        keptRef = ref;
+    }
+
+    // 修改NUMA模式之后，已经切分的权重仍然由切分时的pool计算
+    std::weak_ptr<NumaPool> oldPool = NumaPool::get();
+    setNumaNodes(3);
+    M_Assert(NumaPool::get() != oldPool.lock() && !oldPool.expired());
+    M_Assert(norm(kept.gemm(a), keptRef, NORM_INF) < 1e-4);
+
+    setNumaNodes(0);
+    M_Assert(getNumaNodes() == 0 && !NumaPool::get());
+    M_Assert(norm(kept.gemm(a), keptRef, NORM_INF) < 1e-4);
+
+    kept = NumaWeight();
+    M_Assert(oldPool.expired());
+}
+
+// kv cache按head分组，每组由pool的一个worker写入，和按整行写入的结果一样
+TEST(Numa_TEST, kv_cache_groups)
+{
+    const int kvDim = 12, groups = 3, groupDim = kvDim / groups, len = 20;
+    NumaPool pool(groups, groups);
+
+    auto value = [](int pos, int j) { return (float)(pos * 100 + j); };
+    std::vector<float> rows(len * kvDim);
+    for (int pos = 0; pos < len; pos++)
+        for (int j = 0; j < kvDim; j++)
+            rows[pos * kvDim + j] = value(pos, j);
+
+    KVCache cache(4);
+    cache.prepare(0, 64, kvDim, groups);
+    pool.run([&](int g) {
+        for (int pos = 0; pos < len; pos++)
+        {
+            const float* r = rows.data() + pos * kvDim + g * groupDim;
+            cache.writeGroup(0, pos, g, r, r);
+        }
+    });
+    cache.advance(len);
+
+    KVCache ref(4);
+    ref.prepare(0, 64, kvDim, groups);
+    for (int pos = 0; pos < len; pos++)
+        ref.write(0, pos, rows.data() + pos * kvDim, rows.data() + pos * kvDim);
+
+    for (int pos = 0; pos < len; pos++)
+        for (int g = 0; g < groups; g++)
+            for (int j = 0; j < groupDim; j++)
+            {
+                M_Assert(cache.k(0, pos, g)[j] == value(pos, g * groupDim + j));
+                M_Assert(cache.v(0, pos, g)[j] == ref.v(0, pos, g)[j]);
+            }
+
+    // 只写入一组时，fork出来的cache只拷贝这一组的page
+    KVCache forked = cache.fork();
+    std::vector<float> x(groupDim, -1.f);
+    forked.writeGroup(0, 5, 1, x.data(), x.data());
+    M_Assert(forked.k(0, 5, 1)[0] == -1.f && cache.k(0, 5, 1)[0] == value(5, groupDim));
+    M_Assert(forked.k(0, 5, 0) == cache.k(0, 5, 0) && forked.k(0, 5, 2) == cache.k(0, 5, 2));
+
+    // 使用大页时每组从自己的chunk中分配page，一个大页只被一个worker第一次写入
+    setHugePageMode(MEMORY_CLASS_KV_CACHE, HUGE_PAGE_MADVISE);
+    {
+        const size_t chunkBytes = 2 << 20;
+        const size_t begin = getHugePageInfo(MEMORY_CLASS_KV_CACHE).requested_bytes;
+        KVCache huge(4);
+        huge.prepare(0, 64, kvDim, groups);
+        pool.run([&](int g) {
+            for (int pos = 0; pos < len; pos++)
+            {
+                const float* r = rows.data() + pos * kvDim + g * groupDim;
+                huge.writeGroup(0, pos, g, r, r);
+            }
+        });
+        M_Assert(getHugePageInfo(MEMORY_CLASS_KV_CACHE).requested_bytes - begin == groups * chunkBytes);
+
+        for (int g = 0; g < groups; g++)
+        {
+            const char* base = (const char *)huge.k(0, 0, g); // 第一个page在chunk的开头
+            for (int pos = 0; pos < len; pos++)
+            {
+                M_Assert(huge.k(0, pos, g)[0] == value(pos, g * groupDim));
+                for (int other = 0; other < groups; other++)
+                {
+                    // 其他组的page不在这一组的chunk中
+                    const char* p = (const char *)huge.v(0, pos, other);
+                    M_Assert((other == g) == (p >= base && p < base + chunkBytes));
+                }
+            }
+        }
+    }
+    setHugePageMode(MEMORY_CLASS_KV_CACHE, HUGE_PAGE_OFF);
+}
+
+TEST(Numa_TEST, tiny_llama)
+{
+    std::vector<int> prompt = {1, 5, 9, 3, 17};
+    std::vector<int> next = {4, 8, 15};
+
+    auto run = [&](Net& net) {
+        std::vector<Mat> outs;
+        auto session = net.createSession();
+        session->setInput(tinyTokens(prompt));
+        outs.push_back(session->forward().clone());
+        for (int id : next)
+        {
+            session->setInput(tinyTokens({id}));
+            outs.push_back(session->forward().clone());
+        }
+        return outs;
+    };
+
+    Net refNet;
+    refNet.createNet(createTinyLlamaParams());
+    std::vector<Mat> ref = run(refNet);
+
+    setNumaNodes(2);
+    {
+        Net net;
+        net.createNet(createTinyLlamaParams());
+        // 按照切分之后每个worker持有的权重计算，切分之后不再保留原来的权重，总和不变
+        M_Assert(net.getWeightBytes() == refNet.getWeightBytes());
+
+        std::vector<Mat> outs = run(net);
+        for (int i = 0; i < outs.size(); i++)
+            M_Assert(norm(outs[i], ref[i], NORM_INF) < 1e-4);
+
+        // decode时worker执行同样不分配内存
+        auto session = net.createSession();
+        session->setInput(tinyTokens(prompt));
+        session->forward();
+        Mat token = tinyTokens({4});
+        session->setInput(token);
+        session->forward();
+        for (int k = 0; k < 4; k++)
+        {
+            size_t begin = getAllocationCount();
+            session->setInput(token);
+            session->forward();
+            EXPECT_EQ(getAllocationCount() - begin, 0u);
+        }
+    }
+    setNumaNodes(0);
+}
+
+// mmap加载的FP32模型，矩阵乘的权重切分之后不再引用模型文件：源模型被释放，
+// 权重内存按照切分之后的计算，weight streaming也没有需要换入换出的权重
+TEST(Numa_TEST, mapped_model)
+{
+#if defined(__linux__)
+    std::string path = "minfer_numa_mapped_test.gguf";
+    TinyLlamaConfig c;
+    c.n_vocab = 64;
+    c.n_embd = 128;
+    c.n_ff = 256;
+    writeTinyLlamaGGUF(path, DT_32F, c);
+
+    auto run = [](Net& net) {
+        std::vector<Mat> outs;
+        auto session = net.createSession();
+        session->setInput(tinyTokens({1, 5, 9, 3, 17}));
+        outs.push_back(session->forward().clone());
+        for (int id : {4, 8, 15})
+        {
+            session->setInput(tinyTokens({id}));
+            outs.push_back(session->forward().clone());
+        }
+        return outs;
+    };
+
+    std::vector<Mat> outs;
+    size_t bytes = 0;
+    setNumaNodes(2);
+    {
+        Net net;
+        net.readNet(path);
+        M_Assert(!isFileMapped(path));
+        bytes = net.getWeightBytes();
+
+        // 没有映射的权重，打开weight streaming不影响结果
+        net.setWeightStreaming(1);
+        outs = run(net);
+    }
+    setNumaNodes(0);
+
+    Net refNet;
+    refNet.readNet(path);
+    M_Assert(isFileMapped(path));
+    M_Assert(refNet.getWeightBytes() == bytes);
+
+    std::vector<Mat> ref = run(refNet);
+    for (int i = 0; i < outs.size(); i++)
+        M_Assert(norm(outs[i], ref[i], NORM_INF) < 1e-4);
+
+    remove(path.c_str());
+#endif
+}
@@ -0,0 +1,81 @@
+//
+// Created by mzh on 2025/3/14.
+//
+
+#include "minfer.h"
+#include "gtest/gtest.h"
+#include "tiny_llama.h"
+#include <cfloat>
+#include <cmath>
+
+using namespace minfer;
+
+// 一次完整的forward得到所有位置的logits，逐个计算tokens[i + 1]的log概率
+static std::vector<double> ref_logprobs(Net& net, const std::vector<int>& tokens)
+{
+    auto session = net.createSession();
+    session->setOutputPositions({});
+    session->setInput(tinyTokens(tokens));
+    Mat out = session->forward();
+    const int n_vocab = out.size[2];
+
+    std::vector<double> logprobs;
+    for (int i = 0; i + 1 < tokens.size(); i++)
+    {
+        const float* p = (const float *)out.data + i * n_vocab;
+        double max_val = -FLT_MAX;
+        for (int j = 0; j < n_vocab; j++)
+            max_val = std::max(max_val, (double)p[j]);
+
+        double s = 0.0;
+        for (int j = 0; j < n_vocab; j++)
+            s += exp(p[j] - max_val);
+        logprobs.push_back(p[tokens[i + 1]] - max_val - log(s));
+    }
+    return logprobs;
+}
+
+TEST(Score_TEST, chunked_matches_full_forward)
+{
+    Net net;
+    net.createNet(createTinyLlamaParams());
+
+    std::vector<int> tokens = {1, 5, 9, 3, 17, 22, 8, 0, 31, 4, 12, 7, 19, 26, 2, 11, 30, 6, 14, 25, 3};
+    std::vector<double> ref = ref_logprobs(net, tokens);
+
+    double ref_sum = 0.0;
+    for (double lp : ref)
+        ref_sum += lp;
+    const double ref_ppl = exp(-ref_sum / ref.size());
+
+    // chunk大小不影响结果，包含不能整除和大于序列长度的情况
+    for (int chunk_size : {1, 3, 8, 64})
+    {
+        ScoreParams params;
+        params.chunk_size = chunk_size;
+        params.keep_token_logprobs = true;
+
+        auto session = net.createSession();
+        ScoreResult result;
+        session->score(tokens, params, result);
+
+        M_Assert(result.n_tokens == tokens.size() - 1);
+        M_Assert(session->getPosition() == tokens.size() - 1);
+        M_Assert(result.token_logprobs.size() == ref.size());
+        for (int i = 0; i < ref.size(); i++)
+        {
+            M_Assert(fabs(result.token_logprobs[i] - ref[i]) < 1e-4);
+        }
+        M_Assert(fabs(result.sum_logprob - ref_sum) < 1e-3);
+        M_Assert(fabs(result.perplexity - ref_ppl) < 1e-3 * ref_ppl);
+        M_Assert(result.tokens_per_second >= 0.0);
+    }
+
+    // 打分之后恢复默认的输出位置，只输出最后一个位置
+    auto session = net.createSession();
+    ScoreResult result;
+    session->score({1, 5, 9}, ScoreParams(), result);
+    M_Assert(result.token_logprobs.empty());
+    session->setInput(tinyTokens({4, 8}));
+    M_Assert(session->forward().size[1] == 1);
+}
@@ -0,0 +1,272 @@
+//
+// Created by mzh on 2025/3/6.
+//
+
+#include "minfer.h"
+#include "gtest/gtest.h"
+#include "tiny_llama.h"
+#include "../../src/core/kv_cache.h"
+#include <thread>
+
+using namespace minfer;
+
+// prefill之后，逐个token decode，返回每一步最后一个位置的logits
+static std::vector<Mat> run_conversation(Session& session, const std::vector<int>& prompt, const std::vector<int>& next_ids)
+{
+    std::vector<Mat> outs;
+    session.setInput(tinyTokens(prompt));
+    outs.push_back(session.forward().clone());
+
+    for (int id : next_ids)
+    {
+        session.setInput(tinyTokens({id}));
+        outs.push_back(session.forward().clone());
+    }
+    return outs;
+}
+
+TEST(Session_TEST, independent_sessions)
+{
+    Net net;
+    net.createNet(createTinyLlamaParams());
+
+    std::vector<int> prompt_a = {1, 5, 9, 3, 17};
+    std::vector<int> prompt_b = {2, 30, 11, 7};
+
+    auto ref_a_session = net.createSession();
+    auto ref_b_session = net.createSession();
+    std::vector<Mat> ref_a = run_conversation(*ref_a_session, prompt_a, {4, 8, 15});
+    std::vector<Mat> ref_b = run_conversation(*ref_b_session, prompt_b, {16, 23, 6});
+
+    // 两个会话交替推理，kv cache互不影响
+    auto sa = net.createSession();
+    auto sb = net.createSession();
+    sa->setInput(tinyTokens(prompt_a));
+    Mat out_a = sa->forward().clone();
+    sb->setInput(tinyTokens(prompt_b));
+    Mat out_b = sb->forward().clone();
+    M_Assert(norm(out_a, ref_a[0], NORM_INF) < 1e-5);
+    M_Assert(norm(out_b, ref_b[0], NORM_INF) < 1e-5);
+
+    sa->setInput(tinyTokens({4}));
+    out_a = sa->forward().clone();
+    sb->setInput(tinyTokens({16}));
+    out_b = sb->forward().clone();
+    M_Assert(norm(out_a, ref_a[1], NORM_INF) < 1e-5);
+    M_Assert(norm(out_b, ref_b[1], NORM_INF) < 1e-5);
+    M_Assert(sa->getPosition() == prompt_a.size() + 1);
+    M_Assert(sb->getPosition() == prompt_b.size() + 1);
+
+    // reset之后重新开始对话
+    sa->reset();
+    M_Assert(sa->getPosition() == 0);
+    std::vector<Mat> again_a = run_conversation(*sa, prompt_a, {4, 8, 15});
+    for (int i = 0; i < again_a.size(); i++)
+    {
+        M_Assert(norm(again_a[i], ref_a[i], NORM_INF) < 1e-5);
+    }
+}
+
+TEST(Session_TEST, concurrent_sessions)
+{
+    Net net;
+    net.createNet(createTinyLlamaParams());
+
+    const int thread_num = 4;
+    std::vector<std::vector<int> > prompts = {{1, 2, 3}, {4, 5, 6, 7, 8}, {9, 10}, {11, 12, 13, 14}};
+    std::vector<int> next_ids = {20, 21, 22, 23, 24};
+
+    std::vector<std::vector<Mat> > refs(thread_num);
+    for (int i = 0; i < thread_num; i++)
+    {
+        auto s = net.createSession();
+        refs[i] = run_conversation(*s, prompts[i], next_ids);
+    }
+
+    std::vector<std::vector<Mat> > results(thread_num);
+    std::vector<std::thread> threads;
+    for (int i = 0; i < thread_num; i++)
+    {
+        threads.emplace_back([&, i]() {
+            auto s = net.createSession();
+            for (int r = 0; r < 3; r++)
+            {
+                s->reset();
+                results[i] = run_conversation(*s, prompts[i], next_ids);
+            }
+        });
+    }
+
+    for (auto& t : threads)
+        t.join();
+
+    for (int i = 0; i < thread_num; i++)
+    {
+        M_Assert(results[i].size() == refs[i].size());
+        for (int j = 0; j < refs[i].size(); j++)
+        {
+            M_Assert(norm(results[i][j], refs[i][j], NORM_INF) < 1e-5);
+        }
+    }
+}
+
+TEST(Session_TEST, fork_copy_on_write)
+{
+    Net net;
+    net.createNet(createTinyLlamaParams());
+
+    // 20个token，每层占用两个page，第二个page没有写满
+    std::vector<int> prompt = {1, 5, 9, 3, 17, 22, 8, 0, 31, 4, 12, 7, 19, 26, 2, 11, 30, 6, 14, 25};
+    std::vector<int> branch_ids = {3, 7, 11, 15, 19, 23, 27, 31};
+
+    size_t bytes_start = KVCache::getAllocatedBytes();
+    auto parent = net.createSession();
+    parent->setInput(tinyTokens(prompt));
+    parent->forward();
+
+    size_t bytes_prefill = KVCache::getAllocatedBytes() - bytes_start;
+
+    std::vector<std::shared_ptr<Session> > children;
+    for (int i = 0; i < branch_ids.size(); i++)
+    {
+        children.push_back(parent->fork());
+        M_Assert(children[i]->getPosition() == prompt.size());
+    }
+
+    // fork不分配新的page
+    M_Assert(KVCache::getAllocatedBytes() - bytes_start == bytes_prefill);
+
+    // 每个分支写入自己的token，只会拷贝最后一个共享的page
+    std::vector<Mat> outs;
+    for (int i = 0; i < branch_ids.size(); i++)
+    {
+        children[i]->setInput(tinyTokens({branch_ids[i]}));
+        outs.push_back(children[i]->forward().clone());
+    }
+    size_t bytes_branch = KVCache::getAllocatedBytes() - bytes_start - bytes_prefill;
+    std::cout<<"kv cache bytes after prefill = "<<bytes_prefill<<", extra bytes of "<<branch_ids.size()
+             <<" branches = "<<bytes_branch<<std::endl;
+    M_Assert(bytes_branch * 2 <= bytes_prefill * branch_ids.size());
+
+    // 每个分支的结果和直接prefill prompt + token一致，parent不受影响
+    for (int i = 0; i < branch_ids.size(); i++)
+    {
+        std::vector<int> ids = prompt;
+        ids.push_back(branch_ids[i]);
+        auto ref = net.createSession();
+        ref->setOutputPositions({});
+        ref->setInput(tinyTokens(ids));
+        Mat ref_out = ref->forward();
+
+        int n_vocab = ref_out.size[2];
+        Mat ref_last = Mat({1, 1, n_vocab}, DT_32F, (float *)ref_out.data + prompt.size() * n_vocab);
+        M_Assert(norm(ref_last, outs[i], NORM_INF) < 1e-5);
+    }
+
+    parent->setInput(tinyTokens({branch_ids[0]}));
+    M_Assert(norm(parent->forward(), outs[0], NORM_INF) < 1e-5);
+}
+
+TEST(Session_TEST, memory_plan)
+{
+    Net net;
+    net.createNet(createTinyLlamaParams());
+
+    std::vector<int> prompt = {1, 5, 9, 3, 17, 22, 8, 0, 31, 4, 12, 7};
+    auto session = net.createSession();
+    session->setOutputPositions({});
+    session->setInput(tinyTokens(prompt));
+    Mat out = session->forward().clone();
+
+    // 按照生存区间规划之后，激活值内存远小于每个Mat单独分配
+    Session::MemoryInfo info = session->getMemoryInfo();
+    std::cout<<"activation bytes: planned = "<<info.planned_bytes<<", naive = "<<info.naive_bytes<<std::endl;
+    M_Assert(info.planned_bytes > 0 && info.planned_bytes * 2 <= info.naive_bytes);
+    M_Assert(info.arena_bytes >= info.planned_bytes);
+
+    // layer的临时Mat都放在按照workspace准备好的scratch内存中
+    M_Assert(info.scratch_bytes > 0 && info.scratch_overflows == 0);
+
+    // decode时shape变小，复用prefill的arena
+    session->setInput(tinyTokens({4}));
+    session->forward();
+    Session::MemoryInfo decode_info = session->getMemoryInfo();
+    M_Assert(decode_info.planned_bytes < info.planned_bytes);
+    M_Assert(decode_info.arena_bytes == info.arena_bytes);
+    M_Assert(decode_info.scratch_bytes == info.scratch_bytes && decode_info.scratch_overflows == 0);
+
+    // 新的会话从头规划内存，相同的输入得到相同的结果
+    auto again = net.createSession();
+    again->setOutputPositions({});
+    again->setInput(tinyTokens(prompt));
+    M_Assert(norm(again->forward(), out, NORM_INF) < 1e-6);
+}
+
+TEST(Session_TEST, decode_no_allocation)
+{
+    Net net;
+    net.createNet(createTinyLlamaParams());
+
+    auto session = net.createSession();
+    session->setInput(tinyTokens({1, 5, 9, 3, 17}));
+    session->forward();
+
+    // 第一个decode token需要按照新的shape重新init，之后的decode不应该有任何堆内存分配。
+    // kv cache每M_KV_CACHE_PAGE_SIZE个token分配一个新的page，这里的token都在第一个page中。
+    Mat token = tinyTokens({4});
+    session->setInput(token);
+    session->forward();
+
+    while (session->getPosition() < M_KV_CACHE_PAGE_SIZE)
+    {
+        ((int *)token.data)[0] = session->getPosition() % 32;
+        size_t begin = getAllocationCount();
+        session->setInput(token);
+        Mat logits = session->forward();
+        size_t count = getAllocationCount() - begin;
+
+        M_Assert(logits.dims == 3);
+        EXPECT_EQ(count, 0u);
+        EXPECT_EQ(session->getMemoryInfo().forward_allocations, 0u);
+    }
+}
+
+TEST(Session_TEST, shape_buckets)
+{
+    Net net;
+    net.createNet(createTinyLlamaParams());
+
+    // 参考：一次forward得到所有位置的logits
+    std::vector<int> seq = {1, 5, 9, 3, 17, 22, 8, 0, 31, 4};
+    auto ref = net.createSession();
+    ref->setOutputPositions({});
+    ref->setInput(tinyTokens(seq));
+    Mat ref_logits = ref->forward().clone();
+    const int n_vocab = ref_logits.size[2];
+
+    auto max_diff = [&](const Mat& out, int pos) {
+        const float* a = (const float *)out.data + (size_t)(out.size[1] - 1) * n_vocab;
+        const float* b = (const float *)ref_logits.data + (size_t)pos * n_vocab;
+        float d = 0.f;
+        for (int i = 0; i < n_vocab; i++)
+            d = std::max(d, std::abs(a[i] - b[i]));
+        return d;
+    };
+
+    // prefill和decode交替，不同长度的prompt在同一个bucket中，只需要两个执行计划
+    auto session = net.createSession();
+    for (int round = 0; round < 3; round++)
+    {
+        session->reset();
+        const int prompt_len = 4 + round;
+        session->setInput(tinyTokens(std::vector<int>(seq.begin(), seq.begin() + prompt_len)));
+        M_Assert(max_diff(session->forward(), prompt_len - 1) < 1e-5);
+
+        for (int i = prompt_len; i < seq.size(); i++)
+        {
+            session->setInput(tinyTokens({seq[i]}));
+            M_Assert(max_diff(session->forward(), i) < 1e-5);
+        }
+        EXPECT_EQ(session->getMemoryInfo().plan_count, 2u);
+    }
+}
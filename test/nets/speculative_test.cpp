@@ -0,0 +1,277 @@
+//
+// Created by mzh on 2025/3/16.
+//
+
+#include "minfer.h"
+#include "gtest/gtest.h"
+#include "tiny_llama.h"
+#include <algorithm>
+#include <cmath>
+#include <stdexcept>
+
+using namespace minfer;
+
+// 和target vocab一致，但是权重不同的draft模型
+static TinyLlamaConfig draft_config()
+{
+    TinyLlamaConfig c;
+    c.n_layer = 1;
+    c.seed = 7;
+    return c;
+}
+
+static SamplingParams plain_sampling(int max_new_tokens, unsigned int seed)
+{
+    SamplingParams params;
+    params.temperature = 1.f;
+    params.top_k = 0;
+    params.top_p = 1.f;
+    params.min_p = 0.f;
+    params.max_new_tokens = max_new_tokens;
+    params.seed = seed;
+    return params;
+}
+
+// target模型在ids之后的下一个token的分布
+static std::vector<float> target_probs(Net& target, const std::vector<int>& ids)
+{
+    auto s = target.createSession();
+    s->setInput(tinyTokens(ids));
+    Mat out = s->forward();
+    const int n_vocab = out.size[2];
+    const float* p = (const float *)out.data;
+
+    std::vector<float> probs(n_vocab);
+    float max_val = *std::max_element(p, p + n_vocab);
+    float sum = 0.f;
+    for (int i = 0; i < n_vocab; i++)
+    {
+        probs[i] = expf(p[i] - max_val);
+        sum += probs[i];
+    }
+    for (int i = 0; i < n_vocab; i++)
+        probs[i] /= sum;
+    return probs;
+}
+
+TEST(Speculative_TEST, greedy_matches_target)
+{
+    Net target, draft;
+    target.createNet(createTinyLlamaParams());
+    draft.createNet(createTinyLlamaParams(draft_config()));
+
+    std::vector<int> prompt = {1, 5, 9, 3, 17};
+    SamplingParams params;
+    params.temperature = 0.f;
+    params.max_new_tokens = 24;
+
+    std::vector<int> ref;
+    auto session = target.createSession();
+    session->generate(prompt, params, ref);
+
+    SpeculativeGenerator gen(target, draft, 4);
+    std::vector<int> out;
+    std::vector<int> streamed;
+    gen.generate(prompt, params, out, [&](int token) {
+        streamed.push_back(token);
+        return true;
+    });
+    M_Assert(out == ref);
+    M_Assert(streamed == out);
+    std::cout<<"speculative greedy: drafted "<<gen.getDraftedTokens()<<", accepted "<<gen.getAcceptedTokens()<<std::endl;
+
+    // 继续对话，kv cache回退之后的状态和target单独推理一致
+    params.max_new_tokens = 9;
+    session->generate({4, 8}, params, ref);
+    gen.generate({4, 8}, params, out);
+    M_Assert(out == ref);
+
+    // callback返回false时停止，之后仍然可以继续
+    std::vector<int> stop_ref, stop_out;
+    session->generate({6}, params, stop_ref);
+    int count = 0;
+    gen.generate({6}, params, stop_out, [&](int) { return ++count < 6; });
+    M_Assert(stop_out.size() == 6);
+    M_Assert(std::equal(stop_out.begin(), stop_out.end(), stop_ref.begin()));
+}
+
+// generate修改的输出位置在结束和抛出异常时都恢复为用户的设置
+TEST(Speculative_TEST, keeps_output_positions)
+{
+    Net target, draft;
+    target.createNet(createTinyLlamaParams());
+    draft.createNet(createTinyLlamaParams(draft_config()));
+
+    SamplingParams params;
+    params.temperature = 0.f;
+    params.max_new_tokens = 10;
+
+    SpeculativeGenerator gen(target, draft, 4);
+    std::vector<std::shared_ptr<Session> > sessions = {gen.getTargetSession(), gen.getDraftSession()};
+    for (auto& s : sessions)
+        s->setOutputPositions({0, -1});
+
+    auto checkPositions = [&]() {
+        for (auto& s : sessions)
+        {
+            s->setInput(tinyTokens({2, 4, 6}));
+            M_Assert(s->forward().size[1] == 2);
+        }
+    };
+
+    std::vector<int> out;
+    gen.generate({1, 5, 9, 3, 17}, params, out);
+    M_Assert(out.size() == 10);
+    checkPositions();
+
+    EXPECT_THROW(gen.generate({7}, params, out, [](int) -> bool { throw std::runtime_error("stop"); }),
+                 std::runtime_error);
+    checkPositions();
+}
+
+TEST(Speculative_TEST, same_model_accepts_all)
+{
+    Net target, draft;
+    target.createNet(createTinyLlamaParams());
+    draft.createNet(createTinyLlamaParams());
+
+    SpeculativeGenerator gen(target, draft, 5);
+    std::vector<int> out;
+    gen.generate({2, 30, 11, 7}, plain_sampling(40, 3), out);
+    M_Assert(out.size() == 40);
+
+    // draft和target的分布一样时，所有的draft都会被接受
+    std::cout<<"speculative same model: drafted "<<gen.getDraftedTokens()<<", accepted "<<gen.getAcceptedTokens()<<std::endl;
+    M_Assert(gen.getAcceptedTokens() >= gen.getDraftedTokens() * 0.95);
+
+    // 全部接受时draft的kv cache需要补上最后一个draft，结果仍然和target一致
+    SamplingParams greedy;
+    greedy.temperature = 0.f;
+    greedy.max_new_tokens = 23;
+    std::vector<int> ref, out_greedy;
+    target.createSession()->generate({1, 5, 9, 3, 17}, greedy, ref);
+    gen.reset();
+    gen.generate({1, 5, 9, 3, 17}, greedy, out_greedy);
+    M_Assert(out_greedy == ref);
+}
+
+TEST(Speculative_TEST, rejection_sampling_distribution)
+{
+    Net target, draft;
+    target.createNet(createTinyLlamaParams());
+    draft.createNet(createTinyLlamaParams(draft_config()));
+
+    std::vector<int> prompt = {1, 5, 9, 3, 17};
+    const int n_vocab = TinyLlamaConfig().n_vocab;
+
+    // 第二个token的精确分布：sum_x p(x) * p(y | x)
+    std::vector<float> p1 = target_probs(target, prompt);
+    std::vector<double> expect(n_vocab, 0.0);
+    for (int x = 0; x < n_vocab; x++)
+    {
+        std::vector<int> ids = prompt;
+        ids.push_back(x);
+        std::vector<float> p2 = target_probs(target, ids);
+        for (int y = 0; y < n_vocab; y++)
+            expect[y] += p1[x] * p2[y];
+    }
+
+    // 第二个token来自draft被接受或者拒绝之后重新采样
+    const int n_run = 4000;
+    SpeculativeGenerator gen(target, draft, 1);
+    std::vector<double> hist(n_vocab, 0.0);
+    for (int r = 0; r < n_run; r++)
+    {
+        gen.reset();
+        std::vector<int> out;
+        gen.generate(prompt, plain_sampling(2, r), out);
+        M_Assert(out.size() == 2);
+        hist[out[1]] += 1.0 / n_run;
+    }
+
+    double tv = 0.0;
+    for (int y = 0; y < n_vocab; y++)
+        tv += 0.5 * fabs(hist[y] - expect[y]);
+
+    std::cout<<"speculative sampling total variation distance = "<<tv<<", acceptance = "
+             <<gen.getAcceptedTokens() / (float)gen.getDraftedTokens()<<std::endl;
+    M_Assert(tv < 0.06);
+    M_Assert(gen.getAcceptedTokens() < gen.getDraftedTokens());
+}
+
+TEST(Speculative_TEST, prompt_lookup)
+{
+    Net target;
+    target.createNet(createTinyLlamaParams());
+
+    // prompt中有重复的片段，输出很容易复制prompt
+    std::vector<int> prompt = {3, 8, 1, 20, 9, 14, 5, 3, 8, 1, 20, 9, 14, 5, 3, 8};
+    SamplingParams params;
+    params.temperature = 0.f;
+    params.max_new_tokens = 30;
+
+    std::vector<int> ref;
+    auto session = target.createSession();
+    session->generate(prompt, params, ref);
+
+    PromptLookupParams lookup;
+    lookup.n_draft = 6;
+    SpeculativeGenerator gen(target, lookup);
+    std::vector<int> out;
+    gen.generate(prompt, params, out);
+    M_Assert(out == ref);
+    std::cout<<"prompt lookup greedy: drafted "<<gen.getDraftedTokens()<<", accepted "<<gen.getAcceptedTokens()<<std::endl;
+    M_Assert(gen.getAcceptedTokens() > 0);
+
+    // 继续对话
+    params.max_new_tokens = 10;
+    session->generate({3, 8}, params, ref);
+    gen.generate({3, 8}, params, out);
+    M_Assert(out == ref);
+}
+
+TEST(Speculative_TEST, prompt_lookup_distribution)
+{
+    Net target;
+    target.createNet(createTinyLlamaParams());
+    const int n_vocab = TinyLlamaConfig().n_vocab;
+
+    // prompt包含所有的token，第一个token之后一定能找到1-gram的draft
+    std::vector<int> prompt;
+    for (int i = 0; i < n_vocab; i++)
+        prompt.push_back((i * 7) % n_vocab);
+
+    std::vector<float> p1 = target_probs(target, prompt);
+    std::vector<double> expect(n_vocab, 0.0);
+    for (int x = 0; x < n_vocab; x++)
+    {
+        std::vector<int> ids = prompt;
+        ids.push_back(x);
+        std::vector<float> p2 = target_probs(target, ids);
+        for (int y = 0; y < n_vocab; y++)
+            expect[y] += p1[x] * p2[y];
+    }
+
+    PromptLookupParams lookup;
+    lookup.n_draft = 1;
+    SpeculativeGenerator gen(target, lookup);
+
+    const int n_run = 4000;
+    std::vector<double> hist(n_vocab, 0.0);
+    for (int r = 0; r < n_run; r++)
+    {
+        gen.reset();
+        std::vector<int> out;
+        gen.generate(prompt, plain_sampling(2, r), out);
+        hist[out[1]] += 1.0 / n_run;
+    }
+
+    double tv = 0.0;
+    for (int y = 0; y < n_vocab; y++)
+        tv += 0.5 * fabs(hist[y] - expect[y]);
+
+    std::cout<<"prompt lookup total variation distance = "<<tv<<", drafted "<<gen.getDraftedTokens()
+             <<", accepted "<<gen.getAcceptedTokens()<<std::endl;
+    M_Assert(gen.getDraftedTokens() == n_run);
+    M_Assert(tv < 0.06);
+}
@@ -0,0 +1,63 @@
+//
+// Created by mzh on 2025/3/19.
+//
+
+#include "minfer.h"
+#include "gtest/gtest.h"
+#include "tiny_llama.h"
+
+using namespace minfer;
+
+// 输出层和embedding使用同一个[n_embd, n_vocab]的权重（和readGGUF中没有output.weight时一样）
+static std::vector<std::shared_ptr<LayerParams> > createTiedParams(int type, bool shared)
+{
+    TinyLlamaConfig c;
+    auto params = createTinyLlamaParams(c);
+
+    Mat tied = transpose(params[1]->getWeights()[0]->clone());
+    if (type != DT_32F)
+    {
+        Mat w;
+        tied.convertTo(w, type);
+        tied = w;
+    }
+
+    *params[1]->getWeights()[0] = shared ? tied : tied.clone();
+    *params[params.size() - 2]->getWeights()[0] = shared ? tied : tied.clone();
+    return params;
+}
+
+static Mat runPrompt(Net& net, const std::vector<int>& prompt)
+{
+    auto session = net.createSession();
+    session->setInput(tinyTokens(prompt));
+    return session->forward().clone();
+}
+
+TEST(TiedEmbedding_TEST, share_weight)
+{
+    std::vector<int> prompt = {1, 5, 9, 3, 17};
+    TinyLlamaConfig c;
+
+    for (int type : {DT_32F, DT_16F})
+    {
+        // 不共享时embedding保持源类型
+        const size_t tiedBytes = (size_t)c.n_embd * c.n_vocab * DT_ELEM_SIZE(type);
+
+        Net refNet;
+        refNet.createNet(createTiedParams(type, false));
+        Mat ref = runPrompt(refNet, prompt);
+
+        auto params = createTiedParams(type, true);
+        Net net;
+        net.createNet(params);
+        Mat out = runPrompt(net, prompt);
+        M_Assert(norm(out, ref, NORM_INF) < 1e-6);
+
+        // 非FP32的权重只转换一次，两个layer引用同一块FP32内存
+        Mat* embd = params[1]->getWeights()[0];
+        Mat* output = params[params.size() - 2]->getWeights()[0];
+        M_Assert(embd->type() == DT_32F && embd->data == output->data);
+        M_Assert(net.getWeightBytes() + tiedBytes == refNet.getWeightBytes());
+    }
+}
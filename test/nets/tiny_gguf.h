@@ -0,0 +1,185 @@
+//
+// Created by mzh on 2025/3/19.
+//
+
+#ifndef MINFER_TEST_TINY_GGUF_H
+#define MINFER_TEST_TINY_GGUF_H
+
+#include "tiny_llama.h"
+#include "../../src/core/gguf_model/gguf_utils.h"
+#include "../../src/core/gguf_model/ggml_quant.h"
+
+#include <cstdio>
+#include <cstdlib>
+#include <filesystem>
+#include <fstream>
+#include <string>
+#include <vector>
+
+namespace minfer
+{
+
+// 把createTinyLlamaParams的权重写成llama结构的gguf模型，用于测试readNet相关的功能（mmap、权重缓存、weight streaming）。
+// type为DT_16F时二维的权重保存为FP16，quantType不是QUANT_NONE时二维的权重按block量化，
+// norm的权重和gguf一样仍然是FP32。
+// 没有词表（tokenizer.ggml.model = "no_vocab"），loader不读取rms eps，所以结果和createTinyLlamaParams不完全一样。
+static inline void writeTinyLlamaGGUF(const std::string& path, int type = DT_32F,
+                                      const TinyLlamaConfig& c = TinyLlamaConfig(),
+                                      QuantType quantType = QUANT_NONE)
+{
+    auto params = createTinyLlamaParams(c);
+
+    // 和readGGUF中的顺序一致，量化的tensor保存为 [ne1, 每行的字节数] 的DT_8U
+    std::vector<std::string> names;
+    std::vector<Mat> mats;
+    std::vector<MatShape> shapes;
+    auto add = [&](const std::string& name, const Mat& m) {
+        Mat w = m;
+        if (quantType != QUANT_NONE && m.dims == 2)
+        {
+            const size_t rowBytes = ggml_row_size((GGML_TYPE)quantType, m.size[0]);
+            w = Mat({m.size[1], (int)rowBytes}, DT_8U);
+            for (int r = 0; r < m.size[1]; r++)
+                quantize_row((GGML_TYPE)quantType, (const float *)m.data + (size_t)r * m.size[0], w.data + r * rowBytes,
+                             m.size[0]);
+        }
+        else if (type == DT_16F && m.dims == 2)
+            m.convertTo(w, DT_16F);
+        names.push_back(name);
+        mats.push_back(w);
+        shapes.push_back(m.shape());
+    };
+
+    add("token_embd.weight", *params[1]->getWeights()[0]);
+    const char* attnNames[] = {"attn_norm", "attn_q", "attn_k", "attn_v", "attn_output"};
+    const char* ffnNames[] = {"ffn_norm", "ffn_gate", "ffn_up", "ffn_down"};
+    for (int i = 0; i < c.n_layer; i++)
+    {
+        std::vector<Mat*> attn = params[2 + i * 2]->getWeights();
+        for (int k = 0; k < 5; k++)
+            add(format("blk.%d.%s.weight", i, attnNames[k]), *attn[k]);
+
+        std::vector<Mat*> ffn = params[3 + i * 2]->getWeights();
+        for (int k = 0; k < 4; k++)
+            add(format("blk.%d.%s.weight", i, ffnNames[k]), *ffn[k]);
+    }
+    add("output_norm.weight", *params[params.size() - 3]->getWeights()[0]);
+    add("output.weight", *params[params.size() - 2]->getWeights()[0]);
+
+    FILE* f = fopen(path.c_str(), "wb");
+    M_Assert(f);
+
+    size_t pos = 0;
+    auto write = [&](const void* p, size_t n) {
+        M_Assert(fwrite(p, 1, n, f) == n);
+        pos += n;
+    };
+    auto writeStr = [&](const std::string& s) {
+        uint64_t n = s.size();
+        write(&n, sizeof(n));
+        write(s.data(), n);
+    };
+    auto writeKvU32 = [&](const std::string& key, uint32_t value) {
+        uint32_t kvType = GGUF_TYPE_UINT32;
+        writeStr(key);
+        write(&kvType, sizeof(kvType));
+        write(&value, sizeof(value));
+    };
+    auto writeKvStr = [&](const std::string& key, const std::string& value) {
+        uint32_t kvType = GGUF_TYPE_STRING;
+        writeStr(key);
+        write(&kvType, sizeof(kvType));
+        writeStr(value);
+    };
+
+    uint32_t version = 3;
+    uint64_t n_tensors = names.size();
+    uint64_t n_kv = 11;
+    write(GGUF_MAGIC, 4);
+    write(&version, sizeof(version));
+    write(&n_tensors, sizeof(n_tensors));
+    write(&n_kv, sizeof(n_kv));
+
+    writeKvU32("general.alignment", GGUF_DEFAULT_ALIGNMENT);
+    writeKvStr("general.architecture", "llama");
+    writeKvU32("llama.vocab_size", c.n_vocab);
+    writeKvU32("llama.context_length", c.n_ctx);
+    writeKvU32("llama.embedding_length", c.n_embd);
+    writeKvU32("llama.feed_forward_length", c.n_ff);
+    writeKvU32("llama.attention.head_count", c.n_head);
+    writeKvU32("llama.attention.head_count_kv", c.n_head_kv);
+    writeKvU32("llama.block_count", c.n_layer);
+    writeKvStr("tokenizer.ggml.model", "no_vocab");
+    writeKvU32("llama.rope.dimension_count", c.n_embd / c.n_head);
+
+    // loader中Mat的shape和ne的顺序相同
+    uint64_t dataOffset = 0;
+    std::vector<uint64_t> offsets;
+    for (int i = 0; i < names.size(); i++)
+    {
+        const Mat& m = mats[i];
+        writeStr(names[i]);
+        uint32_t n_dims = shapes[i].size();
+        write(&n_dims, sizeof(n_dims));
+        for (int d = 0; d < n_dims; d++)
+        {
+            int64_t ne = shapes[i][d];
+            write(&ne, sizeof(ne));
+        }
+        uint32_t ggmlType = m.type() == DT_8U ? (uint32_t)quantType : m.type() == DT_16F ? GGML_TYPE_F16 : GGML_TYPE_F32;
+        write(&ggmlType, sizeof(ggmlType));
+        write(&dataOffset, sizeof(dataOffset));
+
+        offsets.push_back(dataOffset);
+        dataOffset += M_PAD(m.total() * DT_ELEM_SIZE(m.type()), GGUF_DEFAULT_ALIGNMENT);
+    }
+
+    std::vector<char> zeros(GGUF_DEFAULT_ALIGNMENT, 0);
+    write(zeros.data(), M_PAD(pos, GGUF_DEFAULT_ALIGNMENT) - pos);
+    size_t start = pos;
+    for (int i = 0; i < mats.size(); i++)
+    {
+        write(zeros.data(), start + offsets[i] - pos);
+        write(mats[i].data, mats[i].total() * DT_ELEM_SIZE(mats[i].type()));
+    }
+    write(zeros.data(), M_PAD(pos, GGUF_DEFAULT_ALIGNMENT) - pos);
+    fclose(f);
+}
+
+// 当前进程是否mmap了path这个文件，/proc/self/maps中是绝对路径
+static inline bool isFileMapped(const std::string& path)
+{
+    std::string absPath = std::filesystem::absolute(path).string();
+    std::ifstream maps("/proc/self/maps");
+    std::string line;
+    while (std::getline(maps, line))
+    {
+        if (line.size() >= absPath.size() && line.compare(line.size() - absPath.size(), absPath.size(), absPath) == 0)
+            return true;
+    }
+    return false;
+}
+
+// 当前进程中path这个文件的映射实际驻留内存的字节数（/proc/self/smaps中的Rss）
+static inline size_t mappedFileRss(const std::string& path)
+{
+    std::string absPath = std::filesystem::absolute(path).string();
+    std::ifstream smaps("/proc/self/smaps");
+    std::string line;
+    bool inFile = false;
+    size_t rss = 0;
+    while (std::getline(smaps, line))
+    {
+        std::string first = line.substr(0, line.find(' '));
+        if (first.find('-') != std::string::npos)
+            inFile = line.size() >= absPath.size() &&
+                     line.compare(line.size() - absPath.size(), absPath.size(), absPath) == 0;
+        else if (inFile && first == "Rss:")
+            rss += strtoull(line.c_str() + first.size(), nullptr, 10) * 1024;
+    }
+    return rss;
+}
+
+}
+
+#endif //MINFER_TEST_TINY_GGUF_H
@@ -0,0 +1,95 @@
+//
+// Created by mzh on 2025/3/2.
+//
+
+#ifndef MINFER_TEST_TINY_LLAMA_H
+#define MINFER_TEST_TINY_LLAMA_H
+
+#include "minfer.h"
+#include <random>
+
+namespace minfer
+{
+
+// 随机权重的小llama模型，结构和readGGUF生成的一样，用于测试不依赖于大模型文件的Net级别功能。
+struct TinyLlamaConfig
+{
+    int n_vocab = 32;
+    int n_embd = 16;
+    int n_ff = 32;
+    int n_head = 4;
+    int n_head_kv = 2;
+    int n_layer = 2;
+    int n_ctx = 64;
+    float rms_eps = 1e-5f;
+    unsigned int seed = 42;
+};
+
+static inline Mat tinyRandMat(const std::vector<int>& shape, std::mt19937& rng, float scale)
+{
+    std::uniform_real_distribution<float> dist(-scale, scale);
+    Mat m(shape, DT_32F);
+    float* p = (float *)m.data;
+    for (size_t i = 0; i < m.total(); i++)
+    {
+        p[i] = dist(rng);
+    }
+    return m;
+}
+
+static inline std::vector<std::shared_ptr<LayerParams> > createTinyLlamaParams(const TinyLlamaConfig& c = TinyLlamaConfig())
+{
+    std::mt19937 rng(c.seed);
+    const int n_embd_kv = c.n_embd / c.n_head * c.n_head_kv;
+    const float w_scale = 1.f / sqrtf((float)c.n_embd);
+
+    std::vector<std::shared_ptr<LayerParams> > params;
+    params.push_back(std::shared_ptr<LayerParams>(new LayerParams(LayerType::Input, {0}, {1})));
+    params.push_back(std::shared_ptr<LayerParams>(
+            new EmbeddingLayerParams({1}, {2}, c.n_vocab, c.n_embd, tinyRandMat({c.n_vocab, c.n_embd}, rng, 1.f))));
+
+    int layer_id = 2;
+    for (int i = 0; i < c.n_layer; i++)
+    {
+        Mat attn_norm = tinyRandMat({c.n_embd}, rng, 0.5f) + 1.f;
+        params.push_back(std::shared_ptr<LayerParams>(new AttentionLayerParams(
+                {layer_id}, {layer_id + 1}, c.n_ctx, c.n_embd, c.n_head, c.n_head_kv, c.rms_eps, attn_norm,
+                tinyRandMat({c.n_embd, c.n_embd}, rng, w_scale), tinyRandMat({c.n_embd, n_embd_kv}, rng, w_scale),
+                tinyRandMat({c.n_embd, n_embd_kv}, rng, w_scale), tinyRandMat({c.n_embd, c.n_embd}, rng, w_scale))));
+        layer_id++;
+
+        Mat ffn_norm = tinyRandMat({c.n_embd}, rng, 0.5f) + 1.f;
+        params.push_back(std::shared_ptr<LayerParams>(new FeedForwardLayerParams(
+                {layer_id}, {layer_id + 1}, ActivateType::SILU, c.n_embd, c.n_ff, c.rms_eps, ffn_norm,
+                tinyRandMat({c.n_embd, c.n_ff}, rng, w_scale), tinyRandMat({c.n_embd, c.n_ff}, rng, w_scale),
+                tinyRandMat({c.n_ff, c.n_embd}, rng, w_scale))));
+        layer_id++;
+    }
+
+    params.push_back(std::shared_ptr<LayerParams>(new LayerParams(LayerType::GetRows, {layer_id}, {layer_id + 1})));
+    layer_id++;
+
+    Mat out_norm = tinyRandMat({c.n_embd}, rng, 0.5f) + 1.f;
+    params.push_back(std::shared_ptr<LayerParams>(
+            new RMSNormLayerParams({layer_id}, {layer_id + 1}, c.n_embd, c.rms_eps, out_norm)));
+    layer_id++;
+
+    params.push_back(std::shared_ptr<LayerParams>(
+            new LinearLayerParams({layer_id}, {layer_id + 1}, c.n_embd, c.n_vocab,
+                                  tinyRandMat({c.n_embd, c.n_vocab}, rng, w_scale))));
+    layer_id++;
+
+    params.push_back(std::shared_ptr<LayerParams>(new LayerParams(LayerType::Output, {layer_id}, {layer_id + 1})));
+    return params;
+}
+
+static inline Mat tinyTokens(const std::vector<int>& ids)
+{
+    Mat m({1, (int)ids.size()}, DT_32S);
+    memcpy(m.data, ids.data(), ids.size() * sizeof(int));
+    return m;
+}
+
+}
+
+#endif //MINFER_TEST_TINY_LLAMA_H
@@ -0,0 +1,223 @@
+//
+// Created by mzh on 2025/3/18.
+//
+
+#include "minfer.h"
+#include "gtest/gtest.h"
+#include "tiny_llama.h"
+#include "tiny_gguf.h"
+#include "../../src/core/gguf_model/weight_cache.h"
+#include <chrono>
+#include <cstdio>
+#include <filesystem>
+#include <thread>
+
+using namespace minfer;
+
+// FP16权重的tiny llama，模拟从FP16的gguf模型中读取的参数（和gguf一样，norm的权重仍然是FP32）
+static std::vector<std::shared_ptr<LayerParams> > createFp16Params()
+{
+    auto params = createTinyLlamaParams();
+    for (auto& p : params)
+    {
+        for (Mat* w : p->getWeights())
+        {
+            if (w->dims == 2)
+            {
+                Mat w16;
+                w->convertTo(w16, DT_16F);
+                *w = w16;
+            }
+        }
+    }
+    return params;
+}
+
+static Mat runPrompt(const std::vector<std::shared_ptr<LayerParams> >& params, const std::vector<int>& prompt)
+{
+    Net net;
+    net.createNet(params);
+    auto session = net.createSession();
+    session->setInput(tinyTokens(prompt));
+    return session->forward().clone();
+}
+
+TEST(WeightCache_TEST, write_and_load)
+{
+    std::string path = "minfer_weight_cache_test.gguf";
+    std::vector<int> prompt = {1, 5, 9, 3, 17};
+    Mat ref = runPrompt(createFp16Params(), prompt);
+
+    writeWeightCache(path, "source-a", "hash-a", createFp16Params());
+
+    {
+        // 缓存中的权重是FP32，直接引用映射内存；embedding保持源类型，不在缓存中
+        auto params = createFp16Params();
+        std::shared_ptr<GGUF_context> cache = loadWeightCache(path, "source-a", params);
+        M_Assert(cache);
+        for (auto& p : params)
+        {
+            for (Mat* w : p->getWeights())
+                M_Assert(w->empty() || w->type() == (p->convertsWeights() ? DT_32F : DT_16F));
+        }
+
+        Mat out = runPrompt(params, prompt);
+        M_Assert(norm(out, ref, NORM_INF) < 1e-6);
+    }
+
+    {
+        // 源模型变化时缓存失效，参数不变
+        auto params = createFp16Params();
+        M_Assert(!loadWeightCache(path, "source-b", params));
+        M_Assert(!loadWeightCache(path, "source-b", params, "hash-b"));
+        M_Assert(params[1]->getWeights()[0]->type() == DT_16F);
+
+        // key不一致但是所有数据的hash一致时，缓存仍然有效
+        M_Assert(loadWeightCache(path, "source-b", params, "hash-a"));
+        params = createFp16Params();
+
+        // 模型结构不一样时也失效
+        TinyLlamaConfig c;
+        c.n_layer = 3;
+        auto other = createTinyLlamaParams(c);
+        M_Assert(!loadWeightCache(path, "source-a", other));
+    }
+
+    auto params = createFp16Params();
+    M_Assert(!loadWeightCache("minfer_weight_cache_not_exist.gguf", "source-a", params));
+    remove(path.c_str());
+}
+
+// 多个写入者同时生成同一个缓存，每个写入者使用自己的临时文件，最后的缓存是完整的，不留下临时文件
+TEST(WeightCache_TEST, concurrent_write)
+{
+    std::string path = "minfer_weight_cache_concurrent_test.gguf";
+    std::vector<int> prompt = {1, 5, 9, 3, 17};
+    Mat ref = runPrompt(createFp16Params(), prompt);
+
+    std::vector<std::thread> writers;
+    for (int i = 0; i < 4; i++)
+        writers.emplace_back([&]() { writeWeightCache(path, "source-a", "hash-a", createFp16Params()); });
+    for (auto& th : writers)
+        th.join();
+
+    auto params = createFp16Params();
+    std::shared_ptr<GGUF_context> cache = loadWeightCache(path, "source-a", params);
+    M_Assert(cache);
+    M_Assert(norm(runPrompt(params, prompt), ref, NORM_INF) < 1e-6);
+
+    for (auto& entry : std::filesystem::directory_iterator("."))
+    {
+        std::string name = entry.path().filename().string();
+        M_Assert(!(name.rfind(path, 0) == 0 && name.size() > 4 && name.compare(name.size() - 4, 4, ".tmp") == 0));
+    }
+
+    cache = nullptr;
+    remove(path.c_str());
+}
+
+TEST(WeightCache_TEST, source_changed)
+{
+    std::string modelPath = "minfer_weight_cache_source_test.gguf";
+    std::string cachePath = "minfer_weight_cache_source_test.cache.gguf";
+    std::vector<int> prompt = {1, 5, 9, 3, 17};
+
+    // 每个权重都大于4KB
+    TinyLlamaConfig c;
+    c.n_vocab = 64;
+    c.n_embd = 64;
+    c.n_ff = 128;
+    writeTinyLlamaGGUF(modelPath, DT_16F, c);
+
+    auto run = [&](bool useCache) {
+        Net net;
+        if (useCache)
+            net.setWeightCachePath(cachePath);
+        net.readNet(modelPath);
+        auto session = net.createSession();
+        session->setInput(tinyTokens(prompt));
+        return session->forward().clone();
+    };
+
+    Mat ref = run(false);
+    Mat cached = run(true);
+    M_Assert(norm(cached, ref, NORM_INF) < 1e-6);
+
+    // 只修改文件的修改时间，key变化，内容不变时通过所有数据的hash仍然使用缓存，不重新生成
+    const std::string key = weightCacheSourceKey(modelPath);
+    const std::string hash = weightCacheSourceHash(modelPath);
+    auto mtime = std::filesystem::last_write_time(modelPath);
+    std::filesystem::last_write_time(modelPath, mtime + std::chrono::seconds(10));
+    M_Assert(weightCacheSourceKey(modelPath) != key && weightCacheSourceHash(modelPath) == hash);
+
+    auto cacheTime = std::filesystem::last_write_time(cachePath);
+    M_Assert(norm(run(true), ref, NORM_INF) < 1e-6);
+    M_Assert(std::filesystem::last_write_time(cachePath) == cacheTime);
+
+    // 原地修改最后一个权重（output.weight）中4KB之后的一个字节，大小和metadata都不变，缓存必须重新生成
+    std::this_thread::sleep_for(std::chrono::milliseconds(50));
+    {
+        FILE* f = fopen(modelPath.c_str(), "r+b");
+        M_Assert(f);
+        fseek(f, 0, SEEK_END);
+        long pos = ftell(f) - 999; // FP16的高字节
+        fseek(f, pos, SEEK_SET);
+        int b = fgetc(f);
+        fseek(f, pos, SEEK_SET);
+        fputc(b ^ 0x01, f);
+        fclose(f);
+    }
+
+    M_Assert(weightCacheSourceHash(modelPath) != hash);
+
+    Mat changedRef = run(false);
+    M_Assert(norm(changedRef, ref, NORM_INF) > 1e-6);
+    M_Assert(norm(run(true), changedRef, NORM_INF) < 1e-6);
+
+    remove(modelPath.c_str());
+    remove(cachePath.c_str());
+}
+
+// 量化的模型：没有缓存时layer构造时反量化，缓存命中时直接使用缓存中的FP32，加载时不再反量化
+TEST(WeightCache_TEST, quantized_warm_start)
+{
+    std::string modelPath = "minfer_weight_cache_quant_test.gguf";
+    std::string cachePath = "minfer_weight_cache_quant_test.cache.gguf";
+    std::vector<int> prompt = {1, 5, 9, 3, 17};
+
+    TinyLlamaConfig c;
+    c.n_vocab = 64;
+    c.n_embd = 64;
+    c.n_ff = 128;
+    for (QuantType quantType : {QUANT_Q8_0, QUANT_Q4_0})
+    {
+        writeTinyLlamaGGUF(modelPath, DT_32F, c, quantType);
+        remove(cachePath.c_str());
+
+        size_t dequantized = 0;
+        auto run = [&](bool useCache) {
+            Net net;
+            if (useCache)
+                net.setWeightCachePath(cachePath);
+            size_t begin = getDequantizedCount();
+            net.readNet(modelPath);
+            dequantized = getDequantizedCount() - begin;
+            auto session = net.createSession();
+            session->setInput(tinyTokens(prompt));
+            return session->forward().clone();
+        };
+
+        Mat ref = run(false);
+        M_Assert(dequantized > 0);
+
+        // 第一次生成缓存
+        M_Assert(norm(run(true), ref, NORM_INF) < 1e-6);
+
+        // 缓存命中，不反量化任何权重
+        M_Assert(norm(run(true), ref, NORM_INF) < 1e-6);
+        EXPECT_EQ(dequantized, 0u);
+    }
+
+    remove(modelPath.c_str());
+    remove(cachePath.c_str());
+}
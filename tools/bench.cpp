@@ -0,0 +1,120 @@
+//
+// Created by mzh on 2025/3/19.
+//
+
+// 测试prefill和decode的速度。
+// 用法：minfer_bench model.gguf [n_prompt] [n_gen] [stream_window]
+// stream_window > 0 时，先在权重常驻内存的模式下测试，再打开weight streaming测试，输出两者的速度比。
+// 环境变量MINFER_NUMA_NODES打开NUMA模式时，同时输出和关闭NUMA模式的速度比。
+
+#include "minfer.h"
+
+#include <chrono>
+#include <cstdio>
+#include <cstdlib>
+
+using namespace minfer;
+
+struct BenchResult
+{
+    double prefill_tokens_per_second = 0.0;
+    double decode_tokens_per_second = 0.0;
+};
+
+static BenchResult runBench(Net& net, const std::vector<int>& prompt, int n_gen)
+{
+    typedef std::chrono::steady_clock Clock;
+    auto session = net.createSession();
+    BenchResult r;
+
+    auto t0 = Clock::now();
+    Mat prompt_mat({1, (int)prompt.size()}, DT_32S);
+    memcpy(prompt_mat.data, prompt.data(), prompt.size() * sizeof(int));
+    session->setInput(prompt_mat);
+    session->forward();
+    double prefill = std::chrono::duration<double>(Clock::now() - t0).count();
+    r.prefill_tokens_per_second = prompt.size() / prefill;
+
+    // 固定输入同一个token，只测试速度
+    Mat token({1, 1}, DT_32S);
+    ((int *)token.data)[0] = prompt.back();
+    auto t1 = Clock::now();
+    for (int i = 0; i < n_gen; i++)
+    {
+        session->setInput(token);
+        session->forward();
+    }
+    double decode = std::chrono::duration<double>(Clock::now() - t1).count();
+    r.decode_tokens_per_second = n_gen / decode;
+    return r;
+}
+
+int main(int argc, char** argv)
+{
+    if (argc < 2)
+    {
+        printf("Usage: %s model.gguf [n_prompt=128] [n_gen=32] [stream_window=0]\n", argv[0]);
+        return 1;
+    }
+
+    const std::string model_path = argv[1];
+    const int n_prompt = argc > 2 ? atoi(argv[2]) : 128;
+    const int n_gen = argc > 3 ? atoi(argv[3]) : 32;
+    const int stream_window = argc > 4 ? atoi(argv[4]) : 0;
+    if (n_prompt <= 0 || n_gen <= 0 || stream_window < 0)
+    {
+        printf("n_prompt and n_gen must be > 0, stream_window must be >= 0!\n");
+        return 1;
+    }
+
+    Net net;
+    net.readNet(model_path);
+
+    std::vector<int> text_ids;
+    net.encode("The quick brown fox jumps over the lazy dog.", text_ids);
+    M_Assert(!text_ids.empty());
+    std::vector<int> prompt(n_prompt);
+    for (int i = 0; i < n_prompt; i++)
+        prompt[i] = text_ids[i % text_ids.size()];
+
+    BenchResult resident = runBench(net, prompt, n_gen);
+    printf("resident: prefill %.2f tokens/s, decode %.2f tokens/s\n",
+           resident.prefill_tokens_per_second, resident.decode_tokens_per_second);
+
+    // MINFER_HUGE_PAGES打开大页时，权重中实际使用大页的部分
+    HugePageInfo hp = getHugePageInfo(MEMORY_CLASS_WEIGHT);
+    if (hp.requested_bytes > 0)
+        printf("weight huge pages: requested %.1f MB, hugetlb %.1f MB, thp %.1f MB, fallback %.1f MB\n",
+               hp.requested_bytes / 1048576.0, hp.hugetlb_bytes / 1048576.0, hp.thp_bytes / 1048576.0,
+               hp.fallback_bytes / 1048576.0);
+
+    // MINFER_NUMA_NODES打开NUMA模式时，矩阵乘的权重切分到的node数量，
+    // 并关闭NUMA模式重新加载模型测试一次，输出两者的速度比
+    const int numa_nodes = getNumaNodes();
+    if (numa_nodes > 0)
+    {
+        printf("numa: weights split across %d node(s)\n", numa_nodes);
+        setNumaNodes(0);
+        BenchResult plain;
+        {
+            Net plain_net;
+            plain_net.readNet(model_path);
+            plain = runBench(plain_net, prompt, n_gen);
+        }
+        setNumaNodes(numa_nodes);
+        printf("numa off: prefill %.2f tokens/s, decode %.2f tokens/s (numa on: prefill %.2fx, decode %.2fx)\n",
+               plain.prefill_tokens_per_second, plain.decode_tokens_per_second,
+               resident.prefill_tokens_per_second / plain.prefill_tokens_per_second,
+               resident.decode_tokens_per_second / plain.decode_tokens_per_second);
+    }
+
+    if (stream_window > 0)
+    {
+        net.setWeightStreaming(stream_window);
+        BenchResult stream = runBench(net, prompt, n_gen);
+        printf("streaming (window = %d): prefill %.2f tokens/s (%.2fx), decode %.2f tokens/s (%.2fx)\n", stream_window,
+               stream.prefill_tokens_per_second, stream.prefill_tokens_per_second / resident.prefill_tokens_per_second,
+               stream.decode_tokens_per_second, stream.decode_tokens_per_second / resident.decode_tokens_per_second);
+    }
+    return 0;
+}
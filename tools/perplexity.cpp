@@ -0,0 +1,87 @@
+//
+// Created by mzh on 2025/3/14.
+//
+
+// 计算模型在文本文件上的困惑度。
+// 用法：minfer_perplexity model.gguf text.txt [ctx_size] [chunk_size]
+// 文本按照ctx_size切分成多个窗口，每个窗口使用新的上下文单独打分，最后汇总所有窗口的结果。
+
+#include "minfer.h"
+
+#include <cmath>
+#include <cstdio>
+#include <cstdlib>
+#include <fstream>
+#include <sstream>
+
+using namespace minfer;
+
+int main(int argc, char** argv)
+{
+    if (argc < 3)
+    {
+        printf("Usage: %s model.gguf text.txt [ctx_size=512] [chunk_size=128]\n", argv[0]);
+        return 1;
+    }
+
+    const std::string model_path = argv[1];
+    const std::string text_path = argv[2];
+    const int ctx_size = argc > 3 ? atoi(argv[3]) : 512;
+    const int chunk_size = argc > 4 ? atoi(argv[4]) : 128;
+    if (ctx_size < 2 || chunk_size <= 0)
+    {
+        printf("ctx_size must be >= 2 and chunk_size must be > 0!\n");
+        return 1;
+    }
+
+    std::ifstream file(text_path);
+    if (!file.is_open())
+    {
+        printf("Fail to open the text file: %s\n", text_path.c_str());
+        return 1;
+    }
+    std::stringstream ss;
+    ss << file.rdbuf();
+
+    Net net;
+    net.readNet(model_path);
+
+    std::vector<int> tokens;
+    net.encode(ss.str(), tokens);
+    printf("tokens = %d, ctx_size = %d, chunk_size = %d\n", (int)tokens.size(), ctx_size, chunk_size);
+    if (tokens.size() < 2)
+    {
+        printf("The text is too short!\n");
+        return 1;
+    }
+
+    ScoreParams params;
+    params.chunk_size = chunk_size;
+
+    auto session = net.createSession();
+    double sum_logprob = 0.0;
+    double seconds = 0.0;
+    int n_tokens = 0;
+    int window = 0;
+    for (int start = 0; start + 1 < tokens.size(); start += ctx_size, window++)
+    {
+        int end = std::min((int)tokens.size(), start + ctx_size);
+        std::vector<int> ids(tokens.begin() + start, tokens.begin() + end);
+        if (ids.size() < 2)
+            break;
+
+        ScoreResult result;
+        session->reset();
+        session->score(ids, params, result);
+
+        sum_logprob += result.sum_logprob;
+        seconds += result.seconds;
+        n_tokens += result.n_tokens;
+        printf("[%d] ppl = %.4f, running ppl = %.4f, %.2f tokens/s\n", window, result.perplexity,
+               exp(-sum_logprob / n_tokens), result.tokens_per_second);
+    }
+
+    printf("Final: tokens = %d, ppl = %.4f, nll = %.6f, %.2f tokens/s\n", n_tokens, exp(-sum_logprob / n_tokens),
+           -sum_logprob / n_tokens, seconds > 0 ? n_tokens / seconds : 0.0);
+    return 0;
+}